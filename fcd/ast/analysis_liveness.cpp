@@ -7,63 +7,41 @@
 //
 
 #include "analysis_liveness.h"
-#include "function.h"
+
+#include <llvm/ADT/DenseSet.h>
 
 using namespace llvm;
 using namespace std;
 
-namespace
+void LivenessAnalysis::getStatements(ExpressionUse& expressionUse, SmallVectorImpl<FlatAst::NodeIndex>& statements)
 {
-	LoopStatement* getParentLoop(NOT_NULL(Statement) statement)
+	// Uses from expressions that the function body doesn't reach can't be rooted in any statement.
+	FlatAst::NodeIndex topLevelUser = layout->getIndex(*expressionUse.getUser());
+	if (topLevelUser == FlatAst::None)
 	{
-		for (Statement* parent = statement->getParent(); parent != nullptr; parent = parent->getParent())
-		{
-			if (auto loop = dyn_cast<LoopStatement>(parent))
-			{
-				return loop;
-			}
-		}
-		return nullptr;
+		return;
 	}
-}
-
-unordered_set<Statement*> LivenessAnalysis::getStatements(ExpressionUse& expressionUse)
-{
-	auto topLevelUser = expressionUse.getUser();
-	if (auto topLevelStatement = dyn_cast<Statement>(topLevelUser))
-	{
-		return { topLevelStatement };
-	}
-	
-	unordered_set<Statement*> statements;
-	unordered_set<Expression*> parents { cast<Expression>(topLevelUser) };
-	unordered_set<Expression*> visited;
 	
+	SmallVector<FlatAst::NodeIndex, 16> parents { topLevelUser };
+	SmallDenseSet<FlatAst::NodeIndex, 16> visited;
+	visited.insert(topLevelUser);
 	while (parents.size() > 0)
 	{
-		auto parentIter = parents.begin();
-		Expression* parent = *parentIter;
-		parents.erase(parentIter);
+		FlatAst::NodeIndex parent = parents.pop_back_val();
+		if (layout->isStatement(parent))
+		{
+			statements.push_back(parent);
+			continue;
+		}
 		
-		for (ExpressionUse& use : parent->uses())
+		for (FlatAst::NodeIndex user : layout->users(parent))
 		{
-			ExpressionUser* user = use.getUser();
-			if (auto stmt = dyn_cast<Statement>(user))
+			if (visited.insert(user).second)
 			{
-				statements.insert(stmt);
-			}
-			else
-			{
-				Expression* parentExpr = cast<Expression>(user);
-				if (visited.count(parentExpr) == 0)
-				{
-					parents.insert(parentExpr);
-				}
+				parents.push_back(user);
 			}
 		}
 	}
-	
-	return statements;
 }
 
 void LivenessAnalysis::collectAssignments(Statement *statement, ExpressionUser::iterator iter, ExpressionUser::iterator end)
@@ -112,63 +90,32 @@ bool LivenessAnalysis::assignmentAssigns(Statement *assignment, Expression *left
 	return false;
 }
 
-void LivenessAnalysis::collectStatementIndices(StatementList& list)
+FlatAst::NodeIndex LivenessAnalysis::getParentLoop(FlatAst::NodeIndex statement) const
 {
-	for (Statement* stmt : list)
+	for (auto parent = layout->getParentStatement(statement); parent != FlatAst::None; parent = layout->getParentStatement(parent))
 	{
-		size_t index = flatStatements.size();
-		auto result = statementStartIndices.insert({stmt, index});
-		assert(result.second); (void) result;
-		flatStatements.push_back(stmt);
-		
-		if (auto ifElse = dyn_cast<IfElseStatement>(stmt))
-		{
-			collectStatementIndices(ifElse->getIfBody());
-			collectStatementIndices(ifElse->getElseBody());
-		}
-		else if (auto loop = dyn_cast<LoopStatement>(stmt))
+		if (layout->getKind(parent) == ExpressionUser::Loop)
 		{
-			collectStatementIndices(loop->getLoopBody());
+			return parent;
 		}
-		else if (auto exprStatement = dyn_cast<ExpressionStatement>(stmt))
-		{
-			Expression* expr = exprStatement->getExpression();
-			if (auto assignment = dyn_cast<NAryOperatorExpression>(expr))
-			{
-				if (assignment->getType() == NAryOperatorExpression::Assign)
-				{
-					collectAssignments(stmt, assignment->operands_begin(), assignment->operands_end());
-				}
-			}
-			
-			// Expression statements represent statements that are not side-effect-free, and are all memory
-			// operations, whether calls, loads or stores.
-			memoryOperations.insert(index);
-		}
-		else if (!isa<KeywordStatement>(stmt))
-		{
-			llvm_unreachable("Unknown statement type!");
-		}
-		
-		result = statementEndIndices.insert({stmt, flatStatements.size()});
-		assert(result.second); (void) result;
 	}
+	return FlatAst::None;
 }
 
 bool LivenessAnalysis::liveRangeContains(Expression *liveVariable, Statement *stmt)
 {
-	auto compareStatementMore = [&](size_t index, ExpressionUseRoot& statement)
+	auto compareStatementMore = [](size_t index, const ExpressionUseRoot& statement)
 	{
-		return index > statementStartIndices.at(statement.getStatement());
+		return index > statement.getIndex();
 	};
 	
-	auto compareStatementLess = [&](size_t index, ExpressionUseRoot& statement)
+	auto compareStatementLess = [](size_t index, const ExpressionUseRoot& statement)
 	{
-		return index < statementStartIndices.at(statement.getStatement());
+		return index < statement.getIndex();
 	};
 	
 	auto& varUsers = usingStatements.at(liveVariable);
-	size_t statementIndex = statementStartIndices.at(stmt);
+	size_t statementIndex = getStartIndex(stmt);
 	
 	auto previousUseDef = upper_bound(varUsers.begin(), varUsers.end(), statementIndex, compareStatementMore);
 	auto nextUseDef = upper_bound(varUsers.begin(), varUsers.end(), statementIndex, compareStatementLess);
@@ -184,28 +131,29 @@ bool LivenessAnalysis::liveRangeContains(Expression *liveVariable, Statement *st
 	// Linearly, there is no next use/def or the next use/def is a def. Check if stmt is inside a loop and
 	// see if the previous definition could reach a use at the start of the loop.
 	// This is conservative with regards to break statements.
-	for (auto parentLoop = getParentLoop(stmt); parentLoop != nullptr; parentLoop = getParentLoop(parentLoop))
+	for (auto parentLoop = getParentLoop(static_cast<FlatAst::NodeIndex>(statementIndex)); parentLoop != FlatAst::None; parentLoop = getParentLoop(parentLoop))
 	{
 		// See if there's a use between the original statement and the end of the loop.
-		auto useDefBeforeLoopEnd = lower_bound(varUsers.begin(), nextUseDef, statementEndIndices.at(parentLoop), [=](ExpressionUseRoot& statement, size_t index)
+		size_t loopEndIndex = layout->getStatementEnd(parentLoop);
+		auto useDefBeforeLoopEnd = lower_bound(varUsers.begin(), nextUseDef, loopEndIndex, [](const ExpressionUseRoot& statement, size_t index)
 		{
-			return statementStartIndices.at(statement.getStatement()) < index;
+			return statement.getIndex() < index;
 		});
 		
 		if (useDefBeforeLoopEnd != varUsers.begin())
 		{
 			--useDefBeforeLoopEnd;
-			if (statementStartIndices.at(useDefBeforeLoopEnd->getStatement()) > statementIndex)
+			if (useDefBeforeLoopEnd->getIndex() > statementIndex)
 			{
 				return useDefBeforeLoopEnd->isUse();
 			}
 		}
 		
 		// See if there's a use between the start of the loop and the original statement.
-		auto useDefAfterLoopStart = upper_bound(varUsers.begin(), nextUseDef, statementStartIndices.at(parentLoop), compareStatementLess);
+		auto useDefAfterLoopStart = upper_bound(varUsers.begin(), nextUseDef, size_t(parentLoop), compareStatementLess);
 		if (useDefAfterLoopStart != nextUseDef)
 		{
-			if (statementStartIndices.at(useDefBeforeLoopEnd->getStatement()) < statementIndex)
+			if (useDefBeforeLoopEnd->getIndex() < statementIndex)
 			{
 				return useDefAfterLoopStart->isUse();
 			}
@@ -228,32 +176,62 @@ bool LivenessAnalysis::interferenceFree(Expression *a, Expression *b)
 	});
 }
 
-void LivenessAnalysis::collectStatementIndices(FunctionNode& function)
+void LivenessAnalysis::collectStatementIndices(shared_ptr<const FlatAst> flatAst)
 {
+	layout = move(flatAst);
 	assignedExpressions.clear();
 	usingStatements.clear();
-	statementStartIndices.clear();
-	statementEndIndices.clear();
-	flatStatements.clear();
+	memoryOperations.clear();
+	
+	// Statements have the lowest indices of the layout, in order, so this is a linear scan.
+	for (FlatAst::NodeIndex index = 0; index < layout->statements_size(); ++index)
+	{
+		switch (layout->getKind(index))
+		{
+			case ExpressionUser::Expr:
+			{
+				FlatAst::NodeIndex expr = layout->operands(index)[0];
+				if (layout->getKind(expr) == ExpressionUser::NAryOperator && layout->getOpcode(expr) == NAryOperatorExpression::Assign)
+				{
+					auto assignment = cast<NAryOperatorExpression>(layout->getNode(expr));
+					collectAssignments(cast<Statement>(layout->getNode(index)), assignment->operands_begin(), assignment->operands_end());
+				}
+				
+				// Expression statements represent statements that are not side-effect-free, and are all memory
+				// operations, whether calls, loads or stores.
+				memoryOperations.insert(index);
+				break;
+			}
+				
+			case ExpressionUser::IfElse:
+			case ExpressionUser::Loop:
+			case ExpressionUser::Keyword:
+				break;
+				
+			default:
+				llvm_unreachable("Unknown statement type!");
+		}
+	}
 	
-	collectStatementIndices(function.getBody());
+	SmallVector<FlatAst::NodeIndex, 8> useDefStatements;
 	for (auto& pair : usesDefs)
 	{
 		auto& statements = usingStatements[pair.first];
 		for (AssignableUseDef useDef : pair.second)
 		{
-			auto useDefStatements = getStatements(*useDef.get());
+			useDefStatements.clear();
+			getStatements(*useDef.get(), useDefStatements);
 			assert(useDef.isUse() || useDefStatements.size() == 1);
-			for (Statement* statement : useDefStatements)
+			for (FlatAst::NodeIndex statement : useDefStatements)
 			{
-				statements.emplace_back(useDef, statement);
+				statements.emplace_back(useDef, cast<Statement>(layout->getNode(statement)), statement);
 			}
 		}
 		
-		sort(statements.begin(), statements.end(), [=](ExpressionUseRoot& a, ExpressionUseRoot& b)
+		sort(statements.begin(), statements.end(), [](const ExpressionUseRoot& a, const ExpressionUseRoot& b)
 		{
-			size_t aIndex = statementStartIndices.at(a.getStatement());
-			size_t bIndex = statementStartIndices.at(b.getStatement());
+			size_t aIndex = a.getIndex();
+			size_t bIndex = b.getIndex();
 			if (aIndex < bIndex)
 			{
 				 return true;
@@ -11,17 +11,17 @@
 #define analysis_liveness_hpp
 
 #include "expression_use.h"
+#include "flat_ast.h"
 #include "statements.h"
 
 #include <llvm/ADT/PointerIntPair.h>
 #include <llvm/ADT/SmallVector.h>
 
 #include <deque>
+#include <memory>
 #include <unordered_map>
-#include <unordered_set>
 #include <set>
-
-class FunctionNode;
+#include <vector>
 
 class AssignableUseDef
 {
@@ -43,37 +43,48 @@ public:
 class ExpressionUseRoot : public AssignableUseDef
 {
 	NOT_NULL(Statement) statement;
+	size_t index;
 	
 public:
-	ExpressionUseRoot(AssignableUseDef useDef, NOT_NULL(Statement) statement)
-	: AssignableUseDef(useDef), statement(statement)
+	ExpressionUseRoot(AssignableUseDef useDef, NOT_NULL(Statement) statement, size_t index)
+	: AssignableUseDef(useDef), statement(statement), index(index)
 	{
 	}
 	
 	Statement* getStatement() { return statement; }
+	
+	// Start index of the statement, kept here so that searches over sorted use/def lists don't look it up.
+	size_t getIndex() const { return index; }
 };
 
 class LivenessAnalysis
 {
+	// Statement indices are the indices of the statements in this layout. Shared with the analysis manager, which
+	// may drop its reference before this analysis is done with it.
+	std::shared_ptr<const FlatAst> layout;
 	std::deque<Expression*> assignedExpressions;
 	std::unordered_map<Expression*, llvm::SmallVector<ExpressionUseRoot, 16>> usingStatements;
-	std::unordered_map<Statement*, size_t> statementStartIndices;
-	std::unordered_map<Statement*, size_t> statementEndIndices;
 	std::set<size_t> memoryOperations;
-	std::deque<Statement*> flatStatements;
 	
 	// intermediate dictionary, gets cleared at some point
 	std::unordered_map<Expression*, llvm::SmallVector<AssignableUseDef, 16>> usesDefs;
 	
-	std::unordered_set<Statement*> getStatements(ExpressionUse& expressionUse);
+	void getStatements(ExpressionUse& expressionUse, llvm::SmallVectorImpl<FlatAst::NodeIndex>& statements);
 	void collectAssignments(Statement* statement, ExpressionUser::iterator iter, ExpressionUser::iterator end);
 	bool assignmentAssigns(Statement* assignment, Expression* left, Expression* right);
-	void collectStatementIndices(StatementList& list);
+	FlatAst::NodeIndex getParentLoop(FlatAst::NodeIndex statement) const;
 	bool liveRangeContains(Expression* liveVariable, Statement* stmt);
 	bool interferenceFree(Expression* a, Expression* b);
 	
+	size_t getStartIndex(const Statement* statement) const
+	{
+		FlatAst::NodeIndex index = layout->getIndex(*statement);
+		assert(layout->isStatement(index));
+		return index;
+	}
+	
 public:
-	void collectStatementIndices(FunctionNode& function);
+	void collectStatementIndices(std::shared_ptr<const FlatAst> flatAst);
 	
 	const std::set<size_t>& getMemoryOperations() const
 	{
@@ -82,12 +93,14 @@ public:
 	
 	Statement* getStatement(size_t index)
 	{
-		return flatStatements.at(index);
+		assert(layout->isStatement(static_cast<FlatAst::NodeIndex>(index)));
+		return llvm::cast<Statement>(layout->getNode(static_cast<FlatAst::NodeIndex>(index)));
 	}
 	
 	std::pair<size_t, size_t> getIndex(Statement* statement) const
 	{
-		return std::make_pair(statementStartIndices.at(statement), statementEndIndices.at(statement));
+		size_t start = getStartIndex(statement);
+		return std::make_pair(start, layout->getStatementEnd(static_cast<FlatAst::NodeIndex>(start)));
 	}
 	
 	std::deque<Expression*> getAssignedExpressions() const
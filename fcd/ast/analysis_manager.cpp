@@ -0,0 +1,223 @@
+//
+// analysis_manager.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "analysis_manager.h"
+#include "function.h"
+#include "visitor.h"
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallVector.h>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	class MemoryOperationVisitor : public AstVisitor<MemoryOperationVisitor, false, bool>
+	{
+		unordered_map<const Expression*, bool>& cache;
+		
+		bool visitOperand(Expression& expr)
+		{
+			auto iter = cache.find(&expr);
+			if (iter != cache.end())
+			{
+				return iter->second;
+			}
+			
+			bool result = visit(expr);
+			cache[&expr] = result;
+			return result;
+		}
+	
+	public:
+		MemoryOperationVisitor(unordered_map<const Expression*, bool>& cache)
+		: cache(cache)
+		{
+		}
+		
+		bool visitUnaryOperator(UnaryOperatorExpression& unary)
+		{
+			return unary.getType() == UnaryOperatorExpression::Dereference || visitOperand(*unary.getOperand());
+		}
+		
+		bool visitNAryOperator(NAryOperatorExpression& nary)
+		{
+			return nary.getType() == NAryOperatorExpression::Assign || any_of(nary.operands(), [&](ExpressionUse& use)
+			{
+				return visitOperand(*use.getUse());
+			});
+		}
+		
+		bool visitTernary(TernaryExpression& ternary)
+		{
+			return visitOperand(*ternary.getCondition()) || visitOperand(*ternary.getTrueValue()) || visitOperand(*ternary.getFalseValue());
+		}
+		
+		bool visitCast(CastExpression& cast)
+		{
+			return visitOperand(*cast.getCastValue());
+		}
+		
+		bool visitSubscript(SubscriptExpression& subscript)
+		{
+			return true;
+		}
+		
+		bool visitMemberAccess(MemberAccessExpression& memberAccess)
+		{
+			return true;
+		}
+		
+		bool visitCall(CallExpression& call)
+		{
+			return true;
+		}
+		
+		bool visitAggregate(AggregateExpression& agg)
+		{
+			return false;
+		}
+		
+		bool visitNumeric(NumericExpression& numeric)
+		{
+			return false;
+		}
+		
+		bool visitToken(TokenExpression& token)
+		{
+			return false;
+		}
+		
+		bool visitAssembly(AssemblyExpression& assembly)
+		{
+			return false;
+		}
+		
+		bool visitAssignable(AssignableExpression& assignable)
+		{
+			return false;
+		}
+		
+		bool visitDefault(ExpressionUser& user)
+		{
+			llvm_unreachable("unimplemented memory operation case");
+		}
+		
+		bool visitRoot(Expression& expr)
+		{
+			return visitOperand(expr);
+		}
+	};
+	
+	void getUsingStatements(unordered_set<Statement*>& set, const FlatAst& layout, Expression& expr)
+	{
+		FlatAst::NodeIndex index = layout.getIndex(expr);
+		if (index == FlatAst::None)
+		{
+			return;
+		}
+		
+		SmallVector<FlatAst::NodeIndex, 16> worklist { index };
+		SmallDenseSet<FlatAst::NodeIndex, 16> visited;
+		visited.insert(index);
+		while (!worklist.empty())
+		{
+			for (FlatAst::NodeIndex user : layout.users(worklist.pop_back_val()))
+			{
+				if (layout.isStatement(user))
+				{
+					// Passes can keep the layout while they erase statements, which leaves them out of any list.
+					auto statement = cast<Statement>(layout.getNode(user));
+					if (statement->getParentList() != nullptr)
+					{
+						set.insert(statement);
+					}
+				}
+				else if (visited.insert(user).second)
+				{
+					worklist.push_back(user);
+				}
+			}
+		}
+	}
+}
+
+const shared_ptr<const FlatAst>& AstAnalysisManager::getSharedLayout(FunctionNode& fn)
+{
+	auto& layout = analyses[&fn].layout;
+	if (layout == nullptr)
+	{
+		layout = make_shared<FlatAst>(fn);
+	}
+	return layout;
+}
+
+LivenessAnalysis& AstAnalysisManager::getLiveness(FunctionNode& fn)
+{
+	auto& liveness = analyses[&fn].liveness;
+	if (liveness == nullptr)
+	{
+		liveness.reset(new LivenessAnalysis);
+		liveness->collectStatementIndices(getSharedLayout(fn));
+	}
+	return *liveness;
+}
+
+bool AstAnalysisManager::hasMemoryOperation(FunctionNode& fn, Expression& expr)
+{
+	return MemoryOperationVisitor(analyses[&fn].memoryOperations).visitRoot(expr);
+}
+
+const unordered_set<Statement*>& AstAnalysisManager::getUsingStatements(FunctionNode& fn, Expression& expr)
+{
+	auto& cache = analyses[&fn].usingStatements;
+	auto iter = cache.find(&expr);
+	if (iter == cache.end())
+	{
+		iter = cache.insert({&expr, {}}).first;
+		::getUsingStatements(iter->second, getLayout(fn), expr);
+	}
+	return iter->second;
+}
+
+void AstAnalysisManager::invalidate(const FunctionNode& fn, unsigned preserved)
+{
+	auto iter = analyses.find(&fn);
+	if (iter == analyses.end())
+	{
+		return;
+	}
+	
+	FunctionAnalyses& functionAnalyses = iter->second;
+	if ((preserved & AstAnalysisLayout) == 0)
+	{
+		functionAnalyses.layout.reset();
+	}
+	if ((preserved & AstAnalysisLiveness) == 0)
+	{
+		functionAnalyses.liveness.reset();
+	}
+	if ((preserved & AstAnalysisMemoryOperations) == 0)
+	{
+		functionAnalyses.memoryOperations.clear();
+	}
+	if ((preserved & AstAnalysisUsingStatements) == 0)
+	{
+		functionAnalyses.usingStatements.clear();
+	}
+}
+
+void AstAnalysisManager::invalidateAll(unsigned preserved)
+{
+	for (auto& pair : analyses)
+	{
+		invalidate(*pair.first, preserved);
+	}
+}
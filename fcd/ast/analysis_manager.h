@@ -0,0 +1,69 @@
+//
+// analysis_manager.h
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__ast_analysis_manager_h
+#define fcd__ast_analysis_manager_h
+
+#include "analysis_liveness.h"
+#include "expressions.h"
+#include "flat_ast.h"
+#include "statements.h"
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+class FunctionNode;
+
+enum AstAnalysis : unsigned
+{
+	AstAnalysisNone = 0,
+	AstAnalysisLiveness = 1 << 0,
+	AstAnalysisMemoryOperations = 1 << 1,
+	AstAnalysisUsingStatements = 1 << 2,
+	AstAnalysisLayout = 1 << 3,
+	AstAnalysisAll = ~0u,
+};
+
+// Caches analyses of AST functions across passes, in the spirit of LLVM's analysis managers. Analyses are computed
+// the first time that they are requested. After a pass runs on a function, the analyses that it doesn't preserve are
+// dropped.
+class AstAnalysisManager
+{
+	struct FunctionAnalyses
+	{
+		std::shared_ptr<const FlatAst> layout;
+		std::unique_ptr<LivenessAnalysis> liveness;
+		std::unordered_map<const Expression*, bool> memoryOperations;
+		std::unordered_map<const Expression*, std::unordered_set<Statement*>> usingStatements;
+	};
+	
+	std::unordered_map<const FunctionNode*, FunctionAnalyses> analyses;
+	
+	const std::shared_ptr<const FlatAst>& getSharedLayout(FunctionNode& fn);
+	
+public:
+	// Structure-of-arrays copy of the function's AST, for analyses that scan it.
+	const FlatAst& getLayout(FunctionNode& fn) { return *getSharedLayout(fn); }
+	
+	// Statement indices, memory operation statements and variable liveness.
+	LivenessAnalysis& getLiveness(FunctionNode& fn);
+	
+	// Whether evaluating an expression could read or write memory.
+	bool hasMemoryOperation(FunctionNode& fn, Expression& expr);
+	
+	// Statements that use an expression, directly or through other expressions.
+	const std::unordered_set<Statement*>& getUsingStatements(FunctionNode& fn, Expression& expr);
+	
+	void invalidate(const FunctionNode& fn, unsigned preserved = AstAnalysisNone);
+	void invalidateAll(unsigned preserved = AstAnalysisNone);
+	void clear() { analyses.clear(); }
+};
+
+#endif /* fcd__ast_analysis_manager_h */
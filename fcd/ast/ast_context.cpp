@@ -11,6 +11,8 @@
 #include "expressions.h"
 #include "metadata.h"
 
+#include <llvm/ADT/PointerIntPair.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/InstVisitor.h>
 
 #include <deque>
@@ -562,6 +564,7 @@ void* AstContext::prepareStorageAndUses(unsigned useCount, size_t storage)
 AstContext::AstContext(DumbAllocator& pool, Module* module)
 : pool(pool)
 , module(module)
+, nodeCount(0)
 , types(new TypeIndex)
 {
 	trueExpr = token(getIntegerType(false, 1), "true");
@@ -601,12 +604,50 @@ AstContext::~AstContext()
 {
 }
 
+void AstContext::numberValues(Function& fn)
+{
+	size_t count = fn.arg_size();
+	for (BasicBlock& bb : fn)
+	{
+		count += bb.size();
+	}
+	
+	valueNumbers.reserve(static_cast<unsigned>(valueNumbers.size() + count));
+	valueExpressions.reserve(valueExpressions.size() + count);
+	for (Argument& arg : fn.args())
+	{
+		(void) getValueNumber(arg);
+	}
+	for (BasicBlock& bb : fn)
+	{
+		for (Instruction& inst : bb)
+		{
+			(void) getValueNumber(inst);
+		}
+	}
+}
+
+uint32_t AstContext::getValueNumber(const Value& value)
+{
+	auto result = valueNumbers.insert({&value, static_cast<uint32_t>(valueExpressions.size())});
+	if (result.second)
+	{
+		valueExpressions.emplace_back();
+	}
+	return result.first->second;
+}
+
+Expression* AstContext::cachedExpressionFor(const Value& value) const
+{
+	auto iter = valueNumbers.find(&value);
+	return iter == valueNumbers.end() ? nullptr : valueExpressions[iter->second].expression;
+}
+
 Expression* AstContext::uncachedExpressionFor(llvm::Value& value)
 {
-	auto iter = expressionMap.find(&value);
-	if (iter != expressionMap.end())
+	if (Expression* expr = cachedExpressionFor(value))
 	{
-		return iter->second;
+		return expr;
 	}
 	
 	InstToExpr visitor(*this);
@@ -615,13 +656,47 @@ Expression* AstContext::uncachedExpressionFor(llvm::Value& value)
 
 Expression* AstContext::expressionFor(Value& value)
 {
-	auto& expr = expressionMap[&value];
-	if (expr == nullptr)
+	if (Expression* expr = cachedExpressionFor(value))
 	{
-		InstToExpr visitor(*this);
-		expr = visitor.visitValue(value);
+		return expr;
+	}
+	
+	// Instruction operands are converted before their users using an explicit stack, so that long dependency chains
+	// don't recurse. The visitor then only recurses into constants. Φ nodes don't need their operands, which is also
+	// what breaks cycles.
+	InstToExpr visitor(*this);
+	SmallVector<PointerIntPair<Value*, 1, bool>, 32> stack;
+	stack.emplace_back(&value, false);
+	while (!stack.empty())
+	{
+		Value* current = stack.back().getPointer();
+		if (stack.back().getInt())
+		{
+			stack.pop_back();
+			if (cachedExpressionFor(*current) == nullptr)
+			{
+				// Visiting constants can add entries, so the table is only indexed again once the visit is done.
+				Expression* expr = visitor.visitValue(*current);
+				valueExpressions[getValueNumber(*current)].expression = expr;
+			}
+			continue;
+		}
+		
+		stack.back().setInt(true);
+		if (auto inst = dyn_cast<Instruction>(current))
+		if (!isa<PHINode>(inst))
+		{
+			for (Value* operand : inst->operand_values())
+			{
+				if (auto operandInst = dyn_cast<Instruction>(operand))
+				if (cachedExpressionFor(*operandInst) == nullptr)
+				{
+					stack.emplace_back(operandInst, false);
+				}
+			}
+		}
 	}
-	return expr;
+	return cachedExpressionFor(value);
 }
 
 Statement* AstContext::statementFor(Instruction &inst)
@@ -645,7 +720,7 @@ Statement* AstContext::statementFor(Instruction &inst)
 	if (isa<PHINode>(inst))
 	{
 		Expression* phiOut = expressionFor(inst);
-		Expression* phiIn = phiReadsToWrites[phiOut];
+		Expression* phiIn = valueExpressions[getValueNumber(inst)].phiWrite;
 		assert(phiIn != nullptr);
 		auto assignment = nary(NAryOperatorExpression::Assign, phiOut, phiIn);
 		return expr(assignment);
@@ -695,11 +770,13 @@ Expression* AstContext::negate(NOT_NULL(Expression) expr)
 
 ExpressionStatement* AstContext::phiAssignment(PHINode &phi, Value &value)
 {
-	auto linkedExpression = expressionFor(phi);
-	auto& phiWrite = phiReadsToWrites[linkedExpression];
+	(void) expressionFor(phi);
+	uint32_t number = getValueNumber(phi);
+	Expression* phiWrite = valueExpressions[number].phiWrite;
 	if (phiWrite == nullptr)
 	{
 		phiWrite = assignable(getType(*phi.getType()), "phi_in");
+		valueExpressions[number].phiWrite = phiWrite;
 	}
 	auto assignment = nary(NAryOperatorExpression::Assign, phiWrite, expressionFor(value));
 	return expr(assignment);
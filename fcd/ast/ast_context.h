@@ -16,12 +16,16 @@
 #include "not_null.h"
 #include "statements.h"
 
+#include <llvm/ADT/DenseMap.h>
+
 #include <memory>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace llvm
 {
+	class Function;
 	class Instruction;
 	class Module;
 	class PHINode;
@@ -40,8 +44,17 @@ class AstContext
 	
 	DumbAllocator& pool;
 	llvm::Module* module;
-	std::unordered_map<Expression*, Expression*> phiReadsToWrites;
-	std::unordered_map<llvm::Value*, Expression*> expressionMap;
+	uint32_t nodeCount;
+	
+	// LLVM values get dense numbers, and the expression and the Φ write created for a value sit together at its number.
+	// LLVM 4.0 values have no room for the number, so it lives in a side table with small entries.
+	struct ValueExpressions
+	{
+		Expression* expression = nullptr;
+		Expression* phiWrite = nullptr;
+	};
+	llvm::DenseMap<const llvm::Value*, uint32_t> valueNumbers;
+	std::vector<ValueExpressions> valueExpressions;
 	std::unique_ptr<TypeIndex> types;
 	std::unordered_map<const llvm::StructType*, StructExpressionType*> structTypeMap;
 	
@@ -55,10 +68,19 @@ class AstContext
 	ExpressionReference memsetToken;
 	ExpressionReference trapToken;
 	
+	uint32_t getValueNumber(const llvm::Value& value);
+	Expression* cachedExpressionFor(const llvm::Value& value) const;
 	Expression* uncachedExpressionFor(llvm::Value& value);
 	
 	void* prepareStorageAndUses(unsigned useCount, size_t storageSize);
 	
+	template<typename T>
+	T* numberNode(T* node)
+	{
+		static_cast<ExpressionUser*>(node)->nodeId = ++nodeCount;
+		return node;
+	}
+	
 	template<typename T, typename... TElements>
 	void setOperand(T* object, unsigned index, NOT_NULL(Expression) expression, TElements&&... elems)
 	{
@@ -79,7 +101,7 @@ class AstContext
 		void* result = HasUses
 			? prepareStorageAndUses(useCount, sizeof(T))
 			: pool.allocateDynamic<char>(sizeof(T), alignof(T));
-		return new (result) T(*this, useCount, std::forward<TArgs>(args)...);
+		return numberNode(new (result) T(*this, useCount, std::forward<TArgs>(args)...));
 	}
 	
 	template<typename T, typename... TArgs, typename = typename std::enable_if<std::is_base_of<Statement, T>::value, T>::type>
@@ -88,7 +110,7 @@ class AstContext
 		void* result = useCount == 0
 			? pool.allocateDynamic<char>(sizeof(T), alignof(T))
 			: prepareStorageAndUses(useCount, sizeof(T));
-		return new (result) T(std::forward<TArgs>(args)...);
+		return numberNode(new (result) T(std::forward<TArgs>(args)...));
 	}
 	
 public:
@@ -97,6 +119,12 @@ public:
 	
 	DumbAllocator& getPool() { return pool; }
 	
+	// Nodes allocated by this context have ids from 1 to getNodeCount().
+	uint32_t getNodeCount() const { return nodeCount; }
+	
+	// Numbers the arguments and instructions of a function up front, which sizes the value tables once.
+	void numberValues(llvm::Function& fn);
+	
 	Expression* expressionFor(llvm::Value& value);
 	Expression* expressionForTrue() { return trueExpr.get(); }
 	Expression* expressionForFalse() { return falseExpr.get(); }
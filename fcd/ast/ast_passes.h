@@ -21,6 +21,7 @@ protected:
 	
 public:
 	virtual const char* getName() const override;
+	virtual unsigned getPreservedAnalyses() const override;
 };
 
 // Combines nested control flow statements.
@@ -31,6 +32,7 @@ protected:
 	
 public:
 	virtual const char* getName() const override;
+	virtual unsigned getPreservedAnalyses() const override;
 };
 
 // Removes assignments to __undefined.
@@ -41,6 +43,7 @@ protected:
 	
 public:
 	virtual const char* getName() const override;
+	virtual unsigned getPreservedAnalyses() const override;
 };
 
 // Simplifies expressions.
@@ -12,6 +12,8 @@
 
 #include "expression_use.h"
 
+#include <cstdint>
+
 struct ExpressionUseAllocInfo
 {
 	unsigned allocated;
@@ -132,9 +134,16 @@ public:
 	typedef UseIterator<true> const_iterator;
 	
 private:
+	friend class AstContext;
+	
 	ExpressionUseAllocInfo allocInfo;
 	UserType userType;
 	
+	// Number given by the AstContext that allocated this user, starting at 1 (0 for users that no context allocated).
+	// Analyses use it to index per-node data in vectors instead of hashing pointers. It fits in the padding after
+	// userType, so it doesn't make nodes bigger.
+	uint32_t nodeId;
+	
 	// force class to have a vtable (we cannot have a destructor, virtual or not)
 	virtual void anchor();
 	
@@ -144,7 +153,7 @@ protected:
 	
 public:
 	ExpressionUser(UserType type, unsigned allocatedUses, unsigned usedUses)
-	: allocInfo(allocatedUses, usedUses), userType(type)
+	: allocInfo(allocatedUses, usedUses), userType(type), nodeId(0)
 	{
 	}
 	
@@ -154,6 +163,7 @@ public:
 	}
 	
 	UserType getUserType() const { return userType; }
+	uint32_t getNodeId() const { return nodeId; }
 	
 	ExpressionUse& getOperandUse(unsigned index);
 	const ExpressionUse& getOperandUse(unsigned index) const { return const_cast<ExpressionUser*>(this)->getOperandUse(index); }
@@ -0,0 +1,189 @@
+//
+// flat_ast.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "flat_ast.h"
+#include "function.h"
+
+#include <llvm/ADT/SmallVector.h>
+
+#include <algorithm>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	uint8_t getNodeOpcode(const ExpressionUser& node)
+	{
+		if (auto unary = dyn_cast<UnaryOperatorExpression>(&node))
+		{
+			return static_cast<uint8_t>(unary->getType());
+		}
+		else if (auto nary = dyn_cast<NAryOperatorExpression>(&node))
+		{
+			return static_cast<uint8_t>(nary->getType());
+		}
+		else if (auto loop = dyn_cast<LoopStatement>(&node))
+		{
+			return static_cast<uint8_t>(loop->getPosition());
+		}
+		return 0;
+	}
+}
+
+constexpr FlatAst::NodeIndex FlatAst::None;
+
+FlatAst::NodeIndex FlatAst::addNode(ExpressionUser& node)
+{
+	uint32_t id = node.getNodeId();
+	assert(id != 0 && id < indices.size() && indices[id] == None);
+	NodeIndex index = static_cast<NodeIndex>(nodes.size());
+	indices[id] = index;
+	nodes.push_back(&node);
+	kinds.push_back(static_cast<uint8_t>(node.getUserType()));
+	opcodes.push_back(getNodeOpcode(node));
+	return index;
+}
+
+void FlatAst::collectStatements(StatementList& body)
+{
+	// Nesting can be arbitrarily deep, so lists are walked from an explicit stack. Nested lists are pushed over the
+	// list of their statement, which keeps statements in the order in which they appear (parents before children).
+	struct PendingList
+	{
+		StatementList::iterator iter;
+		StatementList::iterator end;
+		NodeIndex parent;
+	};
+	
+	SmallVector<PendingList, 16> stack;
+	stack.push_back({body.begin(), body.end(), None});
+	while (!stack.empty())
+	{
+		if (stack.back().iter == stack.back().end)
+		{
+			stack.pop_back();
+			continue;
+		}
+		
+		Statement* stmt = *stack.back().iter;
+		++stack.back().iter;
+		NodeIndex index = addNode(*stmt);
+		statementParents.push_back(stack.back().parent);
+		statementEnds.push_back(index + 1);
+		
+		if (auto ifElse = dyn_cast<IfElseStatement>(stmt))
+		{
+			stack.push_back({ifElse->getElseBody().begin(), ifElse->getElseBody().end(), index});
+			stack.push_back({ifElse->getIfBody().begin(), ifElse->getIfBody().end(), index});
+		}
+		else if (auto loop = dyn_cast<LoopStatement>(stmt))
+		{
+			stack.push_back({loop->getLoopBody().begin(), loop->getLoopBody().end(), index});
+		}
+	}
+		
+	// Children come after their parent, so walking backwards sees every nested statement before the statements that
+	// contain it.
+	for (NodeIndex index = static_cast<NodeIndex>(statementEnds.size()); index-- > 0;)
+	{
+		NodeIndex parent = statementParents[index];
+		if (parent != None)
+		{
+			statementEnds[parent] = max(statementEnds[parent], statementEnds[index]);
+		}
+	}
+}
+
+void FlatAst::collectExpression(Expression& expression)
+{
+	if (getIndex(expression) != None)
+	{
+		return;
+	}
+	
+	// Expressions are numbered after their operands, also from an explicit stack since they can nest deeply.
+	SmallVector<pair<Expression*, ExpressionUser::iterator>, 16> stack;
+	stack.emplace_back(&expression, expression.operands_begin());
+	while (!stack.empty())
+	{
+		auto& top = stack.back();
+		if (top.second == top.first->operands_end())
+		{
+			addNode(*top.first);
+			stack.pop_back();
+			continue;
+		}
+		
+		Expression* operand = top.second->getUse();
+		++top.second;
+		if (operand != nullptr && getIndex(*operand) == None)
+		{
+			stack.emplace_back(operand, operand->operands_begin());
+		}
+	}
+}
+
+FlatAst::FlatAst(FunctionNode& function)
+{
+	// Every node of the function comes from its context, so node IDs are dense enough to index a vector.
+	indices.assign(function.getContext().getNodeCount() + size_t(1), None);
+	collectStatements(function.getBody());
+	
+	size_t statementCount = nodes.size();
+	for (size_t i = 0; i < statementCount; ++i)
+	{
+		for (Expression* operand : nodes[i]->operands())
+		{
+			if (operand != nullptr)
+			{
+				collectExpression(*operand);
+			}
+		}
+	}
+	
+	// Operands, in node order.
+	operandBegin.reserve(nodes.size() + 1);
+	for (ExpressionUser* node : nodes)
+	{
+		operandBegin.push_back(static_cast<uint32_t>(operandList.size()));
+		for (Expression* operand : node->operands())
+		{
+			operandList.push_back(operand == nullptr ? None : getIndex(*operand));
+		}
+	}
+	operandBegin.push_back(static_cast<uint32_t>(operandList.size()));
+	
+	// Users, counted first so that each node's list can be filled in place.
+	userBegin.assign(nodes.size() + 1, 0);
+	for (NodeIndex operand : operandList)
+	{
+		if (operand != None)
+		{
+			++userBegin[operand + 1];
+		}
+	}
+	for (size_t i = 1; i < userBegin.size(); ++i)
+	{
+		userBegin[i] += userBegin[i - 1];
+	}
+	
+	userList.resize(userBegin.back());
+	vector<uint32_t> nextUser(userBegin.begin(), userBegin.end() - 1);
+	for (NodeIndex user = 0; user < nodes.size(); ++user)
+	{
+		for (NodeIndex operand : operands(user))
+		{
+			if (operand != None)
+			{
+				userList[nextUser[operand]++] = user;
+			}
+		}
+	}
+}
@@ -0,0 +1,112 @@
+//
+// flat_ast.h
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__ast_flat_ast_h
+#define fcd__ast_flat_ast_h
+
+#include "statements.h"
+#include "visitor.h"
+
+#include <llvm/ADT/ArrayRef.h>
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+class FunctionNode;
+
+// Read-only, structure-of-arrays copy of the AST of a function. Nodes get dense 32-bit indices: statements come first,
+// in the order in which they appear in the function (parents before their children), and expressions follow, with
+// operands numbered before the expressions that use them. The kind, operator, operands and users of a node live in
+// parallel arrays, so analyses can scan them linearly instead of chasing node pointers and walking ExpressionUse
+// waymarks to find users.
+//
+// This is an index over the pointer AST, not a replacement for it: payloads (tokens, constants, types) are not copied,
+// every index maps back to its pointer node, and passes and the printer still modify and walk pointer nodes. Only
+// nodes reachable from the function body are included. Nodes added to the AST later are missing, and statements that
+// are erased keep their index (with no parent list), so passes that add nodes must invalidate it.
+class FlatAst
+{
+public:
+	typedef uint32_t NodeIndex;
+	static constexpr NodeIndex None = ~NodeIndex(0);
+	
+private:
+	std::vector<ExpressionUser*> nodes;
+	std::vector<uint8_t> kinds;
+	// Operator type of unary and n-ary operators, condition position of loops.
+	std::vector<uint8_t> opcodes;
+	
+	// The operands of node i are operandList[operandBegin[i]] to operandList[operandBegin[i + 1]] (None for null
+	// operands), and its users are laid out the same way. Like Expression::uses, users appear once per use.
+	std::vector<uint32_t> operandBegin;
+	std::vector<NodeIndex> operandList;
+	std::vector<uint32_t> userBegin;
+	std::vector<NodeIndex> userList;
+	
+	// Indexed by statement. Statements nested in a statement have indices between it and its end.
+	std::vector<NodeIndex> statementEnds;
+	std::vector<NodeIndex> statementParents;
+	
+	// Indexed by node ID (see ExpressionUser::getNodeId).
+	std::vector<NodeIndex> indices;
+	
+	NodeIndex addNode(ExpressionUser& node);
+	void collectStatements(StatementList& body);
+	void collectExpression(Expression& expression);
+	
+public:
+	explicit FlatAst(FunctionNode& function);
+	
+	size_t size() const { return nodes.size(); }
+	size_t statements_size() const { return statementEnds.size(); }
+	bool isStatement(NodeIndex index) const { return index < statements_size(); }
+	
+	// Returns None for nodes that are not part of the function body.
+	NodeIndex getIndex(const ExpressionUser& node) const
+	{
+		uint32_t id = node.getNodeId();
+		return id < indices.size() ? indices[id] : None;
+	}
+	
+	ExpressionUser* getNode(NodeIndex index) const { return nodes[index]; }
+	ExpressionUser::UserType getKind(NodeIndex index) const { return static_cast<ExpressionUser::UserType>(kinds[index]); }
+	unsigned getOpcode(NodeIndex index) const { return opcodes[index]; }
+	
+	llvm::ArrayRef<NodeIndex> operands(NodeIndex index) const
+	{
+		return llvm::makeArrayRef(operandList.data() + operandBegin[index], operandList.data() + operandBegin[index + 1]);
+	}
+	
+	llvm::ArrayRef<NodeIndex> users(NodeIndex index) const
+	{
+		return llvm::makeArrayRef(userList.data() + userBegin[index], userList.data() + userBegin[index + 1]);
+	}
+	
+	// One past the index of the last statement nested in this statement.
+	NodeIndex getStatementEnd(NodeIndex statement) const
+	{
+		assert(isStatement(statement));
+		return statementEnds[statement];
+	}
+	
+	NodeIndex getParentStatement(NodeIndex statement) const
+	{
+		assert(isStatement(statement));
+		return statementParents[statement];
+	}
+	
+	template<typename Derived, bool UsesConst, typename ReturnType>
+	ReturnType visit(AstVisitor<Derived, UsesConst, ReturnType>& visitor, NodeIndex index) const
+	{
+		return visitor.visit(*nodes[index]);
+	}
+};
+
+#endif /* fcd__ast_flat_ast_h */
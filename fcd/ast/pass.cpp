@@ -8,42 +8,20 @@
 //
 
 #include "pass.h"
+#include "progress_report.h"
 
 #include <llvm/Support/PrettyStackTrace.h>
 
 using namespace llvm;
 using namespace std;
 
-namespace
-{
-	void getUsingStatements(unordered_set<Statement*>& set, Expression* expr)
-	{
-		for (auto& use : expr->uses())
-		{
-			if (auto statement = dyn_cast<Statement>(use.getUser()))
-			{
-				set.insert(statement);
-			}
-			else if (auto expression = dyn_cast<Expression>(use.getUser()))
-			{
-				getUsingStatements(set, expression);
-			}
-		}
-	}
-}
-
-unordered_set<Statement*> AstModulePass::getUsingStatements(Expression& expr)
-{
-	unordered_set<Statement*> statements;
-	::getUsingStatements(statements, &expr);
-	return statements;
-}
-
-void AstModulePass::run(deque<unique_ptr<FunctionNode>>& fn)
+void AstModulePass::run(deque<unique_ptr<FunctionNode>>& fn, AstAnalysisManager& analysisManager)
 {
 	if (fn.size() > 0)
 	{
+		this->analysisManager = &analysisManager;
 		doRun(fn);
+		analysisManager.invalidateAll(getPreservedAnalyses());
 	}
 }
 
@@ -51,6 +29,7 @@ void AstFunctionPass::doRun(deque<unique_ptr<FunctionNode>>& list)
 {
 	for (unique_ptr<FunctionNode>& funcNode : list)
 	{
+		ProgressItem running(funcNode->getFunction().getName());
 		if (runOnDeclarations || funcNode->hasBody())
 		{
 			PrettyStackTraceFormat runPass("Running AST pass \"%s\" on function \"%s\"", getName(), string(funcNode->getFunction().getName()).c_str());
@@ -10,23 +10,33 @@
 #ifndef fcd__ast_pass_h
 #define fcd__ast_pass_h
 
+#include "analysis_manager.h"
 #include "function.h"
 
 #include <deque>
-#include <unordered_set>
 
 // Lifetime management for an AST pass is the same as for a LLVM pass: the pass manager owns it.
 class AstModulePass
 {
+	AstAnalysisManager* analysisManager;
+	
 protected:
-	virtual void doRun(std::deque<std::unique_ptr<FunctionNode>>& functions) = 0;
+	AstModulePass()
+	: analysisManager(nullptr)
+	{
+	}
 	
-	// Helper functions.
-	static std::unordered_set<Statement*> getUsingStatements(Expression& expr);
+	AstAnalysisManager& analyses() { return *analysisManager; }
+	
+	virtual void doRun(std::deque<std::unique_ptr<FunctionNode>>& functions) = 0;
 	
 public:
 	virtual const char* getName() const = 0;
-	void run(std::deque<std::unique_ptr<FunctionNode>>& functions);
+	
+	// Analyses that are still valid after the pass runs. Everything else is recomputed on demand.
+	virtual unsigned getPreservedAnalyses() const { return AstAnalysisNone; }
+	
+	void run(std::deque<std::unique_ptr<FunctionNode>>& functions, AstAnalysisManager& analysisManager);
 	virtual ~AstModulePass() = default;
 };
 
@@ -11,6 +11,7 @@
 #include "pass_backend.h"
 #include "passes.h"
 #include "pre_ast_cfg.h"
+#include "progress_report.h"
 
 #include <llvm/ADT/PostOrderIterator.h>
 #include <llvm/ADT/SCCIterator.h>
@@ -29,9 +30,27 @@ using namespace std;
 
 namespace
 {
-	uint64_t getVirtualAddress(FunctionNode& node)
+	// Output order key, computed once per function so that sorting doesn't go back to metadata for every comparison.
+	// Names are only compared when two functions share an address (or both have none).
+	struct FunctionOrderKey
 	{
-		if (auto address = md::getVirtualAddress(node.getFunction()))
+		uint64_t virtualAddress;
+		StringRef name;
+		Function* function;
+		
+		bool operator<(const FunctionOrderKey& that) const
+		{
+			if (virtualAddress != that.virtualAddress)
+			{
+				return virtualAddress < that.virtualAddress;
+			}
+			return name < that.name;
+		}
+	};
+	
+	uint64_t getVirtualAddress(Function& fn)
+	{
+		if (auto address = md::getVirtualAddress(fn))
 		{
 			return address->getLimitedValue();
 		}
@@ -837,52 +856,47 @@ void AstBackEnd::addPass(AstModulePass *pass)
 bool AstBackEnd::runOnModule(llvm::Module &m)
 {
 	outputNodes.clear();
+	analysisManager.clear();
 	
+	// Prototypes never get a body, and no AST pass or printer looks at body-less nodes, so only functions with a body
+	// get a FunctionNode. Nodes are created in address order, then by name.
+	vector<FunctionOrderKey> orderedFunctions;
 	for (Function& fn : m)
 	{
-		outputNodes.emplace_back(new FunctionNode(fn));
-		output = outputNodes.back().get();
 		if (!md::isPrototype(fn))
 		{
-			runOnFunction(fn);
+			orderedFunctions.push_back({getVirtualAddress(fn), fn.getName(), &fn});
 		}
 	}
+	sort(orderedFunctions.begin(), orderedFunctions.end());
 	
-	// sort outputNodes by virtual address, then by name
-	sort(outputNodes.begin(), outputNodes.end(), [](unique_ptr<FunctionNode>& a, unique_ptr<FunctionNode>& b)
+	// Progress units are functions, once for structurization and once for every pass.
+	size_t functionCount = orderedFunctions.size();
+	progressBeginPhase("pseudocode", functionCount * (passes.size() + 1));
+	progressSetStep("structurization");
+	for (const FunctionOrderKey& key : orderedFunctions)
 	{
-		auto virtA = getVirtualAddress(*a);
-		auto virtB = getVirtualAddress(*b);
-		if (virtA < virtB)
-		{
-			return true;
-		}
-		else if (virtA == virtB)
-		{
-			return a->getFunction().getName() < b->getFunction().getName();
-		}
-		else
-		{
-			return false;
-		}
-	});
+		ProgressItem structurizing(key.name);
+		outputNodes.emplace_back(new FunctionNode(*key.function));
+		runOnFunction(*outputNodes.back());
+	}
 	
 	// run passes
-	for (auto& pass : passes)
+	for (size_t i = 0; i < passes.size(); ++i)
 	{
-		pass->run(outputNodes);
+		progressSetStep(passes[i]->getName());
+		passes[i]->run(outputNodes, analysisManager);
+		progressSetCompleted(functionCount * (i + 2));
 	}
 	
 	return false;
 }
 
-void AstBackEnd::runOnFunction(Function& fn)
+void AstBackEnd::runOnFunction(FunctionNode& result)
 {
 	// Create AST block graph.
-	outputNodes.emplace_back(new FunctionNode(fn));
-	FunctionNode& result = *outputNodes.back();
 	blockGraph.reset(new PreAstContext(result.getContext()));
-	blockGraph->generateBlocks(fn);
+	blockGraph->generateBlocks(result.getFunction());
 	
 	// Ensure that loops all have an exit node, for the sake of the post-dominator tree.
 	ensureLoopsExit(*blockGraph);
@@ -42,11 +42,9 @@ class AstBackEnd final : public llvm::ModulePass
 	std::unique_ptr<PreAstContext> blockGraph;
 	std::deque<std::unique_ptr<FunctionNode>> outputNodes;
 	std::deque<std::unique_ptr<AstModulePass>> passes;
-	FunctionNode* output;
+	AstAnalysisManager analysisManager;
 	
-	inline DumbAllocator& pool() { return output->getPool(); }
-	
-	void runOnFunction(llvm::Function& fn);
+	void runOnFunction(FunctionNode& result);
 	
 public:
 	static char ID;
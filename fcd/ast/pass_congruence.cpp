@@ -70,8 +70,7 @@ namespace
 
 void AstMergeCongruentVariables::doRun(FunctionNode &fn)
 {
-	LivenessAnalysis liveness;
-	liveness.collectStatementIndices(fn);
+	LivenessAnalysis* liveness = &analyses().getLiveness(fn);
 	
 	// Can we remove explicit load and call expression statements?
 	// Loads and calls are special in that they are themselves rooted as statements. For instance, a load expression for
@@ -80,10 +79,11 @@ void AstMergeCongruentVariables::doRun(FunctionNode &fn)
 	// with a function "bar()" that modifies foo, "int anon1 = foo; bar()" is not the same as `bar(); int anon1 = foo;`.
 	// However, in many cases, there are no memory operations between the rooting statement and the expression's uses,
 	// so we wouldn't need that rooting statement. This is what this code checks and tries to simplify.
-	auto& memoryOperations = liveness.getMemoryOperations();
+	bool erasedDeclarations = false;
+	auto& memoryOperations = liveness->getMemoryOperations();
 	for (auto memoryOperationStatement : memoryOperations)
 	{
-		Expression* expr = cast<ExpressionStatement>(liveness.getStatement(memoryOperationStatement))->getExpression();
+		Expression* expr = cast<ExpressionStatement>(liveness->getStatement(memoryOperationStatement))->getExpression();
 		
 		// Exclude operator expressions, since the only use case of a rooted operator expression is to assign a value,
 		// and assignments are never used so we don't gain anything from attempting to transform them. Also exclude
@@ -97,11 +97,11 @@ void AstMergeCongruentVariables::doRun(FunctionNode &fn)
 		Statement* firstUse = nullptr;
 		size_t declarationLocation = numeric_limits<size_t>::max();
 		size_t firstUseLocation = numeric_limits<size_t>::max();
-		for (Statement* statement : getUsingStatements(*expr))
+		for (Statement* statement : analyses().getUsingStatements(fn, *expr))
 		{
 			// Kind of a heuristic. It works in loops because call results have to be assigned to a ɸ node and
 			// therefore it's not sequentially used before it's called.
-			auto indexPair = liveness.getIndex(statement);
+			auto indexPair = liveness->getIndex(statement);
 			size_t index = indexPair.first;
 			if (auto doWhile = dyn_cast<LoopStatement>(statement))
 			if (doWhile->getPosition() == LoopStatement::PostTested)
@@ -137,15 +137,26 @@ void AstMergeCongruentVariables::doRun(FunctionNode &fn)
 			{
 				StatementList::erase(declaration);
 				declaration->dropAllReferences();
+				// Keep the liveness analysis alive while its memory operations are being iterated. Erasing statements
+				// doesn't add nodes, so the layout still finds the users of the expressions that are left.
+				analyses().invalidate(fn, AstAnalysisLiveness | AstAnalysisMemoryOperations | AstAnalysisLayout);
+				erasedDeclarations = true;
 			}
 		}
 	}
 	
+	// Congruence needs liveness that matches the statements that are left.
+	if (erasedDeclarations)
+	{
+		analyses().invalidate(fn, AstAnalysisMemoryOperations);
+		liveness = &analyses().getLiveness(fn);
+	}
+	
 	unordered_set<pair<Expression*, Expression*>, HashSymmetricPair> candidateSet;
-	auto assignableExpressions = liveness.getAssignedExpressions();
+	auto assignableExpressions = liveness->getAssignedExpressions();
 	for (Expression* key : assignableExpressions)
 	{
-		for (const AssignableUseDef& useDef : liveness.getUsesDefs(*key))
+		for (const AssignableUseDef& useDef : liveness->getUsesDefs(*key))
 		{
 			if (useDef.isUse())
 			{
@@ -168,7 +179,7 @@ void AstMergeCongruentVariables::doRun(FunctionNode &fn)
 	deque<pair<ExpressionReference, ExpressionReference>> mergeList;
 	for (auto& candidate : candidateSet)
 	{
-		if (liveness.congruent(candidate.first, candidate.second))
+		if (liveness->congruent(candidate.first, candidate.second))
 		{
 			if (!isExpressionAddressable(candidate.first))
 			{
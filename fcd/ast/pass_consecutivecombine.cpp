@@ -203,6 +203,12 @@ const char* AstConsecutiveCombiner::getName() const
 	return "Combine Consecutive Statements";
 }
 
+unsigned AstConsecutiveCombiner::getPreservedAnalyses() const
+{
+	// Statements move around, but expressions are not modified.
+	return AstAnalysisMemoryOperations;
+}
+
 void AstConsecutiveCombiner::doRun(FunctionNode& fn)
 {
 	fn.getBody() = ConsecutiveCombiner(fn.getContext()).optimizeSequence(move(fn.getBody())).take();
@@ -15,79 +15,6 @@ using namespace std;
 
 namespace
 {
-	
-	class MemoryOperationVisitor : public AstVisitor<MemoryOperationVisitor, false, bool>
-	{
-	public:
-		bool visitUnaryOperator(UnaryOperatorExpression& unary)
-		{
-			return unary.getType() == UnaryOperatorExpression::Dereference || visit(*unary.getOperand());
-		}
-		
-		bool visitNAryOperator(NAryOperatorExpression& nary)
-		{
-			return nary.getType() == NAryOperatorExpression::Assign || any_of(nary.operands(), [&](ExpressionUse& use)
-			{
-				return visit(*use.getUse());
-			});
-		}
-		
-		bool visitTernary(TernaryExpression& ternary)
-		{
-			return visit(*ternary.getCondition()) || visit(*ternary.getTrueValue()) || visit(*ternary.getFalseValue());
-		}
-		
-		bool visitCast(CastExpression& cast)
-		{
-			return visit(*cast.getCastValue());
-		}
-		
-		bool visitSubscript(SubscriptExpression& subscript)
-		{
-			return true;
-		}
-		
-		bool visitMemberAccess(MemberAccessExpression& memberAccess)
-		{
-			return true;
-		}
-		
-		bool visitCall(CallExpression& call)
-		{
-			return true;
-		}
-		
-		bool visitAggregate(AggregateExpression& agg)
-		{
-			return false;
-		}
-		
-		bool visitNumeric(NumericExpression& numeric)
-		{
-			return false;
-		}
-		
-		bool visitToken(TokenExpression& token)
-		{
-			return false;
-		}
-		
-		bool visitAssembly(AssemblyExpression& assembly)
-		{
-			return false;
-		}
-		
-		bool visitAssignable(AssignableExpression& assignable)
-		{
-			return false;
-		}
-		
-		bool visitDefault(ExpressionUser& user)
-		{
-			llvm_unreachable("unimplemented expression clone case");
-		}
-	};
-	
 	bool isBreak(StatementList& list)
 	{
 		if (auto keyword = dyn_cast_or_null<KeywordStatement>(list.single()))
@@ -100,6 +27,8 @@ namespace
 	class NestedCombiner : public AstVisitor<NestedCombiner, false, StatementReference>
 	{
 		AstContext& ctx;
+		AstAnalysisManager& analyses;
+		FunctionNode& fn;
 		
 		// The LoopToSeq rule is never relevant with fcd's input. The DoWhile, NestedDoWhile, CondToSeq and
 		// CondToSeqNeg are all very similar: you see if the last conditional of a loop has a break statement in it,
@@ -170,8 +99,8 @@ namespace
 		}
 		
 	public:
-		NestedCombiner(AstContext& ctx)
-		: ctx(ctx)
+		NestedCombiner(AstAnalysisManager& analyses, FunctionNode& fn)
+		: ctx(fn.getContext()), analyses(analyses), fn(fn)
 		{
 		}
 		
@@ -192,11 +121,10 @@ namespace
 				// definition materialization could push the operation to appear to happen unconditionally, which would
 				// be deeply incorrect.
 				// XXX: the right way to solve this problem is to use LivenessAnalysis (from the variable congruence
-				// pass) to check for statement ordering, but the right way to do that is to expand the pass framework
-				// to have persistent and updatable analyses. It doesn't feel (yet) like this change would pull its own
-				// weight, so for now, just check that the condition doesn't involve memory operations.
+				// pass) to check for statement ordering. For now, just check that the condition doesn't involve memory
+				// operations.
 				ExpressionReference right = &*innerIfElse->getCondition();
-				if (!MemoryOperationVisitor().visit(*right.get()))
+				if (!analyses.hasMemoryOperation(fn, *right.get()))
 				{
 					ExpressionReference left = &*ifElse.getCondition();
 					ifElse.setCondition(ctx.nary(NAryOperatorExpression::ShortCircuitAnd, left.get(), right.get()));
@@ -239,8 +167,14 @@ const char* AstNestedCombiner::getName() const
 	return "Combine Nested Statements";
 }
 
+unsigned AstNestedCombiner::getPreservedAnalyses() const
+{
+	// Combined conditions are new expressions; existing ones are left alone.
+	return AstAnalysisMemoryOperations;
+}
+
 void AstNestedCombiner::doRun(FunctionNode& fn)
 {
-	NestedCombiner nested(fn.getContext());
+	NestedCombiner nested(analyses(), fn);
 	fn.getBody() = visitAll(nested, move(fn.getBody())).take();
 }
@@ -37,3 +37,8 @@ const char* AstPrint::getName() const
 {
 	return "Print AST";
 }
+
+unsigned AstPrint::getPreservedAnalyses() const
+{
+	return AstAnalysisAll;
+}
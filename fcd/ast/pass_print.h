@@ -32,6 +32,7 @@ public:
 	}
 	
 	virtual const char* getName() const override;
+	virtual unsigned getPreservedAnalyses() const override;
 };
 
 #endif /* fcd__ast_pass_print_h */
@@ -56,3 +56,9 @@ const char* AstRemoveUndef::getName() const
 {
 	return "Remove undefined assignments";
 }
+
+unsigned AstRemoveUndef::getPreservedAnalyses() const
+{
+	// Only statements are removed.
+	return AstAnalysisMemoryOperations;
+}
@@ -94,6 +94,8 @@ PreAstContext::PreAstContext(AstContext& ctx)
 
 void PreAstContext::generateBlocks(Function& fn)
 {
+	ctx.numberValues(fn);
+	
 	std::unordered_map<llvm::BasicBlock*, Statement*> phiInStatements;
 	for (BasicBlock& bbRef : fn)
 	{
@@ -8,6 +8,7 @@
 //
 
 #include "expression_type.h"
+#include "memory_report.h"
 #include "print.h"
 #include "type_printer.h"
 
@@ -325,12 +326,35 @@ void StatementPrintVisitor::insertDeclarations()
 	}
 }
 
+void StatementPrintVisitor::trackBuiltMemory()
+{
+	// Called once the printable tree is complete, right before it is printed.
+	size_t size = currentScope->getMemorySize() + orderedTokens.capacity() * sizeof orderedTokens[0];
+	for (const auto& pair : tokens)
+	{
+		size += sizeof pair + pair.second.token.capacity();
+		if (!pair.second.users.isSmall())
+		{
+			size += pair.second.users.capacity() * sizeof pair.second.users[0];
+		}
+	}
+	size += noTokens.size() * sizeof(const Expression*);
+	
+	trackedMemory = size;
+	trackMemory(MemoryPrinter, static_cast<int64_t>(trackedMemory));
+}
+
 StatementPrintVisitor::StatementPrintVisitor(AstContext& ctx, bool tokenize)
-: ctx(ctx), tokenize(tokenize), parentExpression(nullptr), currentExpression(nullptr), os(currentValue)
+: ctx(ctx), tokenize(tokenize), parentExpression(nullptr), currentExpression(nullptr), os(currentValue), trackedMemory(0)
 {
 	currentScope.reset(new PrintableScope(nullptr));
 }
 
+StatementPrintVisitor::~StatementPrintVisitor()
+{
+	trackMemory(MemoryPrinter, -static_cast<int64_t>(trackedMemory));
+}
+
 void StatementPrintVisitor::visit(const ExpressionUser &user)
 {
 	const Expression* oldParent = parentExpression;
@@ -584,6 +608,8 @@ void StatementPrintVisitor::print(AstContext& ctx, raw_ostream& os, const Statem
 	{
 		printer.insertDeclarations();
 	}
+	
+	printer.trackBuiltMemory();
 	printer.currentScope->print(os, 0);
 }
 
@@ -602,6 +628,7 @@ void StatementPrintVisitor::print(AstContext& ctx, raw_ostream &os, const Expres
 		{
 			printer.insertDeclarations();
 		}
+		printer.trackBuiltMemory();
 		printer.currentScope->print(os, 0);
 	}
 }
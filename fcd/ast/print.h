@@ -43,6 +43,7 @@ class StatementPrintVisitor final : public AstVisitor<StatementPrintVisitor>
 	const Expression* currentExpression;
 	llvm::raw_string_ostream os;
 	llvm::SmallVector<const Expression*, 16> usedByStatement;
+	size_t trackedMemory;
 	
 	Tokenization* getIdentifier(const Expression& expression);
 	
@@ -50,6 +51,7 @@ class StatementPrintVisitor final : public AstVisitor<StatementPrintVisitor>
 	void visit(std::unique_ptr<PrintableScope> childScope, const StatementList& stmt);
 	void fillUsers(PrintableItem* user);
 	void insertDeclarations();
+	void trackBuiltMemory();
 	
 	template<typename TAction>
 	void pushScope(std::unique_ptr<PrintableScope>& childScope, TAction&& action)
@@ -60,7 +62,7 @@ class StatementPrintVisitor final : public AstVisitor<StatementPrintVisitor>
 	}
 	
 	StatementPrintVisitor(AstContext& ctx, bool tokenize);
-	~StatementPrintVisitor() = default;
+	~StatementPrintVisitor();
 	
 public:
 	static void print(AstContext& ctx, llvm::raw_ostream& os, const StatementList& statements, bool tokenize = true);
@@ -38,6 +38,11 @@ void PrintableLine::print(raw_ostream &os, unsigned int indent) const
 	tabulate(os, indent) << lineString << '\n';
 }
 
+size_t PrintableLine::getMemorySize() const
+{
+	return sizeof *this + lineString.capacity();
+}
+
 PrintableItem* PrintableScope::prependItem(string line)
 {
 	prepended.emplace_back(llvm::make_unique<PrintableLine>(this, move(line)));
@@ -79,3 +84,18 @@ void PrintableScope::print(raw_ostream &os, unsigned int indent) const
 		tabulate(os, indent) << suffixString << '\n';
 	}
 }
+
+size_t PrintableScope::getMemorySize() const
+{
+	size_t size = sizeof *this + prefixString.capacity() + suffixString.capacity();
+	size += (prepended.size() + items.size()) * sizeof(unique_ptr<PrintableItem>);
+	for (const auto& item : prepended)
+	{
+		size += item->getMemorySize();
+	}
+	for (const auto& item : items)
+	{
+		size += item->getMemorySize();
+	}
+	return size;
+}
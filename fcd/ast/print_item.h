@@ -42,6 +42,7 @@ public:
 	PrintableScope* getParent() { return parent; }
 	
 	virtual void print(llvm::raw_ostream& os, unsigned indent) const = 0;
+	virtual size_t getMemorySize() const = 0; // the item and everything that it owns, for --memory-report
 	void dump() const;
 };
 
@@ -64,6 +65,7 @@ public:
 	const std::string& line() const { return lineString; }
 	
 	virtual void print(llvm::raw_ostream& os, unsigned indent) const override;
+	virtual size_t getMemorySize() const override;
 };
 
 class PrintableScope : public PrintableItem
@@ -94,6 +96,7 @@ public:
 	PrintableItem* appendItem(std::unique_ptr<PrintableItem> statement);
 	
 	virtual void print(llvm::raw_ostream& os, unsigned indent) const override;
+	virtual size_t getMemorySize() const override;
 };
 
 #endif /* print_item_hpp */
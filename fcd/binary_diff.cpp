@@ -0,0 +1,538 @@
+//
+// binary_diff.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "binary_diff.h"
+#include "executable.h"
+#include "metadata.h"
+#include "task_runtime.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	// FNV-1a, so that fingerprints are the same from one run to the next.
+	class FingerprintHasher
+	{
+		uint64_t state = 0xcbf29ce484222325;
+	
+	public:
+		void add(uint64_t value)
+		{
+			for (unsigned i = 0; i < 8; ++i)
+			{
+				state ^= (value >> (i * 8)) & 0xff;
+				state *= 0x100000001b3;
+			}
+		}
+		
+		void add(StringRef bytes)
+		{
+			add(bytes.size());
+			for (char c : bytes)
+			{
+				state ^= static_cast<uint8_t>(c);
+				state *= 0x100000001b3;
+			}
+		}
+		
+		uint64_t get() const { return state; }
+	};
+	
+	enum OperandTag : uint64_t
+	{
+		TagInstruction,
+		TagArgument,
+		TagBlock,
+		TagNamedCallee,
+		TagUnnamedCallee,
+		TagGlobal,
+		TagLocalGlobal,
+		TagInteger,
+		TagCodePointer,
+		TagDataPointer,
+		TagFloat,
+		TagData,
+		TagConstant,
+		TagInlineAsm,
+		TagMetadata,
+	};
+	
+	// Lifted functions that have no symbol are named after their address, which changes from one version to the next.
+	bool hasAddressName(const Function& fn)
+	{
+		if (auto address = md::getVirtualAddress(fn))
+		{
+			return fn.getName() == "func_" + utohexstr(address->getLimitedValue(), true);
+		}
+		return false;
+	}
+	
+	class FunctionHasher
+	{
+		const vector<MappedRange>& ranges;
+		const unordered_map<uint64_t, Function*>& functionsByAddress;
+		const DenseSet<const Function*>& addressNamedFunctions;
+		uint64_t functionAddress;
+		DenseMap<const Value*, uint64_t> numbers;
+		FingerprintHasher hash;
+		
+		void addType(Type* type)
+		{
+			// Struct names are not hashed: modules that share a context get different names for the same types.
+			hash.add(type->getTypeID());
+			if (auto intType = dyn_cast<IntegerType>(type))
+			{
+				hash.add(intType->getBitWidth());
+			}
+			else if (auto pointerType = dyn_cast<PointerType>(type))
+			{
+				hash.add(pointerType->getAddressSpace());
+				hash.add(pointerType->getElementType()->getTypeID());
+			}
+			else
+			{
+				hash.add(type->isArrayTy() ? type->getArrayNumElements() : type->isVectorTy() ? type->getVectorNumElements() : 0);
+				hash.add(type->getNumContainedTypes());
+				for (Type* contained : type->subtypes())
+				{
+					hash.add(contained->getTypeID());
+				}
+			}
+		}
+		
+		void addBits(const APInt& value)
+		{
+			hash.add(value.getBitWidth());
+			for (unsigned i = 0; i < value.getNumWords(); ++i)
+			{
+				hash.add(value.getRawData()[i]);
+			}
+		}
+		
+		void addCallee(const Function& callee)
+		{
+			if (addressNamedFunctions.count(&callee) != 0)
+			{
+				hash.add(TagUnnamedCallee);
+				if (!callee.isDeclaration())
+				{
+					callees.push_back(&callee);
+				}
+			}
+			else
+			{
+				hash.add(TagNamedCallee);
+				hash.add(callee.getName());
+			}
+		}
+		
+		void addInteger(const ConstantInt& constant)
+		{
+			const APInt& value = constant.getValue();
+			if (value.getBitWidth() >= 32 && value.getBitWidth() <= 64)
+			{
+				uint64_t integer = value.getZExtValue();
+				auto iter = functionsByAddress.find(integer);
+				if (iter != functionsByAddress.end())
+				{
+					addCallee(*iter->second);
+					return;
+				}
+				
+				for (size_t i = 0; i < ranges.size(); ++i)
+				{
+					const MappedRange& range = ranges[i];
+					if (integer >= range.begin && integer < range.end)
+					{
+						// Code pointers are usually within the function, so they are relative to it.
+						hash.add(range.executable ? TagCodePointer : TagDataPointer);
+						hash.add(range.executable ? integer - functionAddress : i);
+						if (!range.executable)
+						{
+							hash.add(integer - range.begin);
+						}
+						return;
+					}
+				}
+			}
+			
+			hash.add(TagInteger);
+			addBits(value);
+		}
+		
+		void addConstant(const Constant& constant)
+		{
+			if (auto fn = dyn_cast<Function>(&constant))
+			{
+				addCallee(*fn);
+			}
+			else if (auto global = dyn_cast<GlobalValue>(&constant))
+			{
+				// Private globals (like instruction details) are numbered in the order in which they were created.
+				if (global->hasLocalLinkage())
+				{
+					hash.add(TagLocalGlobal);
+					addType(global->getValueType());
+				}
+				else
+				{
+					hash.add(TagGlobal);
+					hash.add(global->getName());
+				}
+			}
+			else if (auto integer = dyn_cast<ConstantInt>(&constant))
+			{
+				addInteger(*integer);
+			}
+			else if (auto fp = dyn_cast<ConstantFP>(&constant))
+			{
+				hash.add(TagFloat);
+				addBits(fp->getValueAPF().bitcastToAPInt());
+			}
+			else if (auto data = dyn_cast<ConstantDataSequential>(&constant))
+			{
+				hash.add(TagData);
+				hash.add(data->getRawDataValues());
+			}
+			else
+			{
+				hash.add(TagConstant);
+				hash.add(constant.getValueID());
+				addType(constant.getType());
+				if (auto expression = dyn_cast<ConstantExpr>(&constant))
+				{
+					hash.add(expression->getOpcode());
+					hash.add(expression->isCompare() ? expression->getPredicate() : 0);
+				}
+				
+				// Block addresses have a basic block operand, so not every operand is a constant.
+				hash.add(constant.getNumOperands());
+				for (const Use& use : constant.operands())
+				{
+					addOperand(*use.get());
+				}
+			}
+		}
+		
+		void addOperand(const Value& value)
+		{
+			if (isa<Instruction>(value) || isa<BasicBlock>(value))
+			{
+				hash.add(isa<Instruction>(value) ? TagInstruction : TagBlock);
+				hash.add(numbers.lookup(&value));
+			}
+			else if (auto argument = dyn_cast<Argument>(&value))
+			{
+				hash.add(TagArgument);
+				hash.add(argument->getArgNo());
+			}
+			else if (auto constant = dyn_cast<Constant>(&value))
+			{
+				addConstant(*constant);
+			}
+			else if (auto inlineAsm = dyn_cast<InlineAsm>(&value))
+			{
+				hash.add(TagInlineAsm);
+				hash.add(inlineAsm->getAsmString());
+				hash.add(inlineAsm->getConstraintString());
+			}
+			else
+			{
+				hash.add(TagMetadata);
+			}
+		}
+		
+		void addInstruction(const Instruction& inst)
+		{
+			hash.add(inst.getOpcode());
+			addType(inst.getType());
+			if (auto cmp = dyn_cast<CmpInst>(&inst))
+			{
+				hash.add(cmp->getPredicate());
+			}
+			else if (auto alloca = dyn_cast<AllocaInst>(&inst))
+			{
+				addType(alloca->getAllocatedType());
+			}
+			
+			hash.add(inst.getNumOperands());
+			for (const Use& use : inst.operands())
+			{
+				addOperand(*use.get());
+			}
+		}
+	
+	public:
+		// Callees that are named after their address, in the order in which they are used. Their local fingerprints
+		// are only known once every function has been hashed.
+		vector<const Function*> callees;
+		
+		FunctionHasher(const vector<MappedRange>& ranges, const unordered_map<uint64_t, Function*>& functionsByAddress, const DenseSet<const Function*>& addressNamedFunctions, uint64_t functionAddress)
+		: ranges(ranges), functionsByAddress(functionsByAddress), addressNamedFunctions(addressNamedFunctions), functionAddress(functionAddress)
+		{
+		}
+		
+		uint64_t run(const Function& fn)
+		{
+			// Operands can refer to values that come later (like with phi nodes), so everything is numbered first.
+			uint64_t counter = 0;
+			for (const BasicBlock& bb : fn)
+			{
+				numbers[&bb] = counter++;
+				for (const Instruction& inst : bb)
+				{
+					numbers[&inst] = counter++;
+				}
+			}
+			
+			hash.add(fn.arg_size());
+			for (const BasicBlock& bb : fn)
+			{
+				hash.add(bb.size());
+				for (const Instruction& inst : bb)
+				{
+					addInstruction(inst);
+				}
+			}
+			return hash.get();
+		}
+	};
+	
+	// Pairs functions of both versions, in passes that are each less reliable than the previous one.
+	class FunctionPairing
+	{
+		const vector<FunctionFingerprint>& oldFunctions;
+		const vector<FunctionFingerprint>& newFunctions;
+	
+	public:
+		static constexpr size_t unpaired = ~size_t(0);
+		vector<size_t> oldPartners;
+		vector<size_t> newPartners;
+		
+		FunctionPairing(const vector<FunctionFingerprint>& oldFunctions, const vector<FunctionFingerprint>& newFunctions)
+		: oldFunctions(oldFunctions), newFunctions(newFunctions), oldPartners(oldFunctions.size(), unpaired), newPartners(newFunctions.size(), unpaired)
+		{
+		}
+		
+		// Pairs functions that are still unpaired when their key is unique to one function in each version. keyOf
+		// returns false for functions that have no key.
+		template<typename Key, typename KeyFn>
+		void pairByUniqueKey(KeyFn keyOf)
+		{
+			struct Candidates
+			{
+				size_t oldIndex = unpaired;
+				size_t oldCount = 0;
+				size_t newIndex = unpaired;
+				size_t newCount = 0;
+			};
+			
+			map<Key, Candidates> candidates;
+			Key key;
+			for (size_t i = 0; i < oldFunctions.size(); ++i)
+			{
+				if (oldPartners[i] == unpaired && keyOf(oldFunctions[i], key))
+				{
+					Candidates& entry = candidates[key];
+					entry.oldIndex = i;
+					entry.oldCount++;
+				}
+			}
+			
+			for (size_t i = 0; i < newFunctions.size(); ++i)
+			{
+				if (newPartners[i] == unpaired && keyOf(newFunctions[i], key))
+				{
+					auto iter = candidates.find(key);
+					if (iter != candidates.end())
+					{
+						iter->second.newIndex = i;
+						iter->second.newCount++;
+					}
+				}
+			}
+			
+			for (const auto& entry : candidates)
+			{
+				if (entry.second.oldCount == 1 && entry.second.newCount == 1)
+				{
+					oldPartners[entry.second.oldIndex] = entry.second.newIndex;
+					newPartners[entry.second.newIndex] = entry.second.oldIndex;
+				}
+			}
+		}
+	};
+	
+	constexpr size_t FunctionPairing::unpaired;
+	
+	const char* getKindName(FunctionMatchKind kind)
+	{
+		switch (kind)
+		{
+			case FunctionUnchanged: return "unchanged";
+			case FunctionChanged: return "changed";
+			case FunctionNew: return "new";
+			case FunctionRemoved: return "removed";
+		}
+		llvm_unreachable("unknown match kind");
+	}
+	
+	string formatAddress(const FunctionFingerprint* function)
+	{
+		return function == nullptr ? "-" : "0x" + utohexstr(function->address);
+	}
+}
+
+vector<FunctionFingerprint> fingerprintFunctions(Module& module, const Executable& executable)
+{
+	vector<FunctionFingerprint> fingerprints;
+	unordered_map<uint64_t, Function*> functionsByAddress;
+	DenseSet<const Function*> addressNamedFunctions;
+	for (Function& fn : module)
+	{
+		if (auto address = md::getVirtualAddress(fn))
+		{
+			bool addressNamed = hasAddressName(fn);
+			functionsByAddress[address->getLimitedValue()] = &fn;
+			if (addressNamed)
+			{
+				addressNamedFunctions.insert(&fn);
+			}
+			if (!fn.isDeclaration())
+			{
+				fingerprints.push_back({&fn, address->getLimitedValue(), fn.getName().str(), !addressNamed, 0, 0});
+			}
+		}
+	}
+	
+	// Local fingerprints only read the IR, so functions are hashed concurrently. Metadata lookups by name can add
+	// kinds to the shared LLVMContext, so the functions that are named after their address are found beforehand.
+	vector<MappedRange> ranges = executable.getMappedRanges();
+	TaskGroup group;
+	auto hashes = parallelMap(group, fingerprints, [&](const FunctionFingerprint& fingerprint)
+	{
+		FunctionHasher hasher(ranges, functionsByAddress, addressNamedFunctions, fingerprint.address);
+		uint64_t local = hasher.run(*fingerprint.function);
+		return make_pair(local, move(hasher.callees));
+	});
+	
+	DenseMap<const Function*, uint64_t> localFingerprints;
+	for (size_t i = 0; i < fingerprints.size(); ++i)
+	{
+		fingerprints[i].local = hashes[i].first;
+		localFingerprints[fingerprints[i].function] = fingerprints[i].local;
+	}
+	
+	for (size_t i = 0; i < fingerprints.size(); ++i)
+	{
+		FingerprintHasher full;
+		full.add(fingerprints[i].local);
+		for (const Function* callee : hashes[i].second)
+		{
+			full.add(localFingerprints.lookup(callee));
+		}
+		fingerprints[i].full = full.get();
+	}
+	return fingerprints;
+}
+
+vector<FunctionMatch> matchFunctions(const vector<FunctionFingerprint>& oldFunctions, const vector<FunctionFingerprint>& newFunctions)
+{
+	FunctionPairing pairing(oldFunctions, newFunctions);
+	pairing.pairByUniqueKey<string>([](const FunctionFingerprint& function, string& key)
+	{
+		key = function.name;
+		return function.hasSymbolName;
+	});
+	pairing.pairByUniqueKey<uint64_t>([](const FunctionFingerprint& function, uint64_t& key)
+	{
+		key = function.full;
+		return true;
+	});
+	pairing.pairByUniqueKey<uint64_t>([](const FunctionFingerprint& function, uint64_t& key)
+	{
+		key = function.local;
+		return true;
+	});
+	pairing.pairByUniqueKey<uint64_t>([](const FunctionFingerprint& function, uint64_t& key)
+	{
+		key = function.address;
+		return true;
+	});
+	
+	vector<FunctionMatch> matches;
+	for (size_t i = 0; i < newFunctions.size(); ++i)
+	{
+		size_t oldIndex = pairing.newPartners[i];
+		if (oldIndex == FunctionPairing::unpaired)
+		{
+			matches.push_back({FunctionNew, nullptr, &newFunctions[i]});
+		}
+		else
+		{
+			const FunctionFingerprint& oldFunction = oldFunctions[oldIndex];
+			FunctionMatchKind kind = oldFunction.local == newFunctions[i].local ? FunctionUnchanged : FunctionChanged;
+			matches.push_back({kind, &oldFunction, &newFunctions[i]});
+		}
+	}
+	
+	for (size_t i = 0; i < oldFunctions.size(); ++i)
+	{
+		if (pairing.oldPartners[i] == FunctionPairing::unpaired)
+		{
+			matches.push_back({FunctionRemoved, &oldFunctions[i], nullptr});
+		}
+	}
+	
+	stable_sort(matches.begin(), matches.end(), [](const FunctionMatch& a, const FunctionMatch& b)
+	{
+		const FunctionFingerprint* aFunction = a.newFunction == nullptr ? a.oldFunction : a.newFunction;
+		const FunctionFingerprint* bFunction = b.newFunction == nullptr ? b.oldFunction : b.newFunction;
+		return make_pair(a.newFunction == nullptr, aFunction->address) < make_pair(b.newFunction == nullptr, bFunction->address);
+	});
+	return matches;
+}
+
+void printFunctionMatches(const vector<FunctionMatch>& matches, raw_ostream& output)
+{
+	size_t counts[FunctionRemoved + 1] = {};
+	for (const FunctionMatch& match : matches)
+	{
+		counts[match.kind]++;
+		output << left_justify(getKindName(match.kind), 10);
+		output << left_justify(formatAddress(match.oldFunction), 20);
+		output << left_justify(formatAddress(match.newFunction), 20);
+		
+		const FunctionFingerprint* function = match.newFunction == nullptr ? match.oldFunction : match.newFunction;
+		output << function->name;
+		if (match.oldFunction != nullptr && match.newFunction != nullptr && match.oldFunction->name != match.newFunction->name)
+		{
+			output << " (was " << match.oldFunction->name << ")";
+		}
+		output << '\n';
+	}
+	
+	output << "# " << counts[FunctionUnchanged] << " unchanged, " << counts[FunctionChanged] << " changed, ";
+	output << counts[FunctionNew] << " new, " << counts[FunctionRemoved] << " removed\n";
+}
@@ -0,0 +1,64 @@
+//
+// binary_diff.h
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__binary_diff_h
+#define fcd__binary_diff_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llvm
+{
+	class Function;
+	class Module;
+	class raw_ostream;
+}
+
+class Executable;
+
+// Address-independent summary of the lifted IR of a function, before it is optimized. Integers that point into mapped
+// memory are hashed relative to their segment (or to the function itself, for code), and calls are hashed by symbol
+// name when the callee has one. The local fingerprint stops there; the full fingerprint also covers the local
+// fingerprints of callees that have no symbol name.
+struct FunctionFingerprint
+{
+	llvm::Function* function;
+	uint64_t address;
+	std::string name;
+	bool hasSymbolName;
+	uint64_t local;
+	uint64_t full;
+};
+
+std::vector<FunctionFingerprint> fingerprintFunctions(llvm::Module& module, const Executable& executable);
+
+enum FunctionMatchKind
+{
+	FunctionUnchanged,
+	FunctionChanged,
+	FunctionNew,
+	FunctionRemoved,
+};
+
+struct FunctionMatch
+{
+	FunctionMatchKind kind;
+	const FunctionFingerprint* oldFunction;
+	const FunctionFingerprint* newFunction;
+};
+
+// Pairs functions of two versions of a program: by symbol name, then by unique fingerprint, then by address. Paired
+// functions are unchanged when their local fingerprints are equal. Matches are sorted by the address in the new
+// version, then by the address in the old version for removed functions.
+std::vector<FunctionMatch> matchFunctions(const std::vector<FunctionFingerprint>& oldFunctions, const std::vector<FunctionFingerprint>& newFunctions);
+
+void printFunctionMatches(const std::vector<FunctionMatch>& matches, llvm::raw_ostream& output);
+
+#endif /* fcd__binary_diff_h */
@@ -73,6 +73,15 @@ bool CallingConvention::analyzeCallSite(ParameterRegistry &registry, CallInforma
 	return false;
 }
 
+void CallingConvention::analyzeCallSites(ParameterRegistry& registry, ArrayRef<CallSite> callSites, ArrayRef<CallInformation*> fillOut, vector<bool>& succeeded)
+{
+	assert(callSites.size() == fillOut.size() && callSites.size() == succeeded.size());
+	for (size_t i = 0; i < callSites.size(); ++i)
+	{
+		succeeded[i] = analyzeCallSite(registry, *fillOut[i], callSites[i]);
+	}
+}
+
 bool CallingConvention::analyzeFunctionType(ParameterRegistry& registry, CallInformation& fillOut, FunctionType& type)
 {
 	return false;
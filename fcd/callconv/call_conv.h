@@ -14,6 +14,7 @@
 #include "params_registry.h"
 #include "targetinfo.h"
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/Function.h>
 
 #include <cassert>
@@ -44,6 +45,10 @@ public:
 	// used for functions without a body (prototypes, imports, vararg calls)
 	virtual bool analyzeCallSite(ParameterRegistry& registry, CallInformation& fillOut, llvm::CallSite cs);
 	
+	// used to analyze every call site of a function at once; fillOut and succeeded are parallel to callSites
+	// (the default implementation calls analyzeCallSite for each call site)
+	virtual void analyzeCallSites(ParameterRegistry& registry, llvm::ArrayRef<llvm::CallSite> callSites, llvm::ArrayRef<CallInformation*> fillOut, std::vector<bool>& succeeded);
+	
 	// used when a function type can be inferred but no other information is available
 	// (usually called by another CC's analyzeCallSite when they identify a function type but don't know
 	// what to do with it)
@@ -18,56 +18,6 @@
 using namespace llvm;
 using namespace std;
 
-namespace
-{
-	void findUsedReturns(
-		// invariant inputs
-		const vector<const TargetRegisterInfo*>& returns,
-		TargetInfo& targetInfo,
-		MemorySSA& mssa,
-		
-		// inputs
-		SmallPtrSetImpl<MemoryPhi*>& visited,
-		MemoryAccess& access,
-		
-		// outputs
-		vector<const TargetRegisterInfo*>& result)
-	{
-		for (auto user : access.users())
-		{
-			if (auto phi = dyn_cast<MemoryPhi>(user))
-			{
-				if (visited.insert(phi).second)
-				{
-					findUsedReturns(returns, targetInfo, mssa, visited, *phi, result);
-				}
-			}
-			else if (auto use = dyn_cast<MemoryUse>(user))
-			{
-				if (auto load = dyn_cast<LoadInst>(use->getMemoryInst()))
-				if (const TargetRegisterInfo* maybeReg = targetInfo.registerInfo(*load->getPointerOperand()))
-				{
-					bool alreadyFound = any_of(result.begin(), result.end(), [=](const TargetRegisterInfo* existing)
-					{
-						return existing == maybeReg;
-					});
-					
-					if (!alreadyFound)
-					{
-						const TargetRegisterInfo& registerInfo = targetInfo.largestOverlappingRegister(*maybeReg);
-						auto iter = find(returns.begin(), returns.end(), &registerInfo);
-						if (iter != returns.end())
-						{
-							// return value!
-							result.push_back(&registerInfo);
-						}
-					}
-				}
-			}
-		}
-	}
-}
-
 vector<const TargetRegisterInfo*> ipaFindUsedReturns(ParameterRegistry& registry, Function& function, const vector<const TargetRegisterInfo*>& returns)
 {
 	// Excuse entry points from not having callers; use every return.
@@ -78,29 +28,17 @@ vector<const TargetRegisterInfo*> ipaFindUsedReturns(ParameterRegistry& registry
 		return returns;
 	}
 	
-	// Otherwise, loop through callers and see which registers are used after the function call.
-	TargetInfo& targetInfo = registry.getTargetInfo();
-	SmallPtrSet<MemoryPhi*, 4> visited;
+	// Otherwise, keep the registers that callers read after the function call.
 	vector<const TargetRegisterInfo*> result;
-	for (auto& use : function.uses())
+	if (const SmallBitVector* used = registry.getUsedReturns(function))
 	{
-		if (auto call = dyn_cast<CallInst>(use.getUser()))
+		const TargetRegisterInfo* firstRegister = registry.getTargetInfo().targetRegisterInfo().data();
+		for (const TargetRegisterInfo* reg : returns)
 		{
-			auto parentFunction = call->getParent()->getParent();
-			if (parentFunction == &function)
+			if (used->test(static_cast<unsigned>(reg - firstRegister)))
 			{
-				// TODO: This isn't impossible to compute, just somewhat inconvenient.
-				continue;
+				result.push_back(reg);
 			}
-			
-			auto parentArgs = &*parentFunction->arg_begin();
-			auto pointerType = dyn_cast<PointerType>(parentArgs->getType());
-			assert(pointerType != nullptr && pointerType->getElementType()->getStructName() == "struct.x86_regs");
-			(void) pointerType;
-			
-			visited.clear();
-			MemorySSA& mssa = *registry.getMemorySSA(*parentFunction);
-			findUsedReturns(returns, targetInfo, mssa, visited, *mssa.getMemoryAccess(call), result);
 		}
 	}
 	return result;
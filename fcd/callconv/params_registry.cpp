@@ -12,10 +12,13 @@
 #include "call_conv.h"
 #include "command_line.h"
 #include "executable.h"
+#include "memory_report.h"
 #include "metadata.h"
 #include "params_registry.h"
 #include "pass_executable.h"
+#include "passes.h"
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/Analysis/PostDominators.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/IR/Dominators.h>
@@ -123,6 +126,31 @@ namespace
 		return false;
 	}
 	
+	// Marks registers that are read through the given memory access, looking through phis.
+	void findUsedRegisters(TargetInfo& targetInfo, SmallPtrSetImpl<MemoryPhi*>& visited, MemoryAccess& access, SmallBitVector& result)
+	{
+		const TargetRegisterInfo* firstRegister = targetInfo.targetRegisterInfo().data();
+		for (auto user : access.users())
+		{
+			if (auto phi = dyn_cast<MemoryPhi>(user))
+			{
+				if (visited.insert(phi).second)
+				{
+					findUsedRegisters(targetInfo, visited, *phi, result);
+				}
+			}
+			else if (auto use = dyn_cast<MemoryUse>(user))
+			{
+				if (auto load = dyn_cast<LoadInst>(use->getMemoryInst()))
+				if (const TargetRegisterInfo* maybeReg = targetInfo.registerInfo(*load->getPointerOperand()))
+				{
+					const TargetRegisterInfo& registerInfo = targetInfo.largestOverlappingRegister(*maybeReg);
+					result.set(static_cast<unsigned>(&registerInfo - firstRegister));
+				}
+			}
+		}
+	}
+	
 	struct TemporaryTrue
 	{
 		bool old;
@@ -185,6 +213,10 @@ ParameterRegistry::ParameterRegistry()
 
 ParameterRegistry::~ParameterRegistry()
 {
+	for (const auto& pair : mssas)
+	{
+		trackMemory(MemoryParameterRegistry, -static_cast<int64_t>(pair.second.estimatedSize));
+	}
 }
 
 CallInformation* ParameterRegistry::analyzeFunction(Function& fn)
@@ -215,6 +247,7 @@ CallInformation* ParameterRegistry::analyzeFunction(Function& fn)
 		{
 			info.setStage(CallInformation::Failed);
 		}
+		invalidateCallers(fn);
 	}
 	
 	return info.getStage() == CallInformation::Completed ? &info : nullptr;
@@ -299,40 +332,107 @@ const CallInformation* ParameterRegistry::getDefinitionCallInfo(Function& functi
 	return nullptr;
 }
 
-unique_ptr<CallInformation> ParameterRegistry::analyzeCallSite(CallSite callSite)
+void ParameterRegistry::analyzeCallSites(Function& caller, CallSiteCache& cache, CallSite mustInclude)
 {
-	unique_ptr<CallInformation> info(new CallInformation);
+	// Calls to functions with a body go through analyzeFunction; everything else that hasn't been seen yet is analyzed
+	// together, so that calling conventions can share work between call sites of the same function.
+	SmallVector<CallSite, 16> callSites;
+	for (BasicBlock& bb : caller)
+	{
+		for (Instruction& inst : bb)
+		{
+			if (auto call = dyn_cast<CallInst>(&inst))
+			if (cache.callSites.count(call) == 0)
+			{
+				auto callee = call->getCalledFunction();
+				if (call == mustInclude.getInstruction() || callee == nullptr || (md::isPrototype(*callee) && !callee->isIntrinsic()))
+				{
+					callSites.push_back(CallSite(call));
+				}
+			}
+		}
+	}
+	
+	vector<CallInformation> infos(callSites.size());
+	vector<bool> completed(callSites.size(), false);
+	string callerName = caller.getName();
 	for (CallingConvention* cc : ccChain)
 	{
-		string calleeName;
-		if (auto callee = callSite.getCalledFunction())
+		PrettyStackTraceFormat analyzingFunction("Analyzing call sites in \"%s\" with calling convention \"%s\"",
+			callerName.c_str(), cc->getName());
+		
+		SmallVector<size_t, 16> pending;
+		SmallVector<CallSite, 16> pendingCallSites;
+		SmallVector<CallInformation*, 16> pendingInfos;
+		for (size_t i = 0; i < callSites.size(); ++i)
 		{
-			calleeName = callee->getName();
+			if (!completed[i])
+			{
+				infos[i].setStage(CallInformation::Analyzing);
+				pending.push_back(i);
+				pendingCallSites.push_back(callSites[i]);
+				pendingInfos.push_back(&infos[i]);
+			}
 		}
-		else
+		
+		if (pending.empty())
 		{
-			calleeName = "(not a function)";
+			break;
 		}
-		string callerName = callSite->getFunction()->getName();
-		PrettyStackTraceFormat analyzingFunction("Analyzing call site for \"%s\" in \"%s\" with calling convention \"%s\"",
-			calleeName.c_str(), callerName.c_str(), cc->getName());
 		
-		info->setStage(CallInformation::Analyzing);
-		if (cc->analyzeCallSite(*this, *info, callSite))
+		vector<bool> succeeded(pending.size(), false);
+		cc->analyzeCallSites(*this, pendingCallSites, pendingInfos, succeeded);
+		for (size_t i = 0; i < pending.size(); ++i)
 		{
-			info->setCallingConvention(cc);
-			info->setStage(CallInformation::Completed);
-			return info;
+			CallInformation& info = infos[pending[i]];
+			if (succeeded[i])
+			{
+				info.setCallingConvention(cc);
+				info.setStage(CallInformation::Completed);
+				completed[pending[i]] = true;
+			}
+			else
+			{
+				info.setStage(CallInformation::New);
+				info.clear();
+			}
 		}
-		else
+	}
+	
+	for (size_t i = 0; i < callSites.size(); ++i)
+	{
+		if (!completed[i])
 		{
-			info->setStage(CallInformation::New);
-			info->clear();
+			infos[i].setStage(CallInformation::Failed);
 		}
+		cache.callSites[callSites[i].getInstruction()] = move(infos[i]);
+	}
+}
+
+unique_ptr<CallInformation> ParameterRegistry::analyzeCallSite(CallSite callSite)
+{
+	Function& caller = *callSite->getFunction();
+	unsigned version = md::getFunctionVersion(caller);
+	auto& cache = callSiteCaches[&caller];
+	if (cache == nullptr || cache->version != version)
+	{
+		cache.reset(new CallSiteCache);
+		cache->version = version;
 	}
 	
-	info.reset();
-	return info;
+	auto iter = cache->callSites.find(callSite.getInstruction());
+	if (iter == cache->callSites.end())
+	{
+		analyzeCallSites(caller, *cache, callSite);
+		iter = cache->callSites.find(callSite.getInstruction());
+	}
+	
+	assert(iter != cache->callSites.end());
+	if (iter->second.getStage() != CallInformation::Completed)
+	{
+		return nullptr;
+	}
+	return std::make_unique<CallInformation>(iter->second);
 }
 
 unique_ptr<MemorySSA> ParameterRegistry::createMemorySSA(Function &function)
@@ -353,15 +453,111 @@ MemorySSA* ParameterRegistry::getMemorySSA(Function &function)
 	auto iter = mssas.find(&function);
 	if (iter == mssas.end())
 	{
-		auto mssa = createMemorySSA(function);
-		iter = mssas.insert(make_pair(&function, make_pair(version, move(mssa)))).first;
+		iter = mssas.insert({&function, MemorySSAEntry{version, 0, false, nullptr}}).first;
+	}
+	else if (iter->second.version == version && (!iter->second.stale || isBeingAnalyzed(function)))
+	{
+		// The analysis of a function holds on to its MemorySSA while it analyzes callees, so it is never rebuilt
+		// under it.
+		return iter->second.mssa.get();
+	}
+	
+	// MemorySSA doesn't expose its size. Count one access per memory instruction and one phi per block.
+	size_t accessCount = 0;
+	for (BasicBlock& bb : function)
+	{
+		++accessCount;
+		for (Instruction& inst : bb)
+		{
+			if (inst.mayReadOrWriteMemory())
+			{
+				++accessCount;
+			}
+		}
 	}
-	else if (iter->second.first != version)
+	
+	MemorySSAEntry& entry = iter->second;
+	size_t estimatedSize = accessCount * sizeof(MemoryDef);
+	trackMemory(MemoryParameterRegistry, static_cast<int64_t>(estimatedSize) - static_cast<int64_t>(entry.estimatedSize));
+	entry.version = version;
+	entry.estimatedSize = estimatedSize;
+	entry.stale = false;
+	entry.mssa = createMemorySSA(function);
+	return entry.mssa.get();
+}
+
+void ParameterRegistry::invalidateCallers(Function& function)
+{
+	// Calls to the function now have a different mod/ref behavior, so the MemorySSA of its callers is out of date.
+	for (User* user : function.users())
 	{
-		iter->second.first = version;
-		iter->second.second = createMemorySSA(function);
+		if (auto call = dyn_cast<CallInst>(user))
+		if (call->getCalledFunction() == &function)
+		{
+			auto iter = mssas.find(call->getFunction());
+			if (iter != mssas.end())
+			{
+				iter->second.stale = true;
+			}
+		}
 	}
-	return iter->second.second.get();
+}
+
+const SmallBitVector* ParameterRegistry::getUsedReturns(Function& function)
+{
+	// Only calls from functions with a body are considered.
+	size_t registerCount = targetInfo->targetRegisterInfo().size();
+	SmallBitVector used;
+	bool hasCallers = false;
+	SmallDenseMap<Function*, bool, 8> largeCallers;
+	SmallPtrSet<MemoryPhi*, 4> visited;
+	for (User* user : function.users())
+	{
+		auto call = dyn_cast<CallInst>(user);
+		if (call == nullptr || call->getCalledFunction() != &function)
+		{
+			continue;
+		}
+		
+		Function& caller = *call->getFunction();
+		if (&caller == &function || md::isPrototype(caller))
+		{
+			continue;
+		}
+		
+		if (!hasCallers)
+		{
+			used.resize(registerCount);
+			hasCallers = true;
+		}
+		
+		// Walking MemorySSA from every call of a large function is quadratic, so its callees keep all of their returns.
+		auto largeIter = largeCallers.find(&caller);
+		if (largeIter == largeCallers.end())
+		{
+			largeIter = largeCallers.insert({&caller, isLargeFunction(caller)}).first;
+		}
+		if (largeIter->second)
+		{
+			used.set();
+			continue;
+		}
+		
+		if (MemoryAccess* access = getMemorySSA(caller)->getMemoryAccess(call))
+		{
+			visited.clear();
+			findUsedRegisters(*targetInfo, visited, *access, used);
+		}
+	}
+	
+	if (!hasCallers)
+	{
+		return nullptr;
+	}
+	
+	SmallBitVector& result = usedReturns[&function];
+	result = move(used);
+	return &result;
 }
 
 void ParameterRegistry::getAnalysisUsage(AnalysisUsage &au) const
@@ -412,6 +608,7 @@ bool ParameterRegistry::runOnModule(Module& m)
 	setupCCChain();
 	
 	aaResults.reset(new ParameterRegistryAAResults(TargetInfo::getTargetInfo(m)));
+	usedReturns.clear();
 	
 	TemporaryTrue isAnalyzing(analyzing);
 	for (auto& fn : m.getFunctionList())
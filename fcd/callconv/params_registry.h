@@ -14,9 +14,11 @@
 #include "pass_regaa.h"
 
 #include <llvm/ADT/iterator_range.h>
+#include <llvm/ADT/SmallBitVector.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/Analysis/AliasAnalysis.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/ValueMap.h>
 #include <llvm/Pass.h>
 #include <llvm/Transforms/Utils/MemorySSA.h>
 
@@ -216,11 +218,30 @@ public:
 
 class ParameterRegistry final : public llvm::ModulePass
 {
+	// Call sites are analyzed a whole function at a time, and the results are kept until the function changes version.
+	// Entries go away automatically when their call instruction is deleted.
+	struct CallSiteCache
+	{
+		unsigned version;
+		llvm::ValueMap<const llvm::Instruction*, CallInformation> callSites;
+	};
+	
+	// MemorySSA depends on the mod/ref behavior of calls, so it goes stale when a callee finishes its analysis.
+	struct MemorySSAEntry
+	{
+		unsigned version;
+		size_t estimatedSize;
+		bool stale;
+		std::unique_ptr<llvm::MemorySSA> mssa;
+	};
+	
 	std::unique_ptr<ParameterRegistryAAResults> aaResults;
 	std::unique_ptr<TargetInfo> targetInfo;
 	std::unique_ptr<ProgramMemoryAAResult> aaHack;
 	std::deque<CallingConvention*> ccChain;
-	std::unordered_map<const llvm::Function*, std::pair<unsigned, std::unique_ptr<llvm::MemorySSA>>> mssas;
+	std::unordered_map<const llvm::Function*, MemorySSAEntry> mssas;
+	std::unordered_map<const llvm::Function*, std::unique_ptr<CallSiteCache>> callSiteCaches;
+	std::unordered_map<const llvm::Function*, llvm::SmallBitVector> usedReturns;
 	bool analyzing;
 	
 	void addCallingConvention(CallingConvention* cc)
@@ -230,7 +251,15 @@ class ParameterRegistry final : public llvm::ModulePass
 	}
 	
 	CallInformation* analyzeFunction(llvm::Function& fn);
+	void analyzeCallSites(llvm::Function& caller, CallSiteCache& cache, llvm::CallSite mustInclude);
 	void setupCCChain();
+	void invalidateCallers(llvm::Function& function);
+	
+	bool isBeingAnalyzed(llvm::Function& function) const
+	{
+		auto iter = aaResults->callInformation.find(&function);
+		return iter != aaResults->callInformation.end() && iter->second.getStage() == CallInformation::Analyzing;
+	}
 	
 	std::unique_ptr<llvm::MemorySSA> createMemorySSA(llvm::Function& fn);
 	
@@ -260,6 +289,10 @@ public:
 	
 	llvm::MemorySSA* getMemorySSA(llvm::Function& function);
 	
+	// Registers that callers read after calling this function, indexed like TargetInfo::targetRegisterInfo(). Callers
+	// are looked at each time that this is asked, with MemorySSA that accounts for every callee analyzed so far.
+	const llvm::SmallBitVector* getUsedReturns(llvm::Function& function);
+	
 	virtual void getAnalysisUsage(llvm::AnalysisUsage& au) const override;
 	virtual llvm::StringRef getPassName() const override;
 	virtual bool doInitialization(llvm::Module& module) override;
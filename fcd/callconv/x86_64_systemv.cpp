@@ -29,6 +29,7 @@
 #include <llvm/IR/PatternMatch.h>
 #include <llvm/Transforms/Utils/MemorySSA.h>
 
+#include <algorithm>
 #include <unordered_map>
 
 using namespace llvm;
@@ -93,136 +94,282 @@ namespace
 		return type == Type::getVoidTy(type->getContext());
 	}
 	
-	void identifyParameterCandidates(TargetInfo& target, MemorySSA& mssa, MemoryAccess* access, CallInformation& fillOut)
+	// Adds the parameter that a store before a call site could be setting.
+	void addParameterCandidate(TargetInfo& target, StoreInst& store, CallInformation& fillOut)
 	{
-		// Look for values that are written but not used by the caller (parameters).
-		// MemorySSA chains memory uses and memory defs. Walk back from the call until the previous call, or to liveOnEntry.
-		// Registers in the parameter set that are written to before the function call are parameters for sure.
-		// Stack values that are written before a function must also be analyzed post-call to make sure that they're not
-		// read again before we can determine with certainty that they're parameters.
-		while (!mssa.isLiveOnEntryDef(access))
+		auto& pointer = *store.getPointerOperand();
+		if (const TargetRegisterInfo* info = target.registerInfo(pointer))
 		{
-			if (isa<MemoryPhi>(access))
+			// this could be a parameter register
+			if (isParameterRegister(*info))
 			{
-				// too hard, give up
-				break;
-			}
-			
-			auto useOrDef = cast<MemoryUseOrDef>(access);
-			Instruction* memoryInst = useOrDef->getMemoryInst();
-			if (isa<CallInst>(memoryInst))
-			{
-				break;
-			}
-			
-			auto def = cast<MemoryDef>(useOrDef);
-			// TODO: this check is only *almost* good. The right thing to do would be to make sure that the only
-			// accesses reaching from this def are other defs (with a call ending the chain). However, just checking
-			// that there is a single use is much faster, and probably good enough.
-			if (def->hasOneUse())
-			{
-				if (auto store = dyn_cast<StoreInst>(memoryInst))
+				auto range = fillOut.parameters();
+				auto position = lower_bound(range.begin(), range.end(), info, [](const ValueInformation& that, const TargetRegisterInfo* i)
 				{
-					auto& pointer = *store->getPointerOperand();
-					if (const TargetRegisterInfo* info = target.registerInfo(pointer))
-					{
-						// this could be a parameter register
-						if (isParameterRegister(*info))
-						{
-							auto range = fillOut.parameters();
-							auto position = lower_bound(range.begin(), range.end(), info, [](const ValueInformation& that, const TargetRegisterInfo* i)
-							{
-								if (that.type == ValueInformation::IntegerRegister)
-								{
-									auto thatName = registerPosition(*that.registerInfo, begin(parameterRegisters), end(parameterRegisters));
-									auto iName = registerPosition(*i, begin(parameterRegisters), end(parameterRegisters));
-									return thatName < iName;
-								}
-								return false;
-							});
-							
-							// TODO: add registers in sequence up to this register
-							// (for instance, if we see a use for `rdi` and `rdx`, add `rsi`)
-							
-							if (position == range.end() || position->registerInfo != info)
-							{
-								fillOut.insertParameter(position, ValueInformation::IntegerRegister, info);
-							}
-						}
-					}
-					else if (md::isProgramMemory(*store))
+					if (that.type == ValueInformation::IntegerRegister)
 					{
-						// this could be a stack register
-						Value* origin = nullptr;
-						ConstantInt* offset = nullptr;
-						if (match(&pointer, m_BitCast(m_Add(m_Value(origin), m_ConstantInt(offset)))))
-						if (const TargetRegisterInfo* rsp = target.registerInfo(*origin))
-						if (rsp->name == "rsp")
-						{
-							// stack parameter
-							auto range = fillOut.parameters();
-							auto position = lower_bound(range.begin(), range.end(), offset->getLimitedValue(), [](const ValueInformation& that, uint64_t offset)
-							{
-								return that.type < ValueInformation::Stack || that.frameBaseOffset < offset;
-							});
-							
-							// TODO: add/extend values up to this stack offset.
-							// If we see a parameter at +0 and a parameter at +16, then we have missing values.
-							
-							if (position == range.end() || position->registerInfo != info)
-							{
-								fillOut.insertParameter(position, ValueInformation::IntegerRegister, info);
-							}
-						}
+						auto thatName = registerPosition(*that.registerInfo, begin(parameterRegisters), end(parameterRegisters));
+						auto iName = registerPosition(*i, begin(parameterRegisters), end(parameterRegisters));
+						return thatName < iName;
 					}
+					return false;
+				});
+				
+				// TODO: add registers in sequence up to this register
+				// (for instance, if we see a use for `rdi` and `rdx`, add `rsi`)
+				
+				if (position == range.end() || position->registerInfo != info)
+				{
+					fillOut.insertParameter(position, ValueInformation::IntegerRegister, info);
 				}
-				else
+			}
+		}
+		else if (md::isProgramMemory(store))
+		{
+			// this could be a stack register
+			Value* origin = nullptr;
+			ConstantInt* offset = nullptr;
+			if (match(&pointer, m_BitCast(m_Add(m_Value(origin), m_ConstantInt(offset)))))
+			if (const TargetRegisterInfo* rsp = target.registerInfo(*origin))
+			if (rsp->name == "rsp")
+			{
+				// stack parameter
+				auto range = fillOut.parameters();
+				auto position = lower_bound(range.begin(), range.end(), offset->getLimitedValue(), [](const ValueInformation& that, uint64_t offset)
+				{
+					return that.type < ValueInformation::Stack || that.frameBaseOffset < offset;
+				});
+				
+				// TODO: add/extend values up to this stack offset.
+				// If we see a parameter at +0 and a parameter at +16, then we have missing values.
+				
+				if (position == range.end() || position->registerInfo != info)
 				{
-					// if it's not a call and it's not a store, then what is it?
-					assert(false);
+					fillOut.insertParameter(position, ValueInformation::IntegerRegister, info);
 				}
 			}
-			
-			access = useOrDef->getDefiningAccess();
 		}
 	}
 	
-	void identifyReturnCandidates(TargetInfo& target, MemorySSA& mssa, MemoryAccess* access, CallInformation& fillOut)
+	// Adds the return value that a load after a call site could be reading.
+	void addReturnCandidate(const TargetRegisterInfo* info, CallInformation& fillOut)
+	{
+		auto range = fillOut.returns();
+		auto position = lower_bound(range.begin(), range.end(), info, [](const ValueInformation& that, const TargetRegisterInfo* i)
+		{
+			if (that.type == ValueInformation::IntegerRegister)
+			{
+				auto thatName = registerPosition(*that.registerInfo, begin(parameterRegisters), end(parameterRegisters));
+				auto iName = registerPosition(*i, begin(parameterRegisters), end(parameterRegisters));
+				return thatName < iName;
+			}
+			return false;
+		});
+		
+		// TODO: add registers in sequence up to this register
+		// (for instance, if we see a use for `rdx`, there should be an `rax` somewhere)
+		if (position == range.end() || position->registerInfo != info)
+		{
+			fillOut.insertReturn(position, ValueInformation::IntegerRegister, info);
+		}
+	}
+	
+	// Finds parameter and return candidates for every call site of a function. MemorySSA chains are shared between call
+	// sites, so what is found walking from one access is remembered for every later walk that reaches it.
+	class CallSiteSweep
 	{
-		for (User* user : access->users())
+		struct StoreNode
 		{
-			if (auto memPhi = dyn_cast<MemoryPhi>(user))
+			StoreInst* store;
+			int next;
+		};
+		
+		TargetInfo& target;
+		MemorySSA& mssa;
+		
+		// Stores that could set parameters, linked from the closest to the furthest from a call site. The head for a
+		// memory access is the first store at or before that access; -1 ends the chain.
+		vector<StoreNode> storeNodes;
+		unordered_map<MemoryAccess*, int> storeHeads;
+		
+		// Return registers read after a call or phi. Only complete results are kept here: memory phis on a cycle are
+		// added together once the whole cycle has been walked.
+		unordered_map<MemoryAccess*, vector<const TargetRegisterInfo*>> returnReads;
+		
+		// Accesses of the current walk whose cycle is still open, with their walk order and the reads found so far.
+		struct PendingReads
+		{
+			unsigned index;
+			vector<const TargetRegisterInfo*> reads;
+		};
+		unordered_map<MemoryAccess*, PendingReads> pendingReads;
+		vector<MemoryAccess*> walkStack;
+		unsigned walkIndex = 0;
+		
+		int getStoreHead(MemoryAccess* access)
+		{
+			// Look for values that are written but not used by the caller (parameters).
+			// MemorySSA chains memory uses and memory defs. Walk back from the call until the previous call, or to
+			// liveOnEntry. Registers in the parameter set that are written to before the function call are parameters
+			// for sure. Stack values that are written before a function must also be analyzed post-call to make sure
+			// that they're not read again before we can determine with certainty that they're parameters.
+			SmallVector<MemoryDef*, 16> path;
+			int head = -1;
+			while (!mssa.isLiveOnEntryDef(access))
 			{
-				identifyReturnCandidates(target, mssa, memPhi, fillOut);
+				auto iter = storeHeads.find(access);
+				if (iter != storeHeads.end())
+				{
+					head = iter->second;
+					break;
+				}
+				
+				if (isa<MemoryPhi>(access))
+				{
+					// too hard, give up
+					break;
+				}
+				
+				auto useOrDef = cast<MemoryUseOrDef>(access);
+				if (isa<CallInst>(useOrDef->getMemoryInst()))
+				{
+					break;
+				}
+				
+				path.push_back(cast<MemoryDef>(useOrDef));
+				access = useOrDef->getDefiningAccess();
 			}
-			else if (auto memUse = dyn_cast<MemoryUse>(user))
+			
+			for (auto iter = path.rbegin(); iter != path.rend(); ++iter)
 			{
-				if (auto load = dyn_cast<LoadInst>(memUse->getMemoryInst()))
-				if (const TargetRegisterInfo* info = target.registerInfo(*load->getPointerOperand()))
-				if (isReturnRegister(*info))
+				MemoryDef* def = *iter;
+				// TODO: this check is only *almost* good. The right thing to do would be to make sure that the only
+				// accesses reaching from this def are other defs (with a call ending the chain). However, just checking
+				// that there is a single use is much faster, and probably good enough.
+				if (def->hasOneUse())
 				{
-					auto range = fillOut.returns();
-					auto position = lower_bound(range.begin(), range.end(), info, [](const ValueInformation& that, const TargetRegisterInfo* i)
+					if (auto store = dyn_cast<StoreInst>(def->getMemoryInst()))
 					{
-						if (that.type == ValueInformation::IntegerRegister)
-						{
-							auto thatName = registerPosition(*that.registerInfo, begin(parameterRegisters), end(parameterRegisters));
-							auto iName = registerPosition(*i, begin(parameterRegisters), end(parameterRegisters));
-							return thatName < iName;
-						}
-						return false;
-					});
+						storeNodes.push_back({store, head});
+						head = static_cast<int>(storeNodes.size() - 1);
+					}
+					else
+					{
+						// if it's not a call and it's not a store, then what is it?
+						assert(false);
+					}
+				}
+				storeHeads[def] = head;
+			}
+			return head;
+		}
+		
+		// Walks users with Tarjan's algorithm, so that every memory phi of a cycle gets the reads of the whole cycle.
+		// Returns the lowest walk index that access reaches on the walk stack.
+		unsigned walkReturnReads(MemoryAccess* access)
+		{
+			unsigned index = walkIndex++;
+			unsigned lowLink = index;
+			walkStack.push_back(access);
+			pendingReads[access].index = index;
+			
+			vector<const TargetRegisterInfo*> reads;
+			for (User* user : access->users())
+			{
+				if (auto memPhi = dyn_cast<MemoryPhi>(user))
+				{
+					auto pendingIter = pendingReads.find(memPhi);
+					if (pendingIter != pendingReads.end())
+					{
+						// On the stack: same cycle, its reads are added when the cycle closes.
+						lowLink = min(lowLink, pendingIter->second.index);
+						continue;
+					}
+					
+					if (returnReads.count(memPhi) == 0)
+					{
+						lowLink = min(lowLink, walkReturnReads(memPhi));
+					}
 					
-					// TODO: add registers in sequence up to this register
-					// (for instance, if we see a use for `rdx`, there should be an `rax` somewhere)
-					if (position == range.end() || position->registerInfo != info)
+					auto doneIter = returnReads.find(memPhi);
+					if (doneIter != returnReads.end())
+					{
+						reads.insert(reads.end(), doneIter->second.begin(), doneIter->second.end());
+					}
+				}
+				else if (auto memUse = dyn_cast<MemoryUse>(user))
+				{
+					if (auto load = dyn_cast<LoadInst>(memUse->getMemoryInst()))
+					if (const TargetRegisterInfo* info = target.registerInfo(*load->getPointerOperand()))
+					if (isReturnRegister(*info))
 					{
-						fillOut.insertReturn(position, ValueInformation::IntegerRegister, info);
+						reads.push_back(info);
 					}
 				}
 			}
+			
+			auto& pending = pendingReads[access].reads;
+			pending.insert(pending.end(), reads.begin(), reads.end());
+			if (lowLink == index)
+			{
+				// access is the first of its cycle to have been walked: every access above it on the stack reaches it
+				// and is reached by it, so they all read the same registers.
+				auto cycleBegin = find(walkStack.begin(), walkStack.end(), access);
+				vector<const TargetRegisterInfo*> cycleReads;
+				for (auto iter = cycleBegin; iter != walkStack.end(); ++iter)
+				{
+					auto& memberReads = pendingReads[*iter].reads;
+					cycleReads.insert(cycleReads.end(), memberReads.begin(), memberReads.end());
+				}
+				for (auto iter = cycleBegin; iter != walkStack.end(); ++iter)
+				{
+					returnReads[*iter] = cycleReads;
+					pendingReads.erase(*iter);
+				}
+				walkStack.erase(cycleBegin, walkStack.end());
+			}
+			return lowLink;
 		}
-	}
+		
+		const vector<const TargetRegisterInfo*>& getReturnReads(MemoryAccess* access)
+		{
+			auto iter = returnReads.find(access);
+			if (iter == returnReads.end())
+			{
+				walkReturnReads(access);
+				assert(walkStack.empty() && pendingReads.empty());
+				iter = returnReads.find(access);
+			}
+			return iter->second;
+		}
+		
+	public:
+		CallSiteSweep(TargetInfo& target, MemorySSA& mssa)
+		: target(target), mssa(mssa)
+		{
+		}
+		
+		bool analyze(CallSite cs, CallInformation& fillOut)
+		{
+			fillOut.clear();
+			auto thisDef = dyn_cast_or_null<MemoryDef>(mssa.getMemoryAccess(cs.getInstruction()));
+			if (thisDef == nullptr)
+			{
+				return false;
+			}
+			
+			for (int node = getStoreHead(thisDef->getDefiningAccess()); node != -1; node = storeNodes[node].next)
+			{
+				addParameterCandidate(target, *storeNodes[node].store, fillOut);
+			}
+			
+			for (const TargetRegisterInfo* info : getReturnReads(thisDef))
+			{
+				addReturnCandidate(info, fillOut);
+			}
+			return true;
+		}
+	};
 }
 
 const char* CallingConvention_x86_64_systemv::name = "x86_64/sysv";
@@ -411,15 +558,24 @@ bool CallingConvention_x86_64_systemv::analyzeFunctionType(ParameterRegistry& re
 
 bool CallingConvention_x86_64_systemv::analyzeCallSite(ParameterRegistry &registry, CallInformation &fillOut, CallSite cs)
 {
-	fillOut.clear();
-	TargetInfo& targetInfo = registry.getTargetInfo();
-	
-	Instruction& inst = *cs.getInstruction();
-	Function& caller = *inst.getParent()->getParent();
-	MemorySSA& mssa = *registry.getMemorySSA(caller);
-	MemoryDef* thisDef = cast<MemoryDef>(mssa.getMemoryAccess(&inst));
+	Function& caller = *cs.getInstruction()->getParent()->getParent();
+	CallSiteSweep sweep(registry.getTargetInfo(), *registry.getMemorySSA(caller));
+	return sweep.analyze(cs, fillOut);
+}
+
+void CallingConvention_x86_64_systemv::analyzeCallSites(ParameterRegistry& registry, ArrayRef<CallSite> callSites, ArrayRef<CallInformation*> fillOut, vector<bool>& succeeded)
+{
+	if (callSites.empty())
+	{
+		return;
+	}
 	
-	identifyParameterCandidates(targetInfo, mssa, thisDef->getDefiningAccess(), fillOut);
-	identifyReturnCandidates(targetInfo, mssa, thisDef, fillOut);
-	return true;
+	// All call sites come from the same function.
+	Function& caller = *callSites.front().getInstruction()->getParent()->getParent();
+	CallSiteSweep sweep(registry.getTargetInfo(), *registry.getMemorySSA(caller));
+	for (size_t i = 0; i < callSites.size(); ++i)
+	{
+		assert(callSites[i].getInstruction()->getParent()->getParent() == &caller);
+		succeeded[i] = sweep.analyze(callSites[i], *fillOut[i]);
+	}
 }
@@ -14,6 +14,7 @@
 #include "params_registry.h"
 
 #include <string>
+#include <vector>
 
 class CallingConvention_x86_64_systemv final : public CallingConvention
 {
@@ -27,6 +28,7 @@ public:
 	virtual bool analyzeFunction(ParameterRegistry& registry, CallInformation& fillOut, llvm::Function& func) override;
 	virtual bool analyzeFunctionType(ParameterRegistry& registry, CallInformation& fillOut, llvm::FunctionType& type) override;
 	virtual bool analyzeCallSite(ParameterRegistry& registry, CallInformation& fillOut, llvm::CallSite cs) override;
+	virtual void analyzeCallSites(ParameterRegistry& registry, llvm::ArrayRef<llvm::CallSite> callSites, llvm::ArrayRef<CallInformation*> fillOut, std::vector<bool>& succeeded) override;
 };
 
 #endif /* fcd__callconv_x86_64_systemv_h */
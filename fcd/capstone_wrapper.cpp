@@ -105,13 +105,15 @@ capstone::capstone(csh handle)
 	assert(handle != 0);
 }
 
-ErrorOr<capstone> capstone::create(cs_arch arch, unsigned int mode)
+ErrorOr<capstone> capstone::create(cs_arch arch, unsigned int mode, bool detail)
 {
 	csh handle;
 	cs_err err = cs_open(arch, static_cast<cs_mode>(mode), &handle);
 	if (err == CS_ERR_OK)
 	{
-		err = cs_option(handle, CS_OPT_DETAIL, true);
+		// Without details, Capstone only fills the instruction ID, size and bytes. This is several times faster and
+		// is all that's needed to find instruction boundaries.
+		err = cs_option(handle, CS_OPT_DETAIL, detail ? CS_OPT_ON : CS_OPT_OFF);
 		if (err == CS_ERR_OK)
 		{
 			capstone cs(handle);
@@ -73,7 +73,7 @@ class capstone
 	
 public:
 	typedef std::unique_ptr<cs_insn, cs_free_deleter> inst_ptr;
-	static llvm::ErrorOr<capstone> create(cs_arch arch, unsigned mode);
+	static llvm::ErrorOr<capstone> create(cs_arch arch, unsigned mode, bool detail = true);
 	
 	capstone(capstone&& that);
 	~capstone();
@@ -8,11 +8,11 @@
 //
 
 #include "code_generator.h"
+#include "command_line.h"
 #include "metadata.h"
 
-#include <llvm/IRReader/IRReader.h>
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Support/raw_os_ostream.h>
-#include <llvm/Support/SourceMgr.h>
 
 #include <string>
 
@@ -24,6 +24,8 @@ extern "C" const char fcd_emulator_end_x86;
 
 namespace
 {
+	cl::opt<bool> abstractCallStack("abstract-call-stack", cl::desc("Model call and return without storing or loading return addresses in lifted memory (functions that read their own return address, like PIC thunks, need the regular model)"), whitelist());
+	
 	Type* getMemoryType(LLVMContext& ctx, size_t size)
 	{
 		if (size == 1 || size == 2 || size == 4 || size == 8)
@@ -177,6 +179,11 @@ namespace
 #define X86_INSTRUCTION_DECL(e, n) funcs[e] = getFunction("x86_" #n);
 #include "x86_insts.h"
 			
+			if (abstractCallStack)
+			{
+				funcs[X86_INS_RET] = getFunction("x86_ret_abstract");
+			}
+			
 			for (Function& fn : module().getFunctionList())
 			{
 				if (fn.isDeclaration())
@@ -283,7 +290,7 @@ namespace
 		
 		virtual Function* implementationForPrologue() override
 		{
-			return getFunction("x86_function_prologue");
+			return getFunction(abstractCallStack ? "x86_function_prologue_abstract" : "x86_function_prologue");
 		}
 		
 		virtual llvm::StructType* getRegisterTy() override
@@ -317,16 +324,18 @@ bool CodeGenerator::initGenerator(const char* begin, const char* end)
 {
 	assert(end >= begin);
 	
-	SMDiagnostic errors;
+	// Function bodies are only materialized when an instruction implementation is first inlined. Most programs use a
+	// small fraction of the instructions that the emulator implements.
 	MemoryBufferRef buffer(StringRef(begin, static_cast<uintptr_t>(end - begin)), "IRImplementation");
-	if (auto module = parseIR(buffer, errors, ctx))
+	auto moduleOrError = getLazyBitcodeModule(buffer, ctx);
+	if (moduleOrError)
 	{
-		generatorModule = move(module);
+		generatorModule = move(moduleOrError.get());
 		return true;
 	}
 	else
 	{
-		errors.print(nullptr, errs());
+		logAllUnhandledErrors(moduleOrError.takeError(), errs(), "IRImplementation: ");
 		assert(false);
 		return false;
 	}
@@ -345,6 +354,15 @@ unique_ptr<CodeGenerator> CodeGenerator::x86(LLVMContext &ctx)
 void CodeGenerator::inlineFunction(Function *target, Function *toInline, ArrayRef<Value *> parameters, AddressToFunction& funcMap, AddressToBlock &blockMap, uint64_t nextAddress)
 {
 	assert(toInline->arg_size() == parameters.size());
+	if (toInline->isMaterializable())
+	{
+		if (Error error = toInline->materialize())
+		{
+			logAllUnhandledErrors(move(error), errs(), "IRImplementation: ");
+			abort();
+		}
+	}
+	
 	Module& targetModule = *target->getParent();
 	auto iter = toInline->arg_begin();
 	
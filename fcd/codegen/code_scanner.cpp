@@ -0,0 +1,208 @@
+//
+// code_scanner.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "code_scanner.h"
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstring>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	bool isLegacyPrefix(uint8_t byte)
+	{
+		switch (byte)
+		{
+			case 0x26: case 0x2e: case 0x36: case 0x3e: case 0x64: case 0x65: // segments
+			case 0x66: case 0x67: // operand and address size
+			case 0xf0: case 0xf2: case 0xf3: // lock, repne, rep
+				return true;
+			default:
+				return false;
+		}
+	}
+	
+	// Returns the index of the first opcode byte. Also flips operandSize if there is an operand size prefix.
+	size_t opcodeIndex(const cs_insn& inst, bool is64, size_t& operandSize)
+	{
+		size_t i = 0;
+		while (i < inst.size && isLegacyPrefix(inst.bytes[i]))
+		{
+			// Near branches ignore the operand size prefix in 64-bit mode.
+			if (inst.bytes[i] == 0x66 && !is64)
+			{
+				operandSize = operandSize == 2 ? 4 : 2;
+			}
+			++i;
+		}
+		if (is64 && i < inst.size && (inst.bytes[i] & 0xf0) == 0x40)
+		{
+			++i;
+		}
+		return i;
+	}
+	
+	// Relative branches always end with their displacement. Its size is whatever is left after the opcode. The
+	// instruction pointer is as wide as the operand size, so targets wrap around within it.
+	bool readRelativeTarget(const cs_insn& inst, size_t displacementIndex, size_t operandSize, uint64_t& target)
+	{
+		if (displacementIndex >= inst.size)
+		{
+			return false;
+		}
+		
+		int64_t displacement;
+		switch (inst.size - displacementIndex)
+		{
+			case 1: displacement = static_cast<int8_t>(inst.bytes[displacementIndex]); break;
+			case 2:
+			{
+				int16_t value;
+				memcpy(&value, &inst.bytes[displacementIndex], sizeof value);
+				displacement = value;
+				break;
+			}
+			case 4:
+			{
+				int32_t value;
+				memcpy(&value, &inst.bytes[displacementIndex], sizeof value);
+				displacement = value;
+				break;
+			}
+			default: return false;
+		}
+		target = inst.address + inst.size + static_cast<uint64_t>(displacement);
+		if (operandSize < 8)
+		{
+			target &= (uint64_t(1) << (operandSize * 8)) - 1;
+		}
+		return true;
+	}
+}
+
+CodeScanner::CodeScanner(capstone cs, size_t addressSize)
+: cs(new capstone(move(cs))), addressSize(addressSize)
+{
+	inst = this->cs->alloc();
+}
+
+CodeScanner::~CodeScanner()
+{
+}
+
+unique_ptr<CodeScanner> CodeScanner::x86(size_t addressSize)
+{
+	cs_mode mode;
+	switch (addressSize)
+	{
+		case 2: mode = CS_MODE_16; break;
+		case 4: mode = CS_MODE_32; break;
+		case 8: mode = CS_MODE_64; break;
+		default: llvm_unreachable("invalid pointer size");
+	}
+	
+	auto options = static_cast<unsigned>(CS_MODE_LITTLE_ENDIAN | mode);
+	if (auto csHandle = capstone::create(CS_ARCH_X86, options, false))
+	{
+		return unique_ptr<CodeScanner>(new CodeScanner(move(csHandle.get()), addressSize));
+	}
+	else
+	{
+		errs() << "couldn't open Capstone handle: " << csHandle.getError().message() << '\n';
+		return nullptr;
+	}
+}
+
+bool CodeScanner::scan(const uint8_t* begin, const uint8_t* end, uint64_t address, ScannedInstruction& into)
+{
+	if (!cs->disassemble(inst.get(), begin, end, address))
+	{
+		return false;
+	}
+	
+	const cs_insn& insn = *inst;
+	size_t operandSize = addressSize;
+	size_t opcode = opcodeIndex(insn, addressSize == 8, operandSize);
+	into.address = insn.address;
+	into.size = static_cast<uint8_t>(insn.size);
+	into.target = 0;
+	into.kind = ScannedInstruction::Fallthrough;
+	
+	switch (insn.id)
+	{
+		case X86_INS_RET:
+		case X86_INS_RETF:
+		case X86_INS_RETFQ:
+		case X86_INS_IRET:
+		case X86_INS_IRETD:
+		case X86_INS_IRETQ:
+			into.kind = ScannedInstruction::Return;
+			break;
+		
+		case X86_INS_HLT:
+		case X86_INS_UD2:
+		case X86_INS_INT3:
+			into.kind = ScannedInstruction::Stop;
+			break;
+		
+		case X86_INS_LJMP:
+			into.kind = ScannedInstruction::IndirectJump;
+			break;
+		
+		case X86_INS_LCALL:
+			into.kind = ScannedInstruction::IndirectCall;
+			break;
+		
+		case X86_INS_JMP:
+			// EB rel8 and E9 rel16/32 are direct; everything else (FF /4) is indirect.
+			if (opcode < insn.size && (insn.bytes[opcode] == 0xeb || insn.bytes[opcode] == 0xe9))
+			{
+				if (readRelativeTarget(insn, opcode + 1, operandSize, into.target))
+				{
+					into.kind = ScannedInstruction::Jump;
+					break;
+				}
+			}
+			into.kind = ScannedInstruction::IndirectJump;
+			break;
+		
+		case X86_INS_CALL:
+			if (opcode < insn.size && insn.bytes[opcode] == 0xe8)
+			{
+				if (readRelativeTarget(insn, opcode + 1, operandSize, into.target))
+				{
+					into.kind = ScannedInstruction::Call;
+					break;
+				}
+			}
+			into.kind = ScannedInstruction::IndirectCall;
+			break;
+		
+		case X86_INS_JA: case X86_INS_JAE: case X86_INS_JB: case X86_INS_JBE:
+		case X86_INS_JCXZ: case X86_INS_JECXZ: case X86_INS_JRCXZ:
+		case X86_INS_JE: case X86_INS_JNE: case X86_INS_JG: case X86_INS_JGE:
+		case X86_INS_JL: case X86_INS_JLE: case X86_INS_JNO: case X86_INS_JNP:
+		case X86_INS_JNS: case X86_INS_JO: case X86_INS_JP: case X86_INS_JS:
+		case X86_INS_LOOP: case X86_INS_LOOPE: case X86_INS_LOOPNE:
+		{
+			// Two-byte forms are 0F 8x rel16/32; one-byte forms are 7x, E0-E3 rel8.
+			size_t displacementIndex = opcode + (opcode < insn.size && insn.bytes[opcode] == 0x0f ? 2 : 1);
+			into.kind = readRelativeTarget(insn, displacementIndex, operandSize, into.target)
+				? ScannedInstruction::ConditionalJump
+				: ScannedInstruction::Stop;
+			break;
+		}
+		
+		default: break;
+	}
+	return true;
+}
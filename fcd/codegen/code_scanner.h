@@ -0,0 +1,61 @@
+//
+// code_scanner.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__codegen_code_scanner_h
+#define fcd__codegen_code_scanner_h
+
+#include "capstone_wrapper.h"
+
+#include <cstdint>
+#include <memory>
+
+// Result of a detail-free decode: just enough to find instruction and block boundaries.
+struct ScannedInstruction
+{
+	enum FlowKind : uint8_t
+	{
+		Fallthrough,
+		Jump,
+		ConditionalJump,
+		IndirectJump,
+		Call,
+		IndirectCall,
+		Return,
+		Stop,
+	};
+	
+	uint64_t address;
+	uint64_t target; // only meaningful for Jump, ConditionalJump and Call
+	uint8_t size;
+	FlowKind kind;
+	
+	bool hasTarget() const { return kind == Jump || kind == ConditionalJump || kind == Call; }
+	bool endsBlock() const { return kind != Fallthrough && kind != Call && kind != IndirectCall; }
+	bool fallsThrough() const { return kind != Jump && kind != IndirectJump && kind != Return && kind != Stop; }
+};
+
+// Fast decoding tier. The Capstone handle is opened without instruction details, so operands are never computed;
+// branch targets are recovered from the trailing relative displacement instead. Instructions that are lifted still go
+// through the full-detail handle owned by TranslationContext.
+class CodeScanner
+{
+	std::unique_ptr<capstone> cs;
+	capstone::inst_ptr inst;
+	size_t addressSize;
+	
+	CodeScanner(capstone cs, size_t addressSize);
+
+public:
+	static std::unique_ptr<CodeScanner> x86(size_t addressSize);
+	~CodeScanner();
+	
+	bool scan(const uint8_t* begin, const uint8_t* end, uint64_t address, ScannedInstruction& into);
+};
+
+#endif /* fcd__codegen_code_scanner_h */
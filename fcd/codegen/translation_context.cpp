@@ -309,6 +309,20 @@ Function* TranslationContext::createFunction(uint64_t baseAddress)
 	return fn;
 }
 
+Function* TranslationContext::createStub(uint64_t baseAddress, const std::string& importName)
+{
+	// Import stubs are never lifted: they become named prototypes, and calls to them are calls to the import.
+	Function* fn = functionMap->getCallTarget(baseAddress);
+	if (!md::isPrototype(*fn))
+	{
+		return nullptr;
+	}
+	
+	fn->setName(importName);
+	md::setIsStub(*fn);
+	return fn;
+}
+
 std::unordered_set<uint64_t> TranslationContext::getDiscoveredEntryPoints() const
 {
 	std::unordered_set<uint64_t> entryPoints;
@@ -48,6 +48,7 @@ public:
 	
 	void setFunctionName(uint64_t address, const std::string& name);
 	llvm::Function* createFunction(uint64_t base_address);
+	llvm::Function* createStub(uint64_t base_address, const std::string& importName);
 	std::unordered_set<uint64_t> getDiscoveredEntryPoints() const;
 	
 	inline llvm::Module* operator->() { return &get(); }
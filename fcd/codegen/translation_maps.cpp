@@ -30,7 +30,8 @@ size_t AddressToFunction::getDiscoveredEntryPoints(unordered_set<uint64_t> &entr
 	size_t total = 0;
 	for (const auto& pair : functions)
 	{
-		if (md::isPrototype(*pair.second))
+		// Stubs are prototypes too, but they have been resolved to an import and have nothing left to discover.
+		if (md::isPrototype(*pair.second) && !md::isStub(*pair.second))
 		{
 			entryPoints.insert(pair.first);
 			++total;
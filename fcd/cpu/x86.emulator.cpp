@@ -542,6 +542,23 @@ extern "C" void x86_function_prologue(CPTR(x86_config) config, PTR(x86_regs) reg
 	flags->df = false;
 }
 
+// Variants used with --abstract-call-stack. The return address is implied by the call site, so it never goes through
+// lifted memory: the prologue only moves the stack pointer past its slot, so that stack offsets are the same as with
+// the regular prologue, and ret moves it back without loading anything. The slot itself is never written.
+extern "C" void x86_function_prologue_abstract(CPTR(x86_config) config, PTR(x86_regs) regs, PTR(x86_flags_reg) flags)
+{
+	uint64_t sp = x86_read_reg(regs, config->sp);
+	x86_write_reg(regs, config->sp, sp - config->address_size);
+	flags->df = false;
+}
+
+X86_INSTRUCTION_DEF(ret_abstract)
+{
+	uint64_t sp = x86_read_reg(regs, config->sp);
+	x86_write_reg(regs, config->sp, sp + config->address_size);
+	x86_ret_intrin(config, regs);
+}
+
 #pragma mark - Instruction Implementation
 X86_INSTRUCTION_DEF(adc)
 {
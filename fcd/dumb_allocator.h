@@ -10,6 +10,8 @@
 #ifndef fcd__dumb_allocator_h
 #define fcd__dumb_allocator_h
 
+#include "memory_report.h"
+
 #include <llvm/ADT/StringRef.h>
 
 #include <algorithm>
@@ -35,6 +37,13 @@ class DumbAllocator
 	
 	std::list<std::unique_ptr<char[]>> pool;
 	size_t offset;
+	size_t allocatedBytes;
+	
+	inline void track(size_t bytes)
+	{
+		allocatedBytes += bytes;
+		trackMemory(MemoryDumbAllocators, static_cast<int64_t>(bytes));
+	}
 	
 	inline char* allocateSmall(size_t size, size_t alignment)
 	{
@@ -47,6 +56,7 @@ class DumbAllocator
 			char* bytes = new char[DefaultChunkSize];
 			pool.emplace_back(bytes);
 			offset = DefaultChunkSize;
+			track(DefaultChunkSize);
 			
 			endOffset = reinterpret_cast<uintptr_t>(&bytes[offset]);
 			realSize = size + ((endOffset - size) & (alignment - 1));
@@ -73,23 +83,31 @@ class DumbAllocator
 		}
 		
 		pool.emplace_front(new char[requiredSize]);
+		track(requiredSize);
 		void* bytes = pool.front().get();
 		std::align(alignment, requiredSize, bytes, size);
 		return static_cast<char*>(bytes);
 	}
-	
+
 public:
-	inline DumbAllocator() : offset(0)
+	inline DumbAllocator() : offset(0), allocatedBytes(0)
 	{
 		pool.push_back(nullptr);
 	}
 	
 	DumbAllocator(const DumbAllocator&) = delete;
 	
+	inline ~DumbAllocator()
+	{
+		trackMemory(MemoryDumbAllocators, -static_cast<int64_t>(allocatedBytes));
+	}
+	
 	inline void clear()
 	{
 		pool.clear();
 		offset = 0;
+		trackMemory(MemoryDumbAllocators, -static_cast<int64_t>(allocatedBytes));
+		allocatedBytes = 0;
 	}
 	
 	template<typename T, typename... TParams>
@@ -32,6 +32,8 @@ namespace
 		ERROR_MESSAGE(Python_InvalidPassFunction, "run function should accept a single argument"),
 		ERROR_MESSAGE(Python_PassTypeConfusion, "Python pass must declare exactly one of runOnFunction or runOnModule"),
 		ERROR_MESSAGE(Python_ExecutableScriptInitializationError, "Python script failed to initialize correctly"),
+		
+		ERROR_MESSAGE(Xref_InvalidDatabase, "cross-reference database is corrupted or was built for another executable"),
 	};
 	
 	static_assert(countof(errorMessages) == static_cast<size_t>(FcdError::MaxError), "missing error strings");
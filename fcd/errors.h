@@ -36,6 +36,8 @@ enum class FcdError
 	Python_PassTypeConfusion,
 	Python_ExecutableScriptInitializationError,
 	
+	Xref_InvalidDatabase,
+	
 	MaxError,
 };
 
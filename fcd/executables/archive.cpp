@@ -0,0 +1,119 @@
+//
+// archive.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "archive.h"
+#include "executable_errors.h"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <string.h>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	const char archiveMagic[] = "!<arch>\n";
+	const size_t archiveMagicSize = sizeof archiveMagic - 1;
+	
+	struct ArchiveHeader
+	{
+		char name[16];
+		char date[12];
+		char uid[6];
+		char gid[6];
+		char mode[8];
+		char size[10];
+		char terminator[2];
+	};
+	
+	static_assert(sizeof (ArchiveHeader) == 60, "unexpected archive header size");
+	
+	template<size_t N>
+	StringRef getField(const char (&field)[N])
+	{
+		return StringRef(field, N).rtrim(' ');
+	}
+	
+	bool isSymbolTable(StringRef name)
+	{
+		return name == "/" || name == "/SYM64/" || name == "__.SYMDEF" || name == "__.SYMDEF SORTED";
+	}
+}
+
+bool isArchive(const uint8_t* begin, const uint8_t* end)
+{
+	return end - begin >= static_cast<ptrdiff_t>(archiveMagicSize) && memcmp(begin, archiveMagic, archiveMagicSize) == 0;
+}
+
+ErrorOr<vector<ArchiveMember>> parseArchive(const uint8_t* begin, const uint8_t* end)
+{
+	if (!isArchive(begin, end))
+	{
+		return make_error_code(ExecutableParsingError::Archive_Corrupted);
+	}
+	
+	vector<ArchiveMember> members;
+	StringRef longNames;
+	const uint8_t* cursor = begin + archiveMagicSize;
+	while (end - cursor >= static_cast<ptrdiff_t>(sizeof (ArchiveHeader)))
+	{
+		auto header = reinterpret_cast<const ArchiveHeader*>(cursor);
+		const uint8_t* data = cursor + sizeof (ArchiveHeader);
+		uint64_t size;
+		if (memcmp(header->terminator, "`\n", sizeof header->terminator) != 0 || getField(header->size).getAsInteger(10, size) || size > static_cast<uint64_t>(end - data))
+		{
+			return make_error_code(ExecutableParsingError::Archive_Corrupted);
+		}
+		
+		// Members start on even offsets.
+		const uint8_t* dataEnd = data + size;
+		cursor = dataEnd + (size % 2 != 0 && dataEnd != end ? 1 : 0);
+		
+		StringRef name = getField(header->name);
+		if (name == "//")
+		{
+			// GNU table of names that don't fit in the header. Entries end with "/\n".
+			longNames = StringRef(reinterpret_cast<const char*>(data), size);
+			continue;
+		}
+		
+		string memberName;
+		if (name.startswith("#1/"))
+		{
+			// BSD names follow the header, and count towards the member size.
+			uint64_t nameSize;
+			if (name.substr(3).getAsInteger(10, nameSize) || nameSize > size)
+			{
+				return make_error_code(ExecutableParsingError::Archive_Corrupted);
+			}
+			memberName = StringRef(reinterpret_cast<const char*>(data), nameSize).split('\0').first;
+			data += nameSize;
+		}
+		else if (name.size() > 1 && name[0] == '/' && !isSymbolTable(name))
+		{
+			uint64_t offset;
+			if (name.substr(1).getAsInteger(10, offset) || offset >= longNames.size())
+			{
+				return make_error_code(ExecutableParsingError::Archive_Corrupted);
+			}
+			memberName = longNames.substr(offset).split('\n').first.rtrim('/');
+		}
+		else
+		{
+			memberName = isSymbolTable(name) ? name : name.rtrim('/');
+		}
+		
+		if (!isSymbolTable(memberName))
+		{
+			members.push_back({ move(memberName), data, dataEnd });
+		}
+	}
+	return move(members);
+}
@@ -0,0 +1,33 @@
+//
+// archive.h
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__executables_archive_h
+#define fcd__executables_archive_h
+
+#include <llvm/Support/ErrorOr.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A file stored in an ar archive. Member data points into the archive.
+struct ArchiveMember
+{
+	std::string name;
+	const uint8_t* begin;
+	const uint8_t* end;
+};
+
+// Static libraries are ar archives of object files. Both the GNU/System V and the BSD variants are understood.
+bool isArchive(const uint8_t* begin, const uint8_t* end);
+
+// Lists the members of an archive, in order, without its symbol and long name tables.
+llvm::ErrorOr<std::vector<ArchiveMember>> parseArchive(const uint8_t* begin, const uint8_t* end);
+
+#endif /* fcd__executables_archive_h */
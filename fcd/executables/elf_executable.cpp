@@ -10,12 +10,15 @@
 #include "elf_executable.h"
 #include "executable_errors.h"
 
+#include <llvm/Support/MathExtras.h>
 #include <llvm/Support/PrettyStackTrace.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include <deque>
+#include <map>
 #include <unordered_map>
 
 using namespace llvm;
@@ -109,19 +112,45 @@ namespace
 		ELFDATA2MSB = 2,
 	};
 
+	enum ElfType
+	{
+		ET_REL = 1,
+	};
+	
 	enum ElfPhdrType
 	{
 		PT_LOAD = 1,
 		PT_DYNAMIC = 2,
 	};
 
+	enum ElfPhdrFlags
+	{
+		PF_X = 1,
+	};
+
 	enum ElfShdrType
 	{
 		SHT_PROGBITS = 1,
 		SHT_SYMTAB = 2,
 		SHT_STRTAB = 3,
+		SHT_RELA = 4,
+		SHT_NOBITS = 8,
+		SHT_REL = 9,
 		SHT_DYNSYM = 11,
 	};
+	
+	enum ElfShdrFlags
+	{
+		SHF_ALLOC = 2,
+		SHF_EXECINSTR = 4,
+	};
+	
+	enum ElfSectionIndex
+	{
+		SHN_UNDEF = 0,
+		SHN_LORESERVE = 0xff00,
+		SHN_COMMON = 0xfff2,
+	};
 
 	enum ElfSymbolType
 	{
@@ -131,6 +160,7 @@ namespace
 	enum ElfDynamicTag
 	{
 		DT_PLTRELSZ = 2,
+		DT_PLTGOT = 3,
 		DT_STRTAB = 5,
 		DT_SYMTAB = 6,
 		DT_RELA = 7,
@@ -149,6 +179,19 @@ namespace
 		DT_PREINIT_ARRAYSZ = 33,
 		DT_MAX = 34,
 	};
+	
+	enum ElfX86_64RelocationType
+	{
+		R_X86_64_64 = 1,
+		R_X86_64_PC32 = 2,
+		R_X86_64_PLT32 = 4,
+		R_X86_64_GOTPCREL = 9,
+		R_X86_64_32 = 10,
+		R_X86_64_32S = 11,
+		R_X86_64_PC64 = 24,
+		R_X86_64_GOTPCRELX = 41,
+		R_X86_64_REX_GOTPCRELX = 42,
+	};
 
 	enum ElfMachine
 	{
@@ -357,8 +400,45 @@ namespace
 		uint64_t vbegin;
 		uint64_t vend;
 		const uint8_t* fbegin;
+		uint64_t fsize;
+		bool executable;
 	};
 
+	enum RelocationKind
+	{
+		RelocationUnsupported,
+		RelocationAbsolute,
+		RelocationPCRelative,
+		RelocationGOTPCRelative,
+	};
+	
+	struct RelocationInfo
+	{
+		RelocationKind kind;
+		unsigned size;
+	};
+	
+	RelocationInfo getRelocationInfo(unsigned machine, uint32_t type)
+	{
+		if (machine == EM_X86_64)
+		{
+			switch (type)
+			{
+				case R_X86_64_64: return { RelocationAbsolute, 8 };
+				case R_X86_64_32:
+				case R_X86_64_32S: return { RelocationAbsolute, 4 };
+				case R_X86_64_PC32:
+				case R_X86_64_PLT32: return { RelocationPCRelative, 4 };
+				case R_X86_64_PC64: return { RelocationPCRelative, 8 };
+				case R_X86_64_GOTPCREL:
+				case R_X86_64_GOTPCRELX:
+				case R_X86_64_REX_GOTPCRELX: return { RelocationGOTPCRelative, 4 };
+				default: break;
+			}
+		}
+		return { RelocationUnsupported, 0 };
+	}
+	
 	template<typename Types>
 	class ElfExecutable final : public Executable
 	{
@@ -405,7 +485,45 @@ namespace
 		}
 		
 		vector<Segment> segments;
-		unordered_map<uint64_t, string> stubTargets;
+		vector<const Elf_Shdr*> sections;
+		vector<const Elf_Shdr*> symtabs;
+		array<const Elf_Dynamic*, DT_MAX> dynEnt;
+		bool hasEntryPoint;
+		mutable bool stubTargetsLoaded;
+		mutable unordered_map<uint64_t, string> stubTargets;
+		
+		// Address ranges of PLT sections, or of the stubs made for the imports of a relocatable object.
+		mutable bool stubSectionsLoaded;
+		mutable vector<pair<uint64_t, uint64_t>> stubSections;
+		
+		// Index that doFindSymbolName builds on its first lookup. Names of function symbols are only read from the
+		// string table when they are asked for.
+		mutable bool symbolIndexLoaded;
+		mutable unordered_map<uint64_t, pair<const Elf_Sym*, const uint8_t*>> functionSymbolsByAddress;
+		mutable unordered_map<uint64_t, string> dynamicEntryNames;
+		
+		// Relocatable objects have no segments. Their allocated sections are laid out and relocated in a copy of the
+		// file, and their symbol values are offsets into these sections.
+		vector<uint8_t> relocatedImage;
+		vector<uint64_t> sectionAddresses;
+		
+		// Symbol tables and relocations are only read when they are first needed, because they can be much larger than
+		// the code that a single-function job looks at.
+		template<typename Callback>
+		void forEachDynamicEntryPoint(Callback&& callback) const;
+		template<typename Callback>
+		void forEachFunctionSymbol(Callback&& callback) const;
+		const uint8_t* getStringTable(const Elf_Shdr& symtab) const;
+		string getSymbolName(const Elf_Sym& symbol, const uint8_t* strtab) const;
+		uint64_t getSymbolAddress(const Elf_Sym& symbol) const;
+		void loadStubTargets() const;
+		void loadStubSections() const;
+		void loadSymbolIndex() const;
+		
+		template<typename Callback>
+		static void forEachRelocation(const uint8_t* begin, const uint8_t* end, const vector<const Elf_Shdr*>& sections, Callback&& callback);
+		static const Elf_Sym* getSymbolEntry(const uint8_t* begin, const uint8_t* end, const Elf_Shdr& symtab, size_t index);
+		static ErrorOr<unique_ptr<ElfExecutable<Types>>> parseRelocatable(const uint8_t* begin, const uint8_t* end);
 		
 	protected:
 		virtual string doGetTargetTriple() const override
@@ -504,11 +622,19 @@ namespace
 		static ErrorOr<unique_ptr<ElfExecutable<Types>>> parse(const uint8_t* begin, const uint8_t* end);
 		
 		ElfExecutable(const uint8_t* begin, const uint8_t* end)
-		: Executable(begin, end)
+		: Executable(begin, end), hasEntryPoint(false), stubTargetsLoaded(false), stubSectionsLoaded(false), symbolIndexLoaded(false)
 		{
+			dynEnt.fill(nullptr);
 			assert(end - begin >= sizeof(Elf_Ehdr));
 		}
 		
+		// Moving a vector keeps its buffer, so the executable can own the image that it points to.
+		explicit ElfExecutable(vector<uint8_t> image)
+		: ElfExecutable(image.data(), image.data() + image.size())
+		{
+			relocatedImage = move(image);
+		}
+		
 		virtual string getExecutableType() const override
 		{
 			union {
@@ -533,8 +659,83 @@ namespace
 			return nullptr;
 		}
 		
+		virtual vector<MappedRange> getMappedRanges() const override
+		{
+			vector<MappedRange> result;
+			for (const Segment& seg : segments)
+			{
+				result.push_back({ seg.vbegin, seg.vbegin + min(seg.fsize, seg.vend - seg.vbegin), seg.executable });
+			}
+			return result;
+		}
+		
+		virtual vector<MappedRange> getCodeSections() const override
+		{
+			vector<MappedRange> result;
+			if (!sectionAddresses.empty())
+			{
+				// Each allocated section of a relocatable object is its own segment.
+				for (const Segment& seg : segments)
+				{
+					if (seg.executable)
+					{
+						result.push_back({ seg.vbegin, seg.vend, true });
+					}
+				}
+				return result;
+			}
+			
+			// Linkers merge headers and read-only data into executable segments, so only trust sections here. Without
+			// section headers, nothing is known to be code.
+			for (const Elf_Shdr* sh : sections)
+			{
+				unsigned long long endAddress;
+				bool isCode = (sh->flags & SHF_ALLOC) != 0 && (sh->flags & SHF_EXECINSTR) != 0 && sh->type != SHT_NOBITS;
+				if (isCode && sh->size != 0 && !__builtin_uaddll_overflow(sh->addr, sh->size, &endAddress))
+				{
+					result.push_back({ sh->addr, endAddress, true });
+				}
+			}
+			return result;
+		}
+		
+		virtual bool isInStubSection(uint64_t address) const override
+		{
+			if (!stubSectionsLoaded)
+			{
+				loadStubSections();
+			}
+			
+			for (const auto& range : stubSections)
+			{
+				if (address >= range.first && address < range.second)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		virtual bool getGlobalOffsetTable(uint64_t& address) const override
+		{
+			if (dynEnt[DT_PLTGOT] == nullptr)
+			{
+				return false;
+			}
+			address = dynEnt[DT_PLTGOT]->address;
+			return true;
+		}
+		
+		virtual void doLoadSymbols() override;
+		virtual bool doFindSymbolName(uint64_t address, string& name) const override;
+		
 		virtual StubTargetQueryResult doGetStubTarget(uint64_t address, string& libraryName, string& into) const override
 		{
+			if (!stubTargetsLoaded)
+			{
+				loadStubTargets();
+			}
+			
 			auto iter = stubTargets.find(address);
 			if (iter != stubTargets.end())
 			{
@@ -683,83 +884,9 @@ namespace
 	};
 
 	template<typename Types>
-	ErrorOr<unique_ptr<ElfExecutable<Types>>> ElfExecutable<Types>::parse(const uint8_t* begin, const uint8_t* end)
+	template<typename Callback>
+	void ElfExecutable<Types>::forEachDynamicEntryPoint(Callback&& callback) const
 	{
-		assert(end >= begin);
-		
-		using namespace std;
-		auto executable = std::make_unique<ElfExecutable<Types>>(begin, end);
-		
-		deque<const Elf_Phdr*> dynamics;
-		deque<const Elf_Shdr*> sections;
-		deque<const Elf_Shdr*> symtabs;
-		
-		// Walk header, identify PT_LOAD and PT_DYNAMIC segments, sections, and symbol tables.
-		bool loadAtZero = false;
-		if (auto eh = bounded_cast<Elf_Ehdr>(begin, end, 0))
-		{
-			if (eh->phentsize == sizeof (Elf_Phdr))
-			{
-				for (const auto& ph : bounded_cast<Elf_Phdr>(begin, end, eh->phoff, eh->phnum))
-				{
-					if (ph.type == PT_LOAD)
-					{
-						unsigned long long endAddress;
-						if (!__builtin_uaddll_overflow(ph.vaddr, ph.memsz, &endAddress))
-						{
-							auto fileLoc = bounded_cast<uint8_t>(begin, end, ph.offset, ph.filesz);
-							if (fileLoc.begin() != nullptr)
-							{
-								Segment seg = { .vbegin = ph.vaddr, .vend = endAddress };
-								seg.vbegin = ph.vaddr;
-								seg.vend = endAddress;
-								seg.fbegin = fileLoc.begin();
-								executable->segments.push_back(seg);
-								loadAtZero |= seg.vbegin == 0;
-							}
-						}
-					}
-					else if (ph.type == PT_DYNAMIC)
-					{
-						dynamics.push_back(&ph);
-					}
-				}
-			}
-			
-			if (eh->shentsize == sizeof (Elf_Shdr))
-			{
-				for (const auto& sh : bounded_cast<Elf_Shdr>(begin, end, eh->shoff, eh->shnum))
-				{
-					sections.push_back(&sh);
-					if (sh.type == SHT_SYMTAB)
-					{
-						symtabs.push_back(&sh);
-					}
-				}
-			}
-			
-			if (eh->entry != 0 || loadAtZero)
-			{
-				executable->getSymbol(eh->entry).virtualAddress = eh->entry;
-			}
-		}
-		
-		// Walk dynamic segments.
-		array<const Elf_Dynamic*, DT_MAX> dynEnt;
-		dynEnt.fill(nullptr);
-		
-		for (const auto* dynHeader : dynamics)
-		{
-			size_t numEnts = dynHeader->filesz / sizeof (Elf_Dynamic);
-			for (const auto& dyn : bounded_cast<Elf_Dynamic>(begin, end, dynHeader->offset, numEnts))
-			{
-				if (dyn.tag < DT_MAX)
-				{
-					dynEnt[dyn.tag] = &dyn;
-				}
-			}
-		}
-		
 		EntryPointArrayInfo arrayInfo[] = {
 			{DT_PREINIT_ARRAY, DT_PREINIT_ARRAYSZ, "preinit_"},
 			{DT_INIT_ARRAY, DT_INIT_ARRAYSZ, "init_"},
@@ -773,11 +900,11 @@ namespace
 			{
 				size_t counter = 0;
 				const string& prefix = arrayData.name;
-				for (addr entry : bounded_cast<addr>(begin, end, arrayLocation->address, arraySize->address))
+				for (addr entry : bounded_cast<addr>(begin(), end(), arrayLocation->address, arraySize->address))
 				{
-					auto& symInfo = executable->getSymbol(entry);
-					symInfo.virtualAddress = entry;
-					raw_string_ostream(symInfo.name) << prefix << counter;
+					string name;
+					raw_string_ostream(name) << prefix << counter;
+					callback(entry, move(name));
 					counter++;
 				}
 			}
@@ -792,19 +919,170 @@ namespace
 			auto location = dynEnt[pair.first];
 			if (location != nullptr)
 			{
-				auto& symInfo = executable->getSymbol(location->address);
-				symInfo.virtualAddress = location->address;
-				symInfo.name = pair.second;
+				callback(location->address, pair.second);
+			}
+		}
+	}
+	
+	template<typename Types>
+	template<typename Callback>
+	void ElfExecutable<Types>::forEachFunctionSymbol(Callback&& callback) const
+	{
+		for (const auto* sth : symtabs)
+		{
+			if (sth->entsize != 0 && sth->entsize != sizeof (Elf_Sym))
+			{
+				continue;
+			}
+			
+			const uint8_t* strtab = getStringTable(*sth);
+			size_t numEnts = sth->size / sizeof (Elf_Sym);
+			for (const auto& sym : bounded_cast<Elf_Sym>(begin(), end(), sth->offset, numEnts))
+			{
+				// Exclude non-function symbols.
+				if ((sym.info & 0xf) == STT_FUNC)
+				{
+					callback(sym, strtab);
+				}
+			}
+		}
+	}
+	
+	template<typename Types>
+	const uint8_t* ElfExecutable<Types>::getStringTable(const Elf_Shdr& symtab) const
+	{
+		if (symtab.link != 0 && symtab.link < sections.size())
+		{
+			auto strtabHeader = sections[symtab.link];
+			if (strtabHeader->type == SHT_STRTAB)
+			{
+				return bounded_cast<uint8_t>(begin(), end(), strtabHeader->offset);
+			}
+		}
+		return nullptr;
+	}
+	
+	template<typename Types>
+	string ElfExecutable<Types>::getSymbolName(const Elf_Sym& symbol, const uint8_t* strtab) const
+	{
+		const char* nameBegin = nullptr;
+		if (symbol.name != 0)
+		{
+			nameBegin = bounded_cast<char>(strtab, end(), symbol.name);
+		}
+		
+		const char* nameEnd = nameBegin;
+		if (nameBegin != nullptr)
+		{
+			auto maxSize = static_cast<size_t>(reinterpret_cast<const char*>(end()) - nameBegin);
+			nameEnd = nameBegin + strnlen(nameBegin, maxSize);
+		}
+		return string(nameBegin, nameEnd);
+	}
+	
+	template<typename Types>
+	uint64_t ElfExecutable<Types>::getSymbolAddress(const Elf_Sym& symbol) const
+	{
+		if (sectionAddresses.empty() || symbol.shndx >= SHN_LORESERVE)
+		{
+			return symbol.value;
+		}
+		
+		// Symbols of relocatable objects are relative to their section. Symbols of sections that aren't loaded get no
+		// address.
+		if (symbol.shndx < sectionAddresses.size() && sectionAddresses[symbol.shndx] != 0)
+		{
+			return sectionAddresses[symbol.shndx] + symbol.value;
+		}
+		return 0;
+	}
+	
+	template<typename Types>
+	void ElfExecutable<Types>::doLoadSymbols()
+	{
+		if (hasEntryPoint)
+		{
+			getSymbol(header()->entry).virtualAddress = header()->entry;
+		}
+		
+		// Symbols that don't have a file offset are left out.
+		forEachDynamicEntryPoint([&](uint64_t address, string name)
+		{
+			if (map(address) != nullptr)
+			{
+				auto& symInfo = getSymbol(address);
+				symInfo.virtualAddress = address;
+				symInfo.name = move(name);
+			}
+		});
+		
+		// This can override dynamic segment info, and it's fine.
+		forEachFunctionSymbol([&](const Elf_Sym& sym, const uint8_t* strtab)
+		{
+			uint64_t address = getSymbolAddress(sym);
+			if (map(address) != nullptr)
+			{
+				auto& symInfo = getSymbol(address);
+				symInfo.virtualAddress = address;
+				symInfo.name = getSymbolName(sym, strtab);
 			}
+		});
+	}
+	
+	template<typename Types>
+	void ElfExecutable<Types>::loadSymbolIndex() const
+	{
+		symbolIndexLoaded = true;
+		forEachDynamicEntryPoint([&](uint64_t entry, string entryName)
+		{
+			dynamicEntryNames[entry] = move(entryName);
+		});
+		
+		// Later symbols win, like in doLoadSymbols.
+		forEachFunctionSymbol([&](const Elf_Sym& sym, const uint8_t* strtab)
+		{
+			functionSymbolsByAddress[getSymbolAddress(sym)] = { &sym, strtab };
+		});
+	}
+	
+	template<typename Types>
+	bool ElfExecutable<Types>::doFindSymbolName(uint64_t address, string& name) const
+	{
+		if (!symbolIndexLoaded)
+		{
+			loadSymbolIndex();
+		}
+		
+		// Same precedence as doLoadSymbols: function symbols override dynamic entries.
+		auto symbolIter = functionSymbolsByAddress.find(address);
+		if (symbolIter != functionSymbolsByAddress.end())
+		{
+			name = getSymbolName(*symbolIter->second.first, symbolIter->second.second);
+			return true;
+		}
+		
+		auto entryIter = dynamicEntryNames.find(address);
+		if (entryIter != dynamicEntryNames.end())
+		{
+			name = entryIter->second;
+			return true;
 		}
+		return false;
+	}
+	
+	template<typename Types>
+	void ElfExecutable<Types>::loadStubTargets() const
+	{
+		stubTargetsLoaded = true;
+		const uint8_t* end = this->end();
 		
 		if (dynEnt[DT_STRTAB] && dynEnt[DT_SYMTAB])
-		if (const uint8_t* symtab = executable->map(dynEnt[DT_SYMTAB]->address))
-		if (const uint8_t* strtab = executable->map(dynEnt[DT_STRTAB]->address))
+		if (const uint8_t* symtab = map(dynEnt[DT_SYMTAB]->address))
+		if (const uint8_t* strtab = map(dynEnt[DT_STRTAB]->address))
 		{
 			// Check PLT relocations to put a name on relocated entries.
 			if (dynEnt[DT_JMPREL] && dynEnt[DT_PLTRELSZ] && dynEnt[DT_PLTREL])
-			if (const uint8_t* relocBase = executable->map(dynEnt[DT_JMPREL]->address))
+			if (const uint8_t* relocBase = map(dynEnt[DT_JMPREL]->address))
 			{
 				ElfDynamicTag relType = static_cast<ElfDynamicTag>(dynEnt[DT_PLTREL]->value);
 				if (relType == DT_REL || relType == DT_RELA)
@@ -820,7 +1098,7 @@ namespace
 						{
 							auto maxSize = static_cast<size_t>(end - reinterpret_cast<const uint8_t*>(nameBegin));
 							const char* nameEnd = nameBegin + strnlen(nameBegin, maxSize);
-							executable->stubTargets[reloc->offset] = string(nameBegin, nameEnd);
+							stubTargets[reloc->offset] = string(nameBegin, nameEnd);
 						}
 					}
 				}
@@ -829,7 +1107,7 @@ namespace
 			// Also check RELA table. This is important especially on position-independent executables, which don't have
 			// a PLT.
 			if (dynEnt[DT_RELA] && dynEnt[DT_RELASZ] && dynEnt[DT_RELAENT] && dynEnt[DT_RELAENT]->value == sizeof (Elf_Rela))
-			if (const uint8_t* relocBase = executable->map(dynEnt[DT_RELA]->address))
+			if (const uint8_t* relocBase = map(dynEnt[DT_RELA]->address))
 			{
 				for (uint64_t relocIter = 0; relocIter < dynEnt[DT_RELASZ]->value; relocIter += sizeof (Elf_Rela))
 				{
@@ -839,65 +1117,367 @@ namespace
 					{
 						auto maxSize = static_cast<size_t>(end - reinterpret_cast<const uint8_t*>(nameBegin));
 						const char* nameEnd = nameBegin + strnlen(nameBegin, maxSize);
-						executable->stubTargets[reloc->offset] = string(nameBegin, nameEnd);
+						stubTargets[reloc->offset] = string(nameBegin, nameEnd);
 					}
 				}
 			}
 		}
+	}
+	
+	template<typename Types>
+	void ElfExecutable<Types>::loadStubSections() const
+	{
+		stubSectionsLoaded = true;
+		if (header()->shstrndx >= sections.size())
+		{
+			return;
+		}
 		
-		// Walk symbol tables and identify function symbols.
-		// This can override dynamic segment info, and it's fine.
-		for (const auto* sth : symtabs)
+		// Linkers name trampoline sections .plt, .plt.sec, .plt.got or .iplt.
+		const Elf_Shdr& sectionNames = *sections[header()->shstrndx];
+		for (const Elf_Shdr* sh : sections)
 		{
-			if (sth->entsize != 0 && sth->entsize != sizeof (Elf_Sym))
+			unsigned long long nameOffset;
+			unsigned long long endAddress;
+			if ((sh->flags & SHF_EXECINSTR) == 0 || __builtin_uaddll_overflow(sectionNames.offset, sh->name, &nameOffset) || __builtin_uaddll_overflow(sh->addr, sh->size, &endAddress))
 			{
 				continue;
 			}
 			
-			const uint8_t* strtab = nullptr;
-			if (sth->link != 0 && sth->link < sections.size())
+			if (const char* nameBegin = bounded_cast<char>(begin(), end(), nameOffset))
 			{
-				auto strtabHeader = sections[sth->link];
-				if (strtabHeader->type == SHT_STRTAB)
+				auto maxSize = static_cast<size_t>(end() - reinterpret_cast<const uint8_t*>(nameBegin));
+				StringRef name(nameBegin, strnlen(nameBegin, maxSize));
+				if (name == ".plt" || name.startswith(".plt.") || name == ".iplt")
 				{
-					strtab = bounded_cast<uint8_t>(begin, end, strtabHeader->offset);
+					stubSections.push_back({sh->addr, endAddress});
 				}
 			}
+		}
+	}
+	
+	template<typename Types>
+	template<typename Callback>
+	void ElfExecutable<Types>::forEachRelocation(const uint8_t* begin, const uint8_t* end, const vector<const Elf_Shdr*>& sections, Callback&& callback)
+	{
+		for (const Elf_Shdr* sh : sections)
+		{
+			if ((sh->type != SHT_REL && sh->type != SHT_RELA) || sh->info >= sections.size() || sh->link >= sections.size())
+			{
+				continue;
+			}
 			
-			size_t numEnts = sth->size / sizeof (Elf_Sym);
-			for (const auto& sym : bounded_cast<Elf_Sym>(begin, end, sth->offset, numEnts))
+			// Relocations of sections that aren't loaded, like debug info, are not needed.
+			if ((sections[sh->info]->flags & SHF_ALLOC) == 0)
 			{
-				// Exclude non-function symbols.
-				if ((sym.info & 0xf) != STT_FUNC)
+				continue;
+			}
+			
+			// As with PLT relocations, Elf_Rela entries start with an Elf_Rel.
+			bool hasAddend = sh->type == SHT_RELA;
+			uint64_t entrySize = hasAddend ? sizeof (Elf_Rela) : sizeof (Elf_Rel);
+			for (uint64_t offset = 0; offset + entrySize <= sh->size; offset += entrySize)
+			{
+				const Elf_Rel* reloc = bounded_cast<Elf_Rel>(begin, end, sh->offset + offset);
+				const Elf_Rela* rela = hasAddend ? bounded_cast<Elf_Rela>(begin, end, sh->offset + offset) : nullptr;
+				if (reloc == nullptr || (hasAddend && rela == nullptr))
+				{
+					break;
+				}
+				callback(sh->info, sh->link, *reloc, rela == nullptr ? 0 : static_cast<int64_t>(rela->addend), hasAddend);
+			}
+		}
+	}
+	
+	template<typename Types>
+	const typename ElfExecutable<Types>::Elf_Sym* ElfExecutable<Types>::getSymbolEntry(const uint8_t* begin, const uint8_t* end, const Elf_Shdr& symtab, size_t index)
+	{
+		if (index == 0 || symtab.type != SHT_SYMTAB || index >= symtab.size / sizeof (Elf_Sym))
+		{
+			return nullptr;
+		}
+		return bounded_cast<Elf_Sym>(begin, end, symtab.offset + index * sizeof (Elf_Sym));
+	}
+	
+	template<typename Types>
+	ErrorOr<unique_ptr<ElfExecutable<Types>>> ElfExecutable<Types>::parseRelocatable(const uint8_t* begin, const uint8_t* end)
+	{
+		auto eh = bounded_cast<Elf_Ehdr>(begin, end, 0);
+		auto sectionHeaders = bounded_cast<Elf_Shdr>(begin, end, eh->shoff, eh->shnum);
+		if (eh->shentsize != sizeof (Elf_Shdr) || sectionHeaders.begin() == nullptr)
+		{
+			return make_error_code(ExecutableParsingError::Elf_Corrupted);
+		}
+		
+		vector<const Elf_Shdr*> fileSections;
+		for (const auto& sh : sectionHeaders)
+		{
+			fileSections.push_back(&sh);
+		}
+		
+		// Sections with contents are laid out after a copy of the file, so that addresses are offsets into the image
+		// and everything that map returns is between begin() and end().
+		uint64_t fileSize = static_cast<uint64_t>(end - begin);
+		unsigned long long imageSize = alignTo(fileSize, 16);
+		vector<uint64_t> sectionLayout(fileSections.size(), 0);
+		for (size_t i = 0; i < fileSections.size(); ++i)
+		{
+			const Elf_Shdr& sh = *fileSections[i];
+			if ((sh.flags & SHF_ALLOC) == 0 || sh.size == 0 || sh.type == SHT_NOBITS)
+			{
+				continue;
+			}
+			
+			if (bounded_cast<uint8_t>(begin, end, sh.offset, sh.size).begin() == nullptr)
+			{
+				return make_error_code(ExecutableParsingError::Elf_Corrupted);
+			}
+			imageSize = alignTo(imageSize, max<uint64_t>(sh.addralign, 1));
+			sectionLayout[i] = imageSize;
+			imageSize += sh.size;
+		}
+		
+		// Undefined symbols get a jump stub through a pointer slot, like PLT entries, so that they are declared as
+		// imports. Defined symbols that are accessed through the GOT get a slot that holds their address.
+		map<pair<size_t, size_t>, size_t> imports;
+		map<pair<size_t, size_t>, size_t> globalOffsets;
+		forEachRelocation(begin, end, fileSections, [&](size_t, size_t symtab, const Elf_Rel& reloc, int64_t, bool)
+		{
+			RelocationInfo info = getRelocationInfo(eh->machine, reloc.type());
+			const Elf_Sym* symbol = getSymbolEntry(begin, end, *fileSections[symtab], reloc.symbol());
+			if (info.kind == RelocationUnsupported || symbol == nullptr)
+			{
+				return;
+			}
+			
+			auto key = make_pair(symtab, static_cast<size_t>(reloc.symbol()));
+			if (symbol->shndx == SHN_UNDEF || symbol->shndx == SHN_COMMON)
+			{
+				imports.insert({key, imports.size()});
+			}
+			else if (info.kind == RelocationGOTPCRelative)
+			{
+				globalOffsets.insert({key, globalOffsets.size()});
+			}
+		});
+		
+		const uint64_t stubSize = 8;
+		uint64_t stubsAddress = alignTo(imageSize, 16);
+		uint64_t slotsAddress = stubsAddress + imports.size() * stubSize;
+		uint64_t slotCount = imports.size() + globalOffsets.size();
+		imageSize = slotsAddress + slotCount * sizeof (addr);
+		
+		// Sections without contents, like .bss, get addresses past the image, but no memory.
+		unsigned long long uninitializedAddress = alignTo(imageSize, 16);
+		for (size_t i = 0; i < fileSections.size(); ++i)
+		{
+			const Elf_Shdr& sh = *fileSections[i];
+			if ((sh.flags & SHF_ALLOC) != 0 && sh.size != 0 && sh.type == SHT_NOBITS)
+			{
+				uninitializedAddress = alignTo(uninitializedAddress, max<uint64_t>(sh.addralign, 1));
+				sectionLayout[i] = uninitializedAddress;
+				if (__builtin_uaddll_overflow(uninitializedAddress, sh.size, &uninitializedAddress))
+				{
+					return make_error_code(ExecutableParsingError::Elf_Corrupted);
+				}
+			}
+		}
+		
+		vector<uint8_t> image(imageSize);
+		uint8_t* data = image.data();
+		memcpy(data, begin, fileSize);
+		auto executable = std::make_unique<ElfExecutable<Types>>(move(image));
+		for (size_t i = 0; i < fileSections.size(); ++i)
+		{
+			const Elf_Shdr& sh = *fileSections[i];
+			auto sectionHeader = reinterpret_cast<const Elf_Shdr*>(data + (reinterpret_cast<const uint8_t*>(&sh) - begin));
+			executable->sections.push_back(sectionHeader);
+			if (sh.type == SHT_SYMTAB)
+			{
+				executable->symtabs.push_back(sectionHeader);
+			}
+			
+			if (sectionLayout[i] != 0 && sh.type != SHT_NOBITS)
+			{
+				uint64_t address = sectionLayout[i];
+				memcpy(data + address, begin + sh.offset, sh.size);
+				executable->segments.push_back({ address, address + sh.size, data + address, sh.size, (sh.flags & SHF_EXECINSTR) != 0 });
+			}
+		}
+		executable->sectionAddresses = move(sectionLayout);
+		
+		if (imports.size() > 0)
+		{
+			executable->segments.push_back({ stubsAddress, slotsAddress, data + stubsAddress, slotsAddress - stubsAddress, true });
+		}
+		if (slotCount > 0)
+		{
+			executable->segments.push_back({ slotsAddress, imageSize, data + slotsAddress, imageSize - slotsAddress, false });
+		}
+		
+		auto getSymbolValue = [&](const pair<size_t, size_t>& key, const Elf_Sym& symbol)
+		{
+			auto import = imports.find(key);
+			return import == imports.end() ? executable->getSymbolAddress(symbol) : stubsAddress + import->second * stubSize;
+		};
+		
+		for (const auto& import : imports)
+		{
+			// jmp [rip+disp32], padded with int3.
+			uint64_t stub = stubsAddress + import.second * stubSize;
+			uint64_t slot = slotsAddress + import.second * sizeof (addr);
+			int32_t displacement = static_cast<int32_t>(slot - (stub + 6));
+			uint8_t stubCode[stubSize] = { 0xff, 0x25, 0, 0, 0, 0, 0xcc, 0xcc };
+			memcpy(stubCode + 2, &displacement, sizeof displacement);
+			memcpy(data + stub, stubCode, sizeof stubCode);
+			
+			addr slotValue = static_cast<addr>(stub);
+			memcpy(data + slot, &slotValue, sizeof slotValue);
+			
+			const Elf_Shdr& symtab = *fileSections[import.first.first];
+			if (const Elf_Sym* symbol = getSymbolEntry(begin, end, symtab, import.first.second))
+			if (const uint8_t* strtab = executable->getStringTable(symtab))
+			{
+				executable->stubTargets[slot] = executable->getSymbolName(*symbol, strtab);
+			}
+		}
+		executable->stubTargetsLoaded = true;
+		executable->stubSectionsLoaded = true;
+		if (imports.size() > 0)
+		{
+			executable->stubSections.push_back({stubsAddress, slotsAddress});
+		}
+		
+		for (const auto& entry : globalOffsets)
+		{
+			const Elf_Sym* symbol = getSymbolEntry(begin, end, *fileSections[entry.first.first], entry.first.second);
+			addr slotValue = static_cast<addr>(getSymbolValue(entry.first, *symbol));
+			memcpy(data + slotsAddress + (imports.size() + entry.second) * sizeof (addr), &slotValue, sizeof slotValue);
+		}
+		
+		forEachRelocation(begin, end, fileSections, [&](size_t target, size_t symtab, const Elf_Rel& reloc, int64_t addend, bool hasAddend)
+		{
+			RelocationInfo info = getRelocationInfo(eh->machine, reloc.type());
+			const Elf_Shdr& targetSection = *fileSections[target];
+			const Elf_Sym* symbol = getSymbolEntry(begin, end, *fileSections[symtab], reloc.symbol());
+			if (info.kind == RelocationUnsupported || symbol == nullptr || targetSection.type == SHT_NOBITS)
+			{
+				return;
+			}
+			if (reloc.offset > targetSection.size || targetSection.size - reloc.offset < info.size)
+			{
+				return;
+			}
+			
+			uint64_t place = executable->sectionAddresses[target] + reloc.offset;
+			uint8_t* location = data + place;
+			if (!hasAddend)
+			{
+				// Elf_Rel entries keep their addend at the relocated location.
+				addend = 0;
+				memcpy(&addend, location, info.size);
+				if (info.size == 4)
 				{
-					continue;
+					addend = static_cast<int32_t>(addend);
 				}
-				
-				const char* nameBegin = nullptr;
-				if (sym.name != 0)
+			}
+			
+			auto key = make_pair(symtab, static_cast<size_t>(reloc.symbol()));
+			uint64_t value = getSymbolValue(key, *symbol) + static_cast<uint64_t>(addend);
+			if (info.kind == RelocationPCRelative)
+			{
+				value -= place;
+			}
+			else if (info.kind == RelocationGOTPCRelative)
+			{
+				auto import = imports.find(key);
+				size_t slotIndex = import == imports.end() ? imports.size() + globalOffsets.at(key) : import->second;
+				value = slotsAddress + slotIndex * sizeof (addr) + static_cast<uint64_t>(addend) - place;
+			}
+			memcpy(location, &value, info.size);
+		});
+		
+		return move(executable);
+	}
+	
+	template<typename Types>
+	ErrorOr<unique_ptr<ElfExecutable<Types>>> ElfExecutable<Types>::parse(const uint8_t* begin, const uint8_t* end)
+	{
+		assert(end >= begin);
+		
+		using namespace std;
+		
+		// Relocatable objects have no program headers, and only make sense once their sections are laid out.
+		if (auto eh = bounded_cast<Elf_Ehdr>(begin, end, 0))
+		if (eh->type == ET_REL)
+		{
+			return parseRelocatable(begin, end);
+		}
+		
+		auto executable = std::make_unique<ElfExecutable<Types>>(begin, end);
+		
+		deque<const Elf_Phdr*> dynamics;
+		
+		// Walk header, identify PT_LOAD and PT_DYNAMIC segments, sections, and symbol tables. Only segments and the
+		// dynamic table are parsed here; the rest waits until symbols or stub targets are requested.
+		bool loadAtZero = false;
+		if (auto eh = bounded_cast<Elf_Ehdr>(begin, end, 0))
+		{
+			if (eh->phentsize == sizeof (Elf_Phdr))
+			{
+				for (const auto& ph : bounded_cast<Elf_Phdr>(begin, end, eh->phoff, eh->phnum))
 				{
-					nameBegin = bounded_cast<char>(strtab, end, sym.name);
+					if (ph.type == PT_LOAD)
+					{
+						unsigned long long endAddress;
+						if (!__builtin_uaddll_overflow(ph.vaddr, ph.memsz, &endAddress))
+						{
+							auto fileLoc = bounded_cast<uint8_t>(begin, end, ph.offset, ph.filesz);
+							if (fileLoc.begin() != nullptr)
+							{
+								Segment seg = { .vbegin = ph.vaddr, .vend = endAddress };
+								seg.vbegin = ph.vaddr;
+								seg.vend = endAddress;
+								seg.fbegin = fileLoc.begin();
+								seg.fsize = ph.filesz;
+								seg.executable = (ph.flags & PF_X) != 0;
+								executable->segments.push_back(seg);
+								loadAtZero |= seg.vbegin == 0;
+							}
+						}
+					}
+					else if (ph.type == PT_DYNAMIC)
+					{
+						dynamics.push_back(&ph);
+					}
 				}
-				
-				const char* nameEnd = nameBegin;
-				if (nameBegin != nullptr)
+			}
+			
+			if (eh->shentsize == sizeof (Elf_Shdr))
+			{
+				for (const auto& sh : bounded_cast<Elf_Shdr>(begin, end, eh->shoff, eh->shnum))
 				{
-					auto maxSize = static_cast<size_t>(reinterpret_cast<const char*>(end) - nameBegin);
-					nameEnd = nameBegin + strnlen(nameBegin, maxSize);
+					executable->sections.push_back(&sh);
+					if (sh.type == SHT_SYMTAB)
+					{
+						executable->symtabs.push_back(&sh);
+					}
 				}
-				
-				auto& symInfo = executable->getSymbol(sym.value);
-				symInfo.virtualAddress = sym.value;
-				symInfo.name = string(nameBegin, nameEnd);
 			}
+			
+			executable->hasEntryPoint = (eh->entry != 0 || loadAtZero) && executable->map(eh->entry) != nullptr;
 		}
 		
-		// Figure out file offset for symbols, remove those that don't have one.
-		for (auto entryPoint : executable->getVisibleEntryPoints())
+		// Walk dynamic segments.
+		for (const auto* dynHeader : dynamics)
 		{
-			if (executable->map(entryPoint) == nullptr)
+			size_t numEnts = dynHeader->filesz / sizeof (Elf_Dynamic);
+			for (const auto& dyn : bounded_cast<Elf_Dynamic>(begin, end, dynHeader->offset, numEnts))
 			{
-				executable->eraseSymbol(entryPoint);
+				if (dyn.tag < DT_MAX)
+				{
+					executable->dynEnt[dyn.tag] = &dyn;
+				}
 			}
 		}
 		
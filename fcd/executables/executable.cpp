@@ -14,7 +14,10 @@
 #include "flat_binary.h"
 #include "python_executable.h"
 
+#include <llvm/ADT/Triple.h>
+
 #include <ctype.h>
+#include <string.h>
 
 using namespace llvm;
 using namespace std;
@@ -192,8 +195,19 @@ string Executable::getTargetTriple() const
 	return "unknown-unknown-unknown";
 }
 
+void Executable::loadSymbols() const
+{
+	if (!symbolsLoaded)
+	{
+		symbolsLoaded = true;
+		const_cast<Executable*>(this)->doLoadSymbols();
+	}
+}
+
 vector<uint64_t> Executable::getVisibleEntryPoints() const
 {
+	loadSymbols();
+	
 	vector<uint64_t> result;
 	for (const auto& pair : symbols)
 	{
@@ -203,6 +217,19 @@ vector<uint64_t> Executable::getVisibleEntryPoints() const
 	return result;
 }
 
+vector<MappedRange> Executable::getCodeSections() const
+{
+	vector<MappedRange> result;
+	for (const MappedRange& range : getMappedRanges())
+	{
+		if (range.executable)
+		{
+			result.push_back(range);
+		}
+	}
+	return result;
+}
+
 const SymbolInfo* Executable::getInfo(uint64_t address) const
 {
 	auto iter = symbols.find(address);
@@ -214,6 +241,10 @@ const SymbolInfo* Executable::getInfo(uint64_t address) const
 	{
 		SymbolInfo& info = symbols[address];
 		info.virtualAddress = address;
+		if (!symbolsLoaded)
+		{
+			doFindSymbolName(address, info.name);
+		}
 		return &info;
 	}
 	return nullptr;
@@ -253,6 +284,75 @@ const StubInfo* Executable::getStubTarget(uint64_t address) const
 	}
 }
 
+const StubInfo* Executable::getImportStub(uint64_t address) const
+{
+	if (!isInStubSection(address))
+	{
+		return nullptr;
+	}
+	
+	const uint8_t* bytes = map(address);
+	if (bytes == nullptr || bytes >= dataEnd)
+	{
+		return nullptr;
+	}
+	
+	Triple::ArchType arch = Triple(getTargetTriple()).getArch();
+	if (arch != Triple::x86_64 && arch != Triple::x86)
+	{
+		return nullptr;
+	}
+	
+	// Both x86 flavors can start with endbr (.plt.sec) and a bnd prefix (MPX PLTs) before the jump.
+	size_t available = static_cast<size_t>(dataEnd - bytes);
+	size_t offset = 0;
+	const uint8_t endbrByte = arch == Triple::x86_64 ? 0xfa : 0xfb;
+	const uint8_t endbr[] = { 0xf3, 0x0f, 0x1e, endbrByte };
+	if (available >= sizeof endbr && memcmp(bytes, endbr, sizeof endbr) == 0)
+	{
+		offset += sizeof endbr;
+	}
+	if (available > offset && bytes[offset] == 0xf2)
+	{
+		++offset;
+	}
+	if (available - offset < 6 || bytes[offset] != 0xff)
+	{
+		return nullptr;
+	}
+	
+	uint32_t operand;
+	memcpy(&operand, bytes + offset + 2, sizeof operand);
+	if (arch == Triple::x86_64)
+	{
+		// jmp [rip+disp32]. The displacement is sign-extended and the sum wraps like the processor's.
+		if (bytes[offset + 1] != 0x25)
+		{
+			return nullptr;
+		}
+		uint64_t displacement = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(operand)));
+		return getStubTarget(address + offset + 6 + displacement);
+	}
+	
+	// jmp [abs32] in non-PIC PLTs, jmp [ebx+disp32] in PIC PLTs, where ebx holds the address of the GOT.
+	if (bytes[offset + 1] == 0x25)
+	{
+		return getStubTarget(operand);
+	}
+	
+	uint64_t globalOffsetTable;
+	if (bytes[offset + 1] == 0xa3 && getGlobalOffsetTable(globalOffsetTable))
+	{
+		return getStubTarget(static_cast<uint32_t>(globalOffsetTable + operand));
+	}
+	return nullptr;
+}
+
+bool Executable::parsingNeedsPython()
+{
+	return executableFactory->needsPython();
+}
+
 ErrorOr<unique_ptr<Executable>> Executable::parse(const uint8_t* begin, const uint8_t* end)
 {
 	return executableFactory->parse(begin, end);
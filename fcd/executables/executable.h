@@ -26,6 +26,14 @@ struct StubInfo
 	std::string name;
 };
 
+// File-backed part of a segment. Bytes past the end of the file (like .bss) are not included.
+struct MappedRange
+{
+	uint64_t begin;
+	uint64_t end;
+	bool executable;
+};
+
 class ExecutableFactory;
 
 class Executable : public EntryPointProvider
@@ -35,6 +43,9 @@ class Executable : public EntryPointProvider
 	mutable std::unordered_map<uint64_t, SymbolInfo> symbols;
 	mutable std::unordered_map<uint64_t, StubInfo> stubTargets;
 	mutable std::set<std::string> libraries;
+	mutable bool symbolsLoaded;
+	
+	void loadSymbols() const;
 	
 protected:
 	enum StubTargetQueryResult
@@ -45,18 +56,24 @@ protected:
 	};
 	
 	inline Executable(const uint8_t* begin, const uint8_t* end)
-	: dataBegin(begin), dataEnd(end)
+	: dataBegin(begin), dataEnd(end), symbolsLoaded(false)
 	{
 	}
 	
 	SymbolInfo& getSymbol(uint64_t address) { return symbols[address]; }
 	void eraseSymbol(uint64_t address) { symbols.erase(address); }
 	
+	// Formats with large symbol tables can defer reading them. doLoadSymbols is called once, the first time that every
+	// symbol is needed; until then, doFindSymbolName is used to name addresses one at a time.
+	virtual void doLoadSymbols() {}
+	virtual bool doFindSymbolName(uint64_t address, std::string& name) const { return false; }
+	
 	virtual StubTargetQueryResult doGetStubTarget(uint64_t address, std::string& sharedObject, std::string& symbolName) const = 0;
 	virtual std::string doGetTargetTriple() const = 0;
 	
 public:
 	static llvm::ErrorOr<std::unique_ptr<Executable>> parse(const uint8_t* begin, const uint8_t* end);
+	static bool parsingNeedsPython();
 	
 	virtual std::string getExecutableType() const = 0;
 	std::string getTargetTriple() const;
@@ -65,11 +82,28 @@ public:
 	inline const uint8_t* end() const { return dataEnd; }
 	
 	virtual const uint8_t* map(uint64_t address) const = 0;
+	virtual std::vector<MappedRange> getMappedRanges() const { return {}; }
+	
+	// Ranges that only hold instructions. Executable segments can also hold headers and read-only data; formats that
+	// can tell them apart override this. By default, every executable range is code.
+	virtual std::vector<MappedRange> getCodeSections() const;
+	
+	// Whether an address is in a section of import trampolines, like .plt. Only these addresses are decoded as stubs,
+	// which keeps formats from resolving imports for every function.
+	virtual bool isInStubSection(uint64_t address) const { return false; }
+	
+	// The address that 32-bit x86 position-independent trampolines expect in ebx, if the format knows it.
+	virtual bool getGlobalOffsetTable(uint64_t& address) const { return false; }
 	
 	virtual std::vector<uint64_t> getVisibleEntryPoints() const override final;
 	virtual const SymbolInfo* getInfo(uint64_t address) const override final;
 	const StubInfo* getStubTarget(uint64_t address) const;
 	
+	// Recognizes import trampolines (jumps through a relocated pointer in .plt, .plt.sec and the like) at a function
+	// address, so that they can be declared with their import name instead of being lifted. The trampoline layout
+	// depends on the target architecture.
+	const StubInfo* getImportStub(uint64_t address) const;
+	
 	virtual ~Executable() = default;
 };
 
@@ -87,6 +121,7 @@ public:
 	const std::string& getParameterValue() const { return parameterValue; }
 	const std::string& getHelp() const { return help; }
 	
+	virtual bool needsPython() const { return false; }
 	virtual llvm::ErrorOr<std::unique_ptr<Executable>> parse(const uint8_t* begin, const uint8_t* end) = 0;
 	virtual ~ExecutableFactory() = default;
 };
@@ -30,6 +30,8 @@ namespace
 		ERROR_MESSAGE(Elf_EndianMismatch, "fixme: ELF parser requires executable to use host endianness"),
 		
 		ERROR_MESSAGE(FlatBin_EntryPointOutOfRange, "entry address points outside of program memory"),
+		
+		ERROR_MESSAGE(Archive_Corrupted, "archive fatally corrupted"),
 	};
 	
 	static_assert(countof(messageTable) == static_cast<size_t>(ExecutableParsingError::Generic_ErrorMax), "missing error strings");
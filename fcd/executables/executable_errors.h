@@ -23,6 +23,8 @@ enum class ExecutableParsingError
 	
 	FlatBin_EntryPointOutOfRange,
 	
+	Archive_Corrupted,
+	
 	Generic_ErrorMax
 };
 
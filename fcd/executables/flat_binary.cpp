@@ -52,6 +52,12 @@ namespace
 			return nullptr;
 		}
 		
+		virtual vector<MappedRange> getMappedRanges() const override
+		{
+			auto size = static_cast<size_t>(end() - begin());
+			return { { baseAddress, baseAddress + size, true } };
+		}
+		
 		virtual StubTargetQueryResult doGetStubTarget(uint64_t address, string& libraryName, string& into) const override
 		{
 			return Unresolved;
@@ -16,7 +16,8 @@
 
 #include <unordered_map>
 
-// We assume here that Python has already been initialized (most likely with a PythonContext).
+// We assume here that Python has already been initialized (most likely with a PythonContext). Callers should check
+// Executable::parsingNeedsPython before parsing, since the interpreter is started lazily.
 
 using namespace llvm;
 using namespace std;
@@ -35,17 +36,7 @@ namespace
 		
 		static bool getString(AutoPyObject&& object, string& output)
 		{
-			if (object)
-			{
-				char* bufferPointer;
-				Py_ssize_t stringLength;
-				if (PyString_AsStringAndSize(object.get(), &bufferPointer, &stringLength) == 0)
-				{
-					output = string(bufferPointer, static_cast<size_t>(stringLength));
-					return true;
-				}
-			}
-			return false;
+			return object && getPythonString(object.get(), output);
 		}
 		
 		PythonParsedExecutable(string path, const uint8_t* begin, const uint8_t* end)
@@ -58,7 +49,7 @@ namespace
 			PyErrClearAtEnd clearPyErrAtEndOfFunction;
 			
 			auto init = getCallable("init");
-			auto bytes = TAKEREF PyString_FromStringAndSize(reinterpret_cast<const char*>(begin()), end() - begin());
+			auto bytes = TAKEREF pyBytesFromStringAndSize(reinterpret_cast<const char*>(begin()), end() - begin());
 			callObject(init, bytes);
 			
 			if (PyErr_Occurred())
@@ -26,6 +26,7 @@ public:
 		scriptPath = std::move(path);
 	}
 	
+	virtual bool needsPython() const override { return true; }
 	virtual llvm::ErrorOr<std::unique_ptr<Executable>> parse(const uint8_t* begin, const uint8_t* end) override;
 };
 
@@ -8,6 +8,7 @@
 //
 
 #include "header_decls.h"
+#include "memory_report.h"
 
 #include "CodeGenTypes.h"
 
@@ -156,8 +157,17 @@ namespace
 }
 
 HeaderDeclarations::HeaderDeclarations(llvm::Module& module, unique_ptr<ASTUnit> tu, vector<string> includedFiles)
-: module(module), tu(move(tu)), includedFiles(move(includedFiles))
+: module(module), tu(move(tu)), includedFiles(move(includedFiles)), trackedMemory(0)
 {
+	if (this->tu)
+	{
+		ASTContext& context = this->tu->getASTContext();
+		SourceManager& sourceManager = this->tu->getSourceManager();
+		auto bufferSizes = sourceManager.getMemoryBufferSizes();
+		trackedMemory = context.getASTAllocatedMemory() + context.getSideTableAllocatedMemory();
+		trackedMemory += sourceManager.getDataStructureSizes() + bufferSizes.malloc_bytes + bufferSizes.mmap_bytes;
+		trackMemory(MemoryHeaderDeclarations, static_cast<int64_t>(trackedMemory));
+	}
 }
 
 unique_ptr<HeaderDeclarations> HeaderDeclarations::create(llvm::Module& module, const vector<string>& searchPath, vector<string> headers, const vector<string>& frameworks, raw_ostream& errors)
@@ -376,4 +386,5 @@ const SymbolInfo* HeaderDeclarations::getInfo(uint64_t address) const
 
 HeaderDeclarations::~HeaderDeclarations()
 {
+	trackMemory(MemoryHeaderDeclarations, -static_cast<int64_t>(trackedMemory));
 }
@@ -52,6 +52,7 @@ private:
 	std::vector<std::string> includedFiles;
 	std::unordered_map<std::string, clang::FunctionDecl*> knownImports;
 	std::unordered_map<uint64_t, Export> knownExports;
+	size_t trackedMemory;
 	
 	HeaderDeclarations(llvm::Module& module, std::unique_ptr<clang::ASTUnit> tu, std::vector<std::string> includedFiles);
 	
@@ -7,23 +7,34 @@
 // license. See LICENSE.md for details.
 //
 
+#include "archive.h"
 #include "ast_passes.h"
+#include "binary_diff.h"
 #include "command_line.h"
 #include "errors.h"
 #include "executable.h"
 #include "header_decls.h"
 #include "main.h"
+#include "memory_report.h"
 #include "metadata.h"
 #include "passes.h"
 #include "params_registry.h"
+#include "progress_report.h"
 #include "python_context.h"
+#include "supervisor.h"
 #include "translation_context.h"
+#include "xref_database.h"
 
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Analysis/AliasAnalysis.h>
 #include <llvm/Analysis/BasicAliasAnalysis.h>
 #include <llvm/Analysis/Passes.h>
 #include <llvm/Analysis/ScopedNoAliasAA.h>
 #include <llvm/Analysis/TypeBasedAliasAnalysis.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Metadata.h>
@@ -37,6 +48,7 @@
 #include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Support/Signals.h>
 #include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/Timer.h>
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Scalar/GVN.h>
@@ -65,6 +77,7 @@ raw_ostream& llvm_errs()
 namespace
 {
 	cl::opt<string> inputFile(cl::Positional, cl::desc("<input program>"), cl::Required, whitelist());
+	cl::list<string> batchInputFiles(cl::Positional, cl::desc("<more input programs>"), cl::ZeroOrMore, whitelist());
 	cl::list<unsigned long long> additionalEntryPoints("other-entry", cl::desc("Add entry point from virtual address (can be used multiple times)"), cl::CommaSeparated, whitelist());
 	cl::list<bool> partialDisassembly("partial", cl::desc("Only decompile functions specified with --other-entry"), whitelist());
 	cl::list<bool> inputIsModule("module-in", cl::desc("Input file is a LLVM module"), whitelist());
@@ -73,10 +86,32 @@ namespace
 	cl::list<string> additionalPasses("opt", cl::desc("Insert LLVM optimization pass; a pass name ending in .py is interpreted as a Python script. Requires default pass pipeline."), whitelist());
 	cl::opt<string> customPassPipeline("opt-pipeline", cl::desc("Customize pass pipeline. Empty string lets you order passes through $EDITOR; otherwise, must be a whitespace-separated list of passes."), cl::init("default"), whitelist());
 	
+	enum DecompilationTier
+	{
+		FastTier,
+		FullTier,
+	};
+	
+	cl::opt<DecompilationTier> tier("tier", cl::desc("Decompilation tier"), cl::values(
+		clEnumValN(FastTier, "fast", "Argument recovery and minimal cleanup, for triage"),
+		clEnumValN(FullTier, "full", "Complete optimization pipeline")
+	), cl::init(FullTier), whitelist());
+	cl::opt<string> tierCheckpoint("tier-checkpoint", cl::desc("Save the lifted module as bitcode, so that functions can be promoted later without lifting again"), cl::value_desc("path"), whitelist());
+	cl::opt<string> batchOutputDirectory("batch-output", cl::desc("Directory where each program of a batch (several inputs, or the members of an archive) gets its output file"), cl::value_desc("path"), cl::init("."), whitelist());
+	cl::list<unsigned long long> promotedFunctions("promote", cl::desc("With --module-in, only decompile the functions at these addresses, using the full tier"), cl::CommaSeparated, whitelist());
+	cl::opt<bool> diffVersions("diff", cl::desc("Match the functions of two versions of a program (<old> <new>) and report which ones changed"), whitelist());
+	cl::opt<bool> diffDecompile("diff-decompile", cl::desc("With --diff, decompile the functions of the new version that changed or are new"), whitelist());
+	
+	cl::opt<bool> interleavePhaseOne("interleave-phase-one", cl::desc("Clean up each function as soon as it is lifted, instead of once the whole program is lifted"), whitelist());
+	cl::opt<bool> xrefPrepass("xref-prepass", cl::desc("Sweep executable segments for functions and cross-references before lifting"), whitelist());
+	cl::opt<string> xrefDatabasePath("xref-db", cl::desc("Cross-reference database to load, or to create with the pre-pass if it doesn't exist"), cl::value_desc("path"), whitelist());
+	
 	cl::list<string> headers("header", cl::desc("Path of a header file to parse for function declarations. Can be specified multiple times"), whitelist());
 	cl::list<string> frameworks("framework", cl::desc("Path of an Apple framework that fcd should use for declarations. Can be specified multiple times"), whitelist());
 	cl::list<string> headerSearchPath("I", cl::desc("Additional directory to search headers in. Can be specified multiple times"), whitelist());
 	
+	cl::opt<bool> timePhases("time-phases", cl::desc("Print how long each phase of the decompilation takes"), whitelist());
+	
 	cl::alias additionalEntryPointsAlias("e", cl::desc("Alias for --other-entry"), cl::aliasopt(additionalEntryPoints), whitelist());
 	cl::alias partialDisassemblyAlias("p", cl::desc("Alias for --partial"), cl::aliasopt(partialDisassembly), whitelist());
 	cl::alias additionalPassesAlias("O", cl::desc("Alias for --opt"), cl::aliasopt(additionalPasses), whitelist());
@@ -159,6 +194,86 @@ namespace
 		return count;
 	}
 	
+	// Instructions that couldn't be lifted become calls to x86_assertion_failure.
+	bool checkTranslations(Module& module)
+	{
+		size_t errorCount = 0;
+		if (Function* assertionFailure = module.getFunction("x86_assertion_failure"))
+		{
+			errorCount += forEachCall(assertionFailure, 0, [](const string& message) {
+				cerr << "translation assertion failure: " << message << endl;
+			});
+		}
+		
+		if (errorCount > 0)
+		{
+			cerr << "incorrect or missing translations; cannot decompile" << endl;
+			return false;
+		}
+		return true;
+	}
+	
+	TimerGroup& getPhaseTimerGroup()
+	{
+		static TimerGroup phaseTimers("fcd", "fcd phases");
+		return phaseTimers;
+	}
+	
+	// Times a phase of the decompilation for --time-phases. Timers are reported when the program exits.
+	class PhaseTimer
+	{
+		Timer timer;
+		
+	public:
+		PhaseTimer(StringRef name, StringRef description)
+		: timer(name, description, getPhaseTimerGroup())
+		{
+			if (timePhases)
+			{
+				timer.startTimer();
+			}
+		}
+		
+		void stop()
+		{
+			if (timer.isRunning())
+			{
+				timer.stopTimer();
+			}
+		}
+		
+		~PhaseTimer()
+		{
+			stop();
+		}
+	};
+	
+	// Transformation pass families are registered the first time that a pass name can't be found, in the order in which
+	// they are most likely to be needed. fcd's own passes, and the Core and Analysis families that they depend on, are
+	// always registered. Passes that are created directly with their create function register themselves and their
+	// dependencies.
+	const PassInfo* findPassInfo(StringRef passName)
+	{
+		static void (*const passFamilies[])(PassRegistry&) = {
+			&initializeScalarOpts,
+			&initializeInstCombine,
+			&initializeIPO,
+			&initializeTransformUtils,
+			&initializeVectorization,
+		};
+		static size_t initializedFamilies = 0;
+		
+		PassRegistry& pr = *PassRegistry::getPassRegistry();
+		const PassInfo* pi = pr.getPassInfo(passName);
+		while (pi == nullptr && initializedFamilies < sizeof passFamilies / sizeof *passFamilies)
+		{
+			passFamilies[initializedFamilies](pr);
+			++initializedFamilies;
+			pi = pr.getPassInfo(passName);
+		}
+		return pi;
+	}
+	
 	bool refillEntryPoints(const TranslationContext& transl, const EntryPointRepository& entryPoints, map<uint64_t, SymbolInfo>& toVisit, size_t iterations)
 	{
 		if (isExclusiveDisassembly() || (isPartialDisassembly() && iterations > 1))
@@ -176,6 +291,194 @@ namespace
 		return !toVisit.empty();
 	}
 	
+	// Modules can be restricted to functions promoted from a checkpoint, or to the functions specified with
+	// --other-entry when disassembly is partial or exclusive.
+	bool hasFunctionSelection()
+	{
+		return promotedFunctions.size() > 0 || (!isFullDisassembly() && additionalEntryPoints.size() > 0);
+	}
+	
+	bool isSelectedFunction(uint64_t address)
+	{
+		if (any_of(promotedFunctions.begin(), promotedFunctions.end(), [&](uint64_t promotedAddress) { return address == promotedAddress; }))
+		{
+			return true;
+		}
+		return !isFullDisassembly() && isEntryPoint(address);
+	}
+	
+	// deleteBody also drops the metadata of a function, but fcd metadata (like its address) still describes the
+	// declaration that is left.
+	void dropBody(Function& fn)
+	{
+		SmallVector<pair<unsigned, MDNode*>, 4> metadata;
+		fn.getAllMetadata(metadata);
+		fn.deleteBody();
+		for (const auto& attachment : metadata)
+		{
+			fn.setMetadata(attachment.first, attachment.second);
+		}
+	}
+	
+	// Moves the functions of pending to needed, along with every function that they call, transitively. visit is
+	// called before the body of a function is scanned (lazily-loaded functions are materialized there), and can fail.
+	template<typename Visitor>
+	bool collectCallees(SmallVectorImpl<Function*>& pending, SmallPtrSetImpl<Function*>& needed, Visitor&& visit)
+	{
+		while (!pending.empty())
+		{
+			Function* fn = pending.pop_back_val();
+			if (!needed.insert(fn).second)
+			{
+				continue;
+			}
+			
+			if (!visit(*fn))
+			{
+				return false;
+			}
+			
+			for (BasicBlock& bb : *fn)
+			{
+				for (Instruction& inst : bb)
+				{
+					if (auto call = dyn_cast<CallInst>(&inst))
+					if (Function* callee = call->getCalledFunction())
+					if (!callee->isIntrinsic())
+					{
+						pending.push_back(callee);
+					}
+				}
+			}
+		}
+		return true;
+	}
+	
+	// Keeps the bodies of functions whose address is kept, and of every function that they call, transitively:
+	// argument recovery and the parameter registry read the bodies of callees. Everything else becomes a declaration,
+	// whose parameters are inferred from call sites.
+	template<typename Predicate>
+	void keepFunctions(Module& module, Predicate&& isKept)
+	{
+		SmallVector<Function*, 16> pending;
+		for (Function& fn : module)
+		{
+			if (!md::isPrototype(fn))
+			if (auto address = md::getVirtualAddress(fn))
+			if (isKept(address->getLimitedValue()))
+			{
+				pending.push_back(&fn);
+			}
+		}
+		
+		SmallPtrSet<Function*, 16> needed;
+		collectCallees(pending, needed, [](Function&) { return true; });
+		for (Function& fn : module)
+		{
+			if (!md::isPrototype(fn) && needed.count(&fn) == 0)
+			{
+				dropBody(fn);
+			}
+		}
+	}
+	
+	// Once the analyses are done, the callees that keepFunctions kept are turned into declarations too, so that only the
+	// kept functions are decompiled.
+	template<typename Predicate>
+	void pruneFunctions(Module& module, Predicate&& isKept)
+	{
+		for (Function& fn : module)
+		{
+			if (!fn.isDeclaration())
+			if (auto address = md::getVirtualAddress(fn))
+			if (!isKept(address->getLimitedValue()))
+			{
+				dropBody(fn);
+			}
+		}
+	}
+	
+	void keepSelectedFunctions(Module& module)
+	{
+		keepFunctions(module, isSelectedFunction);
+	}
+	
+	// Functions of a lazily-loaded module are read from bitcode when they are materialized. When the module has a
+	// function index, the selected functions and their callees are materialized, and the bodies of the other functions
+	// are dropped without ever being read. Without a selection, everything is materialized.
+	bool materializeSelectedFunctions(Module& module, StringRef program)
+	{
+		auto index = md::getFunctionIndex(module);
+		md::removeFunctionIndex(module);
+		
+		if (hasFunctionSelection() && index.size() > 0)
+		{
+			SmallVector<Function*, 16> pending;
+			for (const auto& entry : index)
+			{
+				if (!entry.isPrototype && isSelectedFunction(entry.virtualAddress))
+				{
+					pending.push_back(entry.function);
+				}
+			}
+			
+			SmallPtrSet<Function*, 16> needed;
+			bool materialized = collectCallees(pending, needed, [&](Function& fn)
+			{
+				if (Error error = fn.materialize())
+				{
+					logAllUnhandledErrors(move(error), errs(), program + ": ");
+					return false;
+				}
+				return true;
+			});
+			if (!materialized)
+			{
+				return false;
+			}
+			
+			// The address of a function is attached to its body in bitcode, so it is restored from the index.
+			for (const auto& entry : index)
+			{
+				if (!entry.isPrototype && needed.count(entry.function) == 0)
+				{
+					entry.function->deleteBody();
+					md::setVirtualAddress(*entry.function, entry.virtualAddress);
+				}
+			}
+		}
+		
+		if (Error error = module.materializeAll())
+		{
+			logAllUnhandledErrors(move(error), errs(), program + ": ");
+			return false;
+		}
+		
+		// Modules without an index had every function materialized. This also drops the bodies of functions that are
+		// neither selected nor called by a selected function.
+		if (hasFunctionSelection())
+		{
+			keepSelectedFunctions(module);
+		}
+		return true;
+	}
+	
+	bool saveCheckpoint(Module& module, StringRef path, raw_ostream& errorOutput)
+	{
+		error_code errorCode;
+		raw_fd_ostream checkpoint(path, errorCode, sys::fs::F_None);
+		if (errorCode)
+		{
+			errorOutput << "can't open " << path << ": " << errorCode.message() << '\n';
+			return false;
+		}
+		
+		md::setFunctionIndex(module);
+		WriteBitcodeToFile(&module, checkpoint);
+		md::removeFunctionIndex(module);
+		return true;
+	}
+	
 	class Main
 	{
 		int argc;
@@ -183,6 +486,7 @@ namespace
 	
 		LLVMContext llvm;
 		PythonContext python;
+		vector<string> optimizeAndTransformPassNames;
 		vector<Pass*> optimizeAndTransformPasses;
 		
 		static void aliasAnalysisHooks(Pass& pass, Function& fn, AAResults& aar)
@@ -197,20 +501,37 @@ namespace
 			}
 		}
 	
-		static legacy::PassManager createBasePassManager()
+		static void addAliasAnalysisPasses(legacy::PassManagerBase& pm)
 		{
-			legacy::PassManager pm;
 			pm.add(createTypeBasedAAWrapperPass());
 			pm.add(createScopedNoAliasAAWrapperPass());
 			pm.add(createBasicAAWrapperPass());
 			pm.add(createProgramMemoryAliasAnalysis());
+		}
+		
+		static legacy::PassManager createBasePassManager()
+		{
+			legacy::PassManager pm;
+			addAliasAnalysisPasses(pm);
 			return pm;
 		}
 		
+		// Phase one is everything that makes lifted code suitable for analysis except GlobalDCE, and it only looks at
+		// one function at a time.
+		static void addPhaseOneFunctionPasses(legacy::PassManagerBase& pm)
+		{
+			pm.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
+			pm.add(createDeadCodeEliminationPass());
+			pm.add(createInstructionCombiningPass());
+			pm.add(createRegisterPointerPromotionPass());
+			pm.add(createGVNPass());
+			pm.add(createDeadStoreEliminationPass());
+			pm.add(createInstructionCombiningPass());
+		}
+		
 		vector<Pass*> createPassesFromList(const vector<string>& passNames)
 		{
 			vector<Pass*> result;
-			PassRegistry* pr = PassRegistry::getPassRegistry();
 			for (string passName : passNames)
 			{
 				auto begin = passName.begin();
@@ -256,9 +577,30 @@ namespace
 							return vector<Pass*>();
 						}
 					}
-					else if (const PassInfo* pi = pr->getPassInfo(passName))
+					else if (const PassInfo* pi = findPassInfo(passName))
 					{
-						result.push_back(pi->createPass());
+						string replacementName;
+						if (getLargeFunctionReplacement(passName, replacementName))
+						{
+							Pass* replacement = nullptr;
+							if (replacementName.size() > 0)
+							{
+								if (const PassInfo* replacementInfo = findPassInfo(replacementName))
+								{
+									replacement = replacementInfo->createPass();
+								}
+								else
+								{
+									cerr << getProgramName() << ": couldn't identify large function replacement pass " << replacementName << endl;
+									return vector<Pass*>();
+								}
+							}
+							addSizeAdaptivePasses(result, passName, pi->createPass(), replacementName, replacement);
+						}
+						else
+						{
+							result.push_back(pi->createPass());
+						}
 					}
 					else
 					{
@@ -275,14 +617,14 @@ namespace
 			return result;
 		}
 	
-		vector<Pass*> interactivelyEditPassPipeline(const string& editor, const vector<string>& basePasses)
+		vector<string> interactivelyEditPassPipeline(const string& editor, const vector<string>& basePasses)
 		{
 			int fd;
 			SmallVector<char, 100> path;
 			if (auto errorCode = sys::fs::createTemporaryFile("fcd-pass-pipeline", "txt", fd, path))
 			{
 				errs() << getProgramName() << ": can't open temporary file for editing: " << errorCode.message() << "\n";
-				return vector<Pass*>();
+				return vector<string>();
 			}
 			
 			raw_fd_ostream passListOs(fd, true);
@@ -312,7 +654,7 @@ namespace
 			if (int errorCode = system(editCommand.c_str()))
 			{
 				errs() << getProgramName() << ": interactive pass pipeline: editor returned status code " << errorCode << '\n';
-				return vector<Pass*>();
+				return vector<string>();
 			}
 			
 			ifstream passListIs(path.data());
@@ -330,10 +672,10 @@ namespace
 				lines.push_back(inputLine);
 			}
 			
-			return createPassesFromList(lines);
+			return lines;
 		}
 		
-		vector<Pass*> readPassPipelineFromString(const string& argString)
+		vector<string> readPassPipelineFromString(const string& argString)
 		{
 			stringstream ss(argString, ios::in);
 			vector<string> passes;
@@ -347,12 +689,11 @@ namespace
 					passes.pop_back();
 				}
 			}
-			auto result = createPassesFromList(passes);
-			if (result.size() == 0)
+			if (passes.size() == 0)
 			{
 				errs() << getProgramName() << ": empty custom pass list\n";
 			}
-			return result;
+			return passes;
 		}
 	
 	public:
@@ -368,17 +709,48 @@ namespace
 	
 		ErrorOr<unique_ptr<Executable>> parseExecutable(MemoryBuffer& executableCode)
 		{
+			if (Executable::parsingNeedsPython())
+			{
+				python.initialize();
+			}
+			
 			auto start = reinterpret_cast<const uint8_t*>(executableCode.getBufferStart());
 			auto end = reinterpret_cast<const uint8_t*>(executableCode.getBufferEnd());
 			return Executable::parse(start, end);
 		}
 		
+		ErrorOr<unique_ptr<XrefDatabase>> loadOrBuildXrefDatabase(Executable& executable, size_t addressSize)
+		{
+			if (xrefDatabasePath != "" && sys::fs::exists(xrefDatabasePath))
+			{
+				return XrefDatabase::load(xrefDatabasePath, executable);
+			}
+			
+			vector<uint64_t> seeds = executable.getVisibleEntryPoints();
+			seeds.insert(seeds.end(), additionalEntryPoints.begin(), additionalEntryPoints.end());
+			auto xrefs = XrefDatabase::build(executable, addressSize, seeds);
+			if (!xrefs)
+			{
+				return make_error_code(FcdError::Main_DecompilationError);
+			}
+			
+			if (xrefDatabasePath != "")
+			{
+				if (auto error = xrefs->save(xrefDatabasePath))
+				{
+					errs() << getProgramName() << ": couldn't save cross-reference database: " << error.message() << '\n';
+				}
+			}
+			return move(xrefs);
+		}
+		
 		ErrorOr<unique_ptr<Module>> generateAnnotatedModule(Executable& executable, const string& moduleName = "fcd-out")
 		{
 			x86_config config64 = { x86_isa64, 8, X86_REG_RIP, X86_REG_RSP, X86_REG_RBP };
 			TranslationContext transl(llvm, executable, config64, moduleName);
 			
 			// Load headers here, since this is the earliest point where we have an executable and a module.
+			progressBeginPhase("headers", 0);
 			auto cDecls = HeaderDeclarations::create(
 				transl.get(),
 				headerSearchPath.begin(),
@@ -393,7 +765,20 @@ namespace
 				return make_error_code(FcdError::Main_HeaderParsingError);
 			}
 			
+			// The cross-reference database only knows addresses, so it goes first and has the lowest priority.
+			unique_ptr<XrefDatabase> xrefs;
 			EntryPointRepository entryPoints;
+			if (xrefPrepass || xrefDatabasePath != "")
+			{
+				progressBeginPhase("cross-references", 0);
+				auto xrefsOrError = loadOrBuildXrefDatabase(executable, config64.address_size);
+				if (!xrefsOrError)
+				{
+					return xrefsOrError.getError();
+				}
+				xrefs = move(xrefsOrError.get());
+				entryPoints.addProvider(*xrefs);
+			}
 			entryPoints.addProvider(executable);
 			entryPoints.addProvider(*cDecls);
 			
@@ -427,6 +812,18 @@ namespace
 				return make_error_code(FcdError::Main_NoEntryPoint);
 			}
 	
+			// With --interleave-phase-one, functions are cleaned up while their IR is still hot, and the module never holds
+			// every function in its raw lifted form at once.
+			unique_ptr<legacy::FunctionPassManager> phaseOneFunctions;
+			if (interleavePhaseOne)
+			{
+				phaseOneFunctions.reset(new legacy::FunctionPassManager(&transl.get()));
+				addAliasAnalysisPasses(*phaseOneFunctions);
+				addPhaseOneFunctionPasses(*phaseOneFunctions);
+				phaseOneFunctions->doInitialization();
+			}
+			
+			progressBeginPhase("lifting", toVisit.size());
 			size_t iterations = 0;
 			do
 			{
@@ -435,18 +832,36 @@ namespace
 					auto iter = toVisit.begin();
 					auto functionInfo = iter->second;
 					toVisit.erase(iter);
+					progressSetRemaining(toVisit.size() + 1);
 			
+					// Import stubs are resolved from relocations and declared under their import name, without lifting.
+					if (const StubInfo* stubTarget = executable.getImportStub(functionInfo.virtualAddress))
+					{
+						if (Function* fn = transl.createStub(functionInfo.virtualAddress, stubTarget->name))
+						if (Function* cFunction = cDecls->prototypeForImportName(stubTarget->name))
+						{
+							md::setFinalPrototype(*fn, *cFunction);
+						}
+						continue;
+					}
+					
 					if (functionInfo.name.size() > 0)
 					{
 						transl.setFunctionName(functionInfo.virtualAddress, functionInfo.name);
 					}
 					
+					ProgressItem lifting(functionInfo.name.size() > 0 ? functionInfo.name : "0x" + utohexstr(functionInfo.virtualAddress));
 					if (Function* fn = transl.createFunction(functionInfo.virtualAddress))
 					{
 						if (Function* cFunction = cDecls->prototypeForAddress(functionInfo.virtualAddress))
 						{
 							md::setFinalPrototype(*fn, *cFunction);
 						}
+						
+						if (phaseOneFunctions)
+						{
+							phaseOneFunctions->run(*fn);
+						}
 					}
 					else
 					{
@@ -459,19 +874,23 @@ namespace
 			while (refillEntryPoints(transl, entryPoints, toVisit, iterations));
 	
 			// Perform early optimizations to make the module suitable for analysis
+			if (phaseOneFunctions)
+			{
+				phaseOneFunctions->doFinalization();
+				phaseOneFunctions.reset();
+			}
+			
 			auto module = transl.take();
+			progressBeginPhase("cleanup", 0);
 			legacy::PassManager phaseOne = createBasePassManager();
-			phaseOne.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
-			phaseOne.add(createDeadCodeEliminationPass());
-			phaseOne.add(createInstructionCombiningPass());
-			phaseOne.add(createRegisterPointerPromotionPass());
-			phaseOne.add(createGVNPass());
-			phaseOne.add(createDeadStoreEliminationPass());
-			phaseOne.add(createInstructionCombiningPass());
+			if (!interleavePhaseOne)
+			{
+				addPhaseOneFunctionPasses(phaseOne);
+			}
 			phaseOne.add(createGlobalDCEPass());
 			phaseOne.run(*module);
 	
-			// Annotate stubs before returning module
+			// Annotate stubs that getImportStub did not recognize before returning module
 			Function* jumpIntrin = module->getFunction("x86_jump_intrin");
 			vector<Function*> functions;
 			for (Function& fn : module->getFunctionList())
@@ -518,15 +937,45 @@ namespace
 			PrettyStackTraceString optimize("Optimizing LLVM IR");
 			
 			// Phase 3: make into functions with arguments, run codegen.
+			// The pass manager takes ownership of the passes that it runs.
+			if (optimizeAndTransformPasses.empty())
+			{
+				// The pipeline was valid when it was first created, so a module of a batch can't go on without it.
+				optimizeAndTransformPasses = createPassesFromList(optimizeAndTransformPassNames);
+				if (optimizeAndTransformPasses.empty())
+				{
+					errorOutput << getProgramName() << ": couldn't create the optimization pipeline again\n";
+					return false;
+				}
+			}
+			
 			auto passManager = createBasePassManager();
 			passManager.add(new ExecutableWrapper(executable));
 			passManager.add(createParameterRegistryPass());
 			passManager.add(createExternalAAWrapperPass(&Main::aliasAnalysisHooks));
-			for (Pass* pass : optimizeAndTransformPasses)
+			
+			// With progress reports, every pass is preceded by a marker, and units are passes run on functions.
+			size_t definedFunctions = 0;
+			size_t progressUnits = 0;
+			for (Function& fn : module)
+			{
+				definedFunctions += fn.isDeclaration() ? 0 : 1;
+			}
+			for (size_t i = 0; i < optimizeAndTransformPasses.size(); ++i)
 			{
+				Pass* pass = optimizeAndTransformPasses[i];
+				if (isProgressReported())
+				if (Pass* marker = createProgressMarker(*pass, i, optimizeAndTransformPasses.size()))
+				{
+					passManager.add(marker);
+					progressUnits += marker->getPassKind() == PT_Function ? definedFunctions : 1;
+				}
 				passManager.add(pass);
 			}
+			progressBeginPhase("optimization", progressUnits);
+			optimizeAndTransformPasses.clear();
 			passManager.run(module);
+			reportLargeFunctions(errorOutput, getProgramName());
 	
 #ifdef FCD_DEBUG
 			if (verifyModule(module, &errorOutput))
@@ -545,7 +994,7 @@ namespace
 			// Run that module through the output pass
 			// UnwrapReturns happens after value propagation because value propagation doesn't know that calls
 			// are generally not safe to reorder.
-			AstBackEnd* backend = createAstBackEnd();
+			unique_ptr<AstBackEnd> backend(createAstBackEnd());
 			backend->addPass(new AstRemoveUndef);
 			backend->addPass(new AstConsecutiveCombiner);
 			backend->addPass(new AstNestedCombiner);
@@ -562,21 +1011,31 @@ namespace
 	
 		static void initializePasses()
 		{
+			// Other pass families are initialized on demand by findPassInfo. Core and Analysis are registered up front
+			// because fcd passes that are found by name require analyses from them (like DemandedBits for
+			// intnarrowing), and the pass manager can't schedule analyses that aren't registered.
 			auto& pr = *PassRegistry::getPassRegistry();
 			initializeCore(pr);
-			initializeVectorization(pr);
-			initializeIPO(pr);
 			initializeAnalysis(pr);
-			initializeTransformUtils(pr);
-			initializeInstCombine(pr);
-			initializeScalarOpts(pr);
-		
 			initializeParameterRegistryPass(pr);
 			initializeArgumentRecoveryPass(pr);
 		}
 		
 		bool prepareOptimizationPasses()
 		{
+			// The fast tier only does what is necessary to produce functions with arguments, and enough cleanup to make
+			// them readable.
+			vector<string> fastPassNames = {
+				"globaldce",
+				"fixindirects",
+				"argrec",
+				"sroa",
+				"instcombine",
+				// <-- custom passes go here with the fast pass pipeline
+				"simplifycfg",
+				"globaldce",
+			};
+			
 			// Default passes
 			vector<string> passNames = {
 				"globaldce",
@@ -609,20 +1068,25 @@ namespace
 				"simplifycfg",
 			};
 			
+			if (tier == FastTier)
+			{
+				passNames = move(fastPassNames);
+			}
+			
 			if (customPassPipeline == "default")
 			{
 				if (additionalPasses.size() > 0)
 				{
-					auto extensionPoint = find(passNames.begin(), passNames.end(), "simplifyconditions") + 1;
+					auto extensionPoint = find(passNames.begin(), passNames.end(), tier == FastTier ? "instcombine" : "simplifyconditions") + 1;
 					passNames.insert(extensionPoint, additionalPasses.begin(), additionalPasses.end());
 				}
-				optimizeAndTransformPasses = createPassesFromList(passNames);
+				optimizeAndTransformPassNames = move(passNames);
 			}
 			else if (customPassPipeline == "")
 			{
 				if (auto editor = getenv("EDITOR"))
 				{
-					optimizeAndTransformPasses = interactivelyEditPassPipeline(editor, passNames);
+					optimizeAndTransformPassNames = interactivelyEditPassPipeline(editor, passNames);
 				}
 				else
 				{
@@ -632,11 +1096,242 @@ namespace
 			}
 			else
 			{
-				optimizeAndTransformPasses = readPassPipelineFromString(customPassPipeline);
+				optimizeAndTransformPassNames = readPassPipelineFromString(customPassPipeline);
 			}
+			
+			// Names are kept so that passes can be created again for the next module of a batch.
+			optimizeAndTransformPasses = createPassesFromList(optimizeAndTransformPassNames);
 			return optimizeAndTransformPasses.size() > 0;
 		}
 	};
+	
+	// A program of a batch, with the name of its output file relative to --batch-output.
+	struct BatchObject
+	{
+		string outputName;
+		unique_ptr<MemoryBuffer> buffer;
+	};
+	
+	bool isArchiveFile(const string& path)
+	{
+		sys::fs::file_magic magic;
+		return !sys::fs::identify_magic(path, magic) && magic == sys::fs::file_magic::archive;
+	}
+	
+	// Archives contribute one program per member, whose output goes in a directory named after the archive.
+	bool collectBatchObjects(const string& program, vector<BatchObject>& objects)
+	{
+		vector<string> paths = { inputFile };
+		paths.insert(paths.end(), batchInputFiles.begin(), batchInputFiles.end());
+		for (const string& path : paths)
+		{
+			auto bufferOrError = MemoryBuffer::getFile(path, -1, false);
+			if (!bufferOrError)
+			{
+				cerr << program << ": can't open " << path << ": " << errorOf(bufferOrError) << endl;
+				return false;
+			}
+			
+			unique_ptr<MemoryBuffer>& buffer = bufferOrError.get();
+			auto begin = reinterpret_cast<const uint8_t*>(buffer->getBufferStart());
+			auto end = reinterpret_cast<const uint8_t*>(buffer->getBufferEnd());
+			string stem = sys::path::stem(path);
+			if (!isArchive(begin, end))
+			{
+				objects.push_back({ move(stem), move(buffer) });
+				continue;
+			}
+			
+			auto membersOrError = parseArchive(begin, end);
+			if (!membersOrError)
+			{
+				cerr << program << ": couldn't parse " << path << ": " << errorOf(membersOrError) << endl;
+				return false;
+			}
+			
+			for (const ArchiveMember& member : membersOrError.get())
+			{
+				// Members are copied to buffers of their own, since parsers expect aligned data.
+				StringRef contents(reinterpret_cast<const char*>(member.begin), static_cast<size_t>(member.end - member.begin));
+				SmallString<128> outputName(stem);
+				sys::path::append(outputName, sys::path::stem(member.name));
+				objects.push_back({ outputName.str(), MemoryBuffer::getMemBufferCopy(contents, member.name) });
+			}
+		}
+		
+		// Archives can have several members with the same name.
+		StringMap<unsigned> nameCounts;
+		for (BatchObject& object : objects)
+		{
+			if (unsigned count = nameCounts[object.outputName]++)
+			{
+				object.outputName += "-" + to_string(count);
+			}
+		}
+		return true;
+	}
+	
+	bool decompileBatchObject(Main& mainObj, const BatchObject& object, StringRef outputPath)
+	{
+		string program = mainObj.getProgramName();
+		auto executableOrError = mainObj.parseExecutable(*object.buffer);
+		if (!executableOrError)
+		{
+			cerr << program << ": couldn't parse " << object.outputName << ": " << errorOf(executableOrError) << endl;
+			return false;
+		}
+		
+		Executable& executable = *executableOrError.get();
+		auto moduleOrError = mainObj.generateAnnotatedModule(executable, sys::path::filename(object.outputName));
+		if (!moduleOrError)
+		{
+			cerr << program << ": couldn't build LLVM module out of " << object.outputName << ": " << errorOf(moduleOrError) << endl;
+			return false;
+		}
+		
+		Module& module = *moduleOrError.get();
+		if (!checkTranslations(module))
+		{
+			return false;
+		}
+		
+		StringRef outputDirectory = sys::path::parent_path(outputPath);
+		if (!outputDirectory.empty())
+		if (auto errorCode = sys::fs::create_directories(outputDirectory))
+		{
+			errs() << program << ": can't create " << outputDirectory << ": " << errorCode.message() << '\n';
+			return false;
+		}
+		
+		error_code errorCode;
+		raw_fd_ostream output(outputPath, errorCode, sys::fs::F_Text);
+		if (errorCode)
+		{
+			errs() << program << ": can't open " << outputPath << ": " << errorCode.message() << '\n';
+			return false;
+		}
+		
+		if (moduleOutCount() == 1)
+		{
+			module.print(output, nullptr);
+			return true;
+		}
+		
+		if (!mainObj.optimizeAndTransformModule(module, errs(), &executable))
+		{
+			return false;
+		}
+		
+		if (moduleOutCount() > 1)
+		{
+			module.print(output, nullptr);
+			return true;
+		}
+		return mainObj.generateEquivalentPseudocode(module, output);
+	}
+	
+	// Programs of a batch share the LLVM context, the Python interpreter and the pass pipeline. A program that fails
+	// doesn't stop the batch.
+	bool runBatch(Main& mainObj, vector<BatchObject>& objects)
+	{
+		bool succeeded = true;
+		for (BatchObject& object : objects)
+		{
+			PrettyStackTraceFormat decompilingObject("Decompiling \"%s\" of batch", object.outputName.c_str());
+			SmallString<128> outputPath(batchOutputDirectory.getValue());
+			sys::path::append(outputPath, object.outputName + (moduleOutCount() > 0 ? ".ll" : ".c"));
+			if (!decompileBatchObject(mainObj, object, outputPath))
+			{
+				succeeded = false;
+			}
+			object.buffer.reset();
+		}
+		return succeeded;
+	}
+	
+	// A program compared with --diff. The executable refers to the buffer.
+	struct LiftedProgram
+	{
+		unique_ptr<MemoryBuffer> buffer;
+		unique_ptr<Executable> executable;
+		unique_ptr<Module> module;
+	};
+	
+	bool liftProgram(Main& mainObj, const string& path, LiftedProgram& lifted)
+	{
+		string program = mainObj.getProgramName();
+		PrettyStackTraceFormat parsingIR("Parsing executable \"%s\"", path.c_str());
+		
+		auto bufferOrError = MemoryBuffer::getFile(path, -1, false);
+		if (!bufferOrError)
+		{
+			cerr << program << ": can't open " << path << ": " << errorOf(bufferOrError) << endl;
+			return false;
+		}
+		lifted.buffer = move(bufferOrError.get());
+		
+		auto executableOrError = mainObj.parseExecutable(*lifted.buffer);
+		if (!executableOrError)
+		{
+			cerr << program << ": couldn't parse " << path << ": " << errorOf(executableOrError) << endl;
+			return false;
+		}
+		lifted.executable = move(executableOrError.get());
+		
+		auto moduleOrError = mainObj.generateAnnotatedModule(*lifted.executable, sys::path::stem(path));
+		if (!moduleOrError)
+		{
+			cerr << program << ": couldn't build LLVM module out of " << path << ": " << errorOf(moduleOrError) << endl;
+			return false;
+		}
+		lifted.module = move(moduleOrError.get());
+		return true;
+	}
+	
+	// Both versions are lifted without being optimized, and their functions are matched with fingerprints of the lifted
+	// IR. With --diff-decompile, the new version is then decompiled with only the functions that changed or are new.
+	bool runDiff(Main& mainObj)
+	{
+		LiftedProgram oldVersion;
+		LiftedProgram newVersion;
+		if (!liftProgram(mainObj, inputFile, oldVersion) || !liftProgram(mainObj, batchInputFiles.front(), newVersion))
+		{
+			return false;
+		}
+		
+		vector<FunctionFingerprint> oldFunctions = fingerprintFunctions(*oldVersion.module, *oldVersion.executable);
+		vector<FunctionFingerprint> newFunctions = fingerprintFunctions(*newVersion.module, *newVersion.executable);
+		vector<FunctionMatch> matches = matchFunctions(oldFunctions, newFunctions);
+		printFunctionMatches(matches, diffDecompile ? errs() : outs());
+		if (!diffDecompile)
+		{
+			return true;
+		}
+		
+		unordered_set<uint64_t> changedFunctions;
+		for (const FunctionMatch& match : matches)
+		{
+			if (match.kind == FunctionChanged || match.kind == FunctionNew)
+			{
+				changedFunctions.insert(match.newFunction->address);
+			}
+		}
+		
+		// The old version isn't needed anymore.
+		matches.clear();
+		oldFunctions.clear();
+		oldVersion.module.reset();
+		
+		Module& module = *newVersion.module;
+		auto isChanged = [&](uint64_t address) { return changedFunctions.count(address) != 0; };
+		keepFunctions(module, isChanged);
+		if (!checkTranslations(module) || !mainObj.optimizeAndTransformModule(module, errs(), newVersion.executable.get()))
+		{
+			return false;
+		}
+		pruneFunctions(module, isChanged);
+		return mainObj.generateEquivalentPseudocode(module, outs());
+	}
 }
 
 bool isFullDisassembly()
@@ -677,6 +1372,41 @@ int main(int argc, char** argv)
 		return 1;
 	}
 	
+	if (promotedFunctions.size() > 0 && (tier == FastTier || moduleInCount() == 0))
+	{
+		errs() << sys::path::filename(argv[0]) << ": functions can only be promoted to the full tier from a checkpoint module\n";
+		return 1;
+	}
+	
+	// Workers promote their functions from the supervisor's checkpoint, which only works with the full tier.
+	if (isSupervisedBatch() && (moduleInCount() != 0 || moduleOutCount() != 0 || promotedFunctions.size() > 0 || tier == FastTier))
+	{
+		errs() << sys::path::filename(argv[0]) << ": supervised batches decompile executables to pseudocode with the full tier, and can't be combined with module input, module output, promotion or --tier=fast\n";
+		return 1;
+	}
+	
+	if (diffVersions && (batchInputFiles.size() != 1 || moduleInCount() != 0 || moduleOutCount() != 0 || isSupervisedBatch() || promotedFunctions.size() > 0 || tierCheckpoint != "" || xrefDatabasePath != ""))
+	{
+		errs() << sys::path::filename(argv[0]) << ": --diff compares an old and a new executable, and can't be combined with module input or output, --supervise, --promote, --tier-checkpoint or --xref-db\n";
+		return 1;
+	}
+	
+	if (diffDecompile && !diffVersions)
+	{
+		errs() << sys::path::filename(argv[0]) << ": --diff-decompile requires --diff\n";
+		return 1;
+	}
+	
+	// Batches decompile several programs, or the members of archives, to one output file each.
+	bool isBatch = !diffVersions && (batchInputFiles.size() > 0 || (moduleInCount() == 0 && isArchiveFile(inputFile)));
+	if (isBatch && (moduleInCount() != 0 || isSupervisedBatch() || promotedFunctions.size() > 0 || tierCheckpoint != "" || xrefDatabasePath != ""))
+	{
+		errs() << sys::path::filename(argv[0]) << ": batches can't be combined with module input, --supervise, --promote, --tier-checkpoint or --xref-db\n";
+		return 1;
+	}
+	
+	startProgressReport();
+	PhaseTimer startupTimer("startup", "Startup");
 	Main::initializePasses();
 	
 	Main mainObj(argc, argv);
@@ -688,23 +1418,55 @@ int main(int argc, char** argv)
 	{
 		return 1;
 	}
+	startupTimer.stop();
+	recordMemoryUsage("startup", nullptr);
+	
+	if (isBatch)
+	{
+		PhaseTimer batchTimer("batch", "Batch decompilation");
+		vector<BatchObject> objects;
+		if (!collectBatchObjects(program, objects))
+		{
+			return 1;
+		}
+		
+		bool batchSucceeded = runBatch(mainObj, objects);
+		batchTimer.stop();
+		recordMemoryUsage("batch", nullptr);
+		return batchSucceeded ? 0 : 1;
+	}
+	
+	if (diffVersions)
+	{
+		PhaseTimer diffTimer("diff", "Lifting and matching two versions");
+		bool diffSucceeded = runDiff(mainObj);
+		diffTimer.stop();
+		recordMemoryUsage("diff", nullptr);
+		return diffSucceeded ? 0 : 1;
+	}
 	
 	unique_ptr<Executable> executable;
 	unique_ptr<Module> module;
 	
 	// step one: create annotated module from executable (or load it from .ll)
 	ErrorOr<unique_ptr<MemoryBuffer>> bufferOrError(nullptr);
+	PhaseTimer liftingTimer("lifting", "Executable parsing and lifting");
 	if (moduleInCount())
 	{
 		PrettyStackTraceFormat parsingIR("Parsing IR from \"%s\"", inputFile.c_str());
 		
 		SMDiagnostic errors;
-		module = parseIRFile(inputFile, errors, mainObj.getContext());
+		module = getLazyIRFileModule(inputFile, errors, mainObj.getContext());
 		if (!module)
 		{
 			errors.print(argv[0], errs());
 			return 1;
 		}
+		
+		if (!materializeSelectedFunctions(*module, program))
+		{
+			return 1;
+		}
 	}
 	else
 	{
@@ -734,21 +1496,47 @@ int main(int argc, char** argv)
 		}
 		
 		module = move(moduleOrError.get());
+		
+		if (tierCheckpoint != "" && !saveCheckpoint(*module, tierCheckpoint, errs()))
+		{
+			return 1;
+		}
 	}
 	
+	liftingTimer.stop();
+	recordMemoryUsage("lifting", module.get());
+	
 	// Make sure that the module is legal
-	size_t errorCount = 0;
-	if (Function* assertionFailure = module->getFunction("x86_assertion_failure"))
+	if (!checkTranslations(*module))
 	{
-		errorCount += forEachCall(assertionFailure, 0, [](const string& message) {
-			cerr << "translation assertion failure: " << message << endl;
-		});
+		return 1;
 	}
 	
-	if (errorCount > 0)
+	// Supervised batches have workers load the lifted module from a checkpoint, and decompile it piece by piece.
+	if (isSupervisedBatch())
 	{
-		cerr << "incorrect or missing translations; cannot decompile" << endl;
-		return 1;
+		SmallString<128> checkpointPath(tierCheckpoint);
+		if (checkpointPath.empty())
+		{
+			if (auto errorCode = sys::fs::createTemporaryFile("fcd-checkpoint", "bc", checkpointPath))
+			{
+				errs() << program << ": can't create checkpoint: " << errorCode.message() << '\n';
+				return 1;
+			}
+			if (!saveCheckpoint(*module, checkpointPath, errs()))
+			{
+				sys::fs::remove(checkpointPath);
+				return 1;
+			}
+		}
+		
+		PhaseTimer supervisionTimer("supervision", "Supervised decompilation");
+		bool batchCompleted = runSupervisedBatch(*module, *executable, inputFile, checkpointPath, argc, argv, outs());
+		if (tierCheckpoint == "")
+		{
+			sys::fs::remove(checkpointPath);
+		}
+		return batchCompleted ? 0 : 1;
 	}
 	
 	// if we want module output, this is where we stop
@@ -760,10 +1548,19 @@ int main(int argc, char** argv)
 	
 	if (moduleInCount() < 2)
 	{
+		PhaseTimer optimizationTimer("optimization", "LLVM IR optimization");
 		if (!mainObj.optimizeAndTransformModule(*module, errs(), executable.get()))
 		{
 			return 1;
 		}
+		optimizationTimer.stop();
+		recordMemoryUsage("optimization", module.get());
+	}
+	
+	// Callees of the selected functions were only kept for their analyses.
+	if (moduleInCount() && hasFunctionSelection())
+	{
+		pruneFunctions(*module, isSelectedFunction);
 	}
 	
 	if (moduleOutCount() > 1)
@@ -773,5 +1570,9 @@ int main(int argc, char** argv)
 	}
 	
 	// step three (final step): emit pseudocode
-	return mainObj.generateEquivalentPseudocode(*module, outs()) ? 0 : 1;
+	PhaseTimer pseudocodeTimer("pseudocode", "Pseudocode generation");
+	bool pseudocodeGenerated = mainObj.generateEquivalentPseudocode(*module, outs());
+	pseudocodeTimer.stop();
+	recordMemoryUsage("pseudocode", module.get());
+	return pseudocodeGenerated ? 0 : 1;
 }
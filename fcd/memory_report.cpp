@@ -0,0 +1,256 @@
+//
+// memory_report.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "command_line.h"
+#include "memory_report.h"
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	cl::opt<bool> memoryReport("memory-report", cl::desc("Print memory usage by subsystem at the end of each phase"), whitelist());
+	cl::opt<unsigned> memoryReportFunctions("memory-report-functions", cl::value_desc("count"), cl::desc("Number of functions listed by --memory-report"), cl::init(10), whitelist());
+	
+	const char* subsystemNames[MemorySubsystemCount] = {
+		"AST and symbolic allocators",
+		"Header declarations",
+		"Parameter registry (MemorySSA)",
+		"Pseudocode printer",
+	};
+	
+	atomic<int64_t> currentUsage[MemorySubsystemCount];
+	atomic<int64_t> peakUsage[MemorySubsystemCount];
+	
+	struct FunctionFootprint
+	{
+		string name;
+		uint64_t bytes;
+		size_t instructions;
+	};
+	
+	struct MemorySnapshot
+	{
+		string phase;
+		int64_t subsystemCurrent[MemorySubsystemCount];
+		int64_t subsystemPeak[MemorySubsystemCount];
+		uint64_t residentSize;
+		uint64_t peakResidentSize;
+		uint64_t mallocUsage;
+		
+		bool hasModule;
+		size_t functions;
+		size_t basicBlocks;
+		size_t instructions;
+		size_t metadataAttachments;
+		size_t namedMetadataOperands;
+		size_t structTypes;
+		uint64_t moduleBytes;
+		vector<FunctionFootprint> largestFunctions;
+	};
+	
+	uint64_t getPeakResidentSize()
+	{
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+		{
+			return 0;
+		}
+#ifdef __APPLE__
+		return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+	}
+	
+	// Estimate of the memory that LLVM uses to represent a function. It doesn't account for constants and types, which
+	// belong to the LLVMContext.
+	uint64_t estimateFootprint(const Function& fn, size_t& instructionCount, size_t& attachmentCount)
+	{
+		SmallVector<pair<unsigned, MDNode*>, 4> attachments;
+		uint64_t bytes = sizeof(Function) + fn.arg_size() * sizeof(Argument);
+		for (const BasicBlock& bb : fn)
+		{
+			bytes += sizeof(BasicBlock);
+			for (const Instruction& inst : bb)
+			{
+				bytes += sizeof(Instruction) + inst.getNumOperands() * sizeof(Use);
+				attachments.clear();
+				inst.getAllMetadata(attachments);
+				bytes += attachments.size() * sizeof(attachments[0]);
+				attachmentCount += attachments.size();
+				++instructionCount;
+			}
+		}
+		return bytes;
+	}
+	
+	void measureModule(const Module& module, MemorySnapshot& snapshot)
+	{
+		snapshot.hasModule = true;
+		snapshot.structTypes = module.getIdentifiedStructTypes().size();
+		for (const NamedMDNode& node : module.named_metadata())
+		{
+			snapshot.namedMetadataOperands += node.getNumOperands();
+		}
+		
+		vector<FunctionFootprint> footprints;
+		for (const Function& fn : module)
+		{
+			if (fn.isDeclaration())
+			{
+				continue;
+			}
+			
+			size_t instructions = 0;
+			uint64_t bytes = estimateFootprint(fn, instructions, snapshot.metadataAttachments);
+			snapshot.functions++;
+			snapshot.basicBlocks += fn.size();
+			snapshot.instructions += instructions;
+			snapshot.moduleBytes += bytes;
+			footprints.push_back({fn.getName().str(), bytes, instructions});
+		}
+		
+		size_t keep = min<size_t>(memoryReportFunctions, footprints.size());
+		partial_sort(footprints.begin(), footprints.begin() + keep, footprints.end(), [](const FunctionFootprint& a, const FunctionFootprint& b)
+		{
+			return a.bytes > b.bytes;
+		});
+		footprints.resize(keep);
+		snapshot.largestFunctions = move(footprints);
+	}
+	
+	raw_ostream& printBytes(raw_ostream& os, int64_t bytes)
+	{
+		return os << format("%10.1f KB", static_cast<double>(bytes) / 1024);
+	}
+	
+	class MemoryReport
+	{
+		mutex lock;
+		vector<MemorySnapshot> snapshots;
+		raw_ostream& output;
+	
+	public:
+		MemoryReport()
+		: output(errs())
+		{
+		}
+		
+		void add(MemorySnapshot snapshot)
+		{
+			lock_guard<mutex> guard(lock);
+			snapshots.push_back(move(snapshot));
+		}
+		
+		~MemoryReport()
+		{
+			for (const MemorySnapshot& snapshot : snapshots)
+			{
+				output << "===-- Memory usage after " << snapshot.phase << " --===\n";
+				printBytes(output << "  Resident set size:    ", static_cast<int64_t>(snapshot.residentSize)) << '\n';
+				printBytes(output << "  Peak resident size:   ", static_cast<int64_t>(snapshot.peakResidentSize)) << '\n';
+				printBytes(output << "  Heap:                 ", static_cast<int64_t>(snapshot.mallocUsage)) << '\n';
+				
+				output << "  Subsystems (current, peak since previous phase):\n";
+				for (unsigned i = 0; i < MemorySubsystemCount; ++i)
+				{
+					output << "    " << left_justify(subsystemNames[i], 32);
+					printBytes(output, snapshot.subsystemCurrent[i]);
+					printBytes(output, snapshot.subsystemPeak[i]) << '\n';
+				}
+				
+				if (snapshot.hasModule)
+				{
+					output << "  Module: " << snapshot.functions << " functions, " << snapshot.basicBlocks << " blocks, ";
+					output << snapshot.instructions << " instructions, " << snapshot.metadataAttachments << " metadata attachments, ";
+					output << snapshot.namedMetadataOperands << " named metadata operands, " << snapshot.structTypes << " struct types\n";
+					printBytes(output << "  Estimated IR size:    ", static_cast<int64_t>(snapshot.moduleBytes)) << '\n';
+					
+					if (snapshot.largestFunctions.size() > 0)
+					{
+						output << "  Largest functions:\n";
+						for (const FunctionFootprint& footprint : snapshot.largestFunctions)
+						{
+							printBytes(output << "    ", static_cast<int64_t>(footprint.bytes));
+							output << "  " << footprint.name << " (" << footprint.instructions << " instructions)\n";
+						}
+					}
+				}
+				output << '\n';
+			}
+		}
+	};
+	
+	MemoryReport& getMemoryReport()
+	{
+		static MemoryReport report;
+		return report;
+	}
+}
+
+uint64_t getResidentSize()
+{
+	ifstream statm("/proc/self/statm");
+	uint64_t totalPages = 0;
+	uint64_t residentPages = 0;
+	if (statm >> totalPages >> residentPages)
+	{
+		return residentPages * sys::Process::getPageSize();
+	}
+	return 0;
+}
+
+void trackMemory(MemorySubsystem subsystem, int64_t delta)
+{
+	int64_t usage = currentUsage[subsystem] += delta;
+	int64_t peak = peakUsage[subsystem];
+	while (usage > peak && !peakUsage[subsystem].compare_exchange_weak(peak, usage))
+	{
+	}
+}
+
+void recordMemoryUsage(StringRef phase, const Module* module)
+{
+	if (!memoryReport)
+	{
+		return;
+	}
+	
+	MemorySnapshot snapshot = {};
+	snapshot.phase = phase.str();
+	for (unsigned i = 0; i < MemorySubsystemCount; ++i)
+	{
+		snapshot.subsystemCurrent[i] = currentUsage[i];
+		snapshot.subsystemPeak[i] = peakUsage[i].exchange(snapshot.subsystemCurrent[i]);
+	}
+	
+	snapshot.residentSize = getResidentSize();
+	snapshot.peakResidentSize = getPeakResidentSize();
+	snapshot.mallocUsage = sys::Process::GetMallocUsage();
+	if (module != nullptr)
+	{
+		measureModule(*module, snapshot);
+	}
+	getMemoryReport().add(move(snapshot));
+}
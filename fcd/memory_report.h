@@ -0,0 +1,43 @@
+//
+// memory_report.h
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__memory_report_h
+#define fcd__memory_report_h
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+
+namespace llvm
+{
+	class Module;
+}
+
+enum MemorySubsystem
+{
+	MemoryDumbAllocators,
+	MemoryHeaderDeclarations,
+	MemoryParameterRegistry,
+	MemoryPrinter,
+	MemorySubsystemCount,
+};
+
+// Owners of large structures report how much memory they gain or release. Counters are atomic and always maintained,
+// so that they are correct whenever --memory-report takes a snapshot.
+void trackMemory(MemorySubsystem subsystem, int64_t delta);
+
+// Resident set size of the process, or 0 where it can't be measured.
+uint64_t getResidentSize();
+
+// Takes a snapshot at the end of a phase, for --memory-report: subsystem counters (with their peak since the previous
+// snapshot), module contents, the largest functions, heap usage and resident set size. Snapshots are printed when the
+// program exits, along with phase timers.
+void recordMemoryUsage(llvm::StringRef phase, const llvm::Module* module);
+
+#endif /* fcd__memory_report_h */
@@ -381,3 +381,54 @@ StringRef md::getRecoveredReturnFieldName(Module& module, StructType& returnType
 	
 	return "";
 }
+
+void md::setFunctionIndex(Module& module)
+{
+	removeFunctionIndex(module);
+	
+	LLVMContext& ctx = module.getContext();
+	Type* i1 = Type::getInt1Ty(ctx);
+	auto mdNode = module.getOrInsertNamedMetadata("fcd.functions");
+	for (Function& fn : module)
+	{
+		if (auto address = getVirtualAddress(fn))
+		{
+			Metadata* operands[] = {
+				ValueAsMetadata::get(&fn),
+				ConstantAsMetadata::get(address),
+				ConstantAsMetadata::get(ConstantInt::get(i1, isPrototype(fn))),
+			};
+			mdNode->addOperand(MDNode::get(ctx, operands));
+		}
+	}
+}
+
+vector<md::IndexedFunction> md::getFunctionIndex(Module& module)
+{
+	vector<IndexedFunction> result;
+	if (auto mdNode = module.getNamedMetadata("fcd.functions"))
+	{
+		for (MDNode* entry : mdNode->operands())
+		{
+			if (entry->getNumOperands() == 3)
+			if (auto fnMD = dyn_cast_or_null<ValueAsMetadata>(entry->getOperand(0).get()))
+			if (auto fn = dyn_cast<Function>(fnMD->getValue()))
+			if (auto addressMD = dyn_cast<ConstantAsMetadata>(entry->getOperand(1)))
+			if (auto prototypeMD = dyn_cast<ConstantAsMetadata>(entry->getOperand(2)))
+			{
+				uint64_t address = cast<ConstantInt>(addressMD->getValue())->getLimitedValue();
+				bool prototype = !cast<ConstantInt>(prototypeMD->getValue())->isZero();
+				result.push_back({fn, address, prototype});
+			}
+		}
+	}
+	return result;
+}
+
+void md::removeFunctionIndex(Module& module)
+{
+	if (auto mdNode = module.getNamedMetadata("fcd.functions"))
+	{
+		module.eraseNamedMetadata(mdNode);
+	}
+}
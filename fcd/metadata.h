@@ -22,6 +22,13 @@
 
 namespace md
 {
+	struct IndexedFunction
+	{
+		llvm::Function* function;
+		uint64_t virtualAddress;
+		bool isPrototype;
+	};
+	
 	void ensureFunctionBody(llvm::Function& fn);
 	
 	std::vector<std::string> getIncludedFiles(llvm::Module& module);
@@ -55,6 +62,12 @@ namespace md
 	
 	void setRecoveredReturnFieldNames(llvm::Module& module, llvm::StructType& returnType, const CallInformation& callInfo);
 	llvm::StringRef getRecoveredReturnFieldName(llvm::Module& module, llvm::StructType& returnType, unsigned i);
+	
+	// Module-level index of function addresses. Unlike function metadata, it can be read from bitcode without
+	// materializing function bodies.
+	void setFunctionIndex(llvm::Module& module);
+	std::vector<IndexedFunction> getFunctionIndex(llvm::Module& module);
+	void removeFunctionIndex(llvm::Module& module);
 }
 
 #endif /* fcd__metadata_h */
@@ -0,0 +1,443 @@
+//
+// pass_adaptive.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "command_line.h"
+#include "passes.h"
+
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/LegacyPassManagers.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <map>
+#include <memory>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	cl::opt<unsigned> largeFunctionInstructions(
+		"large-function-instructions", cl::value_desc("count"),
+		cl::desc("Number of instructions above which a function is optimized with the large function policy"),
+		cl::init(25000),
+		whitelist()
+	);
+	
+	cl::opt<unsigned> largeFunctionComplexity(
+		"large-function-complexity", cl::value_desc("count"),
+		cl::desc("Cyclomatic complexity above which a function is optimized with the large function policy"),
+		cl::init(2500),
+		whitelist()
+	);
+	
+	cl::list<string> largeFunctionPolicy(
+		"large-function-policy", cl::value_desc("pass=replacement"),
+		cl::desc("Pass substitutions for large functions (leave the replacement empty to skip the pass)"),
+		cl::CommaSeparated,
+		whitelist()
+	);
+	
+	// Substitutions used when none are specified on the command line. GVN is quadratic-ish on very large functions, and
+	// recoverstackframe and memssadle build structures proportional to the number of memory accesses.
+	const pair<const char*, const char*> defaultLargeFunctionPolicy[] = {
+		{"gvn", "early-cse"},
+		{"recoverstackframe", ""},
+		{"memssadle", ""},
+	};
+	
+	struct FunctionSize
+	{
+		size_t instructions;
+		size_t blocks;
+		size_t edges;
+		
+		size_t complexity() const
+		{
+			return edges + 2 > blocks ? edges + 2 - blocks : 0;
+		}
+		
+		bool isLarge() const
+		{
+			return instructions > largeFunctionInstructions || complexity() > largeFunctionComplexity;
+		}
+	};
+	
+	FunctionSize measure(Function& fn)
+	{
+		FunctionSize size = {0, 0, 0};
+		for (BasicBlock& bb : fn)
+		{
+			size.instructions += bb.size();
+			size.blocks++;
+			size.edges += bb.getTerminator()->getNumSuccessors();
+		}
+		return size;
+	}
+	
+	// Large functions met by size-adaptive passes, reported once after the pipeline runs instead of once per function
+	// and pass.
+	struct LargeFunctionSummary
+	{
+		map<string, FunctionSize> functions;
+		vector<string> substitutions;
+		
+		void add(Function& fn, const FunctionSize& size, const string& original, const string& replacement)
+		{
+			functions.insert({fn.getName().str(), size});
+			string substitution = replacement.empty() ? "skipped " + original : replacement + " instead of " + original;
+			if (find(substitutions.begin(), substitutions.end(), substitution) == substitutions.end())
+			{
+				substitutions.push_back(move(substitution));
+			}
+		}
+	};
+	
+	LargeFunctionSummary& getSummary()
+	{
+		static LargeFunctionSummary summary;
+		return summary;
+	}
+	
+	// Runs either the original function pass or its replacement on each function, so that the substitution stays in
+	// the function pass manager's batch. The wrapper requires what either pass requires and only preserves what both
+	// preserve. The inner passes get their own resolvers, which are filled from the wrapper's pass manager before they
+	// run.
+	struct SizeAdaptivePass final : public FunctionPass
+	{
+		static char ID;
+		string original;
+		string replacement;
+		string passName;
+		unique_ptr<FunctionPass> originalPass;
+		unique_ptr<FunctionPass> replacementPass;
+		
+		SizeAdaptivePass(StringRef original, FunctionPass* originalPass, StringRef replacement, FunctionPass* replacementPass)
+		: FunctionPass(ID), original(original.str()), replacement(replacement.str()), originalPass(originalPass), replacementPass(replacementPass)
+		{
+			passName = "Size-Adaptive " + this->original;
+		}
+		
+		virtual StringRef getPassName() const override
+		{
+			return passName;
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			AnalysisUsage originalUsage;
+			originalPass->getAnalysisUsage(originalUsage);
+			AnalysisUsage replacementUsage;
+			if (replacementPass)
+			{
+				replacementPass->getAnalysisUsage(replacementUsage);
+			}
+			else
+			{
+				replacementUsage.setPreservesAll();
+			}
+			
+			for (const AnalysisUsage* usage : {&originalUsage, &replacementUsage})
+			{
+				for (AnalysisID id : usage->getRequiredSet())
+				{
+					au.addRequiredID(id);
+				}
+				for (AnalysisID id : usage->getUsedSet())
+				{
+					au.addUsedIfAvailableID(id);
+				}
+			}
+			
+			if (originalUsage.getPreservesAll() && replacementUsage.getPreservesAll())
+			{
+				au.setPreservesAll();
+				return;
+			}
+			
+			auto preserves = [](const AnalysisUsage& usage, AnalysisID id)
+			{
+				const auto& preserved = usage.getPreservedSet();
+				return usage.getPreservesAll() || find(preserved.begin(), preserved.end(), id) != preserved.end();
+			};
+			for (const AnalysisUsage* usage : {&originalUsage, &replacementUsage})
+			{
+				for (AnalysisID id : usage->getPreservedSet())
+				{
+					if (preserves(originalUsage, id) && preserves(replacementUsage, id))
+					{
+						au.addPreservedID(id);
+					}
+				}
+			}
+		}
+		
+		virtual bool doInitialization(Module& m) override
+		{
+			bool changed = false;
+			for (FunctionPass* pass : {originalPass.get(), replacementPass.get()})
+			{
+				if (pass != nullptr)
+				{
+					if (pass->getResolver() == nullptr)
+					{
+						pass->setResolver(new AnalysisResolver(getResolver()->getPMDataManager()));
+					}
+					changed |= pass->doInitialization(m);
+				}
+			}
+			return changed;
+		}
+		
+		virtual bool runOnFunction(Function& fn) override
+		{
+			FunctionPass* pass = originalPass.get();
+			FunctionSize size = measure(fn);
+			if (size.isLarge())
+			{
+				getSummary().add(fn, size, original, replacement);
+				pass = replacementPass.get();
+			}
+			
+			if (pass == nullptr)
+			{
+				return false;
+			}
+			getResolver()->getPMDataManager().initializeAnalysisImpl(pass);
+			return pass->runOnFunction(fn);
+		}
+		
+		virtual bool doFinalization(Module& m) override
+		{
+			bool changed = false;
+			for (FunctionPass* pass : {originalPass.get(), replacementPass.get()})
+			{
+				if (pass != nullptr)
+				{
+					changed |= pass->doFinalization(m);
+				}
+			}
+			return changed;
+		}
+	};
+	
+	char SizeAdaptivePass::ID = 0;
+	
+	// Module passes already end the function pass manager's batch, so gates around them can hide functions with the
+	// optnone attribute instead. This is the state shared by the three gates that surround a substituted module pass.
+	struct Substitution
+	{
+		struct Suppression
+		{
+			WeakVH function;
+			bool addedNoInline;
+		};
+		
+		string original;
+		string replacement;
+		vector<WeakVH> largeFunctions;
+		vector<Suppression> suppressed;
+		
+		void suppress(Function& fn)
+		{
+			if (!fn.hasFnAttribute(Attribute::OptimizeNone))
+			{
+				bool addNoInline = !fn.hasFnAttribute(Attribute::NoInline);
+				if (addNoInline)
+				{
+					fn.addFnAttr(Attribute::NoInline);
+				}
+				fn.addFnAttr(Attribute::OptimizeNone);
+				suppressed.push_back({WeakVH(&fn), addNoInline});
+			}
+		}
+		
+		void restore()
+		{
+			for (auto& suppression : suppressed)
+			{
+				if (auto fn = cast_or_null<Function>(static_cast<Value*>(suppression.function)))
+				{
+					fn->removeFnAttr(Attribute::OptimizeNone);
+					if (suppression.addedNoInline)
+					{
+						fn->removeFnAttr(Attribute::NoInline);
+					}
+				}
+			}
+			suppressed.clear();
+		}
+	};
+	
+	struct SizeAdaptiveGate final : public ModulePass
+	{
+		enum Stage
+		{
+			// Classifies functions and hides large functions from the original pass.
+			Enter,
+			// Hides small functions from the replacement pass.
+			Swap,
+			// Restores every function.
+			Leave,
+		};
+		
+		static char ID;
+		shared_ptr<Substitution> substitution;
+		Stage stage;
+		
+		SizeAdaptiveGate(shared_ptr<Substitution> substitution, Stage stage)
+		: ModulePass(ID), substitution(move(substitution)), stage(stage)
+		{
+		}
+		
+		virtual StringRef getPassName() const override
+		{
+			return "Size-Adaptive Pass Gate";
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			au.setPreservesAll();
+		}
+		
+		virtual bool runOnModule(Module& m) override
+		{
+			if (stage == Enter)
+			{
+				substitution->largeFunctions.clear();
+				for (Function& fn : m)
+				{
+					if (!fn.isDeclaration())
+					{
+						FunctionSize size = measure(fn);
+						if (size.isLarge())
+						{
+							getSummary().add(fn, size, substitution->original, substitution->replacement);
+							substitution->largeFunctions.emplace_back(&fn);
+							substitution->suppress(fn);
+						}
+					}
+				}
+			}
+			else if (stage == Swap)
+			{
+				substitution->restore();
+				SmallPtrSet<Value*, 16> large;
+				for (auto& handle : substitution->largeFunctions)
+				{
+					large.insert(handle);
+				}
+				
+				for (Function& fn : m)
+				{
+					if (!fn.isDeclaration() && large.count(&fn) == 0)
+					{
+						substitution->suppress(fn);
+					}
+				}
+			}
+			else
+			{
+				substitution->restore();
+				substitution->largeFunctions.clear();
+			}
+			return false;
+		}
+	};
+	
+	char SizeAdaptiveGate::ID = 0;
+}
+
+bool getLargeFunctionReplacement(StringRef passName, string& replacement)
+{
+	if (largeFunctionPolicy.empty())
+	{
+		for (const auto& pair : defaultLargeFunctionPolicy)
+		{
+			if (passName == pair.first)
+			{
+				replacement = pair.second;
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	for (const string& entry : largeFunctionPolicy)
+	{
+		auto split = StringRef(entry).split('=');
+		if (split.first.trim() == passName)
+		{
+			replacement = split.second.trim().str();
+			return true;
+		}
+	}
+	return false;
+}
+
+void addSizeAdaptivePasses(vector<Pass*>& passes, StringRef originalName, Pass* original, StringRef replacementName, Pass* replacement)
+{
+	if (original->getPassKind() == PT_Function && (replacement == nullptr || replacement->getPassKind() == PT_Function))
+	{
+		auto replacementFunctionPass = static_cast<FunctionPass*>(replacement);
+		passes.push_back(new SizeAdaptivePass(originalName, static_cast<FunctionPass*>(original), replacementName, replacementFunctionPass));
+		return;
+	}
+	
+	auto substitution = make_shared<Substitution>();
+	substitution->original = originalName.str();
+	substitution->replacement = replacementName.str();
+	
+	passes.push_back(new SizeAdaptiveGate(substitution, SizeAdaptiveGate::Enter));
+	passes.push_back(original);
+	if (replacement != nullptr)
+	{
+		passes.push_back(new SizeAdaptiveGate(substitution, SizeAdaptiveGate::Swap));
+		passes.push_back(replacement);
+	}
+	passes.push_back(new SizeAdaptiveGate(substitution, SizeAdaptiveGate::Leave));
+}
+
+bool isLargeFunction(Function& fn)
+{
+	return measure(fn).isLarge();
+}
+
+void reportLargeFunctions(raw_ostream& os, StringRef programName)
+{
+	LargeFunctionSummary& summary = getSummary();
+	if (summary.functions.empty())
+	{
+		return;
+	}
+	
+	os << programName << ": " << summary.functions.size() << " large function";
+	os << (summary.functions.size() == 1 ? "" : "s") << " optimized with the large function policy (";
+	for (size_t i = 0; i < summary.substitutions.size(); ++i)
+	{
+		os << (i == 0 ? "" : ", ") << summary.substitutions[i];
+	}
+	os << "):";
+	
+	const size_t listedFunctions = 10;
+	size_t listed = 0;
+	for (const auto& pair : summary.functions)
+	{
+		if (listed == listedFunctions)
+		{
+			os << " and " << summary.functions.size() - listed << " more";
+			break;
+		}
+		os << (listed == 0 ? " " : ", ") << pair.first << " (" << pair.second.instructions << " instructions, complexity ";
+		os << pair.second.complexity() << ")";
+		++listed;
+	}
+	os << '\n';
+	summary = LargeFunctionSummary();
+}
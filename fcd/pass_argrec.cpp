@@ -11,7 +11,8 @@
 #include "pass_argrec.h"
 #include "passes.h"
 
-#include <llvm/Analysis/CallGraph.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/Analysis/Passes.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Instruction.h>
@@ -19,9 +20,57 @@
 #include <llvm/IR/Module.h>
 #include <llvm/Support/raw_os_ostream.h>
 
+#include <algorithm>
+
 using namespace llvm;
 using namespace std;
 
+namespace
+{
+	struct RecoveryTarget
+	{
+		Function* function;
+		Function* definition;
+		const CallInformation* callInfo;
+		unique_ptr<CallInformation> ownedInfo;
+	};
+	
+	// Records the edges of a function that the call graph has not seen yet (or that changed completely), the same way
+	// that CallGraph does when it is built.
+	void resetCallEdges(CallGraph& callGraph, Function& fn)
+	{
+		CallGraphNode* node = callGraph.getOrInsertFunction(&fn);
+		node->removeAllCalledFunctions();
+		if (fn.isDeclaration())
+		{
+			if (!fn.isIntrinsic())
+			{
+				node->addCalledFunction(CallSite(), callGraph.getCallsExternalNode());
+			}
+			return;
+		}
+		
+		for (BasicBlock& bb : fn)
+		{
+			for (Instruction& inst : bb)
+			{
+				if (auto call = dyn_cast<CallInst>(&inst))
+				{
+					Function* callee = call->getCalledFunction();
+					if (callee == nullptr)
+					{
+						node->addCalledFunction(CallSite(call), callGraph.getCallsExternalNode());
+					}
+					else if (!callee->isIntrinsic())
+					{
+						node->addCalledFunction(CallSite(call), callGraph.getOrInsertFunction(callee));
+					}
+				}
+			}
+		}
+	}
+}
+
 char ArgumentRecovery::ID = 0;
 
 Value* ArgumentRecovery::getRegisterPtr(Function& fn)
@@ -46,32 +95,131 @@ void ArgumentRecovery::getAnalysisUsage(AnalysisUsage& au) const
 {
 	au.addRequired<ParameterRegistry>();
 	au.addRequired<CallGraphWrapperPass>();
+	au.addPreserved<CallGraphWrapperPass>();
 	ModulePass::getAnalysisUsage(au);
 }
 
 bool ArgumentRecovery::runOnModule(Module& module)
 {
+	callGraph = &getAnalysis<CallGraphWrapperPass>().getCallGraph();
 	for (Function& fn : module.getFunctionList())
 	{
 		getRegisterPtr(fn);
 	}
 	
-	bool changed = false;
+	// Callees go before their callers, so that a body moves to its parameterized function once every call that it
+	// contains has been rewritten. Functions that the call graph can't reach go last.
+	vector<RecoveryTarget> targets;
+	SmallPtrSet<Function*, 64> ordered;
+	auto addTarget = [&](Function* fn)
+	{
+		if (fn != nullptr && md::areArgumentsRecoverable(*fn) && ordered.insert(fn).second)
+		{
+			targets.emplace_back();
+			targets.back().function = fn;
+		}
+	};
+	
+	for (auto iter = scc_begin(callGraph); !iter.isAtEnd(); ++iter)
+	{
+		for (CallGraphNode* node : *iter)
+		{
+			addTarget(node->getFunction());
+		}
+	}
 	for (Function& fn : module.getFunctionList())
 	{
-		if (md::areArgumentsRecoverable(fn))
+		addTarget(&fn);
+	}
+	
+	// Resolve call information before any call site changes. Rewriting a call changes the version of its caller, which
+	// would discard the call site analyses that ParameterRegistry cached for that caller.
+	for (RecoveryTarget& target : targets)
+	{
+		target.callInfo = resolveCallInformation(*target.function, target.definition, target.ownedInfo);
+	}
+	
+	bool changed = false;
+	for (RecoveryTarget& target : targets)
+	{
+		if (target.callInfo != nullptr)
 		{
-			changed |= recoverArguments(fn);
+			recoverArguments(*target.function, target.definition, *target.callInfo);
+			changed = true;
 		}
 	}
 	
-	getAnalysis<CallGraphWrapperPass>().releaseMemory();
+	updateRewrittenCallEdges();
+	eraseReplacedFunctions(module);
+	return changed;
+}
+
+void ArgumentRecovery::updateRewrittenCallEdges()
+{
+	// Searching a caller's edges for every rewritten call is quadratic in its number of calls. Instead, each function
+	// that contains a rewritten call has its edges rebuilt once, after every call has been rewritten and every body has
+	// moved to its parameterized function.
+	SmallPtrSet<Function*, 16> callers;
+	for (CallInst* call : rewrittenCalls)
+	{
+		callers.insert(call->getFunction());
+	}
+	rewrittenCalls.clear();
+	
+	for (Function* caller : callers)
+	{
+		resetCallEdges(*callGraph, *caller);
+	}
+}
+
+void ArgumentRecovery::eraseReplacedFunctions(Module& module)
+{
+	// Calls to replaced functions have all been rewritten, but the external calling node still refers to them. Its
+	// edges are recreated once rather than searched for each erased function.
+	CallGraphNode* externalNode = callGraph->getExternalCallingNode();
+	externalNode->removeAllCalledFunctions();
 	for (Function* toErase : functionsToErase)
 	{
-		toErase->eraseFromParent();
+		CallGraphNode* node = callGraph->getOrInsertFunction(toErase);
+		node->removeAllCalledFunctions();
+		delete callGraph->removeFunctionFromModule(node);
 	}
+	functionsToErase.clear();
 	
-	return changed;
+	for (Function& fn : module)
+	{
+		if (!fn.hasLocalLinkage() || fn.hasAddressTaken())
+		{
+			externalNode->addCalledFunction(CallSite(), callGraph->getOrInsertFunction(&fn));
+		}
+	}
+}
+
+const CallInformation* ArgumentRecovery::resolveCallInformation(Function& fn, Function*& definition, unique_ptr<CallInformation>& ownedInfo)
+{
+	ParameterRegistry& paramRegistry = getAnalysis<ParameterRegistry>();
+	definition = nullptr;
+	if (Function* prototype = md::getFinalPrototype(fn))
+	if (const CallInformation* callInfo = paramRegistry.getDefinitionCallInfo(*prototype))
+	{
+		definition = prototype;
+		return callInfo;
+	}
+	
+	if (md::isPrototype(fn))
+	{
+		// find a call site and consider it canon
+		for (auto user : fn.users())
+		{
+			if (auto call = dyn_cast<CallInst>(user))
+			{
+				ownedInfo = paramRegistry.analyzeCallSite(CallSite(call));
+				return ownedInfo.get();
+			}
+		}
+		return nullptr;
+	}
+	return paramRegistry.getCallInfo(fn);
 }
 
 Function& ArgumentRecovery::createParameterizedFunction(Function& base, const CallInformation& callInfo)
@@ -108,6 +256,7 @@ Function& ArgumentRecovery::createParameterizedFunction(Function& base, const Ca
 		++i;
 	}
 	
+	resetCallEdges(*callGraph, *newFunc);
 	return *newFunc;
 }
 
@@ -123,7 +272,8 @@ void ArgumentRecovery::fixCallSites(Function& base, Function& newTarget, const C
 		auto registers = getRegisterPtr(*caller);
 		auto newCall = createCallSite(*targetInfo, ci, newTarget, *registers, *call);
 		
-		// replace call
+		// replace call; the call graph catches up in updateRewrittenCallEdges
+		rewrittenCalls.push_back(newCall);
 		newCall->takeName(call);
 		call->eraseFromParent();
 		
@@ -202,6 +352,11 @@ void ArgumentRecovery::updateFunctionBody(Function& oldFunction, Function& newFu
 	newFunction.getBasicBlockList().splice(newFunction.begin(), oldFunction.getBasicBlockList());
 	oldFunction.deleteBody();
 	
+	// The calls moved with the body, and so do their call graph edges.
+	CallGraphNode* newNode = callGraph->getOrInsertFunction(&newFunction);
+	newNode->removeAllCalledFunctions();
+	newNode->stealCalledFunctionsFrom(callGraph->getOrInsertFunction(&oldFunction));
+	
 	// Create a register structure at the beginning of the function and copy arguments to it.
 	Argument* oldArg0 = &*oldFunction.arg_begin();
 	Type* registerStruct = oldArg0->getType()->getPointerElementType();
@@ -433,75 +588,44 @@ CallInst* ArgumentRecovery::createCallSite(TargetInfo& targetInfo, const CallInf
 	return newCall;
 }
 
-bool ArgumentRecovery::recoverArguments(Function& fn)
+void ArgumentRecovery::recoverArguments(Function& fn, Function* definition, const CallInformation& callInfo)
 {
-	ParameterRegistry& paramRegistry = getAnalysis<ParameterRegistry>();
-	
-	unique_ptr<CallInformation> uniqueCallInfo;
-	const CallInformation* callInfo = nullptr;
-	Function* parameterizedFunction = nullptr;
-	if (Function* prototype = md::getFinalPrototype(fn))
-	{
-		callInfo = paramRegistry.getDefinitionCallInfo(*prototype);
-		if (callInfo != nullptr)
-		{
-			parameterizedFunction = prototype;
-			if (md::isPrototype(fn))
-			{
-				prototype->deleteBody();
-			}
-			
-			parameterizedFunction->takeName(&fn);
-			
-			// Set stub parameter names.
-			SmallVector<string, 8> parameterNames;
-			auto& module = *prototype->getParent();
-			auto info = TargetInfo::getTargetInfo(module);
-			(void) createFunctionType(*info, *callInfo, module, fn.getName().str(), parameterNames);
-			size_t paramIndex = 0;
-			for (Argument& arg : parameterizedFunction->args())
-			{
-				assert(paramIndex < parameterNames.size());
-				arg.setName(parameterNames[paramIndex]);
-				++paramIndex;
-			}
-		}
-	}
-	
-	if (callInfo == nullptr)
+	Function* parameterizedFunction = definition;
+	if (definition != nullptr)
 	{
 		if (md::isPrototype(fn))
 		{
-			// find a call site and consider it canon
-			for (auto user : fn.users())
-			{
-				if (auto call = dyn_cast<CallInst>(user))
-				{
-					uniqueCallInfo = paramRegistry.analyzeCallSite(CallSite(call));
-					callInfo = uniqueCallInfo.get();
-					break;
-				}
-			}
+			definition->deleteBody();
+			resetCallEdges(*callGraph, *definition);
 		}
-		else
+		
+		definition->takeName(&fn);
+		
+		// Set stub parameter names.
+		SmallVector<string, 8> parameterNames;
+		auto& module = *definition->getParent();
+		auto info = TargetInfo::getTargetInfo(module);
+		(void) createFunctionType(*info, callInfo, module, fn.getName().str(), parameterNames);
+		size_t paramIndex = 0;
+		for (Argument& arg : definition->args())
 		{
-			callInfo = paramRegistry.getCallInfo(fn);
+			assert(paramIndex < parameterNames.size());
+			arg.setName(parameterNames[paramIndex]);
+			++paramIndex;
 		}
-		parameterizedFunction = &createParameterizedFunction(fn, *callInfo);
 	}
+	else
+	{
+		parameterizedFunction = &createParameterizedFunction(fn, callInfo);
+	}
+	
+	fixCallSites(fn, *parameterizedFunction, callInfo);
 	
-	if (callInfo != nullptr)
+	if (!md::isPrototype(fn))
 	{
-		fixCallSites(fn, *parameterizedFunction, *callInfo);
-		
-		if (!md::isPrototype(fn))
-		{
-			updateFunctionBody(fn, *parameterizedFunction, *callInfo);
-			functionsToErase.push_back(&fn);
-		}
-		return true;
+		updateFunctionBody(fn, *parameterizedFunction, callInfo);
+		functionsToErase.push_back(&fn);
 	}
-	return false;
 }
 
 ModulePass* createArgumentRecoveryPass()
@@ -13,28 +13,36 @@
 #include "params_registry.h"
 
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/CallGraph.h>
 #include <llvm/Analysis/Passes.h>
 #include <llvm/IR/Module.h>
 
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 class ArgumentRecovery final : public llvm::ModulePass
 {
 	std::unordered_map<const llvm::Function*, llvm::Value*> registerPtr;
 	llvm::SmallVector<llvm::Function*, 10> functionsToErase;
+	std::vector<llvm::CallInst*> rewrittenCalls;
+	llvm::CallGraph* callGraph;
 	
 	llvm::Value* getRegisterPtr(llvm::Function& fn);
 	
+	const CallInformation* resolveCallInformation(llvm::Function& fn, llvm::Function*& definition, std::unique_ptr<CallInformation>& ownedInfo);
 	llvm::Function& createParameterizedFunction(llvm::Function& base, const CallInformation& ci);
 	void fixCallSites(llvm::Function& base, llvm::Function& newTarget, const CallInformation& ci);
 	llvm::Value* createReturnValue(llvm::Function& function, const CallInformation& ci, llvm::Instruction* insertionPoint);
 	void updateFunctionBody(llvm::Function& oldFunction, llvm::Function& newTarget, const CallInformation& ci);
-	bool recoverArguments(llvm::Function& fn);
+	void recoverArguments(llvm::Function& fn, llvm::Function* definition, const CallInformation& callInfo);
+	void updateRewrittenCallEdges();
+	void eraseReplacedFunctions(llvm::Module& module);
 	
 public:
 	static char ID;
 	
-	ArgumentRecovery() : ModulePass(ID)
+	ArgumentRecovery() : ModulePass(ID), callGraph(nullptr)
 	{
 	}
 	
@@ -7,15 +7,14 @@
 // license. See LICENSE.md for details.
 //
 
-#include "dumb_allocator.h"
 #include "metadata.h"
 #include "passes.h"
 
 #include <llvm/IR/PatternMatch.h>
+#include <llvm/Support/MathExtras.h>
 
-#include <deque>
+#include <limits>
 #include <map>
-#include <unordered_map>
 #include <vector>
 
 using namespace llvm;
@@ -30,800 +29,376 @@ namespace
 		return N;
 	}
 	
-	class StackObject
+	unsigned getTypePriority(Type* t)
 	{
-	public:
-		enum ObjectType
-		{
-			Object,
-			Structure,
+		static constexpr unsigned typePriority[] = {
+			[Type::ArrayTyID] = 5,
+			[Type::StructTyID] = 4,
+			[Type::PointerTyID] = 3,
+			[Type::FloatTyID] = 2,
+			[Type::IntegerTyID] = 1,
 		};
 		
-	private:
-		ObjectType type;
-		
-	public:
-		StackObject(ObjectType type, StackObject* parent = nullptr)
-		: type(type)
-		{
-		}
-		
-		virtual ~StackObject() = default;
-		
-		ObjectType getType() const { return type; }
-		
-		virtual void print(raw_ostream& os) const = 0;
-		void dump() const
+		auto id = t->getTypeID();
+		if (id >= countof(typePriority))
 		{
-			auto& stream = errs();
-			print(stream);
-			stream << '\n';
+			return 0;
 		}
-	};
+		return typePriority[id];
+	}
 	
-	class ObjectStackObject : public StackObject
+	// Types of the memory accessed through an inttoptr cast. An integer that is loaded and then cast to a pointer means
+	// that the location holds a pointer.
+	void getCastTypes(CastInst* cast, SmallPtrSetImpl<Type*>& types)
 	{
-		Value& offset;
-		
-		static void getCastTypes(CastInst* cast, SmallPtrSetImpl<Type*>& types)
+		for (User* user : cast->users())
 		{
-			for (User* user : cast->users())
+			if (auto load = dyn_cast<LoadInst>(user))
 			{
-				if (auto load = dyn_cast<LoadInst>(user))
+				auto loadType = load->getType();
+				types.insert(loadType);
+				
+				if (loadType->isIntegerTy())
 				{
-					auto loadType = load->getType();
-					types.insert(loadType);
-					
-					if (loadType->isIntegerTy())
+					// see if that load is casted into something else
+					for (User* loadUser : load->users())
 					{
-						// see if that load is casted into something else
-						for (User* loadUser : load->users())
+						if (auto subcast = dyn_cast<CastInst>(loadUser))
+						if (subcast->getOpcode() == CastInst::IntToPtr)
 						{
-							if (auto subcast = dyn_cast<CastInst>(loadUser))
-							if (subcast->getOpcode() == CastInst::IntToPtr)
+							SmallPtrSet<Type*, 2> castTypes;
+							getCastTypes(subcast, castTypes);
+							
+							for (Type* t : castTypes)
 							{
-								SmallPtrSet<Type*, 2> castTypes;
-								getCastTypes(subcast, castTypes);
-								
-								for (Type* t : castTypes)
-								{
-									types.insert(t->getPointerTo());
-								}
+								types.insert(t->getPointerTo());
 							}
 						}
 					}
 				}
-				else if (auto store = dyn_cast<StoreInst>(user))
-				{
-					types.insert(store->getValueOperand()->getType());
-				}
 			}
-		}
-		
-	public:
-		static bool classof(const StackObject* obj)
-		{
-			return obj->getType() == Object;
-		}
-		
-		ObjectStackObject(Value& offset, StackObject& parent)
-		: StackObject(Object, &parent), offset(offset)
-		{
-		}
-		
-		Value* getOffsetValue() const { return &offset; }
-		
-		void getUnionTypes(SmallPtrSetImpl<Type*>& types) const
-		{
-			//
-			// The offset may be used as:
-			//
-			// * an int2ptr cast operand leading to load/store instructions;
-			// * a call argument;
-			// * the value operand of a store instruction;
-			// * an offset base to something else (we ignore that case here though).
-			//
-			// Only int2ptr -> load/store are useful to determine the type at an offset (at least until we have typed
-			// function parameters). However, if we only see another use, we can determine that there's *at least
-			// something* there; so default to void*.
-			//
-			
-			size_t initialSize = types.size();
-			for (User* offsetUser : offset.users())
-			{
-				if (auto cast = dyn_cast<CastInst>(offsetUser))
-				{
-					getCastTypes(cast, types);
-				}
-				else if (!isa<StoreInst>(offsetUser) && !isa<CallInst>(offsetUser))
-				{
-					assert(isa<BinaryOperator>(offsetUser) || isa<PHINode>(offsetUser) || isa<SelectInst>(offsetUser) || isa<CmpInst>(offsetUser));
-				}
-			}
-			
-			if (types.size() == initialSize)
-			{
-				// If there's no access, assume that there's at least a byte there.
-				types.insert(Type::getVoidTy(offset.getContext()));
-			}
-		}
-		
-		virtual void print(raw_ostream& os) const override
-		{
-			os << '(';
-			SmallPtrSet<Type*, 1> types;
-			getUnionTypes(types);
-			auto iter = types.begin();
-			auto end = types.end();
-			if (iter != end)
+			else if (auto store = dyn_cast<StoreInst>(user))
 			{
-				(*iter)->print(os);
-				for (++iter; iter != end; ++iter)
-				{
-					os << ", ";
-					(*iter)->print(os);
-				}
+				types.insert(store->getValueOperand()->getType());
 			}
-			os << ')';
 		}
+	}
+	
+	struct TypedAccess
+	{
+		int64_t offset;
+		Type* type;
 	};
 	
-	class StructureStackObject : public StackObject
+	// Accesses relative to a base pointer that is offset by a variable.
+	struct ArrayAccesses
 	{
-	public:
-		struct StructureField
+		uint64_t stride;
+		vector<TypedAccess> elementAccesses;
+	};
+	
+	// A base pointer plus a variable index, scaled by the array stride.
+	struct VariableOffset
+	{
+		Instruction* value;
+		int64_t base;
+		uint64_t stride;
+		Value* index;
+	};
+	
+	// Everything that recoverstackframe learns about a stack frame, collected with a single traversal of the values
+	// derived from the stack pointer.
+	struct StackFrameAccesses
+	{
+		// Values that are the stack pointer plus a constant, in the order in which they were found.
+		vector<pair<Value*, int64_t>> constantOffsets;
+		vector<VariableOffset> variableOffsets;
+		vector<TypedAccess> scalarAccesses;
+		map<int64_t, ArrayAccesses> arrays;
+	};
+	
+	void getStride(Value* offset, uint64_t& stride, Value*& index)
+	{
+		ConstantInt* scale;
+		if (match(offset, m_Mul(m_Value(index), m_ConstantInt(scale))) || match(offset, m_Mul(m_ConstantInt(scale), m_Value(index))))
 		{
-			int64_t offset;
-			unique_ptr<StackObject> object;
-			
-			StructureField(int64_t offset, unique_ptr<StackObject> object)
-			: offset(offset), object(move(object))
-			{
-			}
-			
-			StructureField(int64_t offset, StackObject* object)
-			: offset(offset), object(object)
-			{
-			}
-			
-			void print(raw_ostream& os) const
+			if (scale->getSExtValue() > 0)
 			{
-				os << offset << ": ";
-				object->print(os);
+				stride = scale->getLimitedValue();
+				return;
 			}
-		};
-		
-	private:
-		vector<StructureField> fields;
-		
-	public:
-		static bool classof(const StackObject* obj)
-		{
-			return obj->getType() == Structure;
-		}
-		
-		StructureStackObject(StackObject* parent = nullptr)
-		: StackObject(Structure, parent)
-		{
 		}
-		
-		auto begin() { return fields.begin(); }
-		auto end() { return fields.end(); }
-		auto begin() const { return fields.begin(); }
-		auto end() const { return fields.end(); }
-		
-		size_t size() const { return fields.size(); }
-		
-		template<typename... Args>
-		void insert(decltype(fields)::iterator position, Args&&... args)
+		else if (match(offset, m_Shl(m_Value(index), m_ConstantInt(scale))))
 		{
-			fields.emplace(position, std::forward<Args>(args)...);
-		}
-		
-		template<typename... Args>
-		void insert(Args&&... args)
-		{
-			insert(end(), std::forward<Args>(args)...);
-		}
-		
-		virtual void print(raw_ostream& os) const override
-		{
-			os << '{';
-			auto iter = begin();
-			if (iter != end())
+			if (scale->getLimitedValue() < 32)
 			{
-				iter->print(os);
-				for (++iter; iter != end(); ++iter)
-				{
-					os << ", ";
-					iter->print(os);
-				}
+				stride = 1ull << scale->getLimitedValue();
+				return;
 			}
-			os << '}';
 		}
-	};
+		
+		stride = 1;
+		index = offset;
+	}
 	
-	class OverlappingTypedAccesses
+	// Layout of a stack frame, solved once all accesses are known. Regions are kept in an interval map keyed by their
+	// first offset; regions never overlap, and accesses that overlap are merged into a single region. Each region
+	// becomes one field of a packed structure, with byte arrays as padding.
+	class StackFrameLayout
 	{
-	public:
-		struct TypedAccess
+		struct Region
 		{
-			int64_t offset;
-			const StackObject* object;
+			int64_t end;
+			// Arrays begin where they are indexed. Merging a region that starts before an array makes it a plain
+			// region.
+			uint64_t stride;
+			vector<TypedAccess> accesses;
 			Type* type;
-			
-			TypedAccess(int64_t offset, const StackObject* object, Type* type)
-			: offset(offset), object(object), type(type)
-			{
-			}
-			
-			uint64_t size(const DataLayout& layout) const
-			{
-				return type->isVoidTy() ? 0 : layout.getTypeStoreSize(type);
-			}
-			
-			int64_t endOffset(const DataLayout& layout) const
-			{
-				return offset + static_cast<int64_t>(size(layout));
-			}
+			unsigned fieldIndex;
 		};
 		
-	private:
-		static unsigned getTypePriority(Type* t)
+		LLVMContext& ctx;
+		const DataLayout& dl;
+		map<int64_t, Region> regions;
+		int64_t frameBegin;
+		int64_t frameEnd;
+		StructType* frameType;
+		
+		uint64_t getSize(Type* type) const
 		{
-			static constexpr unsigned typePriority[] = {
-				[Type::ArrayTyID] = 5,
-				[Type::StructTyID] = 4,
-				[Type::PointerTyID] = 3,
-				[Type::FloatTyID] = 2,
-				[Type::IntegerTyID] = 1,
-			};
-			
-			auto id = t->getTypeID();
-			if (id >= countof(typePriority))
-			{
-				return 0;
-			}
-			return typePriority[id];
+			return type->isSized() ? dl.getTypeStoreSize(type) : 0;
 		}
 		
-		const DataLayout& dl;
-		vector<TypedAccess> accesses;
-		
-		template<typename T>
-		void pad(LLVMContext& ctx, size_t difference, T outputIter) const
+		Region& insert(int64_t begin, int64_t end, uint64_t stride)
 		{
-			if (difference > 16)
+			auto iter = regions.upper_bound(begin);
+			if (iter != regions.begin() && prev(iter)->second.end > begin)
 			{
-				ArrayType* int64Padding = ArrayType::get(Type::getInt64Ty(ctx), difference / 8);
-				difference -= int64Padding->getNumElements() * 8;
-				*outputIter = int64Padding;
-				++outputIter;
+				--iter;
 			}
 			
-			for (unsigned i = 8; i > 0 && difference > 0; i /= 2)
+			Region merged = {end, stride, {}, nullptr, 0};
+			int64_t mergedBegin = begin;
+			while (iter != regions.end() && iter->first < merged.end)
 			{
-				if (difference >= i)
+				// The region that starts first decides whether the result is an array.
+				if (iter->first < mergedBegin)
 				{
-					difference -= i;
-					*outputIter = Type::getIntNTy(ctx, i * 8);
-					++outputIter;
+					mergedBegin = iter->first;
+					merged.stride = iter->second.stride;
 				}
+				else if (iter->first == mergedBegin && merged.stride == 0)
+				{
+					merged.stride = iter->second.stride;
+				}
+				merged.end = max(merged.end, iter->second.end);
+				merged.accesses.insert(merged.accesses.end(), iter->second.accesses.begin(), iter->second.accesses.end());
+				iter = regions.erase(iter);
 			}
+			return regions.insert({mergedBegin, move(merged)}).first->second;
 		}
 		
-	public:
-		OverlappingTypedAccesses(const DataLayout& dl)
-		: dl(dl)
-		{
-		}
-		
-		int64_t endOffset() const
-		{
-			if (accesses.size() == 0)
-			{
-				return 0;
-			}
-			return accesses.back().endOffset(dl);
-		}
-		
-		bool insert(int64_t offset, const StackObject* object, Type* type)
+		Type* chooseType(Type* candidate, Type* current) const
 		{
-			if (accesses.size() != 0 && accesses.back().endOffset(dl) <= offset)
+			if (current == nullptr || getTypePriority(candidate) > getTypePriority(current))
 			{
-				// not overlapping
-				return false;
+				return candidate;
 			}
-			
-			accesses.emplace_back(offset, object, type);
-			return true;
+			return current;
 		}
 		
-		bool empty() const
+		Type* solveRegion(int64_t begin, Region& region) const
 		{
-			return accesses.empty();
-		}
-		
-		void clear()
-		{
-			accesses.clear();
-		}
-		
-		auto begin() { return accesses.begin(); }
-		auto end() { return accesses.end(); }
-		auto begin() const { return accesses.begin(); }
-		auto end() const { return accesses.end(); }
-		
-		// returns the number of useful fields in outputType
-		size_t reduce(LLVMContext& ctx, Type*& outputType, unordered_map<const StackObject*, int>& gepIndices) const
-		{
-			outputType = nullptr;
-			gepIndices.clear();
-			
-			// No possible overlap
-			if (accesses.size() == 0)
-			{
-				assert(false);
-				outputType = nullptr;
-				return 0;
-			}
-			else if (accesses.size() == 1)
+			uint64_t size = static_cast<uint64_t>(region.end - begin);
+			Type* i8 = Type::getInt8Ty(ctx);
+			if (region.stride != 0 && size % region.stride == 0)
 			{
-				outputType = accesses.front().type;
-				return 1;
-			}
-			
-			// Harder case: overlaps.
-			// It is necessary that we can get a pointer to the beginning of the object. For instance:
-			// +---------------+
-			// 0|1|2|3|4|5|6|7|8
-			// |--A:4--|--B:4--|
-			// |.....|C:2|.....|
-			// +---------------+
-			// This needs to be represented as a structure where it's possible to get an offset to byte 0
-			// (for object A), byte 3 (for object C) and byte 4 (for object B). This is satisfied by a struct such as
-			// { [4 x i8], i32 }: a GEP to byte 0 is casted to an i32* for A, one to byte 3 is casted to an i16* for C,
-			// and B has its own field. (An equivalent representation could be {i8, i8, i8, i8, i32}.)
-			
-			auto sortedAccesses = accesses;
-			sort(sortedAccesses.begin(), sortedAccesses.end(), [&](const TypedAccess& a, const TypedAccess& b)
-			{
-				if (a.offset > b.offset)
-				{
-					return true;
-				}
-				
-				if (a.offset < b.offset)
+				Type* elementType = nullptr;
+				for (const TypedAccess& access : region.accesses)
 				{
-					return false;
-				}
-				
-				auto aSize = dl.getTypeStoreSize(a.type);
-				auto bSize = dl.getTypeStoreSize(b.type);
-				if (aSize > bSize)
-				{
-					return true;
-				}
-				if (aSize < bSize)
-				{
-					return false;
-				}
-				
-				return getTypePriority(a.type) > getTypePriority(b.type);
-			});
-			
-			size_t fieldCount = 1;
-			deque<Type*> structBody;
-			
-			// The first type after sorting is always intact, the rest is broken up ugly.
-			auto iter = sortedAccesses.begin();
-			structBody.push_back(iter->type);
-			gepIndices[iter->object] = -1;
-			
-			int64_t startOffset = iter->offset;
-			int64_t endOffset = iter->endOffset(dl);
-			for (++iter; iter != sortedAccesses.end(); ++iter)
-			{
-				int64_t iterFront = iter->offset;
-				int64_t frontDifference = startOffset - iterFront;
-				if (frontDifference > 0)
-				{
-					pad(ctx, static_cast<uint64_t>(frontDifference), front_inserter(structBody));
-					startOffset = iterFront;
-					fieldCount++;
+					if (access.offset == begin && access.type->isSized() && dl.getTypeAllocSize(access.type) == region.stride)
+					{
+						elementType = chooseType(access.type, elementType);
+					}
 				}
-				
-				int64_t iterEnd = iter->endOffset(dl);
-				int64_t backDifference = iterEnd - endOffset;
-				if (backDifference > 0)
+				if (elementType == nullptr)
 				{
-					pad(ctx, static_cast<uint64_t>(backDifference), back_inserter(structBody));
-					endOffset = iterEnd;
+					elementType = ArrayType::get(i8, region.stride);
 				}
-				
-				gepIndices[iter->object] = -static_cast<int>(structBody.size());
+				return ArrayType::get(elementType, size / region.stride);
 			}
 			
-			if (fieldCount == 1)
+			region.stride = 0;
+			Type* type = nullptr;
+			for (const TypedAccess& access : region.accesses)
 			{
-				// just return the only element in this case
-				outputType = structBody[0];
-				gepIndices.clear();
-			}
-			else
-			{
-				// needs contiguous storage for ArrayRef
-				SmallVector<Type*, 4> body(structBody.begin(), structBody.end());
-				outputType = StructType::get(ctx, body, true);
-				for (auto& pair : gepIndices)
+				if (access.offset == begin && getSize(access.type) == size)
 				{
-					pair.second += structBody.size();
+					type = chooseType(access.type, type);
 				}
 			}
-			return fieldCount;
-		}
-	};
-	
-	class GepLink
-	{
-		GepLink* parent;
-		Value* index;
-		Type* expectedType;
-		
-	public:
-		GepLink()
-		: parent(nullptr), index(nullptr), expectedType(nullptr)
-		{
-		}
-		
-		void setIndex(NOT_NULL(Value) idx, NOT_NULL(Type) expected)
-		{
-			this->index = idx;
-			this->expectedType = expected;
-		}
-		
-		void setParent(GepLink* p)
-		{
-			assert(this->parent == nullptr);
-			this->parent = p;
+			return type == nullptr ? ArrayType::get(i8, size) : type;
 		}
 		
-		GepLink* getParent() { return parent; }
-		Value* getIndex() { return index; }
-		Type* getExpectedType() { return expectedType; }
-		
-		vector<GepLink> toVector()
+		// Arrays don't say how long they are. They are assumed to extend to the next array, or to the next access that
+		// can't be one of their elements.
+		int64_t findArrayEnd(int64_t base, const ArrayAccesses& array, const StackFrameAccesses& accesses) const
 		{
-			vector<GepLink> result;
-			for (auto iter = this; iter != nullptr; iter = iter->parent)
+			int64_t end = numeric_limits<int64_t>::max();
+			auto nextArray = accesses.arrays.upper_bound(base);
+			if (nextArray != accesses.arrays.end())
 			{
-				result.push_back(*iter);
-			}
-			reverse(result.begin(), result.end());
-			return result;
-		}
-	};
-	
-	Value* increment(Value* base)
-	{
-		if (auto constant = dyn_cast<ConstantInt>(base))
-		{
-			auto next = constant->getLimitedValue() + 1;
-			return ConstantInt::get(constant->getType(), next);
-		}
-		else if (auto inst = dyn_cast<Instruction>(base))
-		{
-			auto one = ConstantInt::get(inst->getType(), 1);
-			auto incremented = BinaryOperator::Create(BinaryOperator::Add, inst, one);
-			incremented->insertAfter(inst);
-			return incremented;
-		}
-		else
-		{
-			llvm_unreachable("not implemented");
-		}
-	}
-	
-	class LlvmStackFrame
-	{
-		
-		LLVMContext& ctx;
-		const DataLayout& dl;
-		
-		deque<GepLink> links;
-		unordered_map<const StackObject*, GepLink*> linkMap;
-		unordered_map<const StackObject*, Type*> typeMap;
-		deque<const ObjectStackObject*> allObjects;
-		
-		LlvmStackFrame(LLVMContext& ctx, const DataLayout& dl)
-		: ctx(ctx), dl(dl)
-		{
-		}
-		
-		GepLink* createLink()
-		{
-			links.emplace_back();
-			return &links.back();
-		}
-		
-		GepLink* linkFor(const StackObject* value)
-		{
-			GepLink*& result = linkMap[value];
-			if (result == nullptr)
-			{
-				result = createLink();
-			}
-			return result;
-		}
-		
-		Type* reduceStructField(OverlappingTypedAccesses& typedAccesses, GepLink* parentLink, uint64_t index)
-		{
-			Type* resultType;
-			unordered_map<const StackObject*, int> gep;
-			auto structFieldCount = typedAccesses.reduce(ctx, resultType, gep);
-			
-			if (structFieldCount == 0)
-			{
-				assert(false);
-				return nullptr;
+				end = nextArray->first;
 			}
 			
-			Type* i32 = Type::getInt32Ty(ctx);
-			auto linkIndex = ConstantInt::get(i32, index);
-			if (structFieldCount == 1)
+			for (const TypedAccess& access : accesses.scalarAccesses)
 			{
-				for (const auto& access : typedAccesses)
+				if (access.offset >= base + static_cast<int64_t>(array.stride) && access.offset < end)
 				{
-					auto fieldLink = linkFor(access.object);
-					fieldLink->setIndex(linkIndex, access.type);
-					fieldLink->setParent(parentLink);
-				}
-			}
-			else
-			{
-				auto structureLink = createLink();
-				structureLink->setParent(parentLink);
-				structureLink->setIndex(linkIndex, resultType);
-				
-				for (const auto& access : typedAccesses)
-				{
-					auto iter = gep.find(access.object);
-					if (iter == gep.end())
+					uint64_t relative = static_cast<uint64_t>(access.offset - base);
+					if (relative % array.stride != 0 || getSize(access.type) > array.stride)
 					{
-						assert(false);
-						return nullptr;
+						end = access.offset;
 					}
-					auto fieldLink = linkFor(access.object);
-					fieldLink->setIndex(ConstantInt::get(i32, static_cast<uint64_t>(iter->second)), access.type);
-					fieldLink->setParent(structureLink);
 				}
 			}
 			
-			return resultType;
-		}
-		
-		bool representObject(const ObjectStackObject* object)
-		{
-			SmallPtrSet<Type*, 4> types;
-			object->getUnionTypes(types);
-			
-			OverlappingTypedAccesses typedAccesses(dl);
-			for (Type* type : types)
+			if (end == numeric_limits<int64_t>::max())
 			{
-				if (!typedAccesses.insert(0, object, type))
-				{
-					return false;
-				}
+				// Nothing follows the array. Frames grow down, so locals end where the incoming stack pointer points.
+				end = base < 0 ? 0 : base + static_cast<int64_t>(array.stride);
 			}
 			
-			Type* resultType = nullptr;
-			unordered_map<const StackObject*, int> gep;
-			auto count = typedAccesses.reduce(ctx, resultType, gep);
-			if (count != 1)
-			{
-				return false;
-			}
-			
-			auto& typeOut = typeMap[object];
-			assert(typeOut == nullptr);
-			typeOut = resultType;
-			allObjects.push_back(object);
-			return true;
+			int64_t size = max<int64_t>(end - base, static_cast<int64_t>(array.stride));
+			return base + size - size % static_cast<int64_t>(array.stride);
+		}
+	
+	public:
+		StackFrameLayout(LLVMContext& ctx, const DataLayout& dl)
+		: ctx(ctx), dl(dl), frameBegin(0), frameEnd(0), frameType(nullptr)
+		{
 		}
 		
-		bool representObject(const StructureStackObject* object)
+		StructType* solve(const StackFrameAccesses& accesses)
 		{
-			GepLink* thisLink = linkFor(object);
-			vector<Type*> fieldTypes;
-			OverlappingTypedAccesses typedAccesses(dl);
-			
-			for (const auto& field : *object)
+			for (const auto& pair : accesses.arrays)
 			{
-				StackObject* fieldObject = field.object.get();
-				if (!representObject(fieldObject))
+				Region& region = insert(pair.first, findArrayEnd(pair.first, pair.second, accesses), pair.second.stride);
+				for (const TypedAccess& access : pair.second.elementAccesses)
 				{
-					// bail out if field can't be represented
-					return false;
-				}
-				
-				Type* fieldType = typeMap[field.object.get()];
-				if (typedAccesses.insert(field.offset, fieldObject, fieldType))
-				{
-					// continue until accesses no longer overlap
-					continue;
-				}
-				
-				if (Type* result = reduceStructField(typedAccesses, thisLink, fieldTypes.size()))
-				{
-					if (!result->isVoidTy())
+					if (access.offset == 0)
 					{
-						// Don't insert void as a struct member. The GepLink* will just end up referring to the
-						// next object, which is most likely to be either padding (which would be correct) or the end of
-						// the structure.
-						fieldTypes.push_back(result);
+						region.accesses.push_back({pair.first, access.type});
 					}
-					
-					long long padding = field.offset - typedAccesses.endOffset();
-					if (padding > 0)
-					{
-						Type* i8 = Type::getInt8Ty(ctx);
-						Type* padArray = ArrayType::get(i8, static_cast<uint64_t>(padding));
-						fieldTypes.push_back(padArray);
-					}
-					
-					typedAccesses.clear();
-					typedAccesses.insert(field.offset, field.object.get(), fieldType);
-				}
-				else
-				{
-					return false;
 				}
 			}
 			
-			if (!typedAccesses.empty())
+			for (const TypedAccess& access : accesses.scalarAccesses)
 			{
-				if (Type* result = reduceStructField(typedAccesses, thisLink, fieldTypes.size()))
-				{
-					if (!result->isVoidTy())
-					{
-						fieldTypes.push_back(result);
-					}
-				}
-				else
+				if (uint64_t size = getSize(access.type))
 				{
-					return false;
+					Region& region = insert(access.offset, access.offset + static_cast<int64_t>(size), 0);
+					region.accesses.push_back(access);
 				}
 			}
 			
-			Type* resultType = StructType::get(ctx, fieldTypes, true);
-			auto& resultOut = typeMap[object];
-			assert(resultOut == nullptr);
-			resultOut = resultType;
-			return true;
-		}
-		
-		bool representObject(StackObject* object)
-		{
-			if (auto obj = dyn_cast<ObjectStackObject>(object))
+			frameBegin = numeric_limits<int64_t>::max();
+			frameEnd = numeric_limits<int64_t>::min();
+			for (const auto& pair : accesses.constantOffsets)
 			{
-				return representObject(obj);
+				frameBegin = min(frameBegin, pair.second);
+				frameEnd = max(frameEnd, pair.second);
 			}
-			else if (auto structure = dyn_cast<StructureStackObject>(object))
+			if (!regions.empty())
 			{
-				return representObject(structure);
+				frameBegin = min(frameBegin, regions.begin()->first);
+				frameEnd = max(frameEnd, regions.rbegin()->second.end);
 			}
-			else
+			
+			SmallVector<Type*, 16> fields;
+			Type* i8 = Type::getInt8Ty(ctx);
+			int64_t offset = frameBegin;
+			for (auto& pair : regions)
 			{
-				return false;
+				if (pair.first > offset)
+				{
+					fields.push_back(ArrayType::get(i8, static_cast<uint64_t>(pair.first - offset)));
+				}
+				pair.second.type = solveRegion(pair.first, pair.second);
+				pair.second.fieldIndex = static_cast<unsigned>(fields.size());
+				fields.push_back(pair.second.type);
+				offset = pair.second.end;
 			}
-		}
-		
-	public:
-		static unique_ptr<LlvmStackFrame> representObject(LLVMContext& ctx, const DataLayout& dl, const StructureStackObject& object)
-		{
-			unique_ptr<LlvmStackFrame> frame(new LlvmStackFrame(ctx, dl));
-			if (frame->representObject(&object))
+			
+			if (frameEnd > offset || fields.empty())
 			{
-				Type* rootType = frame->getNaiveType(object);
-				frame->linkFor(&object)->setIndex(ConstantInt::get(Type::getInt64Ty(ctx), 0), rootType);
-				return frame;
+				fields.push_back(ArrayType::get(i8, static_cast<uint64_t>(max<int64_t>(frameEnd - offset, 1))));
 			}
-			return nullptr;
+			
+			frameType = StructType::get(ctx, fields, true);
+			return frameType;
 		}
 		
-		const deque<const ObjectStackObject*>& getAllObjects() const { return allObjects; }
-		
-		Type* getNaiveType(const StackObject& object) const
+		// Pointer to the byte at a given offset from the stack pointer, typed after the field that starts there when
+		// there is one.
+		Value* getPointer(Value* frame, int64_t offset, Instruction* insertionPoint) const
 		{
-			auto iter = typeMap.find(&object);
-			if (iter == typeMap.end())
-			{
-				return nullptr;
-			}
-			return iter->second;
-		}
-
-		Value* getPointerToObject(const ObjectStackObject& object, Value* basePointer, Instruction* insertionPoint) const
-		{
-			auto linkMapIter = linkMap.find(&object);
-			if (linkMapIter == linkMap.end())
-			{
-				return nullptr;
-			}
-			
-			ConstantInt* zero = ConstantInt::get(Type::getInt64Ty(ctx), 0);
-			Value* result = basePointer;
-			SmallVector<Value*, 4> gepIndices;
-			
-			auto vectorOfLinks = linkMapIter->second->toVector();
-			// If we're seeking a void element, we need to adjust the GEP to get the element after it. This is already
-			// done at representation time unless the item we seek is the last item of the structure.
-			if (vectorOfLinks.back().getExpectedType()->isVoidTy())
-			{
-				Type* voidTy = vectorOfLinks.back().getExpectedType();
-				for (size_t size = vectorOfLinks.size(); size > 1; --size)
+			Type* i32 = Type::getInt32Ty(ctx);
+			Type* i64 = Type::getInt64Ty(ctx);
+			auto iter = regions.upper_bound(offset);
+			if (iter != regions.begin())
+			{
+				--iter;
+				const Region& region = iter->second;
+				int64_t relative = offset - iter->first;
+				if (relative < region.end - iter->first)
 				{
-					GepLink& parentLink = vectorOfLinks[size - 2];
-					GepLink& currentLink = vectorOfLinks[size - 1];
-					
-					// The index can only refer to a void field if it is constant.
-					// Otherwise we're probably indexing into an array or something.
-					if (auto constant = dyn_cast<ConstantInt>(currentLink.getIndex()))
+					Value* fieldIndices[] = { ConstantInt::get(i64, 0), ConstantInt::get(i32, region.fieldIndex) };
+					if (region.stride != 0)
 					{
-						auto parentType = parentLink.getExpectedType();
-						bool shouldIncrementIndex = false;
-						if (auto parentStruct = dyn_cast<StructType>(parentType))
+						uint64_t elementSize = dl.getTypeAllocSize(cast<ArrayType>(region.type)->getElementType());
+						if (static_cast<uint64_t>(relative) % elementSize == 0)
 						{
-							if (parentStruct->getNumElements() == constant->getLimitedValue())
-							{
-								shouldIncrementIndex = true;
-							}
-							else
-							{
-								// stop after this iteration
-								size = 1;
-							}
-						}
-						else
-						{
-							shouldIncrementIndex = isa<PointerType>(parentType);
-							// no point in looping any further
-							size = 1;
-						}
-						
-						if (shouldIncrementIndex)
-						{
-							parentLink.setIndex(increment(parentLink.getIndex()), voidTy);
-							vectorOfLinks.pop_back();
+							Value* elementIndices[] = { fieldIndices[0], fieldIndices[1], ConstantInt::get(i64, static_cast<uint64_t>(relative) / elementSize) };
+							return GetElementPtrInst::Create(nullptr, frame, elementIndices, "", insertionPoint);
 						}
 					}
-					else
+					else if (relative == 0)
 					{
-						// stop after this iteration
-						size = 1;
+						return GetElementPtrInst::Create(nullptr, frame, fieldIndices, "", insertionPoint);
 					}
 				}
 			}
 			
-			for (GepLink& link : vectorOfLinks)
+			Type* i8 = Type::getInt8Ty(ctx);
+			auto bytes = CastInst::Create(CastInst::BitCast, frame, i8->getPointerTo(), "", insertionPoint);
+			auto byteOffset = ConstantInt::get(i64, static_cast<uint64_t>(offset - frameBegin));
+			return GetElementPtrInst::Create(i8, bytes, byteOffset, "", insertionPoint);
+		}
+		
+		// Pointer to an array element, if the array at base has elements of the given size.
+		Value* getElementPointer(Value* frame, int64_t base, uint64_t stride, Value* index, Instruction* insertionPoint) const
+		{
+			auto iter = regions.find(base);
+			if (iter == regions.end() || iter->second.stride == 0)
 			{
-				gepIndices.push_back(link.getIndex());
-				Type* expected = link.getExpectedType();
-				Type* actual = GetElementPtrInst::getIndexedType(result->getType(), gepIndices);
-				if (expected != actual && !expected->isVoidTy())
-				{
-					result = GetElementPtrInst::Create(nullptr, result, gepIndices, "", insertionPoint);
-					result = CastInst::Create(CastInst::BitCast, result, expected->getPointerTo(), "", insertionPoint);
-					gepIndices = { zero };
-				}
+				return nullptr;
 			}
 			
-			if (gepIndices.size() > 1)
+			const Region& region = iter->second;
+			if (dl.getTypeAllocSize(cast<ArrayType>(region.type)->getElementType()) != stride)
 			{
-				result = GetElementPtrInst::Create(nullptr, result, gepIndices, "", insertionPoint);
+				return nullptr;
 			}
 			
-			return result;
+			Type* i32 = Type::getInt32Ty(ctx);
+			Type* i64 = Type::getInt64Ty(ctx);
+			if (index->getType() != i64)
+			{
+				index = CastInst::CreateIntegerCast(index, i64, true, "", insertionPoint);
+			}
+			Value* indices[] = { ConstantInt::get(i64, 0), ConstantInt::get(i32, region.fieldIndex), index };
+			return GetElementPtrInst::Create(nullptr, frame, indices, "", insertionPoint);
 		}
 	};
 	
@@ -856,109 +431,106 @@ namespace
 			return &*arg;
 		}
 		
-		bool analyzeObject(Value& base, bool& hasCastInst, map<int64_t, Instruction*>& constantOffsets, map<int64_t, Instruction*>& variableOffsetStrides)
+		bool collectAccesses(Argument& stackPointer, StackFrameAccesses& accesses)
 		{
-			hasCastInst = false;
-			for (User* user : base.users())
-			{
-				if (auto binOp = dyn_cast<BinaryOperator>(user))
-				{
-					if (binOp->getOpcode() != BinaryOperator::Add)
-					{
-						return false;
-					}
-					
-					Value* right = binOp->getOperand(binOp->getOperand(0) == &base ? 1 : 0);
-					if (auto constant = dyn_cast<ConstantInt>(right))
-					{
-						constantOffsets.insert({constant->getLimitedValue(), binOp});
-					}
-					else
-					{
-						// non-constant offset
-						// IMPLEMENT ME
-						return false;
-					}
-				}
-				else if (auto castInst = dyn_cast<CastInst>(user))
-				{
-					hasCastInst |= castInst->getOpcode() == CastInst::IntToPtr;
-				}
-			}
-			return true;
-		}
-		
-		unique_ptr<StackObject> readObject(Value& base, StackObject* parent)
-		{
-			//
-			// readObject accepts a "base pointer". A base pointer is an SSA value that modifies the stack pointer.
-			// Examples would be the stack pointer itself, "sp+N" (for a constant N), "(sp+N)+v" (for a non-constant v).
-			// This base pointer is expected to:
-			//
-			// * have variable offsets added to it (making it an array);
-			// * have constant offsets added to it (making it a struct);
-			// * be loaded from/stored to (giving it a specific type).
 			//
-			// It's likely that a base pointer is used in multiple ways. In this case, the following rules
-			// disambiguate what to do with it:
+			// Values derived from the stack pointer are visited once. They are expected to:
 			//
-			// * if it's offset by a variable, automatically treat it as an array;
-			// * if it's only offset by constant values, treat it as a structure.
+			// * have constant offsets added to them (giving another location in the frame);
+			// * have variable offsets added to them (making them an array);
+			// * be cast to pointers and loaded from/stored to (giving a type to a location).
 			//
-			// The rationale for arrays is that it's less likely that the SSA form will allow a non-array pointer value
-			// to be offset sometimes by a constant and sometimes by a value. If you have a
-			// `struct { int x, y; int z[20] };` on the stack, then accesses to `z` will look like "(sp+8)+N"
-			// (or "(sp+8)+(N*4)"), where (sp+8) will be considered the array.
+			// Values offset by a variable are array elements. Their accesses are recorded relative to the array base,
+			// and they are not followed further than constant offsets and casts.
 			//
-			// This may misrepresent structures that begin with an array, however.
-			//
-			// Notice how we don't do anything with loads/stores. That's because they require to be casted to a
-			// pointer type first. Casts become a new base value and these are usually only loaded from/stored to. In
-			// practice, we only generate arrays and struct from this function.
+			// Other uses (calls, stores of the value itself, comparisons, phis) only require the location to exist.
+			// Anything else, like masking the stack pointer, makes the frame impossible to recover.
 			//
 			
-			bool hasCastInst = false;
-			map<int64_t, Instruction*> constantOffsets;
-			map<int64_t, Instruction*> variableOffsetsStrides;
-			if (!analyzeObject(base, hasCastInst, constantOffsets, variableOffsetsStrides))
+			struct DerivedValue
 			{
-				return nullptr;
-			}
+				Value* value;
+				int64_t offset;
+				int64_t arrayBase;
+				bool isArrayElement;
+			};
 			
-			if (variableOffsetsStrides.size() > 0)
+			SmallVector<DerivedValue, 16> worklist;
+			SmallPtrSet<Value*, 16> visited;
+			worklist.push_back({&stackPointer, 0, 0, false});
+			while (!worklist.empty())
 			{
-				// This should be an array.
-				// (IMPLEMENT ME)
-				return nullptr;
-			}
-			else if (constantOffsets.size() > 0)
-			{
-				// Since this runs after argument recovery, offsets should uniformly be either positive or negative.
-				auto front = constantOffsets.begin()->first;
-				auto back = constantOffsets.rbegin()->first;
-				assert(front == 0 || back == 0 || signbit(front) == signbit(back));
-				(void) back;
+				DerivedValue derived = worklist.pop_back_val();
+				if (!visited.insert(derived.value).second)
+				{
+					// reached through two operands, like (sp+a)+(sp+b)
+					return false;
+				}
 				
-				unique_ptr<StructureStackObject> structure(new StructureStackObject(parent));
-				if (hasCastInst)
+				if (!derived.isArrayElement)
 				{
-					structure->insert(0, new ObjectStackObject(base, *structure));
+					accesses.constantOffsets.push_back({derived.value, derived.offset});
 				}
 				
-				for (const auto& pair : constantOffsets)
+				for (User* user : derived.value->users())
 				{
-					if (auto type = readObject(*pair.second, structure.get()))
+					if (auto binOp = dyn_cast<BinaryOperator>(user))
 					{
-						int64_t offset = pair.first - front;
-						structure->insert(offset, move(type));
+						bool isLeft = binOp->getOperand(0) == derived.value;
+						Value* other = binOp->getOperand(isLeft ? 1 : 0);
+						if (other == derived.value)
+						{
+							return false;
+						}
+						
+						auto constant = dyn_cast<ConstantInt>(other);
+						if (binOp->getOpcode() == BinaryOperator::Add && constant != nullptr)
+						{
+							worklist.push_back({binOp, derived.offset + constant->getSExtValue(), derived.arrayBase, derived.isArrayElement});
+						}
+						else if (binOp->getOpcode() == BinaryOperator::Sub && constant != nullptr && isLeft)
+						{
+							worklist.push_back({binOp, derived.offset - constant->getSExtValue(), derived.arrayBase, derived.isArrayElement});
+						}
+						else if (binOp->getOpcode() == BinaryOperator::Add && !derived.isArrayElement)
+						{
+							uint64_t stride;
+							Value* index;
+							getStride(other, stride, index);
+							
+							ArrayAccesses& array = accesses.arrays[derived.offset];
+							array.stride = array.stride == 0 ? stride : GreatestCommonDivisor64(array.stride, stride);
+							accesses.variableOffsets.push_back({binOp, derived.offset, stride, index});
+							worklist.push_back({binOp, 0, derived.offset, true});
+						}
+						else if (binOp->getOpcode() != BinaryOperator::Add)
+						{
+							return false;
+						}
+						// Variable offsets into array elements (arrays of arrays, for instance) stay as arithmetic.
+					}
+					else if (auto cast = dyn_cast<CastInst>(user))
+					{
+						if (cast->getOpcode() == CastInst::IntToPtr)
+						{
+							SmallPtrSet<Type*, 4> types;
+							getCastTypes(cast, types);
+							for (Type* type : types)
+							{
+								if (derived.isArrayElement)
+								{
+									accesses.arrays[derived.arrayBase].elementAccesses.push_back({derived.offset, type});
+								}
+								else
+								{
+									accesses.scalarAccesses.push_back({derived.offset, type});
+								}
+							}
+						}
 					}
 				}
-				return move(structure);
-			}
-			else
-			{
-				return unique_ptr<StackObject>(new ObjectStackObject(base, *parent));
 			}
+			return true;
 		}
 		
 		virtual bool doInitialization(Module& m) override
@@ -982,6 +554,12 @@ namespace
 			changed = false;
 			for (Function* fn : functions)
 			{
+				// Functions hidden from optimizations (for instance, large functions) keep their stack as is.
+				if (fn->hasFnAttribute(Attribute::OptimizeNone))
+				{
+					continue;
+				}
+				
 				tryToCreateStackFrame(*fn);
 				tryToRemoveStackArgument(*fn);
 			}
@@ -1072,30 +650,55 @@ namespace
 		
 		void tryToCreateStackFrame(Function& fn)
 		{
-			if (Argument* stackPointer = getStackPointer(fn))
-			if (auto root = readObject(*stackPointer, nullptr))
-			if (auto llvmFrame = LlvmStackFrame::representObject(fn.getContext(), *dl, cast<StructureStackObject>(*root)))
+			Argument* stackPointer = getStackPointer(fn);
+			StackFrameAccesses accesses;
+			if (stackPointer == nullptr || !collectAccesses(*stackPointer, accesses))
 			{
-				auto allocaInsert = &*fn.getEntryBlock().getFirstInsertionPt();
-				Type* naiveType = llvmFrame->getNaiveType(*root);
-				AllocaInst* stackFrame = new AllocaInst(naiveType, "stackframe", allocaInsert);
-				md::setStackFrame(*stackFrame);
-				for (auto object : llvmFrame->getAllObjects())
+				return;
+			}
+			
+			StackFrameLayout layout(fn.getContext(), *dl);
+			StructType* frameType = layout.solve(accesses);
+			
+			auto allocaInsert = &*fn.getEntryBlock().getFirstInsertionPt();
+			AllocaInst* stackFrame = new AllocaInst(frameType, "stackframe", allocaInsert);
+			md::setStackFrame(*stackFrame);
+			
+			// Array indexing becomes a GEP when the element size matches the stride.
+			for (const VariableOffset& offset : accesses.variableOffsets)
+			{
+				if (auto element = layout.getElementPointer(stackFrame, offset.base, offset.stride, offset.index, offset.value))
 				{
-					Value* offsetInstruction = object->getOffsetValue();
-					Instruction* insertionPoint = dyn_cast<Instruction>(offsetInstruction);
-					
-					Value* pointer = llvmFrame->getPointerToObject(*object, stackFrame, insertionPoint);
-					auto ptr2int = CastInst::Create(CastInst::PtrToInt, pointer, offsetInstruction->getType(), "", insertionPoint);
-					offsetInstruction->replaceAllUsesWith(ptr2int);
-					if (auto inst = dyn_cast<Instruction>(offsetInstruction))
+					auto ptr2int = CastInst::Create(CastInst::PtrToInt, element, offset.value->getType(), "", offset.value);
+					offset.value->replaceAllUsesWith(ptr2int);
+					offset.value->eraseFromParent();
+				}
+			}
+			
+			// Replace constant offsets, most derived first, so that values only used to compute other offsets go away.
+			for (auto iter = accesses.constantOffsets.rbegin(); iter != accesses.constantOffsets.rend(); ++iter)
+			{
+				Value* offsetValue = iter->first;
+				auto inst = dyn_cast<Instruction>(offsetValue);
+				if (offsetValue->use_empty())
+				{
+					if (inst != nullptr)
 					{
-						inst->dropAllReferences();
 						inst->eraseFromParent();
 					}
+					continue;
+				}
+				
+				Instruction* insertionPoint = inst == nullptr ? allocaInsert : inst;
+				Value* pointer = layout.getPointer(stackFrame, iter->second, insertionPoint);
+				auto ptr2int = CastInst::Create(CastInst::PtrToInt, pointer, offsetValue->getType(), "", insertionPoint);
+				offsetValue->replaceAllUsesWith(ptr2int);
+				if (inst != nullptr)
+				{
+					inst->eraseFromParent();
 				}
-				changed = true;
 			}
+			changed = true;
 		}
 	};
 	
@@ -85,6 +85,11 @@ namespace
 		
 		virtual bool runOnFunction(Function& f) override
 		{
+			if (skipFunction(f))
+			{
+				return false;
+			}
+			
 			auto& aaResults = getAnalysis<AAResultsWrapperPass>().getAAResults();
 			auto& domTree = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 			MemorySSA mssa(f, &aaResults, &domTree);
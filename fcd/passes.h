@@ -21,6 +21,17 @@
 #include <llvm/Pass.h>
 #include <llvm/Transforms/Utils/MemorySSA.h>
 
+#include <string>
+#include <vector>
+
 llvm::FunctionPass*		createRegisterPointerPromotionPass();
 
+// Size-adaptive pass selection. Passes that have a large function replacement only run on small functions; their
+// replacement, if any, runs on large functions instead. Large functions are reported together by reportLargeFunctions
+// once the pipeline has run.
+bool getLargeFunctionReplacement(llvm::StringRef passName, std::string& replacement);
+void addSizeAdaptivePasses(std::vector<llvm::Pass*>& passes, llvm::StringRef originalName, llvm::Pass* original, llvm::StringRef replacementName, llvm::Pass* replacement);
+bool isLargeFunction(llvm::Function& fn);
+void reportLargeFunctions(llvm::raw_ostream& os, llvm::StringRef programName);
+
 #endif /* defined(fcd__passes_h) */
@@ -0,0 +1,437 @@
+//
+// progress_report.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "command_line.h"
+#include "memory_report.h"
+#include "progress_report.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	cl::opt<string> progressFile("progress-file", cl::desc("Periodically replace this file with a status record of the decompilation"), cl::value_desc("path"), whitelist());
+	cl::opt<int> progressFd("progress-fd", cl::desc("Periodically write status records to this file descriptor, one per line"), cl::value_desc("fd"), cl::init(-1), whitelist());
+	cl::opt<unsigned> progressInterval("progress-interval", cl::desc("Seconds between status records"), cl::value_desc("seconds"), cl::init(10), whitelist());
+	
+	typedef chrono::steady_clock Clock;
+	
+	// Throughput is measured over this window, so that it reflects what the phase is doing now.
+	const chrono::seconds throughputWindow(60);
+	
+	struct InFlightItem
+	{
+		string name;
+		Clock::time_point start;
+	};
+	
+	struct ProgressSample
+	{
+		Clock::time_point time;
+		size_t completed;
+	};
+	
+	string escape(StringRef text)
+	{
+		string result;
+		raw_string_ostream os(result);
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				os << '\\' << c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				os << format("\\u%04x", static_cast<unsigned>(c));
+			}
+			else
+			{
+				os << c;
+			}
+		}
+		return os.str();
+	}
+	
+	double secondsBetween(Clock::time_point from, Clock::time_point to)
+	{
+		return chrono::duration<double>(to - from).count();
+	}
+	
+	class ProgressReport
+	{
+		mutex lock;
+		condition_variable wakeUp;
+		thread writer;
+		bool exiting = false;
+		bool failed = false;
+		unique_ptr<raw_fd_ostream> fdOutput;
+		Clock::time_point startTime;
+		
+		string phase;
+		string step;
+		size_t completed = 0;
+		size_t total = 0;
+		Clock::time_point phaseStart;
+		deque<ProgressSample> samples;
+		
+		uint64_t nextItemId = 1;
+		map<uint64_t, InFlightItem> inFlight;
+		InFlightItem lastItem;
+		
+		// Called with the lock held.
+		string makeRecord(Clock::time_point now, const char* state)
+		{
+			samples.push_back({now, completed});
+			while (samples.size() > 2 && now - samples[1].time >= throughputWindow)
+			{
+				samples.pop_front();
+			}
+			
+			double elapsed = secondsBetween(samples.front().time, now);
+			size_t progress = completed > samples.front().completed ? completed - samples.front().completed : 0;
+			double rate = elapsed > 0 ? static_cast<double>(progress) / elapsed : 0;
+			
+			// The item that has run for the longest time is the most likely to be stuck.
+			const InFlightItem* item = inFlight.empty() ? &lastItem : &inFlight.begin()->second;
+			
+			string record;
+			raw_string_ostream os(record);
+			os << "{\"state\":\"" << state << "\",\"pid\":" << getpid();
+			os << ",\"elapsed\":" << format("%.1f", secondsBetween(startTime, now));
+			os << ",\"phase\":\"" << escape(phase) << "\",\"phase_elapsed\":" << format("%.1f", secondsBetween(phaseStart, now));
+			os << ",\"step\":\"" << escape(step) << "\"";
+			os << ",\"completed\":" << completed << ",\"remaining\":" << (total > completed ? total - completed : 0);
+			os << ",\"rate\":" << format("%.2f", rate);
+			os << ",\"rss\":" << getResidentSize();
+			os << ",\"in_flight\":" << inFlight.size();
+			os << ",\"item\":\"" << escape(item->name) << "\"";
+			if (!item->name.empty())
+			{
+				os << ",\"item_elapsed\":" << format("%.1f", secondsBetween(item->start, now));
+			}
+			os << "}\n";
+			return os.str();
+		}
+		
+		// Called without the lock, so that a slow file system doesn't block the threads that report progress.
+		void write(const string& record)
+		{
+			if (fdOutput)
+			{
+				*fdOutput << record;
+				fdOutput->flush();
+			}
+			
+			if (progressFile != "")
+			{
+				// Readers must never see a partial record, so it is written next to the file and moved over it.
+				SmallString<128> temporaryPath(progressFile.getValue());
+				temporaryPath += ".tmp";
+				error_code errorCode;
+				{
+					raw_fd_ostream output(temporaryPath, errorCode, sys::fs::F_Text);
+					if (!errorCode)
+					{
+						output << record;
+					}
+				}
+				if (!errorCode)
+				{
+					errorCode = sys::fs::rename(temporaryPath, progressFile);
+				}
+				if (errorCode && !failed)
+				{
+					failed = true;
+					errs() << "fcd: can't write progress file " << progressFile << ": " << errorCode.message() << '\n';
+				}
+			}
+		}
+		
+		void run()
+		{
+			unique_lock<mutex> guard(lock);
+			while (!exiting)
+			{
+				string record = makeRecord(Clock::now(), "running");
+				guard.unlock();
+				write(record);
+				guard.lock();
+				wakeUp.wait_for(guard, chrono::seconds(progressInterval), [&] { return exiting; });
+			}
+		}
+	
+	public:
+		bool enabled = false;
+		
+		void start()
+		{
+			enabled = progressFile != "" || progressFd >= 0;
+			if (!enabled)
+			{
+				return;
+			}
+			
+			if (progressFd >= 0)
+			{
+				fdOutput.reset(new raw_fd_ostream(progressFd, false));
+			}
+			startTime = Clock::now();
+			phaseStart = startTime;
+			phase = "startup";
+			writer = thread([this] { run(); });
+		}
+		
+		void beginPhase(StringRef newPhase, size_t newTotal)
+		{
+			lock_guard<mutex> guard(lock);
+			phase = newPhase.str();
+			step.clear();
+			completed = 0;
+			total = newTotal;
+			phaseStart = Clock::now();
+			samples.clear();
+			lastItem = {};
+		}
+		
+		void setStep(StringRef newStep)
+		{
+			lock_guard<mutex> guard(lock);
+			step = newStep.str();
+		}
+		
+		void setRemaining(size_t remaining)
+		{
+			lock_guard<mutex> guard(lock);
+			total = completed + remaining;
+		}
+		
+		void setCompleted(size_t count)
+		{
+			lock_guard<mutex> guard(lock);
+			completed = count;
+		}
+		
+		void addCompleted(size_t count)
+		{
+			lock_guard<mutex> guard(lock);
+			completed += count;
+		}
+		
+		uint64_t beginItem(StringRef name)
+		{
+			lock_guard<mutex> guard(lock);
+			uint64_t id = nextItemId++;
+			lastItem = { name.str(), Clock::now() };
+			inFlight.insert({id, lastItem});
+			return id;
+		}
+		
+		void endItem(uint64_t id)
+		{
+			lock_guard<mutex> guard(lock);
+			inFlight.erase(id);
+			completed++;
+		}
+		
+		// Units that end when the next one starts, like the steps that marker passes see.
+		void markItem(StringRef name)
+		{
+			lock_guard<mutex> guard(lock);
+			if (!lastItem.name.empty())
+			{
+				completed++;
+			}
+			lastItem = { name.str(), Clock::now() };
+		}
+		
+		~ProgressReport()
+		{
+			if (!enabled)
+			{
+				return;
+			}
+			
+			string record;
+			{
+				lock_guard<mutex> guard(lock);
+				exiting = true;
+				record = makeRecord(Clock::now(), "exited");
+			}
+			wakeUp.notify_all();
+			writer.join();
+			write(record);
+		}
+	};
+	
+	ProgressReport& getProgressReport()
+	{
+		static ProgressReport report;
+		return report;
+	}
+	
+	class FunctionProgressMarker final : public FunctionPass
+	{
+		string step;
+	
+	public:
+		static char ID;
+		
+		FunctionProgressMarker(string step)
+		: FunctionPass(ID), step(move(step))
+		{
+		}
+		
+		virtual StringRef getPassName() const override
+		{
+			return "Report progress";
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			au.setPreservesAll();
+		}
+		
+		virtual bool runOnFunction(Function& fn) override
+		{
+			ProgressReport& report = getProgressReport();
+			report.setStep(step);
+			report.markItem(fn.getName());
+			return false;
+		}
+	};
+	
+	class ModuleProgressMarker final : public ModulePass
+	{
+		string step;
+	
+	public:
+		static char ID;
+		
+		ModuleProgressMarker(string step)
+		: ModulePass(ID), step(move(step))
+		{
+		}
+		
+		virtual StringRef getPassName() const override
+		{
+			return "Report progress";
+		}
+		
+		virtual void getAnalysisUsage(AnalysisUsage& au) const override
+		{
+			au.setPreservesAll();
+		}
+		
+		virtual bool runOnModule(Module& module) override
+		{
+			ProgressReport& report = getProgressReport();
+			report.setStep(step);
+			report.markItem(module.getName());
+			return false;
+		}
+	};
+	
+	char FunctionProgressMarker::ID = 0;
+	char ModuleProgressMarker::ID = 0;
+}
+
+void startProgressReport()
+{
+	getProgressReport().start();
+}
+
+bool isProgressReported()
+{
+	return getProgressReport().enabled;
+}
+
+void progressBeginPhase(StringRef phase, size_t total)
+{
+	if (isProgressReported())
+	{
+		getProgressReport().beginPhase(phase, total);
+	}
+}
+
+void progressSetStep(StringRef step)
+{
+	if (isProgressReported())
+	{
+		getProgressReport().setStep(step);
+	}
+}
+
+void progressSetRemaining(size_t remaining)
+{
+	if (isProgressReported())
+	{
+		getProgressReport().setRemaining(remaining);
+	}
+}
+
+void progressSetCompleted(size_t completed)
+{
+	if (isProgressReported())
+	{
+		getProgressReport().setCompleted(completed);
+	}
+}
+
+void progressCompleted(size_t count)
+{
+	if (isProgressReported())
+	{
+		getProgressReport().addCompleted(count);
+	}
+}
+
+ProgressItem::ProgressItem(StringRef name)
+: id(isProgressReported() ? getProgressReport().beginItem(name) : 0)
+{
+}
+
+ProgressItem::~ProgressItem()
+{
+	if (id != 0)
+	{
+		getProgressReport().endItem(id);
+	}
+}
+
+Pass* createProgressMarker(const Pass& next, size_t index, size_t count)
+{
+	string step;
+	raw_string_ostream(step) << "pass " << (index + 1) << "/" << count << ": " << next.getPassName();
+	switch (next.getPassKind())
+	{
+		case PT_Function: return new FunctionProgressMarker(move(step));
+		case PT_Module: return new ModuleProgressMarker(move(step));
+		default: return nullptr;
+	}
+}
@@ -0,0 +1,62 @@
+//
+// progress_report.h
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__progress_report_h
+#define fcd__progress_report_h
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace llvm
+{
+	class Pass;
+}
+
+// Starts the thread that writes status records for --progress-file and --progress-fd, if either was passed. Records
+// have the current phase and step, the units of work (usually functions) completed and remaining, recent throughput,
+// the resident set size, and the item that has been in flight for the longest time. A last record is written when the
+// program exits.
+void startProgressReport();
+
+// Whether status records are written. When they aren't, progress calls do nothing.
+bool isProgressReported();
+
+// Starts a phase with an estimate of its units of work. Phases without an estimate use 0.
+void progressBeginPhase(llvm::StringRef phase, size_t total);
+
+// Names what a phase that has several steps is doing, such as the pass that runs.
+void progressSetStep(llvm::StringRef step);
+
+// Updates the estimate of a phase that discovers work as it goes: the total becomes what was completed plus this.
+void progressSetRemaining(size_t remaining);
+
+// Phases that know exactly how far they got (like between steps) can correct the count of completed units.
+void progressSetCompleted(size_t completed);
+void progressCompleted(size_t count);
+
+// Scope in which an item (usually a function) is processed. It counts as a completed unit when it ends.
+class ProgressItem
+{
+	// In-flight items are identified by the order in which they started. 0 means that progress isn't reported.
+	uint64_t id;
+
+public:
+	explicit ProgressItem(llvm::StringRef name);
+	ProgressItem(const ProgressItem&) = delete;
+	~ProgressItem();
+};
+
+// Pass that reports one unit of work for every function (or every module) that it sees, so that the optimization phase
+// can say which pass runs on which function. The marker has the same kind as the pass that it goes before, so that it
+// doesn't split function pass groups. Returns nullptr for pass kinds that can't have a marker.
+llvm::Pass* createProgressMarker(const llvm::Pass& next, size_t index, size_t count);
+
+#endif /* fcd__progress_report_h */
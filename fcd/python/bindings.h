@@ -13,6 +13,7 @@
 #include "python_helpers.h"
 
 #include <memory>
+#include <mutex>
 
 template<typename WrappedType>
 struct Py_LLVM_Wrapped
@@ -21,18 +22,30 @@ struct Py_LLVM_Wrapped
 	WrappedType obj;
 };
 
-PyMODINIT_FUNC initLlvmModule(PyObject** module);
-
-extern PyTypeObject Py_LLVMUse_Type;
-extern PyTypeObject Py_LLVMModuleProvider_Type;
-extern PyTypeObject Py_LLVMBuilder_Type;
-extern PyTypeObject Py_LLVMValue_Type;
-extern PyTypeObject Py_LLVMPassRegistry_Type;
-extern PyTypeObject Py_LLVMPassManager_Type;
-extern PyTypeObject Py_LLVMModule_Type;
-extern PyTypeObject Py_LLVMContext_Type;
-extern PyTypeObject Py_LLVMDiagnosticInfo_Type;
-extern PyTypeObject Py_LLVMBasicBlock_Type;
-extern PyTypeObject Py_LLVMType_Type;
+// Python function passes can run in several interpreters at once, but the functions that they see share an
+// LLVMContext. Generated bindings only call into LLVM with this lock held.
+std::mutex& getLlvmLock();
+
+template<typename Fn>
+auto callLlvm(Fn&& fn) -> decltype(fn())
+{
+	std::lock_guard<std::mutex> guard(getLlvmLock());
+	return fn();
+}
+
+// Creates the llvm module (and, with Python 3, its types) in the current interpreter.
+void initLlvmModule(PyObject** module);
+
+PyTypeObject* Py_LLVMUse_Type();
+PyTypeObject* Py_LLVMModuleProvider_Type();
+PyTypeObject* Py_LLVMBuilder_Type();
+PyTypeObject* Py_LLVMValue_Type();
+PyTypeObject* Py_LLVMPassRegistry_Type();
+PyTypeObject* Py_LLVMPassManager_Type();
+PyTypeObject* Py_LLVMModule_Type();
+PyTypeObject* Py_LLVMContext_Type();
+PyTypeObject* Py_LLVMDiagnosticInfo_Type();
+PyTypeObject* Py_LLVMBasicBlock_Type();
+PyTypeObject* Py_LLVMType_Type();
 
 #endif /* fcd__python_bindings_h */
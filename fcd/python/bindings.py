@@ -10,10 +10,12 @@
 #
 
 #
-# (I'm a Python 2 script)
+# (I run on Python 2.7 and Python 3)
 # (feed me a preprocessed llvm-c/Core.h in stdin)
 #
 
+from __future__ import print_function
+
 import re
 import os
 import string
@@ -28,7 +30,7 @@ llvmTypeRE = re.compile("LLVM(.+)Ref")
 class CParameter(object):
 	@staticmethod
 	def parse(paramString):
-		wordCharset = string.letters + string.digits
+		wordCharset = string.ascii_letters + string.digits
 		result = []
 		for param in paramString.split(","):
 			param = param.strip()
@@ -128,7 +130,7 @@ class PythonMethod(object):
 		if cFunction.name == "LLVMConstIntGetZExtValue":
 			sys.stderr.write("got zextvalue\n")
 		if cFunction.returnType in callbacks:
-			raise ValueError, "callback type %s" % cFunction.returnType
+			raise ValueError("callback type %s" % cFunction.returnType)
 
 		self.function = cFunction
 		self.name = self.function.name[4:]
@@ -146,7 +148,7 @@ class PythonMethod(object):
 		prevPointerType = None
 		for param in list:
 			if param in callbacks:
-				raise ValueError, "of callback type %s" % cFunction.returnType
+				raise ValueError("of callback type %s" % cFunction.returnType)
 			
 			if prevPointerType != None:
 				lowerName = param.name.lower()
@@ -156,14 +158,14 @@ class PythonMethod(object):
 						prevPointerType = None
 						break
 				else:
-					raise ValueError, "of uncertain bounds for double-pointer type '%s'" % prevPointerType
+					raise ValueError("of uncertain bounds for double-pointer type '%s'" % prevPointerType)
 			elif param.type == "const char *" or param.type == "const char*":
 				params.append(PythonParameter("string"))
 			else:
 				refType = param.getRefType()
 				if param.isDoublePointer():
 					if refType == None:
-						raise ValueError, "of non-ref double-pointer type '%s'" % param
+						raise ValueError("of non-ref double-pointer type '%s'" % param)
 					prevPointerType = refType
 				elif refType != None:
 					params.append(PythonParameter("object", refType))
@@ -178,10 +180,10 @@ class PythonMethod(object):
 				elif param.type == "LLVMBool":
 					params.append(PythonParameter("bool"))
 				else:
-					raise ValueError, "of unhandled type '%s'" % param
+					raise ValueError("of unhandled type '%s'" % param)
 		
 		if prevPointerType != None:
-			raise ValueError, "of uncertain bounds for double-pointer type %s" % prevPointerType
+			raise ValueError("of uncertain bounds for double-pointer type %s" % prevPointerType)
 		
 		return params
 	
@@ -190,10 +192,10 @@ class PythonMethod(object):
 			return self.selfType
 		
 		if len(self.params) == 0:
-			raise ValueError, "cannot infer self type from empty parameter list"
+			raise ValueError("cannot infer self type from empty parameter list")
 		
 		if self.params[0].type != "object":
-			raise ValueError, "cannot infer self type as non-reference type %s" % self.params[0]
+			raise ValueError("cannot infer self type as non-reference type %s" % self.params[0])
 		
 		self.selfType = self.params[0].generic
 		self.params = self.params[1:]
@@ -247,7 +249,7 @@ for returnType, name, parameters in prototypeRE.findall(contents):
 		if classType not in classes:
 			classes[classType] = PythonClass(classType)
 		classes[classType].addMethod(method)
-	except ValueError, message:
+	except ValueError as message:
 		sys.stderr.write("cannot use %s because %s\n" % (p, message))
 
 #
@@ -284,13 +286,60 @@ for key in classes:
 # code generation starts here
 #
 
-print "#pragma clang diagnostic push"
-print "#pragma clang diagnostic ignored \"-Wshorten-64-to-32\""
-print
-print "#include \"bindings.h\""
-print "#include <llvm-c/Core.h>"
-print "#include <memory>"
-print
+print("#pragma clang diagnostic push")
+print("#pragma clang diagnostic ignored \"-Wshorten-64-to-32\"")
+print()
+print("#include \"bindings.h\"")
+print("#include <llvm-c/Core.h>")
+print("#include <memory>")
+print()
+
+# Types are numbered for the state of the llvm module: classes first, then enums.
+typeIndices = {}
+for classKey in classes:
+	typeIndices["LLVM%s" % classKey] = len(typeIndices)
+for enumKey in enums:
+	typeIndices[enumKey] = len(typeIndices)
+
+print("std::mutex& getLlvmLock()")
+print("{")
+print("\tstatic std::mutex lock;")
+print("\treturn lock;")
+print("}")
+print()
+print("#if PY_MAJOR_VERSION >= 3")
+print("// Every interpreter has its own llvm module, with its own copy of the types in its state, so that interpreters with")
+print("// their own GIL never share objects. Bindings find the types of the calling interpreter through its module.")
+print("static const size_t llvmTypeCount = %i;" % len(typeIndices))
+print("static void freeLlvmModule(void* module);")
+print("static PyModuleDef llvmModuleDefinition = { PyModuleDef_HEAD_INIT, \"llvm\", nullptr, static_cast<Py_ssize_t>(llvmTypeCount * sizeof(PyTypeObject*)), nullptr, nullptr, nullptr, nullptr, &freeLlvmModule };")
+print()
+print("#ifdef Py_TPFLAGS_DISALLOW_INSTANTIATION")
+print("static const unsigned llvmTypeFlags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION;")
+print("#else")
+print("static const unsigned llvmTypeFlags = Py_TPFLAGS_DEFAULT;")
+print("#endif")
+print()
+print("static PyTypeObject** getLlvmTypes(PyObject* module)")
+print("{")
+print("\treturn static_cast<PyTypeObject**>(PyModule_GetState(module));")
+print("}")
+print()
+print("static PyTypeObject* getLlvmType(size_t index)")
+print("{")
+print("\treturn getLlvmTypes(PyState_FindModule(&llvmModuleDefinition))[index];")
+print("}")
+print()
+print("static void freeLlvmModule(void* module)")
+print("{")
+print("\tPyTypeObject** types = getLlvmTypes(static_cast<PyObject*>(module));")
+print("\tfor (size_t i = 0; i < llvmTypeCount; ++i)")
+print("\t{")
+print("\t\tPy_CLEAR(types[i]);")
+print("\t}")
+print("}")
+print("#endif")
+print()
 
 methodNoArgsPrototypeTemplate = """static PyObject* %s(Py_LLVM_Wrapped<%s>* self)"""
 methodArgsPrototypeTemplate = """static PyObject* %s(Py_LLVM_Wrapped<%s>* self, PyObject* args)"""
@@ -300,14 +349,35 @@ methodTableTemplate = """static PyMethodDef %s_methods[] = {
 %s\t{nullptr}\n};
 """
 
-typeObjectTemplate = """PyTypeObject %s_Type = {
-	PyObject_HEAD_INIT(nullptr)
-	.tp_name = "llvm.%s",
-	.tp_basicsize = %s,
+# Python 3 types are created from a spec in every interpreter. Python 2 only has one interpreter, and static types.
+typeObjectTemplate = """#if PY_MAJOR_VERSION >= 3
+static PyType_Slot %(type)s_slots[] = {
+	{Py_tp_doc, (void*)"Wrapper type for %(doc)s"},
+	{Py_tp_methods, %(methods)s_methods},
+	{0, nullptr},
+};
+
+static PyType_Spec %(type)s_spec = { "llvm.%(name)s", %(size)s, 0, llvmTypeFlags, %(type)s_slots };
+
+PyTypeObject* %(type)s_Type()
+{
+	return getLlvmType(%(index)i);
+}
+#else
+static PyTypeObject %(type)s_TypeObject = {
+	PyVarObject_HEAD_INIT(nullptr, 0)
+	.tp_name = "llvm.%(name)s",
+	.tp_basicsize = %(size)s,
 	.tp_flags = Py_TPFLAGS_DEFAULT,
-	.tp_doc = "Wrapper type for %s",
-	.tp_methods = %s_methods,
+	.tp_doc = "Wrapper type for %(doc)s",
+	.tp_methods = %(methods)s_methods,
 };
+
+PyTypeObject* %(type)s_Type()
+{
+	return &%(type)s_TypeObject;
+}
+#endif
 """
 
 methodImplementations = ""
@@ -328,11 +398,11 @@ for classKey in classes:
 		if len(method.params) == 0:
 			args = "NOARGS"
 			prototype = methodNoArgsPrototypeTemplate % (methodCName, llvmName)
-			print prototype + ";"
+			print(prototype + ";")
 		else:
 			args = "VARARGS"
 			prototype = methodArgsPrototypeTemplate % (methodCName, llvmName)
-			print prototype + ";"
+			print(prototype + ";")
 		
 		tableEntries += methodTableEntryTemplate % (method.name, methodCName, args, method.function.name)
 		
@@ -354,7 +424,7 @@ for classKey in classes:
 				if param.type == "object":
 					methodImplementations += "\tPy_LLVM_Wrapped<LLVM%sRef>* arg%i;\n" % (param.generic, i)
 					paramString += "!"
-					addresses.append("&%sLLVM%s_Type" % (prefix, param.generic))
+					addresses.append("%sLLVM%s_Type()" % (prefix, param.generic))
 				else:
 					methodImplementations += "\tPyObject* arg%i;\n" % i
 					if param.type == "bool":
@@ -404,79 +474,100 @@ for classKey in classes:
 				i += 1
 			returnedExpression = "%s(%s)" % (method.function.name, ", ".join(cParams))
 		
+		# LLVM is only called with the lock held, along with the conversion of what it returns.
+		def locked(expression):
+			return "callLlvm([&] { return %s; })" % expression
+		
 		if method.returnType.type == "object":
 			returnTypeString = "Py_LLVM_Wrapped<LLVM%sRef>" % method.returnType.generic
-			objectType = "%sLLVM%s_Type" % (prefix, method.returnType.generic)
-			methodImplementations += "\tauto callReturn = %s;\n" % returnedExpression
+			objectType = "%sLLVM%s_Type()" % (prefix, method.returnType.generic)
+			methodImplementations += "\tauto callReturn = %s;\n" % locked(returnedExpression)
 			methodImplementations += "\tif (callReturn == nullptr)\n"
 			methodImplementations += "\t{\n"
 			methodImplementations += "\t\tPy_RETURN_NONE;\n"
 			methodImplementations += "\t}\n"
-			methodImplementations += "\t%s* result = PyObject_New(%s, &%s);\n" % (returnTypeString, returnTypeString, objectType)
+			methodImplementations += "\t%s* result = PyObject_New(%s, %s);\n" % (returnTypeString, returnTypeString, objectType)
 			methodImplementations += "\tresult->obj = callReturn;\n"
 			methodImplementations += "\treturn (PyObject*)result;\n"
 		elif method.returnType.type == "string":
-			methodImplementations += "\treturn PyString_FromString(%s);\n" % returnedExpression
+			methodImplementations += "\treturn %s;\n" % locked("pyStringFromString(%s)" % returnedExpression)
 		elif method.returnType.type == "int":
-			methodImplementations += "\treturn PyInt_FromLong(static_cast<long>(%s));\n" % returnedExpression
+			methodImplementations += "\treturn %s;\n" % locked("pyIntFromLong(static_cast<long>(%s))" % returnedExpression)
 		elif method.returnType.type == "bool":
-			methodImplementations += "\treturn PyBool_FromLong(%s);\n" % returnedExpression
+			methodImplementations += "\treturn %s;\n" % locked("PyBool_FromLong(%s)" % returnedExpression)
 		elif method.returnType.type == "void":
-			methodImplementations += "\t%s;\n" % returnedExpression
+			methodImplementations += "\t%s;\n" % locked(returnedExpression)
 			methodImplementations += "\tPy_RETURN_NONE;\n"
 		else:
 			methodImplementations += "#error Implement return type %s" % method.returnType.type
 		methodImplementations += "}\n\n"
-	print
+	print()
 	
 	sys.stderr.write("\n")
 	
 	# method table
-	print methodTableTemplate % (typeName, tableEntries)
-	print typeObjectTemplate % (typeName, classKey, "sizeof(Py_LLVM_Wrapped<%s>)" % llvmName, llvmName, typeName)
+	print(methodTableTemplate % (typeName, tableEntries))
+	print(typeObjectTemplate % {
+		"type": typeName, "name": classKey, "size": "sizeof(Py_LLVM_Wrapped<%s>)" % llvmName, "doc": llvmName,
+		"methods": typeName, "index": typeIndices["LLVM%s" % classKey]})
 
 # enum types here
-print methodTableTemplate % ("no", "")
+print(methodTableTemplate % ("no", ""))
 for enumKey in enums:
 	typeName = "%s%s" % (prefix, enumKey)
-	print typeObjectTemplate % (typeName, enumKey[4:], "sizeof(PyObject)", "enum " + enumKey, "no")
+	print(typeObjectTemplate % {
+		"type": typeName, "name": enumKey[4:], "size": "sizeof(PyObject)", "doc": "enum " + enumKey,
+		"methods": "no", "index": typeIndices[enumKey]})
 
-print methodImplementations
+print(methodImplementations)
 
-print "PyMODINIT_FUNC initLlvmModule(PyObject** module)"
-print "{"
+# Type objects and the names that they get in the llvm module, in the order of typeIndices.
+moduleTypes = []
 for classKey in classes:
-	typeObjName = "%sLLVM%s_Type" % (prefix, classKey)
-	print "\tif (PyType_Ready(&%s) < 0) return;" % typeObjName
-
+	moduleTypes.append(("%sLLVM%s" % (prefix, classKey), classKey))
 for enumKey in enums:
-	typeObjName = "%s%s_Type" % (prefix, enumKey)
-	print "\tif (PyType_Ready(&%s) < 0) return;" % typeObjName
-
-print
+	moduleTypes.append(("%s%s" % (prefix, enumKey), enumKey[4:]))
+
+print("void initLlvmModule(PyObject** module)")
+print("{")
+print("#if PY_MAJOR_VERSION >= 3")
+print("\t*module = PyModule_Create(&llvmModuleDefinition);")
+print("\tif (*module == nullptr) return;")
+print("\tPyTypeObject** types = getLlvmTypes(*module);")
+for index, (typeName, name) in enumerate(moduleTypes):
+	print("\tif ((types[%i] = (PyTypeObject*)PyType_FromSpec(&%s_spec)) == nullptr) { Py_CLEAR(*module); return; }" % (index, typeName))
+
+print()
 for enumKey in enums:
-	typeObjName = "%s%s_Type" % (prefix, enumKey)
 	enum = enums[enumKey]
 	for key in enum.cases:
-		print "\tPyDict_SetItemString(%s.tp_dict, \"%s\", (TAKEREF PyInt_FromLong(%i)).get());" % (typeObjName, key[4:], enum.cases[key])
-	print
-
-print
-print "\t*module = Py_InitModule(\"llvm\", nullptr);"
-for classKey in classes:
-	typeObjName = "%sLLVM%s_Type" % (prefix, classKey)
-	print "\tPy_INCREF(&%s);" % typeObjName
+		print("\tPyObject_SetAttrString((PyObject*)types[%i], \"%s\", (TAKEREF pyIntFromLong(%i)).get());" % (typeIndices[enumKey], key[4:], enum.cases[key]))
+	print()
+
+print("\tPyState_AddModule(*module, &llvmModuleDefinition);")
+print("\tPyDict_SetItemString(PyImport_GetModuleDict(), \"llvm\", *module);")
+for index, (typeName, name) in enumerate(moduleTypes):
+	print("\tPy_INCREF(types[%i]);" % index)
+for index, (typeName, name) in enumerate(moduleTypes):
+	print("\tPyModule_AddObject(*module, \"%s\", (PyObject*)types[%i]);" % (name, index))
+print("#else")
+for typeName, name in moduleTypes:
+	print("\tif (PyType_Ready(&%s_TypeObject) < 0) return;" % typeName)
+
+print()
 for enumKey in enums:
-	typeObjName = "%s%s_Type" % (prefix, enumKey)
-	print "\tPy_INCREF(&%s);" % typeObjName
-
-for classKey in classes:
-	typeObjName = "%sLLVM%s_Type" % (prefix, classKey)
-	print "\tPyModule_AddObject(*module, \"%s\", (PyObject*)&%s);" % (classKey, typeObjName)
-for enumKey in enums:
-	typeObjName = "%s%s_Type" % (prefix, enumKey)
-	print "\tPyModule_AddObject(*module, \"%s\", (PyObject*)&%s);" % (enumKey[4:], typeObjName)
-
-print "}"
-print
-print "#pragma clang diagnostic pop"
+	typeObjName = "%s%s_TypeObject" % (prefix, enumKey)
+	enum = enums[enumKey]
+	for key in enum.cases:
+		print("\tPyDict_SetItemString(%s.tp_dict, \"%s\", (TAKEREF pyIntFromLong(%i)).get());" % (typeObjName, key[4:], enum.cases[key]))
+	print()
+
+print("\t*module = Py_InitModule(\"llvm\", nullptr);")
+for typeName, name in moduleTypes:
+	print("\tPy_INCREF(&%s_TypeObject);" % typeName)
+for typeName, name in moduleTypes:
+	print("\tPyModule_AddObject(*module, \"%s\", (PyObject*)&%s_TypeObject);" % (name, typeName))
+print("#endif")
+print("}")
+print()
+print("#pragma clang diagnostic pop")
@@ -8,18 +8,34 @@
 //
 
 #include "bindings.h"
+#include "command_line.h"
 #include "errors.h"
 #include "python_context.h"
 #include "python_helpers.h"
+#include "task_runtime.h"
 
 #include <llvm/IR/Module.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Interpreters that don't share the GIL of the main interpreter appeared in Python 3.12.
+#if PY_VERSION_HEX >= 0x030C0000
+#define FCD_PYTHON_SUBINTERPRETERS 1
+#endif
 
 using namespace llvm;
 using namespace std;
 
 namespace
 {
+	cl::opt<unsigned> pythonInterpreters("python-interpreters", cl::value_desc("count"), cl::desc("Number of interpreters that run each Python function pass on several functions at once (Python 3.12 and later; each interpreter has its own copy of the pass's module-level state)"), cl::init(1), whitelist());
+	
 #pragma mark - Wrapper passes
 	struct PythonWrapper
 	{
@@ -69,7 +85,8 @@ namespace
 		
 		virtual bool runOnModule(Module& m) override
 		{
-			auto pyModuleObject = TAKEREF Py_LLVMModule_Type.tp_alloc(&Py_LLVMModule_Type, 0);
+			PyTypeObject* type = Py_LLVMModule_Type();
+			auto pyModuleObject = TAKEREF type->tp_alloc(type, 0);
 			((Py_LLVM_Wrapped<LLVMModuleRef>*)pyModuleObject.get())->obj = wrap(&m);
 			return runWithObject(pyModuleObject.get());
 		}
@@ -91,17 +108,227 @@ namespace
 		
 		virtual bool runOnFunction(Function& fn) override
 		{
-			auto pyModuleObject = TAKEREF Py_LLVMValue_Type.tp_alloc(&Py_LLVMValue_Type, 0);
+			PyTypeObject* type = Py_LLVMValue_Type();
+			auto pyModuleObject = TAKEREF type->tp_alloc(type, 0);
 			((Py_LLVM_Wrapped<LLVMValueRef>*)pyModuleObject.get())->obj = wrap(&fn);
 			return runWithObject(pyModuleObject.get());
 		}
 	};
+}
+
+#pragma mark - Interpreter pools
+// Interpreters that run the same Python function pass on several functions at once. Each one has its own GIL, its own
+// llvm module and its own copy of the pass's module. Pools are kept by the context, so that passes created again for
+// the next module of a batch reuse the interpreters instead of starting new ones.
+class PythonInterpreterPool
+{
+	struct Interpreter
+	{
+		PyThreadState* threadState; // created with the interpreter, and only attached to create or end it
+		AutoPyObject llvmModule;
+		unique_ptr<PythonWrapper> pass;
+	};
+	
+	string path;
+	vector<unique_ptr<Interpreter>> interpreters;
+	mutex lock;
+	condition_variable released;
+	vector<Interpreter*> idle;
+	
+	static void end(Interpreter& interpreter);
+
+public:
+	PythonInterpreterPool(const string& path)
+	: path(path)
+	{
+	}
+	
+	~PythonInterpreterPool();
+	
+	// Called from the main interpreter.
+	error_code grow(size_t count, const string& passName);
+	
+	// Called from any thread, without a Python thread state. Waits for an idle interpreter.
+	bool runOnFunction(Function& fn);
+};
+
+void PythonInterpreterPool::end(Interpreter& interpreter)
+{
+	PyEval_RestoreThread(interpreter.threadState);
+	interpreter.pass.reset();
+	interpreter.llvmModule.reset();
+	Py_EndInterpreter(interpreter.threadState);
+}
+
+PythonInterpreterPool::~PythonInterpreterPool()
+{
+	if (interpreters.empty())
+	{
+		return;
+	}
+	
+	PyThreadState* mainState = PyEval_SaveThread();
+	for (auto& interpreter : interpreters)
+	{
+		end(*interpreter);
+	}
+	PyEval_RestoreThread(mainState);
+}
+
+error_code PythonInterpreterPool::grow(size_t count, const string& passName)
+{
+#ifdef FCD_PYTHON_SUBINTERPRETERS
+	PyInterpreterConfig config = {};
+	config.use_main_obmalloc = 0;
+	config.allow_fork = 0;
+	config.allow_exec = 0;
+	config.allow_threads = 1;
+	config.allow_daemon_threads = 0;
+	config.check_multi_interp_extensions = 1;
+	config.gil = PyInterpreterConfig_OWN_GIL;
+	
+	while (interpreters.size() < count)
+	{
+		PyThreadState* mainState = PyThreadState_Get();
+		unique_ptr<Interpreter> interpreter(new Interpreter);
+		if (PyStatus_Exception(Py_NewInterpreterFromConfig(&interpreter->threadState, &config)))
+		{
+			return make_error_code(FcdError::Python_LoadError);
+		}
+		
+		// The new interpreter is current. It gets its own llvm module, and runs the pass's module again.
+		error_code error;
+		PyObject* llvmModule = nullptr;
+		initLlvmModule(&llvmModule);
+		interpreter->llvmModule.reset(llvmModule);
+		if (llvmModule == nullptr)
+		{
+			PyErr_Print();
+			error = make_error_code(FcdError::Python_LoadError);
+		}
+		else if (auto moduleOrError = loadModule(path))
+		{
+			auto run = TAKEREF PyObject_GetAttrString(moduleOrError.get().get(), "runOnFunction");
+			PyErr_Clear();
+			if (run && PyCallable_Check(run.get()))
+			{
+				interpreter->pass.reset(new PythonWrapper(move(moduleOrError.get()), move(run), passName));
+			}
+			else
+			{
+				error = make_error_code(FcdError::Python_InvalidPassFunction);
+			}
+		}
+		else
+		{
+			error = moduleOrError.getError();
+		}
+		
+		PyEval_SaveThread();
+		if (error)
+		{
+			end(*interpreter);
+		}
+		PyEval_RestoreThread(mainState);
+		if (error)
+		{
+			return error;
+		}
+		
+		idle.push_back(interpreter.get());
+		interpreters.push_back(move(interpreter));
+	}
+#endif
+	return error_code();
+}
+
+bool PythonInterpreterPool::runOnFunction(Function& fn)
+{
+	Interpreter* interpreter;
+	{
+		unique_lock<mutex> guard(lock);
+		released.wait(guard, [&] { return !idle.empty(); });
+		interpreter = idle.back();
+		idle.pop_back();
+	}
+	
+	// Thread states can't move between threads, so the interpreter gets one for the thread that it runs on.
+	PyThreadState* threadState = PyThreadState_New(PyThreadState_GetInterpreter(interpreter->threadState));
+	PyEval_RestoreThread(threadState);
+	bool changed;
+	{
+		PyTypeObject* type = Py_LLVMValue_Type();
+		auto pyValueObject = TAKEREF type->tp_alloc(type, 0);
+		((Py_LLVM_Wrapped<LLVMValueRef>*)pyValueObject.get())->obj = wrap(&fn);
+		changed = interpreter->pass->runWithObject(pyValueObject.get());
+	}
+	PyThreadState_Clear(threadState);
+	PyThreadState_DeleteCurrent();
+	
+	{
+		lock_guard<mutex> guard(lock);
+		idle.push_back(interpreter);
+	}
+	released.notify_one();
+	return changed;
+}
+
+namespace
+{
+	// Runs a Python function pass on every function of the module at once, with the interpreters of a pool. Functions
+	// are still handed to each interpreter one at a time, but this is a module pass, so the pass manager can't
+	// interleave it with neighbouring function passes. Generated bindings hold the LLVM lock for each call, not across
+	// calls, so passes that run concurrently must stick to the function that they are given: iterating over module-level
+	// lists (like the functions of the module or the uses of a global) can race with the other interpreters.
+	struct PythonConcurrentFunction final : public ModulePass
+	{
+		static char ID;
+		PythonInterpreterPool& pool;
+		string name;
+		
+		PythonConcurrentFunction(PythonInterpreterPool& pool, string name)
+		: ModulePass(ID), pool(pool), name(move(name))
+		{
+		}
+		
+		virtual StringRef getPassName() const override
+		{
+			return name.c_str();
+		}
+		
+		virtual bool runOnModule(Module& m) override
+		{
+			atomic<bool> changed(false);
+			PyThreadState* mainState = PyEval_SaveThread();
+			{
+				TaskGroup group;
+				for (Function& fn : m)
+				{
+					if (!fn.isDeclaration())
+					{
+						group.spawn([&]
+						{
+							if (pool.runOnFunction(fn))
+							{
+								changed = true;
+							}
+						});
+					}
+				}
+				group.wait();
+			}
+			PyEval_RestoreThread(mainState);
+			return changed;
+		}
+	};
 	
 	char PythonWrappedModule::ID = 0;
 	char PythonWrappedFunction::ID = 0;
+	char PythonConcurrentFunction::ID = 0;
 	
 	RegisterPass<PythonWrappedModule> pyModulePass("#py-module-pass", "Python-wrapped module pass", false, false);
 	RegisterPass<PythonWrappedFunction> pyFuncPass("#py-function-pass", "Python-wrapped function pass", false, false);
+	RegisterPass<PythonConcurrentFunction> pyConcurrentFuncPass("#py-concurrent-function-pass", "Python-wrapped function pass, run in several interpreters", false, false);
 }
 
 #ifdef FCD_DEBUG
@@ -114,9 +341,28 @@ void dump(PyObject* obj)
 
 #pragma mark - Implementation
 PythonContext::PythonContext(const string& programPath)
+: programPath(programPath), llvmModule(nullptr)
 {
-	unique_ptr<char, decltype(free)&> mutableName(strdup(programPath.c_str()), free);
-	Py_SetProgramName(mutableName.get());
+}
+
+void PythonContext::initialize()
+{
+	if (isInitialized())
+	{
+		return;
+	}
+	
+	// Py_SetProgramName keeps the pointer, so the string must outlive the interpreter.
+#if PY_MAJOR_VERSION >= 3
+	if (wchar_t* decoded = Py_DecodeLocale(programPath.c_str(), nullptr))
+	{
+		wideProgramPath = decoded;
+		PyMem_RawFree(decoded);
+		Py_SetProgramName(&wideProgramPath[0]);
+	}
+#else
+	Py_SetProgramName(&programPath[0]);
+#endif
 	Py_Initialize();
 	
 	initLlvmModule(&llvmModule);
@@ -124,13 +370,31 @@ PythonContext::PythonContext(const string& programPath)
 
 ErrorOr<Pass*> PythonContext::createPass(const std::string &path)
 {
-	auto moduleOrError = loadModule(path);
-	if (!moduleOrError)
+	initialize();
+	
+	// Passes are created again for every module of a batch. Their Python module is only executed the first time, so
+	// that module-level state survives from one program to the next, like it would with a single pass manager. Function
+	// passes that run in several interpreters (--python-interpreters) execute it again in each of them, and that state
+	// is then split between the interpreters instead.
+	AutoPyObject module;
+	auto iter = passModules.find(path);
+	if (iter != passModules.end())
 	{
-		return moduleOrError.getError();
+		module = ADDREF iter->second;
+	}
+	else
+	{
+		auto moduleOrError = loadModule(path);
+		if (!moduleOrError)
+		{
+			return moduleOrError.getError();
+		}
+		
+		module = move(moduleOrError.get());
+		Py_INCREF(module.get());
+		passModules[path] = module.get();
 	}
 	
-	auto& module = moduleOrError.get();
 	auto runOnModule = TAKEREF PyObject_GetAttrString(module.get(), "runOnModule");
 	auto runOnFunction = TAKEREF PyObject_GetAttrString(module.get(), "runOnFunction");
 	PyErr_Clear();
@@ -139,11 +403,10 @@ ErrorOr<Pass*> PythonContext::createPass(const std::string &path)
 	if (auto passNameObj = TAKEREF PyObject_GetAttrString(module.get(), "passName"))
 	if (auto asString = TAKEREF PyObject_Str(passNameObj.get()))
 	{
-		char* bufferPointer;
-		Py_ssize_t stringLength;
-		if (PyString_AsStringAndSize(asString.get(), &bufferPointer, &stringLength) == 0)
+		string passNameString;
+		if (getPythonString(asString.get(), passNameString))
 		{
-			passName.reset(new string(bufferPointer, static_cast<size_t>(stringLength)));
+			passName.reset(new string(move(passNameString)));
 		}
 	}
 	
@@ -179,6 +442,31 @@ ErrorOr<Pass*> PythonContext::createPass(const std::string &path)
 			passName.reset(new string("Python Function Pass"));
 		}
 		
+#ifdef FCD_PYTHON_SUBINTERPRETERS
+		// Passes that can't load in other interpreters (for instance, because they import extensions that don't
+		// support them) run in the main interpreter. A null pool remembers that for the next modules of a batch.
+		unsigned concurrency = min<unsigned>(pythonInterpreters, TaskRuntime::shared().getConcurrency());
+		if (concurrency > 1)
+		{
+			auto poolIter = interpreterPools.find(path);
+			if (poolIter == interpreterPools.end())
+			{
+				unique_ptr<PythonInterpreterPool> pool(new PythonInterpreterPool(path));
+				if (auto error = pool->grow(concurrency, *passName))
+				{
+					errs() << "Python pass " << path << " can't run in several interpreters (" << error.message() << "); running it in the main interpreter\n";
+					pool.reset();
+				}
+				poolIter = interpreterPools.insert({path, move(pool)}).first;
+			}
+			
+			if (auto& pool = poolIter->second)
+			{
+				return new PythonConcurrentFunction(*pool, move(*passName));
+			}
+		}
+#endif
+		
 		PythonWrapper wrapper(move(module), move(runOnFunction), move(*passName));
 		return new PythonWrappedFunction(move(wrapper));
 	}
@@ -192,7 +480,15 @@ ErrorOr<Pass*> PythonContext::createPass(const std::string &path)
 
 PythonContext::~PythonContext()
 {
-	Py_Finalize();
+	if (isInitialized())
+	{
+		interpreterPools.clear();
+		for (auto& pair : passModules)
+		{
+			Py_DECREF(pair.second);
+		}
+		Py_Finalize();
+	}
 }
 
 namespace llvm
@@ -211,4 +507,11 @@ namespace llvm
 		assert(false);
 		return nullptr;
 	}
+	
+	template<>
+	Pass* callDefaultCtor<PythonConcurrentFunction>()
+	{
+		assert(false);
+		return nullptr;
+	}
 }
@@ -16,17 +16,27 @@
 #include <cassert>
 #include <memory>
 #include <string>
+#include <unordered_map>
 
 struct _object;
+class PythonInterpreterPool;
 
+// The interpreter is only started the first time that something needs it, since most runs don't.
 class PythonContext
 {
+	std::string programPath;
+	std::wstring wideProgramPath; // Python 3 takes the program name as a wide string
 	_object* llvmModule;
+	std::unordered_map<std::string, _object*> passModules; // owned; loaded once per path, even in batches
+	std::unordered_map<std::string, std::unique_ptr<PythonInterpreterPool>> interpreterPools; // null for passes that failed to load in them
 	
 public:
 	PythonContext(const std::string& programPath);
 	~PythonContext();
 	
+	bool isInitialized() const { return llvmModule != nullptr; }
+	void initialize();
+	
 	llvm::ErrorOr<llvm::Pass*> createPass(const std::string& path);
 };
 
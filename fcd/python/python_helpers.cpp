@@ -22,12 +22,17 @@ int getPythonErrno()
 	PyObject* unmanagedData;
 	PyObject* unmanagedBt;
 	PyErr_Fetch(&unmanagedType, &unmanagedData, &unmanagedBt);
-	if (auto managedType = ADDREF unmanagedType)
-	if (auto managedData = ADDREF unmanagedData)
+	
+	// Python 3 usually raises exception instances, whereas Python 2 can leave the arguments in a tuple; normalizing
+	// makes an instance in both cases.
+	PyErr_NormalizeException(&unmanagedType, &unmanagedData, &unmanagedBt);
+	auto managedBt = TAKEREF unmanagedBt;
+	if (auto managedType = TAKEREF unmanagedType)
+	if (auto managedData = TAKEREF unmanagedData)
 	if (PyErr_GivenExceptionMatches(managedType.get(), PyExc_EnvironmentError))
-	if (auto errorField = ADDREF PyTuple_GetItem(managedData.get(), 0))
+	if (auto errorField = TAKEREF PyObject_GetAttrString(managedData.get(), "errno"))
 	{
-		long errorNumber = PyInt_AsLong(errorField.get());
+		long errorNumber = pyIntAsLong(errorField.get());
 		if (errorNumber != -1 || PyErr_Occurred() == nullptr)
 		{
 			return static_cast<int>(errorNumber);
@@ -36,10 +41,61 @@ int getPythonErrno()
 	return 0;
 }
 
+bool getPythonString(PyObject* object, string& output)
+{
+#if PY_MAJOR_VERSION >= 3
+	Py_ssize_t stringLength;
+	if (const char* bufferPointer = PyUnicode_AsUTF8AndSize(object, &stringLength))
+	{
+		output.assign(bufferPointer, static_cast<size_t>(stringLength));
+		return true;
+	}
+#else
+	char* bufferPointer;
+	Py_ssize_t stringLength;
+	if (PyString_AsStringAndSize(object, &bufferPointer, &stringLength) == 0)
+	{
+		output.assign(bufferPointer, static_cast<size_t>(stringLength));
+		return true;
+	}
+#endif
+	return false;
+}
+
 ErrorOr<AutoPyObject> loadModule(const std::string& path)
 {
 	PyErrClearAtEnd clearPyErrAtEndOfFunction;
+	auto moduleName = sys::path::stem(path).str();
+	
+#if PY_MAJOR_VERSION >= 3
+	// Python 3 no longer has imp.load_source. importlib finds a loader for the file (source or compiled) from its
+	// extension, and runs it in a new module.
+	auto importlibUtil = TAKEREF PyImport_ImportModule("importlib.util");
+	if (!importlibUtil)
+	{
+		PyErr_Print();
+		return make_error_code(FcdError::Python_LoadError);
+	}
+	
+	char specMethodName[] = "spec_from_file_location";
+	char moduleMethodName[] = "module_from_spec";
+	char execMethodName[] = "exec_module";
+	char argSpecifier[] = "ss";
+	char objectSpecifier[] = "O";
+	auto spec = TAKEREF PyObject_CallMethod(importlibUtil.get(), specMethodName, argSpecifier, moduleName.c_str(), path.c_str());
+	if (!spec || spec.get() == Py_None)
+	{
+		return make_error_code(FcdError::Python_LoadError);
+	}
 	
+	auto module = TAKEREF PyObject_CallMethod(importlibUtil.get(), moduleMethodName, objectSpecifier, spec.get());
+	if (module)
+	if (auto loader = TAKEREF PyObject_GetAttrString(spec.get(), "loader"))
+	if (auto execResult = TAKEREF PyObject_CallMethod(loader.get(), execMethodName, objectSpecifier, module.get()))
+	{
+		return move(module);
+	}
+#else
 	// Like the official CPython source, use the imp module to load files by path.
 	auto modules = ADDREF PyImport_GetModuleDict();
 	auto impModule = ADDREF PyDict_GetItemString(modules.get(), "imp");
@@ -56,14 +112,15 @@ ErrorOr<AutoPyObject> loadModule(const std::string& path)
 	
 	char methodName[] = "load_source";
 	char argSpecifier[] = "ss";
-	auto moduleName = sys::path::stem(path).str();
 	auto module = TAKEREF PyObject_CallMethod(impModule.get(), methodName, argSpecifier, moduleName.c_str(), path.c_str());
 	
 	if (module)
 	{
 		return move(module);
 	}
-	else if (int error = getPythonErrno())
+#endif
+	
+	if (int error = getPythonErrno())
 	{
 		return error_code(error, system_category());
 	}
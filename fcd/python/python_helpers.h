@@ -19,8 +19,23 @@
 #endif
 
 #include <memory>
+#include <string>
 #include <utility>
 
+// fcd embeds Python 2.7 or Python 3, whichever it was built with. These cover the differences in the API that fcd and
+// the generated bindings use. Text is a str in both versions, and raw data is a bytes object (str in Python 2).
+#if PY_MAJOR_VERSION >= 3
+inline PyObject* pyStringFromString(const char* string) { return PyUnicode_FromString(string); }
+inline PyObject* pyBytesFromStringAndSize(const char* bytes, Py_ssize_t size) { return PyBytes_FromStringAndSize(bytes, size); }
+inline PyObject* pyIntFromLong(long value) { return PyLong_FromLong(value); }
+inline long pyIntAsLong(PyObject* object) { return PyLong_AsLong(object); }
+#else
+inline PyObject* pyStringFromString(const char* string) { return PyString_FromString(string); }
+inline PyObject* pyBytesFromStringAndSize(const char* bytes, Py_ssize_t size) { return PyString_FromStringAndSize(bytes, size); }
+inline PyObject* pyIntFromLong(long value) { return PyInt_FromLong(value); }
+inline long pyIntAsLong(PyObject* object) { return PyInt_AsLong(object); }
+#endif
+
 struct PyErrClearAtEnd
 {
 	~PyErrClearAtEnd() { PyErr_Clear(); }
@@ -63,6 +78,7 @@ struct AddRefWrapWithAutoPyObject
 #define ADDREF AddRefWrapWithAutoPyObject() ||
 
 int getPythonErrno();
+bool getPythonString(PyObject* object, std::string& output);
 llvm::ErrorOr<AutoPyObject> loadModule(const std::string& path);
 
 inline void addObjectToTuple(AutoPyObject& tuple, size_t index, AutoPyObject& item)
@@ -0,0 +1,494 @@
+//
+// supervisor.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "call_conv.h"
+#include "command_line.h"
+#include "executable.h"
+#include "metadata.h"
+#include "progress_report.h"
+#include "supervisor.h"
+#include "targetinfo.h"
+#include "task_runtime.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	cl::opt<bool> supervise("supervise", cl::desc("Decompile in worker processes, and quarantine the functions that make them crash"), whitelist());
+	cl::opt<unsigned> shardSize("supervise-shard-size", cl::value_desc("count"), cl::desc("Number of functions given to each worker (0 gives every function to a single worker, and only splits on failure)"), cl::init(0), whitelist());
+	cl::opt<string> quarantineDirectory("quarantine-dir", cl::value_desc("path"), cl::desc("Directory where repros of quarantined functions are saved (defaults to <input>-quarantine)"), whitelist());
+	
+	// Options that only concern the supervisor, or that would make workers decompile other functions than the ones
+	// that they are given. The second member tells if the option takes a value.
+	const pair<const char*, bool> supervisorOptions[] = {
+		{"supervise", false},
+		{"supervise-shard-size", true},
+		{"quarantine-dir", true},
+		{"tier-checkpoint", true},
+		{"other-entry", true},
+		{"e", true},
+		{"partial", false},
+		{"p", false},
+		{"progress-file", true},
+		{"progress-fd", true},
+		{"progress-interval", true},
+	};
+	
+	struct WorkerResult
+	{
+		int status;
+		bool executionFailed;
+		string errorMessage;
+		string output;
+		string log;
+		
+		bool succeeded() const { return status == 0 && !executionFailed; }
+	};
+	
+	struct QuarantinedFunction
+	{
+		uint64_t address;
+		string reason;
+		string log;
+	};
+	
+	string readAndRemove(StringRef path)
+	{
+		string result;
+		if (auto bufferOrError = MemoryBuffer::getFile(path))
+		{
+			result = bufferOrError.get()->getBuffer();
+		}
+		sys::fs::remove(path);
+		return result;
+	}
+	
+	// Workers print the included files before their functions. The supervisor prints them once.
+	StringRef skipIncludes(StringRef output, size_t includeCount)
+	{
+		size_t lines = includeCount == 0 ? 0 : includeCount + 1;
+		for (size_t i = 0; i < lines && !output.empty(); ++i)
+		{
+			output = output.split('\n').second;
+		}
+		return output;
+	}
+	
+	class BatchSupervisor
+	{
+		string program;
+		vector<string> baseArguments;
+		string checkpointPath;
+		size_t includeCount;
+		unordered_map<uint64_t, string> functionNames;
+		
+		AddressOrderedResults<string> outputs;
+		mutex lock;
+		vector<QuarantinedFunction> quarantined;
+		string abortMessage;
+		mutex probeLock;
+		bool probed = false;
+		bool probeFailed = false;
+		
+		vector<string> getWorkerArguments(ArrayRef<uint64_t> addresses, StringRef inputPath) const
+		{
+			string promoted;
+			for (uint64_t address : addresses)
+			{
+				promoted += promoted.empty() ? "--promote=" : ",";
+				promoted += "0x" + utohexstr(address);
+			}
+			
+			vector<string> arguments;
+			arguments.push_back(program);
+			arguments.insert(arguments.end(), baseArguments.begin(), baseArguments.end());
+			arguments.push_back("--module-in");
+			arguments.push_back(move(promoted));
+			arguments.push_back(inputPath);
+			return arguments;
+		}
+		
+		WorkerResult runWorker(ArrayRef<uint64_t> addresses)
+		{
+			WorkerResult result = {};
+			SmallString<128> outputPath;
+			SmallString<128> logPath;
+			if (auto errorCode = sys::fs::createTemporaryFile("fcd-worker", "c", outputPath))
+			{
+				result.executionFailed = true;
+				result.errorMessage = "can't create temporary file: " + errorCode.message();
+				return result;
+			}
+			if (auto errorCode = sys::fs::createTemporaryFile("fcd-worker", "log", logPath))
+			{
+				sys::fs::remove(outputPath);
+				result.executionFailed = true;
+				result.errorMessage = "can't create temporary file: " + errorCode.message();
+				return result;
+			}
+			
+			vector<string> arguments = getWorkerArguments(addresses, checkpointPath);
+			vector<const char*> argv;
+			for (const string& argument : arguments)
+			{
+				argv.push_back(argument.c_str());
+			}
+			argv.push_back(nullptr);
+			
+			StringRef outputRedirect = outputPath;
+			StringRef logRedirect = logPath;
+			const StringRef* redirects[] = {nullptr, &outputRedirect, &logRedirect};
+			result.status = sys::ExecuteAndWait(program, argv.data(), nullptr, redirects, 0, 0, &result.errorMessage, &result.executionFailed);
+			result.output = readAndRemove(outputPath);
+			result.log = readAndRemove(logPath);
+			return result;
+		}
+		
+		string describeFailure(const WorkerResult& result) const
+		{
+			if (result.status == -2)
+			{
+				return "crashed: " + result.errorMessage;
+			}
+			return "exited with status " + to_string(result.status);
+		}
+		
+		void quarantine(uint64_t address, const WorkerResult& result)
+		{
+			const string& name = functionNames.at(address);
+			string prototype;
+			raw_string_ostream(prototype) << "// fcd: " << name << " (0x" << utohexstr(address) << ") was quarantined; its worker " << describeFailure(result) << "\nvoid " << name << "();\n";
+			outputs.add(address, move(prototype));
+			
+			progressCompleted(1);
+			lock_guard<mutex> guard(lock);
+			quarantined.push_back({address, describeFailure(result), result.log});
+		}
+		
+		void stop(string message)
+		{
+			lock_guard<mutex> guard(lock);
+			if (abortMessage.empty())
+			{
+				abortMessage = move(message);
+			}
+		}
+		
+		bool isAborted()
+		{
+			lock_guard<mutex> guard(lock);
+			return !abortMessage.empty();
+		}
+		
+		// Workers that exit with an error without crashing may have stopped on something that has nothing to do with
+		// their functions, like an option that they reject. Bisecting would then quarantine every function, so the
+		// first such failure runs a worker that selects no function (no function lives at the last address), and the
+		// batch is aborted if it fails too.
+		bool failsWithoutFunctions()
+		{
+			lock_guard<mutex> guard(probeLock);
+			if (!probed)
+			{
+				probed = true;
+				uint64_t noFunction = ~uint64_t(0);
+				WorkerResult result = runWorker(noFunction);
+				if (result.executionFailed)
+				{
+					stop("couldn't start worker: " + result.errorMessage);
+					probeFailed = true;
+				}
+				else if (!result.succeeded())
+				{
+					stop("workers " + describeFailure(result) + " even without functions to decompile:\n" + result.log);
+					probeFailed = true;
+				}
+			}
+			return probeFailed;
+		}
+		
+		// Splits the functions of failed workers in halves until the functions that cause failures are isolated.
+		void decompile(TaskGroup& group, vector<uint64_t> addresses)
+		{
+			if (isAborted())
+			{
+				return;
+			}
+			
+			WorkerResult result = runWorker(addresses);
+			if (result.executionFailed)
+			{
+				stop("couldn't start worker: " + result.errorMessage);
+				return;
+			}
+			
+			if (!result.succeeded() && result.status != -2 && failsWithoutFunctions())
+			{
+				return;
+			}
+			
+			if (result.succeeded())
+			{
+				outputs.add(addresses.front(), skipIncludes(result.output, includeCount).str());
+				progressCompleted(addresses.size());
+				if (!result.log.empty())
+				{
+					lock_guard<mutex> guard(lock);
+					errs() << result.log;
+				}
+			}
+			else if (addresses.size() == 1)
+			{
+				quarantine(addresses.front(), result);
+			}
+			else
+			{
+				auto middle = addresses.begin() + addresses.size() / 2;
+				vector<uint64_t> second(middle, addresses.end());
+				addresses.erase(middle, addresses.end());
+				group.spawn([this, &group, addresses]
+				{
+					decompile(group, addresses);
+				});
+				group.spawn([this, &group, second]
+				{
+					decompile(group, second);
+				});
+			}
+		}
+		
+		// Repros are module copies where only the quarantined function has a body, so that workers that load them
+		// don't need the checkpoint.
+		bool saveRepro(Module& module, const QuarantinedFunction& function, StringRef directory, raw_ostream& errorOutput)
+		{
+			const string& name = functionNames.at(function.address);
+			SmallString<128> bitcodePath = directory;
+			sys::path::append(bitcodePath, name + ".bc");
+			SmallString<128> reportPath = directory;
+			sys::path::append(reportPath, name + ".txt");
+			
+			unique_ptr<Module> repro = CloneModule(&module);
+			for (Function& fn : *repro)
+			{
+				if (md::isPrototype(fn))
+				{
+					continue;
+				}
+				
+				auto address = md::getVirtualAddress(fn);
+				if (address == nullptr || address->getLimitedValue() != function.address)
+				{
+					fn.deleteBody();
+				}
+			}
+			
+			error_code errorCode;
+			raw_fd_ostream bitcode(bitcodePath, errorCode, sys::fs::F_None);
+			if (errorCode)
+			{
+				errorOutput << "can't open " << bitcodePath << ": " << errorCode.message() << '\n';
+				return false;
+			}
+			WriteBitcodeToFile(repro.get(), bitcode);
+			
+			raw_fd_ostream report(reportPath, errorCode, sys::fs::F_Text);
+			if (errorCode)
+			{
+				errorOutput << "can't open " << reportPath << ": " << errorCode.message() << '\n';
+				return false;
+			}
+			
+			uint64_t address = function.address;
+			report << "Worker " << function.reason << " while decompiling " << name << " (0x" << utohexstr(address) << ").\n\n";
+			report << "Reproduce with:\n";
+			for (const string& argument : getWorkerArguments(address, bitcodePath))
+			{
+				report << ' ' << argument;
+			}
+			report << "\n\nWorker output:\n" << function.log;
+			return true;
+		}
+	
+	public:
+		BatchSupervisor(string program, vector<string> baseArguments, StringRef checkpointPath, size_t includeCount)
+		: program(move(program)), baseArguments(move(baseArguments)), checkpointPath(checkpointPath), includeCount(includeCount)
+		{
+		}
+		
+		const string& getAbortMessage() const { return abortMessage; }
+		
+		bool run(Module& module, raw_ostream& output)
+		{
+			vector<uint64_t> addresses;
+			for (Function& fn : module)
+			{
+				if (!md::isPrototype(fn))
+				if (auto address = md::getVirtualAddress(fn))
+				{
+					addresses.push_back(address->getLimitedValue());
+					functionNames[addresses.back()] = fn.getName().str();
+				}
+			}
+			sort(addresses.begin(), addresses.end());
+			
+			// Workers don't report progress. The supervisor counts the functions of the workers that return.
+			progressBeginPhase("supervision", addresses.size());
+			TaskGroup group;
+			size_t size = shardSize;
+			if (size == 0)
+			{
+				size = max<size_t>(addresses.size(), 1);
+			}
+			for (size_t i = 0; i < addresses.size(); i += size)
+			{
+				vector<uint64_t> shard(addresses.begin() + i, addresses.begin() + min(i + size, addresses.size()));
+				group.spawn([this, &group, shard]
+				{
+					decompile(group, shard);
+				});
+			}
+			group.wait();
+			
+			if (!abortMessage.empty())
+			{
+				return false;
+			}
+			
+			for (const auto& result : outputs.take())
+			{
+				output << result.second;
+			}
+			return true;
+		}
+		
+		void saveRepros(Module& module, StringRef directory, raw_ostream& errorOutput)
+		{
+			if (quarantined.empty())
+			{
+				return;
+			}
+			
+			if (auto errorCode = sys::fs::create_directories(directory))
+			{
+				errorOutput << "can't create " << directory << ": " << errorCode.message() << '\n';
+				return;
+			}
+			
+			sort(quarantined.begin(), quarantined.end(), [](const QuarantinedFunction& a, const QuarantinedFunction& b)
+			{
+				return a.address < b.address;
+			});
+			for (const QuarantinedFunction& function : quarantined)
+			{
+				if (!saveRepro(module, function, directory, errorOutput))
+				{
+					return;
+				}
+			}
+			errorOutput << quarantined.size() << " function(s) quarantined; repros saved in " << directory << '\n';
+		}
+	};
+}
+
+bool isSupervisedBatch()
+{
+	return supervise;
+}
+
+bool runSupervisedBatch(Module& module, Executable& executable, StringRef inputPath, StringRef checkpointPath, int argc, char** argv, raw_ostream& output)
+{
+	string programName = sys::path::filename(argv[0]);
+	bool hasCallingConvention = false;
+	vector<string> baseArguments;
+	for (int i = 1; i < argc; ++i)
+	{
+		StringRef argument = argv[i];
+		if (argument == inputPath)
+		{
+			continue;
+		}
+		
+		StringRef name = argument.ltrim('-').split('=').first;
+		auto iter = find_if(begin(supervisorOptions), end(supervisorOptions), [&](const pair<const char*, bool>& option)
+		{
+			return name == option.first;
+		});
+		if (!argument.startswith("-") || iter == end(supervisorOptions))
+		{
+			hasCallingConvention |= argument.startswith("-") && name == "cc";
+			baseArguments.push_back(argument);
+		}
+		else if (iter->second && argument.find('=') == StringRef::npos)
+		{
+			++i;
+		}
+	}
+	
+	// Workers have no executable to infer the calling convention from.
+	if (!hasCallingConvention)
+	{
+		auto targetInfo = TargetInfo::getTargetInfo(module);
+		if (auto cc = CallingConvention::getMatchingCallingConvention(*targetInfo, executable))
+		{
+			baseArguments.push_back(string("--cc=") + cc->getName());
+		}
+		else
+		{
+			errs() << programName << ": no calling convention could be inferred for workers; specify one with --cc\n";
+			return false;
+		}
+	}
+	
+	void* mainAddress = reinterpret_cast<void*>(&runSupervisedBatch);
+	string program = sys::fs::getMainExecutable(argv[0], mainAddress);
+	vector<string> includes = md::getIncludedFiles(module);
+	for (const auto& file : includes)
+	{
+		output << "#include \"" << file << "\"\n";
+	}
+	
+	if (includes.size() > 0)
+	{
+		output << '\n';
+	}
+	
+	BatchSupervisor supervisor(move(program), move(baseArguments), checkpointPath, includes.size());
+	if (!supervisor.run(module, output))
+	{
+		errs() << programName << ": " << supervisor.getAbortMessage() << '\n';
+		return false;
+	}
+	
+	string directory = quarantineDirectory;
+	if (directory.empty())
+	{
+		directory = sys::path::stem(inputPath).str() + "-quarantine";
+	}
+	supervisor.saveRepros(module, directory, errs());
+	return true;
+}
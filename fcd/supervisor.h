@@ -0,0 +1,32 @@
+//
+// supervisor.h
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__supervisor_h
+#define fcd__supervisor_h
+
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm
+{
+	class Module;
+	class raw_ostream;
+}
+
+class Executable;
+
+// Whether --supervise was passed.
+bool isSupervisedBatch();
+
+// Decompiles the functions of a lifted module in worker processes that load them from a checkpoint. A worker that
+// crashes has its functions split between new workers until the function responsible is isolated. That function is
+// quarantined: its bitcode and the worker command line are saved as a repro, and the output only gets a prototype
+// for it. Returns false if no worker could be started.
+bool runSupervisedBatch(llvm::Module& module, Executable& executable, llvm::StringRef inputPath, llvm::StringRef checkpointPath, int argc, char** argv, llvm::raw_ostream& output);
+
+#endif /* fcd__supervisor_h */
@@ -0,0 +1,603 @@
+//
+// xref_database.cpp
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "code_scanner.h"
+#include "errors.h"
+#include "executable.h"
+#include "xref_database.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/PrettyStackTrace.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <set>
+#include <tuple>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	const char databaseMagic[8] = {'F', 'C', 'D', 'X', 'R', 'E', 'F', 0};
+	const uint32_t databaseVersion = 2;
+	
+	template<typename T>
+	size_t wordCount(size_t count)
+	{
+		return (count * sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	}
+	
+	template<typename T>
+	void appendWords(vector<uint64_t>& image, const T* data, size_t count)
+	{
+		size_t offset = image.size();
+		image.resize(offset + wordCount<T>(count));
+		memcpy(&image[offset], data, count * sizeof(T));
+	}
+	
+	template<typename T>
+	bool readArray(const uint8_t*& cursor, const uint8_t* end, uint64_t count, ArrayRef<T>& into)
+	{
+		// Counts come from the file, so check them against the size of the buffer before computing with them.
+		size_t available = static_cast<size_t>(end - cursor);
+		if (count > available / sizeof(T))
+		{
+			return false;
+		}
+		
+		size_t bytes = wordCount<T>(static_cast<size_t>(count)) * sizeof(uint64_t);
+		if (available < bytes)
+		{
+			return false;
+		}
+		into = ArrayRef<T>(reinterpret_cast<const T*>(cursor), static_cast<size_t>(count));
+		cursor += bytes;
+		return true;
+	}
+	
+	// Words in each of the two bitmaps of a range.
+	uint64_t bitmapWords(const XrefDatabase::Range& range)
+	{
+		uint64_t size = range.end - range.begin;
+		return size / 64 + (size % 64 != 0 ? 1 : 0);
+	}
+	
+	bool isPadding(uint8_t byte)
+	{
+		return byte == 0x00 || byte == 0x90 || byte == 0xcc;
+	}
+	
+	void hashExecutable(const Executable& executable, uint8_t (&hash)[16])
+	{
+		MD5 md5;
+		md5.update(makeArrayRef(executable.begin(), executable.end()));
+		MD5::MD5Result result;
+		md5.final(result);
+		static_assert(sizeof result == sizeof hash, "unexpected MD5 result size");
+		memcpy(hash, &result, sizeof hash);
+	}
+	
+	class XrefBuilder
+	{
+		const Executable& executable;
+		CodeScanner& scanner;
+		vector<MappedRange> code;
+		vector<MappedRange> data;
+		vector<MappedRange> sweepRanges;
+		vector<vector<bool>> visited;
+		set<uint64_t> functionStarts;
+		set<uint64_t> blockStarts;
+		vector<XrefDatabase::Reference> references;
+		deque<uint64_t> pendingFunctions;
+		
+		bool findCode(uint64_t address, size_t& index) const
+		{
+			for (size_t i = 0; i < code.size(); ++i)
+			{
+				if (address >= code[i].begin && address < code[i].end)
+				{
+					index = i;
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		void addReference(uint64_t from, uint64_t to, XrefDatabase::ReferenceKind kind)
+		{
+			references.push_back({from, to, kind, 0});
+		}
+		
+		void addFunction(uint64_t address)
+		{
+			size_t index;
+			if (findCode(address, index) && functionStarts.insert(address).second)
+			{
+				pendingFunctions.push_back(address);
+			}
+		}
+		
+		void exploreFunction(uint64_t entry)
+		{
+			deque<uint64_t> blocks = { entry };
+			blockStarts.insert(entry);
+			while (blocks.size() > 0)
+			{
+				uint64_t address = blocks.front();
+				blocks.pop_front();
+				
+				size_t index;
+				while (findCode(address, index) && !visited[index][address - code[index].begin])
+				{
+					const MappedRange& range = code[index];
+					const uint8_t* begin = executable.map(address);
+					ScannedInstruction inst;
+					if (begin == nullptr || !scanner.scan(begin, begin + (range.end - address), address, inst))
+					{
+						break;
+					}
+					
+					for (uint64_t i = address; i < address + inst.size && i < range.end; ++i)
+					{
+						visited[index][i - range.begin] = true;
+					}
+					
+					size_t targetIndex;
+					if (inst.kind == ScannedInstruction::Call)
+					{
+						addReference(address, inst.target, XrefDatabase::CallReference);
+						addFunction(inst.target);
+					}
+					else if (inst.hasTarget())
+					{
+						addReference(address, inst.target, XrefDatabase::JumpReference);
+						if (findCode(inst.target, targetIndex) && blockStarts.insert(inst.target).second)
+						{
+							blocks.push_back(inst.target);
+						}
+					}
+					
+					uint64_t next = address + inst.size;
+					if (inst.endsBlock())
+					{
+						if (inst.fallsThrough() && blockStarts.insert(next).second)
+						{
+							blocks.push_back(next);
+						}
+						break;
+					}
+					address = next;
+				}
+			}
+		}
+		
+		void explorePendingFunctions()
+		{
+			while (pendingFunctions.size() > 0)
+			{
+				uint64_t address = pendingFunctions.front();
+				pendingFunctions.pop_front();
+				exploreFunction(address);
+			}
+		}
+		
+		bool isSweptCode(uint64_t address) const
+		{
+			for (const MappedRange& range : sweepRanges)
+			{
+				if (address >= range.begin && address < range.end)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		// The sweep decodes bytes that may not be instructions, so only trust a call target that lands in a code
+		// section and starts with a valid instruction that isn't padding.
+		bool isPlausibleFunction(uint64_t address)
+		{
+			size_t index;
+			if (!isSweptCode(address) || !findCode(address, index))
+			{
+				return false;
+			}
+			
+			const uint8_t* begin = executable.map(address);
+			if (begin == nullptr || *begin == 0x00 || *begin == 0xcc)
+			{
+				return false;
+			}
+			
+			ScannedInstruction inst;
+			return scanner.scan(begin, begin + (code[index].end - address), address, inst) && inst.kind != ScannedInstruction::Stop;
+		}
+		
+		// Decode whatever recursive descent did not reach in code sections and treat the targets of direct calls found
+		// there as function starts. This finds functions that are only reachable through pointers.
+		void linearSweep()
+		{
+			for (const MappedRange& sweepRange : sweepRanges)
+			{
+				size_t index;
+				if (!findCode(sweepRange.begin, index))
+				{
+					continue;
+				}
+				
+				const MappedRange& range = code[index];
+				uint64_t end = min(sweepRange.end, range.end);
+				uint64_t address = sweepRange.begin;
+				while (address < end)
+				{
+					const uint8_t* begin = executable.map(address);
+					if (begin == nullptr || visited[index][address - range.begin] || isPadding(*begin))
+					{
+						++address;
+						continue;
+					}
+					
+					ScannedInstruction inst;
+					if (!scanner.scan(begin, begin + (end - address), address, inst))
+					{
+						++address;
+						continue;
+					}
+					
+					if (inst.kind == ScannedInstruction::Call && isPlausibleFunction(inst.target))
+					{
+						addFunction(inst.target);
+					}
+					address += inst.size;
+				}
+			}
+		}
+		
+		void collectDataReferences(size_t pointerSize)
+		{
+			for (const MappedRange& range : data)
+			{
+				for (uint64_t address = (range.begin + pointerSize - 1) & ~(pointerSize - 1); address + pointerSize <= range.end; address += pointerSize)
+				{
+					const uint8_t* bytes = executable.map(address);
+					if (bytes == nullptr)
+					{
+						continue;
+					}
+					
+					uint64_t value = 0;
+					memcpy(&value, bytes, pointerSize);
+					size_t index;
+					if (findCode(value, index))
+					{
+						addReference(address, value, XrefDatabase::DataReference);
+					}
+				}
+			}
+		}
+	
+	public:
+		XrefBuilder(const Executable& executable, CodeScanner& scanner)
+		: executable(executable), scanner(scanner)
+		{
+			for (const MappedRange& range : executable.getMappedRanges())
+			{
+				if (range.end > range.begin)
+				{
+					(range.executable ? code : data).push_back(range);
+				}
+			}
+			sort(code.begin(), code.end(), [](const MappedRange& a, const MappedRange& b) { return a.begin < b.begin; });
+			for (const MappedRange& range : code)
+			{
+				visited.emplace_back(range.end - range.begin, false);
+			}
+			for (const MappedRange& range : executable.getCodeSections())
+			{
+				if (range.end > range.begin)
+				{
+					sweepRanges.push_back(range);
+				}
+			}
+		}
+		
+		void run(const vector<uint64_t>& seeds, size_t pointerSize)
+		{
+			for (uint64_t seed : seeds)
+			{
+				addFunction(seed);
+			}
+			explorePendingFunctions();
+			linearSweep();
+			explorePendingFunctions();
+			collectDataReferences(pointerSize);
+		}
+		
+		vector<uint64_t> createImage() const
+		{
+			vector<XrefDatabase::Reference> sortedReferences = references;
+			auto referenceLess = [](const XrefDatabase::Reference& a, const XrefDatabase::Reference& b)
+			{
+				return tie(a.from, a.to, a.kind) < tie(b.from, b.to, b.kind);
+			};
+			auto referenceEqual = [](const XrefDatabase::Reference& a, const XrefDatabase::Reference& b)
+			{
+				return a.from == b.from && a.to == b.to && a.kind == b.kind;
+			};
+			sort(sortedReferences.begin(), sortedReferences.end(), referenceLess);
+			sortedReferences.erase(unique(sortedReferences.begin(), sortedReferences.end(), referenceEqual), sortedReferences.end());
+			
+			vector<uint32_t> byTarget(sortedReferences.size());
+			for (uint32_t i = 0; i < byTarget.size(); ++i)
+			{
+				byTarget[i] = i;
+			}
+			stable_sort(byTarget.begin(), byTarget.end(), [&](uint32_t a, uint32_t b)
+			{
+				return sortedReferences[a].to < sortedReferences[b].to;
+			});
+			
+			vector<XrefDatabase::Range> ranges;
+			vector<uint64_t> bitmaps;
+			for (const MappedRange& range : code)
+			{
+				uint64_t size = range.end - range.begin;
+				size_t words = static_cast<size_t>((size + 63) / 64);
+				ranges.push_back({range.begin, range.end, bitmaps.size()});
+				
+				size_t functionBase = bitmaps.size();
+				size_t blockBase = functionBase + words;
+				bitmaps.resize(bitmaps.size() + words * 2);
+				for (auto iter = functionStarts.lower_bound(range.begin); iter != functionStarts.end() && *iter < range.end; ++iter)
+				{
+					uint64_t offset = *iter - range.begin;
+					bitmaps[functionBase + offset / 64] |= 1ull << (offset % 64);
+				}
+				for (auto iter = blockStarts.lower_bound(range.begin); iter != blockStarts.end() && *iter < range.end; ++iter)
+				{
+					uint64_t offset = *iter - range.begin;
+					bitmaps[blockBase + offset / 64] |= 1ull << (offset % 64);
+				}
+			}
+			
+			XrefDatabase::Header header;
+			memcpy(header.magic, databaseMagic, sizeof header.magic);
+			header.version = databaseVersion;
+			header.rangeCount = static_cast<uint32_t>(ranges.size());
+			header.functionCount = functionStarts.size();
+			header.referenceCount = sortedReferences.size();
+			header.bitmapWordCount = bitmaps.size();
+			header.executableSize = static_cast<uint64_t>(executable.end() - executable.begin());
+			hashExecutable(executable, header.executableHash);
+			
+			vector<uint64_t> functions(functionStarts.begin(), functionStarts.end());
+			vector<uint64_t> image;
+			appendWords(image, &header, 1);
+			appendWords(image, ranges.data(), ranges.size());
+			appendWords(image, functions.data(), functions.size());
+			appendWords(image, sortedReferences.data(), sortedReferences.size());
+			appendWords(image, byTarget.data(), byTarget.size());
+			appendWords(image, bitmaps.data(), bitmaps.size());
+			return image;
+		}
+	};
+}
+
+bool XrefDatabase::setImage(const uint8_t* begin, const uint8_t* end)
+{
+	if (reinterpret_cast<uintptr_t>(begin) % alignof(uint64_t) != 0 || static_cast<size_t>(end - begin) < sizeof (Header))
+	{
+		return false;
+	}
+	
+	const Header& header = *reinterpret_cast<const Header*>(begin);
+	if (memcmp(header.magic, databaseMagic, sizeof header.magic) != 0 || header.version != databaseVersion)
+	{
+		return false;
+	}
+	
+	const uint8_t* cursor = begin + wordCount<Header>(1) * sizeof(uint64_t);
+	bool valid = readArray(cursor, end, header.rangeCount, ranges)
+		&& readArray(cursor, end, header.functionCount, functions)
+		&& readArray(cursor, end, header.referenceCount, references)
+		&& readArray(cursor, end, header.referenceCount, referencesByTarget)
+		&& readArray(cursor, end, header.bitmapWordCount, bitmaps);
+	
+	if (!valid)
+	{
+		return false;
+	}
+	
+	// Queries index bitmaps and references with the values stored in the image, so a truncated or corrupted file must
+	// be rejected here.
+	for (const Range& range : ranges)
+	{
+		if (range.begin > range.end || range.bitmapIndex > bitmaps.size())
+		{
+			return false;
+		}
+		
+		uint64_t words = bitmapWords(range);
+		if (words > (bitmaps.size() - range.bitmapIndex) / 2)
+		{
+			return false;
+		}
+	}
+	
+	for (size_t i = 0; i < references.size(); ++i)
+	{
+		if (i > 0 && references[i - 1].from > references[i].from)
+		{
+			return false;
+		}
+	}
+	
+	for (size_t i = 0; i < referencesByTarget.size(); ++i)
+	{
+		uint32_t index = referencesByTarget[i];
+		if (index >= references.size())
+		{
+			return false;
+		}
+		if (i > 0 && references[referencesByTarget[i - 1]].to > references[index].to)
+		{
+			return false;
+		}
+	}
+	
+	image = ArrayRef<uint8_t>(begin, cursor);
+	return true;
+}
+
+bool XrefDatabase::testBit(uint64_t address, size_t bitmap) const
+{
+	for (const Range& range : ranges)
+	{
+		if (address >= range.begin && address < range.end)
+		{
+			uint64_t offset = address - range.begin;
+			uint64_t word = bitmaps[range.bitmapIndex + bitmap * bitmapWords(range) + offset / 64];
+			return (word >> (offset % 64)) & 1;
+		}
+	}
+	return false;
+}
+
+unique_ptr<XrefDatabase> XrefDatabase::build(const Executable& executable, size_t addressSize, const vector<uint64_t>& seeds)
+{
+	PrettyStackTraceString buildingXrefs("Building cross-reference database");
+	
+	auto scanner = CodeScanner::x86(addressSize);
+	if (!scanner)
+	{
+		return nullptr;
+	}
+	
+	XrefBuilder builder(executable, *scanner);
+	builder.run(seeds, addressSize);
+	
+	unique_ptr<XrefDatabase> result(new XrefDatabase);
+	result->ownedImage = builder.createImage();
+	auto begin = reinterpret_cast<const uint8_t*>(result->ownedImage.data());
+	auto end = begin + result->ownedImage.size() * sizeof(uint64_t);
+	bool valid = result->setImage(begin, end);
+	assert(valid);
+	(void) valid;
+	return result;
+}
+
+ErrorOr<unique_ptr<XrefDatabase>> XrefDatabase::load(StringRef path, const Executable& executable)
+{
+	auto bufferOrError = MemoryBuffer::getFile(path, -1, false);
+	if (!bufferOrError)
+	{
+		return bufferOrError.getError();
+	}
+	
+	unique_ptr<XrefDatabase> result(new XrefDatabase);
+	result->mappedImage = move(bufferOrError.get());
+	auto begin = reinterpret_cast<const uint8_t*>(result->mappedImage->getBufferStart());
+	size_t size = result->mappedImage->getBufferSize();
+	if (reinterpret_cast<uintptr_t>(begin) % alignof(uint64_t) != 0)
+	{
+		// Buffers that are read instead of mapped are not necessarily aligned.
+		result->ownedImage.resize(wordCount<uint8_t>(size));
+		memcpy(result->ownedImage.data(), begin, size);
+		result->mappedImage.reset();
+		begin = reinterpret_cast<const uint8_t*>(result->ownedImage.data());
+	}
+	const uint8_t* end = begin + size;
+	
+	if (!result->setImage(begin, end))
+	{
+		return make_error_code(FcdError::Xref_InvalidDatabase);
+	}
+	
+	// Patching a binary rarely changes its size, so compare contents too.
+	const Header& header = *reinterpret_cast<const Header*>(begin);
+	uint8_t hash[16];
+	hashExecutable(executable, hash);
+	if (header.executableSize != static_cast<uint64_t>(executable.end() - executable.begin()) || memcmp(header.executableHash, hash, sizeof hash) != 0)
+	{
+		return make_error_code(FcdError::Xref_InvalidDatabase);
+	}
+	return move(result);
+}
+
+error_code XrefDatabase::save(StringRef path) const
+{
+	error_code error;
+	raw_fd_ostream output(path, error, sys::fs::F_None);
+	if (!error)
+	{
+		output.write(reinterpret_cast<const char*>(image.data()), image.size());
+	}
+	return error;
+}
+
+bool XrefDatabase::isCode(uint64_t address) const
+{
+	for (const Range& range : ranges)
+	{
+		if (address >= range.begin && address < range.end)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+ArrayRef<XrefDatabase::Reference> XrefDatabase::getReferencesFrom(uint64_t address) const
+{
+	auto lower = lower_bound(references.begin(), references.end(), address, [](const Reference& ref, uint64_t address)
+	{
+		return ref.from < address;
+	});
+	auto upper = upper_bound(lower, references.end(), address, [](uint64_t address, const Reference& ref)
+	{
+		return address < ref.from;
+	});
+	return ArrayRef<Reference>(lower, upper);
+}
+
+vector<const XrefDatabase::Reference*> XrefDatabase::getReferencesTo(uint64_t address) const
+{
+	auto lower = lower_bound(referencesByTarget.begin(), referencesByTarget.end(), address, [&](uint32_t index, uint64_t address)
+	{
+		return references[index].to < address;
+	});
+	
+	vector<const Reference*> result;
+	for (auto iter = lower; iter != referencesByTarget.end() && references[*iter].to == address; ++iter)
+	{
+		result.push_back(&references[*iter]);
+	}
+	return result;
+}
+
+vector<uint64_t> XrefDatabase::getVisibleEntryPoints() const
+{
+	return vector<uint64_t>(functions.begin(), functions.end());
+}
+
+const SymbolInfo* XrefDatabase::getInfo(uint64_t address) const
+{
+	if (!isFunctionStart(address))
+	{
+		return nullptr;
+	}
+	
+	SymbolInfo& info = symbols[address];
+	info.virtualAddress = address;
+	return &info;
+}
@@ -0,0 +1,101 @@
+//
+// xref_database.h
+// Copyright (C) 2015 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__symbols_xref_database_h
+#define fcd__symbols_xref_database_h
+
+#include "entry_points.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Executable;
+
+// Whole-executable cross-references, built by sweeping executable segments once before lifting starts.
+//
+// The database is a single flat image so that it can be saved to disk and mapped back without any parsing. Function
+// and block starts are stored as one bit per byte of code, so that membership queries are constant time; references
+// are stored sorted by source, with an index sorted by target.
+class XrefDatabase final : public EntryPointProvider
+{
+public:
+	enum ReferenceKind : uint32_t
+	{
+		CallReference,
+		JumpReference,
+		DataReference,
+	};
+	
+	struct Reference
+	{
+		uint64_t from;
+		uint64_t to;
+		ReferenceKind kind;
+		uint32_t reserved;
+	};
+	
+	struct Range
+	{
+		uint64_t begin;
+		uint64_t end;
+		uint64_t bitmapIndex;
+	};
+	
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t rangeCount;
+		uint64_t functionCount;
+		uint64_t referenceCount;
+		uint64_t bitmapWordCount;
+		uint64_t executableSize;
+		uint8_t executableHash[16];
+	};
+
+private:
+	std::vector<uint64_t> ownedImage;
+	std::unique_ptr<llvm::MemoryBuffer> mappedImage;
+	llvm::ArrayRef<uint8_t> image;
+	
+	llvm::ArrayRef<Range> ranges;
+	llvm::ArrayRef<uint64_t> functions;
+	llvm::ArrayRef<Reference> references;
+	llvm::ArrayRef<uint32_t> referencesByTarget;
+	llvm::ArrayRef<uint64_t> bitmaps;
+	mutable std::unordered_map<uint64_t, SymbolInfo> symbols;
+	
+	XrefDatabase() = default;
+	bool setImage(const uint8_t* begin, const uint8_t* end);
+	bool testBit(uint64_t address, size_t bitmap) const;
+
+public:
+	static std::unique_ptr<XrefDatabase> build(const Executable& executable, size_t addressSize, const std::vector<uint64_t>& seeds);
+	static llvm::ErrorOr<std::unique_ptr<XrefDatabase>> load(llvm::StringRef path, const Executable& executable);
+	std::error_code save(llvm::StringRef path) const;
+	
+	bool isCode(uint64_t address) const;
+	bool isFunctionStart(uint64_t address) const { return testBit(address, 0); }
+	bool isBlockStart(uint64_t address) const { return testBit(address, 1); }
+	llvm::ArrayRef<uint64_t> getFunctionStarts() const { return functions; }
+	llvm::ArrayRef<Reference> getReferencesFrom(uint64_t address) const;
+	std::vector<const Reference*> getReferencesTo(uint64_t address) const;
+	
+	virtual std::vector<uint64_t> getVisibleEntryPoints() const override;
+	virtual const SymbolInfo* getInfo(uint64_t address) const override;
+};
+
+#endif /* fcd__symbols_xref_database_h */
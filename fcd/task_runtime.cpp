@@ -0,0 +1,230 @@
+//
+// task_runtime.cpp
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#include "command_line.h"
+#include "task_runtime.h"
+
+#include <cassert>
+
+using namespace llvm;
+using namespace std;
+
+namespace
+{
+	cl::opt<unsigned> jobs("jobs", cl::value_desc("count"), cl::desc("Number of threads that fcd can use (0 uses every core)"), cl::init(0), whitelist());
+	cl::alias jobsA("j", cl::desc("Alias for --jobs"), cl::aliasopt(jobs), whitelist());
+}
+
+thread_local TaskRuntime* TaskRuntime::currentRuntime = nullptr;
+thread_local unsigned TaskRuntime::currentQueue = 0;
+
+TaskRuntime& TaskRuntime::shared()
+{
+	static TaskRuntime runtime(jobs == 0 ? thread::hardware_concurrency() : jobs);
+	return runtime;
+}
+
+TaskRuntime::TaskRuntime(unsigned jobs)
+: queuedTasks(0), stopping(false)
+{
+	unsigned workerCount = jobs > 1 ? jobs - 1 : 0;
+	for (unsigned i = 0; i <= workerCount; ++i)
+	{
+		queues.emplace_back(new WorkQueue);
+	}
+	for (unsigned i = 1; i <= workerCount; ++i)
+	{
+		workers.emplace_back(&TaskRuntime::workerMain, this, i);
+	}
+}
+
+TaskRuntime::~TaskRuntime()
+{
+	{
+		lock_guard<mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	
+	for (thread& worker : workers)
+	{
+		worker.join();
+	}
+	assert(queuedTasks == 0);
+}
+
+void TaskRuntime::push(Task task, Priority priority)
+{
+	WorkQueue& queue = *queues[getCurrentQueue()];
+	{
+		lock_guard<mutex> guard(queue.lock);
+		queue.tasks[priority].push_back(move(task));
+	}
+	++queuedTasks;
+	notifyAll();
+}
+
+bool TaskRuntime::pop(Task& task)
+{
+	unsigned self = getCurrentQueue();
+	for (int priority = Urgent; priority >= Normal; --priority)
+	{
+		// Own tasks are taken from the back, stolen tasks from the front.
+		{
+			WorkQueue& queue = *queues[self];
+			lock_guard<mutex> guard(queue.lock);
+			auto& tasks = queue.tasks[priority];
+			if (!tasks.empty())
+			{
+				task = move(tasks.back());
+				tasks.pop_back();
+				--queuedTasks;
+				return true;
+			}
+		}
+		
+		for (size_t i = 1; i < queues.size(); ++i)
+		{
+			WorkQueue& queue = *queues[(self + i) % queues.size()];
+			lock_guard<mutex> guard(queue.lock);
+			auto& tasks = queue.tasks[priority];
+			if (!tasks.empty())
+			{
+				task = move(tasks.front());
+				tasks.pop_front();
+				--queuedTasks;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool TaskRuntime::runOneTask()
+{
+	Task task;
+	if (!pop(task))
+	{
+		return false;
+	}
+	
+	task.body();
+	task.group->taskFinished();
+	return true;
+}
+
+void TaskRuntime::notifyAll()
+{
+	// Taking the lock orders the notification after the state change that sleepers test.
+	{
+		lock_guard<mutex> guard(sleepLock);
+	}
+	wakeUp.notify_all();
+}
+
+void TaskRuntime::idle(const function<bool()>& done)
+{
+	unique_lock<mutex> sleep(sleepLock);
+	wakeUp.wait(sleep, [&]
+	{
+		return stopping || queuedTasks != 0 || done();
+	});
+}
+
+void TaskRuntime::workerMain(unsigned queueIndex)
+{
+	currentRuntime = this;
+	currentQueue = queueIndex;
+	while (true)
+	{
+		if (!runOneTask())
+		{
+			unique_lock<mutex> sleep(sleepLock);
+			wakeUp.wait(sleep, [&]
+			{
+				return stopping || queuedTasks != 0;
+			});
+			if (stopping && queuedTasks == 0)
+			{
+				return;
+			}
+		}
+	}
+}
+
+TaskGroup::TaskGroup(TaskRuntime& runtime, unsigned maxConcurrency)
+: runtime(runtime), maxConcurrency(maxConcurrency), running(0), unfinished(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+	wait();
+}
+
+void TaskGroup::spawn(function<void()> task, TaskRuntime::Priority priority)
+{
+	++unfinished;
+	{
+		lock_guard<mutex> guard(lock);
+		if (maxConcurrency != 0 && running >= maxConcurrency)
+		{
+			deferred[priority].push_back(move(task));
+			return;
+		}
+		++running;
+	}
+	runtime.push({move(task), this}, priority);
+}
+
+void TaskGroup::taskFinished()
+{
+	function<void()> next;
+	TaskRuntime::Priority nextPriority = TaskRuntime::Normal;
+	{
+		lock_guard<mutex> guard(lock);
+		for (int priority = TaskRuntime::Urgent; priority >= TaskRuntime::Normal; --priority)
+		{
+			if (!deferred[priority].empty())
+			{
+				next = move(deferred[priority].front());
+				nextPriority = static_cast<TaskRuntime::Priority>(priority);
+				deferred[priority].pop_front();
+				break;
+			}
+		}
+		if (!next)
+		{
+			--running;
+		}
+	}
+	
+	if (next)
+	{
+		runtime.push({move(next), this}, nextPriority);
+	}
+	
+	// The group can be destroyed as soon as its last task is accounted for.
+	TaskRuntime& groupRuntime = runtime;
+	if (--unfinished == 0)
+	{
+		groupRuntime.notifyAll();
+	}
+}
+
+void TaskGroup::wait()
+{
+	while (unfinished != 0)
+	{
+		if (!runtime.runOneTask())
+		{
+			runtime.idle([&] { return unfinished == 0; });
+		}
+	}
+}
@@ -0,0 +1,165 @@
+//
+// task_runtime.h
+// Copyright (C) 2017 Félix Cloutier.
+// All Rights Reserved.
+//
+// This file is distributed under the University of Illinois Open Source
+// license. See LICENSE.md for details.
+//
+
+#ifndef fcd__task_runtime_h
+#define fcd__task_runtime_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class TaskGroup;
+
+// Work-stealing scheduler shared by every parallel phase of fcd, so that phases don't compete for cores with their own
+// threads. Each worker has its own deque: it runs the tasks that it spawns in LIFO order, and steals the oldest tasks
+// of other workers when it runs out. Threads that wait on a TaskGroup run tasks too, so a runtime with no worker (with
+// --jobs=1) runs everything on the waiting thread, in a deterministic order.
+class TaskRuntime
+{
+	friend class TaskGroup;
+	
+public:
+	enum Priority
+	{
+		// Urgent tasks are always picked before normal tasks. Use it for work that completes something already in
+		// flight (like the remaining steps of a function that is half-decompiled), so that it finishes before new
+		// work starts.
+		Normal,
+		Urgent,
+		PriorityCount,
+	};
+	
+private:
+	struct Task
+	{
+		std::function<void()> body;
+		TaskGroup* group;
+	};
+	
+	struct WorkQueue
+	{
+		std::mutex lock;
+		std::deque<Task> tasks[PriorityCount];
+	};
+	
+	// Queue 0 receives tasks spawned from threads that are not workers of this runtime.
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	std::vector<std::thread> workers;
+	std::mutex sleepLock;
+	std::condition_variable wakeUp;
+	std::atomic<size_t> queuedTasks;
+	bool stopping;
+	
+	static thread_local TaskRuntime* currentRuntime;
+	static thread_local unsigned currentQueue;
+	
+	unsigned getCurrentQueue() const { return currentRuntime == this ? currentQueue : 0; }
+	
+	void push(Task task, Priority priority);
+	bool pop(Task& task);
+	bool runOneTask();
+	void notifyAll();
+	void idle(const std::function<bool()>& done);
+	void workerMain(unsigned queueIndex);
+	
+public:
+	// Sized by --jobs. Created on first use, which must happen after command-line options are parsed.
+	static TaskRuntime& shared();
+	
+	explicit TaskRuntime(unsigned jobs);
+	TaskRuntime(const TaskRuntime&) = delete;
+	TaskRuntime& operator=(const TaskRuntime&) = delete;
+	~TaskRuntime();
+	
+	// Number of threads that can run tasks at once, including the waiting thread.
+	unsigned getConcurrency() const { return static_cast<unsigned>(workers.size() + 1); }
+};
+
+// A set of tasks that can be waited on, typically all the tasks of a phase. Groups can limit how many of their tasks
+// run at once; tasks past that limit are held back until another task of the group finishes.
+class TaskGroup
+{
+	friend class TaskRuntime;
+	
+	TaskRuntime& runtime;
+	unsigned maxConcurrency;
+	std::mutex lock;
+	std::deque<std::function<void()>> deferred[TaskRuntime::PriorityCount];
+	unsigned running;
+	std::atomic<size_t> unfinished;
+	
+	void taskFinished();
+	
+public:
+	// A maxConcurrency of 0 lets every task of the group run at once.
+	explicit TaskGroup(TaskRuntime& runtime = TaskRuntime::shared(), unsigned maxConcurrency = 0);
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+	~TaskGroup();
+	
+	void spawn(std::function<void()> task, TaskRuntime::Priority priority = TaskRuntime::Normal);
+	
+	// Runs tasks until every task of the group has finished.
+	void wait();
+};
+
+// Runs fn on every input and returns the results in the order of the inputs, regardless of the order in which tasks
+// finished.
+template<typename Input, typename Fn>
+auto parallelMap(TaskGroup& group, const std::vector<Input>& inputs, Fn fn) -> std::vector<decltype(fn(inputs.front()))>
+{
+	std::vector<decltype(fn(inputs.front()))> results(inputs.size());
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		group.spawn([&, i]
+		{
+			results[i] = fn(inputs[i]);
+		});
+	}
+	group.wait();
+	return results;
+}
+
+// Collects results produced by concurrent tasks, and hands them back sorted by address, so that output doesn't depend
+// on scheduling.
+template<typename T>
+class AddressOrderedResults
+{
+	std::mutex lock;
+	std::vector<std::pair<uint64_t, T>> results;
+	
+public:
+	void add(uint64_t address, T result)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		results.emplace_back(address, std::move(result));
+	}
+	
+	std::vector<std::pair<uint64_t, T>> take()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::vector<std::pair<uint64_t, T>> sorted = std::move(results);
+		results.clear();
+		std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint64_t, T>& a, const std::pair<uint64_t, T>& b)
+		{
+			return a.first < b.first;
+		});
+		return sorted;
+	}
+};
+
+#endif /* fcd__task_runtime_h */